@@ -0,0 +1,145 @@
+#include <vnet/ip/ip.h>
+
+/* Checks and times ip checksum kernels over packet sized data at all
+   alignments.  "test ip checksum [iterations N]" */
+
+static char * ip_csum_implementation_names[] = {
+#define _(f) #f,
+  foreach_ip_csum_implementation
+#undef _
+};
+
+/* Reference sum: big-endian byte pairs relative to start of data. */
+static u16
+ip_checksum_reference (u8 * data, uword n_bytes)
+{
+  u64 sum = 0;
+  uword i;
+
+  for (i = 0; i < n_bytes; i++)
+    sum += (i % 2) ? data[i] : (data[i] << 8);
+
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+
+  return clib_net_to_host_u16 (sum);
+}
+
+/* One's complement sums are equal modulo 0xffff (0 and 0xffff are both zero). */
+always_inline uword
+ip_checksum_equal (u16 a, u16 b)
+{ return (a % 0xffff) == (b % 0xffff); }
+
+static clib_error_t *
+ip_checksum_test_command (vlib_main_t * vm,
+			  unformat_input_t * input,
+			  vlib_cli_command_t * cmd)
+{
+  static u32 sizes[] = { 64, 128, 256, 512, 1024, 1500, 4096, 9000, };
+  u32 n_iterations = 10000, n_offsets = 8;
+  u32 max_size = sizes[ARRAY_LEN (sizes) - 1];
+  ip_csum_implementation_t saved, impl;
+  u8 * src = 0, * dst = 0;
+  clib_error_t * error = 0;
+  uword i, j, o, n_errors = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "iterations %d", &n_iterations))
+	;
+      else
+	return clib_error_return (0, "parse error: %U", format_unformat_error, input);
+    }
+
+  vec_validate_aligned (src, max_size + n_offsets, CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (dst, max_size + n_offsets, CLIB_CACHE_LINE_BYTES);
+  memcpy (src, clib_random_buffer_get_data (&vm->random_buffer, vec_len (src)),
+	  vec_len (src));
+
+  saved = ip_csum_implementation_current ();
+
+  vlib_cli_output (vm, "%=10s%=8s%=16s%=16s", "Kernel", "Size", "Clocks/byte", "Copy clocks/byte");
+
+  for (impl = 0; impl < IP_N_CSUM_IMPLEMENTATION; impl++)
+    {
+      if (! ip_csum_implementation_select (impl))
+	{
+	  vlib_cli_output (vm, "%=10s not supported by this cpu",
+			   ip_csum_implementation_names[impl]);
+	  continue;
+	}
+
+      for (i = 0; i < ARRAY_LEN (sizes); i++)
+	{
+	  u32 n_bytes = sizes[i];
+	  u64 t[2], dt[2];
+	  ip_csum_t sum;
+	  u16 ref;
+
+	  dt[0] = dt[1] = 0;
+	  for (o = 0; o < n_offsets; o++)
+	    {
+	      ref = ip_checksum_reference (src + o, n_bytes);
+
+	      /* Correctness. */
+	      sum = ip_incremental_checksum (0, src + o, n_bytes);
+	      if (! ip_checksum_equal (ip_csum_fold (sum), ref))
+		{
+		  vlib_cli_output (vm, "%s: checksum size %d offset %d: 0x%04x expected 0x%04x",
+				   ip_csum_implementation_names[impl], n_bytes, o,
+				   ip_csum_fold (sum), ref);
+		  n_errors++;
+		}
+
+	      /* Copy to aligned destination; memcpy sums by destination so
+		 compare against reference of copied data. */
+	      sum = ip_csum_and_memcpy (0, dst, src + o, n_bytes);
+	      if (memcmp (dst, src + o, n_bytes)
+		  || ! ip_checksum_equal (ip_csum_and_memcpy_fold (sum, dst + n_bytes), ref))
+		{
+		  vlib_cli_output (vm, "%s: checksum and copy size %d offset %d failed",
+				   ip_csum_implementation_names[impl], n_bytes, o);
+		  n_errors++;
+		}
+
+	      /* Timing. */
+	      sum = 0;
+	      t[0] = clib_cpu_time_now ();
+	      for (j = 0; j < n_iterations; j++)
+		sum = ip_incremental_checksum (sum, src + o, n_bytes);
+	      t[1] = clib_cpu_time_now ();
+	      dt[0] += t[1] - t[0];
+
+	      t[0] = clib_cpu_time_now ();
+	      for (j = 0; j < n_iterations; j++)
+		sum = ip_csum_and_memcpy (sum, dst, src + o, n_bytes);
+	      t[1] = clib_cpu_time_now ();
+	      dt[1] += t[1] - t[0];
+
+	      /* Keep compiler from dropping timed loops. */
+	      dst[0] ^= ip_csum_fold (sum);
+	    }
+
+	  vlib_cli_output (vm, "%=10s%=8d%=16.3f%=16.3f",
+			   ip_csum_implementation_names[impl], n_bytes,
+			   (f64) dt[0] / ((f64) n_iterations * n_offsets * n_bytes),
+			   (f64) dt[1] / ((f64) n_iterations * n_offsets * n_bytes));
+	}
+    }
+
+  ip_csum_implementation_select (saved);
+
+  if (n_errors > 0)
+    error = clib_error_return (0, "%d checksum errors", n_errors);
+
+  vec_free (src);
+  vec_free (dst);
+
+  return error;
+}
+
+static VLIB_CLI_COMMAND (ip_checksum_test_command_registration) = {
+  .path = "test ip checksum",
+  .short_help = "Check and time ip checksum kernels [iterations N]",
+  .function = ip_checksum_test_command,
+};
@@ -35,6 +35,15 @@
 #define IP_BUFFER_L4_CHECKSUM_COMPUTED (1 << LOG2_IP_BUFFER_L4_CHECKSUM_COMPUTED)
 #define IP_BUFFER_L4_CHECKSUM_CORRECT  (1 << LOG2_IP_BUFFER_L4_CHECKSUM_CORRECT)
 
+/* Set on first buffer of TCP super segments larger than their segment size;
+   interface output splits them into segments (see vnet/gso.h).  Segment
+   start is set on later buffers which begin a segment whose data checksum
+   is given in buffer opaque. */
+#define LOG2_VNET_BUFFER_GSO		    LOG2_VLIB_BUFFER_FLAG_USER(3)
+#define LOG2_VNET_BUFFER_GSO_SEGMENT_START  LOG2_VLIB_BUFFER_FLAG_USER(4)
+#define VNET_BUFFER_GSO			(1 << LOG2_VNET_BUFFER_GSO)
+#define VNET_BUFFER_GSO_SEGMENT_START	(1 << LOG2_VNET_BUFFER_GSO_SEGMENT_START)
+
 typedef struct {
   /* RX/TX software interface for this packet. */
   u32 sw_if_index[VLIB_N_RX_TX];
@@ -70,7 +79,48 @@ typedef struct {
 	  u32 established_connection_index;
 
 	  u32 mini_connection_index;
+
+	  /* Set on data delivered to listener's data node. */
+	  u32 connection_handle;
 	} tcp;
+
+	/* Alternate used by first buffer of TCP packets queued for
+	   transmit: describes next packet queued on same connection. */
+	struct {
+	  u32 next_packet_first_buffer_index;
+
+	  u16 next_packet_data_ip_checksum;
+
+	  u16 next_packet_n_data_bytes;
+	} tcp_tx;
+
+	/* Alternate used by TCP super segments (VNET_BUFFER_GSO).  First 2
+	   words are left for flow hash and config index used while forwarding. */
+	struct {
+	  u32 reserved[2];
+
+	  /* Data bytes per segment.  First buffer only. */
+	  u16 segment_size;
+
+	  /* Offset of ip header from start of buffer data.  First buffer only;
+	     rewrites only prepend so it stays fixed until interface output. */
+	  i16 l3_header_offset;
+
+	  /* Checksum (not complemented) and size of data of segment starting
+	     in this buffer.  Zero size when unknown. */
+	  u16 data_ip_checksum;
+
+	  u16 n_data_bytes;
+	} gso;
+
+	/* Alternate used by fragments held for reassembly (vnet/ip/ip_reass.c). */
+	struct {
+	  /* Next fragment of same datagram in order of data offset. */
+	  u32 next_fragment_buffer_index;
+
+	  /* Datagram data bytes [first, last) carried by this fragment. */
+	  u16 data_first, data_last;
+	} reass;
       };
     } ip;
 
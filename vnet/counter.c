@@ -0,0 +1,158 @@
+/*
+ * counter.c: per worker sharded packet/byte counters
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/handoff.h>
+
+/* All counter mains with shards so that shards can be added when
+   workers are configured. */
+static vnet_simple_counter_main_t ** simple_counter_mains;
+static vnet_combined_counter_main_t ** combined_counter_mains;
+
+static void
+validate_simple_shards (vnet_simple_counter_main_t * cm)
+{
+  uword i, n_old = vec_len (cm->shards);
+  uword n_workers = vnet_n_workers (&vnet_worker_main);
+
+  if (n_old >= n_workers)
+    return;
+
+  if (n_old == 0)
+    vec_add1 (simple_counter_mains, cm);
+
+  vec_validate (cm->shards, n_workers - 1);
+  for (i = n_old; i < n_workers; i++)
+    {
+      cm->shards[i].name = cm->name;
+      if (n_old > 0 && vec_len (cm->shards[0].maxi) > 0)
+	{
+	  vlib_validate_counter (&cm->shards[i], vec_len (cm->shards[0].maxi) - 1);
+	  vlib_clear_simple_counters (&cm->shards[i]);
+	}
+    }
+}
+
+static void
+validate_combined_shards (vnet_combined_counter_main_t * cm)
+{
+  uword i, n_old = vec_len (cm->shards);
+  uword n_workers = vnet_n_workers (&vnet_worker_main);
+
+  if (n_old >= n_workers)
+    return;
+
+  if (n_old == 0)
+    vec_add1 (combined_counter_mains, cm);
+
+  vec_validate (cm->shards, n_workers - 1);
+  for (i = n_old; i < n_workers; i++)
+    {
+      cm->shards[i].name = cm->name;
+      if (n_old > 0 && vec_len (cm->shards[0].maxi) > 0)
+	{
+	  vlib_validate_counter (&cm->shards[i], vec_len (cm->shards[0].maxi) - 1);
+	  vlib_clear_combined_counters (&cm->shards[i]);
+	}
+    }
+}
+
+void vnet_validate_simple_counter (vnet_simple_counter_main_t * cm, u32 index)
+{
+  vlib_simple_counter_main_t * s;
+  validate_simple_shards (cm);
+  vec_foreach (s, cm->shards)
+    vlib_validate_counter (s, index);
+}
+
+void vnet_validate_combined_counter (vnet_combined_counter_main_t * cm, u32 index)
+{
+  vlib_combined_counter_main_t * s;
+  validate_combined_shards (cm);
+  vec_foreach (s, cm->shards)
+    vlib_validate_counter (s, index);
+}
+
+void vnet_zero_simple_counter (vnet_simple_counter_main_t * cm, u32 index)
+{
+  vlib_simple_counter_main_t * s;
+  vec_foreach (s, cm->shards)
+    vlib_zero_simple_counter (s, index);
+}
+
+void vnet_zero_combined_counter (vnet_combined_counter_main_t * cm, u32 index)
+{
+  vlib_combined_counter_main_t * s;
+  vec_foreach (s, cm->shards)
+    vlib_zero_combined_counter (s, index);
+}
+
+u64 vnet_get_simple_counter (vnet_simple_counter_main_t * cm, u32 index)
+{
+  vlib_simple_counter_main_t * s;
+  u64 sum = 0;
+  vec_foreach (s, cm->shards)
+    sum += vlib_get_simple_counter (s, index);
+  return sum;
+}
+
+void vnet_get_combined_counter (vnet_combined_counter_main_t * cm, u32 index,
+				vlib_counter_t * result)
+{
+  vlib_combined_counter_main_t * s;
+  vlib_counter_t v;
+
+  result->packets = result->bytes = 0;
+  vec_foreach (s, cm->shards)
+    {
+      vlib_get_combined_counter (s, index, &v);
+      result->packets += v.packets;
+      result->bytes += v.bytes;
+    }
+}
+
+void vnet_clear_simple_counters (vnet_simple_counter_main_t * cm)
+{
+  vlib_simple_counter_main_t * s;
+  vec_foreach (s, cm->shards)
+    vlib_clear_simple_counters (s);
+}
+
+void vnet_clear_combined_counters (vnet_combined_counter_main_t * cm)
+{
+  vlib_combined_counter_main_t * s;
+  vec_foreach (s, cm->shards)
+    vlib_clear_combined_counters (s);
+}
+
+void vnet_counters_add_worker_shards (void)
+{
+  uword i;
+
+  for (i = 0; i < vec_len (simple_counter_mains); i++)
+    validate_simple_shards (simple_counter_mains[i]);
+  for (i = 0; i < vec_len (combined_counter_mains); i++)
+    validate_combined_shards (combined_counter_mains[i]);
+}
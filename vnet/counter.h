@@ -0,0 +1,90 @@
+/*
+ * counter.h: per worker sharded packet/byte counters
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef included_vnet_counter_h
+#define included_vnet_counter_h
+
+#include <vlib/vlib.h>
+
+/* Each worker increments its own vlib counter shard so that forwarding
+   never writes a counter cache line shared with another worker.
+   Shards are summed only when counters are read. */
+typedef struct {
+  /* Vector of shards indexed by worker (cpu number). */
+  vlib_simple_counter_main_t * shards;
+
+  /* Name for show commands. */
+  char * name;
+} vnet_simple_counter_main_t;
+
+typedef struct {
+  /* Vector of shards indexed by worker (cpu number). */
+  vlib_combined_counter_main_t * shards;
+
+  /* Name for show commands. */
+  char * name;
+} vnet_combined_counter_main_t;
+
+/* Shard for given worker.  Forwarding nodes fetch this once per frame. */
+always_inline vlib_simple_counter_main_t *
+vnet_simple_counter_shard (vnet_simple_counter_main_t * cm, u32 cpu)
+{ return vec_elt_at_index (cm->shards, cpu); }
+
+always_inline vlib_combined_counter_main_t *
+vnet_combined_counter_shard (vnet_combined_counter_main_t * cm, u32 cpu)
+{ return vec_elt_at_index (cm->shards, cpu); }
+
+always_inline void
+vnet_increment_simple_counter (vnet_simple_counter_main_t * cm, u32 cpu,
+			       u32 index, u32 increment)
+{ vlib_increment_simple_counter (vnet_simple_counter_shard (cm, cpu), index, increment); }
+
+always_inline void
+vnet_increment_combined_counter (vnet_combined_counter_main_t * cm, u32 cpu,
+				 u32 index, u32 packet_increment, u32 byte_increment)
+{
+  vlib_increment_combined_counter (vnet_combined_counter_shard (cm, cpu), index,
+				   packet_increment, byte_increment);
+}
+
+/* Make sure all shards have a counter with given index. */
+void vnet_validate_simple_counter (vnet_simple_counter_main_t * cm, u32 index);
+void vnet_validate_combined_counter (vnet_combined_counter_main_t * cm, u32 index);
+
+void vnet_zero_simple_counter (vnet_simple_counter_main_t * cm, u32 index);
+void vnet_zero_combined_counter (vnet_combined_counter_main_t * cm, u32 index);
+
+/* Sum over all shards. */
+u64 vnet_get_simple_counter (vnet_simple_counter_main_t * cm, u32 index);
+void vnet_get_combined_counter (vnet_combined_counter_main_t * cm, u32 index,
+				vlib_counter_t * result);
+
+void vnet_clear_simple_counters (vnet_simple_counter_main_t * cm);
+void vnet_clear_combined_counters (vnet_combined_counter_main_t * cm);
+
+/* Add shards for workers configured after counters were validated. */
+void vnet_counters_add_worker_shards (void);
+
+#endif /* included_vnet_counter_h */
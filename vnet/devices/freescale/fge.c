@@ -1339,8 +1339,9 @@ fge_rx_queue (fge_main_t * fm,
 
   dq->sw_index = sw_index;
 
-  vlib_increment_combined_counter (vnet_main.interface_main.combined_sw_if_counters
+  vnet_increment_combined_counter (vnet_main.interface_main.combined_sw_if_counters
 				   + VNET_INTERFACE_COUNTER_RX,
+				   os_get_cpu_number (),
 				   fd->vnet_sw_if_index,
 				   n_packets,
 				   dq->rx.n_bytes_total);
@@ -1696,8 +1696,9 @@ ixge_rx_queue (ixge_main_t * xm,
 
   dr->tail_index = dq->tail_index;
 
-  vlib_increment_combined_counter (vnet_main.interface_main.combined_sw_if_counters
+  vnet_increment_combined_counter (vnet_main.interface_main.combined_sw_if_counters
 				   + VNET_INTERFACE_COUNTER_RX,
+				   os_get_cpu_number (),
 				   xd->vlib_sw_if_index,
 				   n_packets,
 				   dq->rx.n_bytes);
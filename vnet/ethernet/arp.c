@@ -26,6 +26,8 @@
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
 #include <vnet/ethernet/arp_packet.h>
+#include <vnet/handoff.h>
+#include <vnet/timer_wheel.h>
 #include <clib/mhash.h>
 
 typedef struct {
@@ -41,6 +43,8 @@ typedef struct {
 #define ETHERNET_ARP_IP4_ENTRY_FLAG_STATIC (1 << 0)
 
   u64 cpu_time_last_updated;
+
+  ip_neighbor_age_t age;
 } ethernet_arp_ip4_entry_t;
 
 typedef struct {
@@ -52,10 +56,21 @@ typedef struct {
   ethernet_arp_ip4_entry_t * ip4_entry_pool;
 
   mhash_t ip4_entry_by_key;
+
+  /* Aging timers of dynamic entries; user data is entry pool index. */
+  vnet_timer_wheel_t aging_timer_wheel;
+
+  ip_neighbor_aging_config_t aging_config;
+
+  /* Entries deleted after failing to respond to probes or going unused. */
+  u64 n_aged_out;
 } ethernet_arp_main_t;
 
 static ethernet_arp_main_t ethernet_arp_main;
 
+/* Seconds per aging timer wheel tick. */
+#define ARP_AGING_TICK_INTERVAL 100e-3
+
 static u8 * format_ethernet_arp_hardware_type (u8 * s, va_list * va)
 {
   ethernet_arp_hardware_type_t h = va_arg (*va, ethernet_arp_hardware_type_t);
@@ -184,13 +199,14 @@ static u8 * format_ethernet_arp_ip4_entry (u8 * s, va_list * va)
   vnet_sw_interface_t * si;
 
   if (! e)
-    return format (s, "%=12s%=20s%=20s%=40s", "Time", "IP4", "Ethernet", "Interface");
+    return format (s, "%=12s%=20s%=20s%=12s%=40s", "Time", "IP4", "Ethernet", "State", "Interface");
 
   si = vnet_get_sw_interface (vm, e->key.sw_if_index);
-  s = format (s, "%=12U%=20U%=20U%=40U",
+  s = format (s, "%=12U%=20U%=20U%=12U%=40U",
 	      format_vlib_cpu_time, vm, e->cpu_time_last_updated,
 	      format_ip4_address, &e->key.ip4_address,
 	      format_ethernet_address, e->ethernet_address,
+	      format_ip_neighbor_state, e->age.state,
 	      format_vnet_sw_interface_name, vm, si);
 
   return s;
@@ -233,11 +249,15 @@ ethernet_arp_sw_interface_up_down (vnet_main_t * vm,
       for (i = 0; i < vec_len (to_delete); i++)
 	{
 	  e = pool_elt_at_index (am->ip4_entry_pool, to_delete[i]);
+	  if (e->age.timer_handle != ~0)
+	    vnet_timer_wheel_stop (&am->aging_timer_wheel, e->age.timer_handle);
 	  mhash_unset (&am->ip4_entry_by_key, &e->key, 0);
 	  pool_put (am->ip4_entry_pool, e);
 	}
 
       vec_free (to_delete);
+
+      ip_neighbor_pending_flush (vm->vlib_main, &ip4_main.lookup_main, sw_if_index);
     }
 
   return 0;
@@ -249,7 +269,8 @@ static void
 arp_set_ip4_over_ethernet (vnet_main_t * vm,
 			   ethernet_arp_main_t * am,
 			   u32 sw_if_index,
-			   ethernet_arp_ip4_over_ethernet_address_t * a)
+			   ethernet_arp_ip4_over_ethernet_address_t * a,
+			   uword is_static)
 {
   ethernet_arp_ip4_key_t k;
   ethernet_arp_ip4_entry_t * e;
@@ -266,8 +287,8 @@ arp_set_ip4_over_ethernet (vnet_main_t * vm,
     {
       e = pool_elt_at_index (am->ip4_entry_pool, p[0]);
 
-      /* Refuse to over-write static arp. */
-      if (e->flags & ETHERNET_ARP_IP4_ENTRY_FLAG_STATIC)
+      /* Refuse to over-write static arp with learned mapping. */
+      if ((e->flags & ETHERNET_ARP_IP4_ENTRY_FLAG_STATIC) && ! is_static)
 	return;
     }
   else
@@ -300,11 +321,39 @@ arp_set_ip4_over_ethernet (vnet_main_t * vm,
                  e - am->ip4_entry_pool,
 		 /* old value */ 0);
       e->key = k;
+      e->flags = 0;
+      e->age.timer_handle = ~0;
+      e->age.n_packets_last = 0;
     }
 
   /* Update time stamp and ethernet address. */
   memcpy (e->ethernet_address, a->ethernet, sizeof (e->ethernet_address));
   e->cpu_time_last_updated = clib_cpu_time_now ();
+
+  if (is_static)
+    {
+      /* Static entries never age. */
+      e->flags |= ETHERNET_ARP_IP4_ENTRY_FLAG_STATIC;
+      if (e->age.timer_handle != ~0)
+	vnet_timer_wheel_stop (&am->aging_timer_wheel, e->age.timer_handle);
+      e->age.timer_handle = ~0;
+      e->age.state = IP_NEIGHBOR_STATE_STATIC;
+    }
+  else
+    {
+      /* Timer re-checks confirmation time when it expires so there is no
+	 need to restart a running timer. */
+      ip_neighbor_age_confirm (&e->age, vlib_time_now (vm->vlib_main));
+      if (e->age.timer_handle == ~0)
+	e->age.timer_handle = vnet_timer_wheel_start (&am->aging_timer_wheel,
+						      e - am->ip4_entry_pool,
+						      am->aging_config.reachable_time);
+    }
+
+  /* Send packets held by ip4-arp while address was being resolved.
+     Entry may already exist (e.g. refreshed by a late reply). */
+  ip_neighbor_pending_resolved (vnet_worker_vlib_main (vm->vlib_main),
+				&im->lookup_main, sw_if_index, &a->ip4);
 }
 
 /* Either we drop the packet or we send a reply to the sender. */
@@ -429,7 +478,8 @@ arp_input (vlib_main_t * vm,
 	     that don't match local interface address. */
 	  if (ethernet_address_cast (eth0->dst_address) == ETHERNET_ADDRESS_UNICAST
 	      || is_request0)
-	    arp_set_ip4_over_ethernet (vnm, am, sw_if_index0, &arp0->ip4_over_ethernet[0]);
+	    arp_set_ip4_over_ethernet (vnm, am, sw_if_index0, &arp0->ip4_over_ethernet[0],
+				       /* is_static */ 0);
 
 	  /* Only send a reply for requests sent which match a local interface. */
 	  if (! (is_request0 && dst_is_local0))
@@ -570,6 +620,8 @@ show_ip4_arp (vlib_main_t * vm,
   }
   vec_free (es);
 
+  vlib_cli_output (vm, "%Ld entries aged out", am->n_aged_out);
+
   return error;
 }
 
@@ -661,6 +713,9 @@ static clib_error_t * ethernet_arp_init (vlib_main_t * vm)
 	      /* value size */ sizeof (uword),
 	      /* key size */ sizeof (ethernet_arp_ip4_key_t));
 
+  ip_neighbor_aging_config_init (&am->aging_config);
+  vnet_timer_wheel_init (&am->aging_timer_wheel, ARP_AGING_TICK_INTERVAL, vlib_time_now (vm));
+
   return 0;
 }
 
@@ -689,6 +744,8 @@ arp_unset_ip4_over_ethernet (vnet_main_t * vm,
     }
   e = pool_elt_at_index (am->ip4_entry_pool, p[0]);
   e_copy = e[0];
+  if (e->age.timer_handle != ~0)
+    vnet_timer_wheel_stop (&am->aging_timer_wheel, e->age.timer_handle);
   mhash_unset (&am->ip4_entry_by_key, &e->key, 0);
   pool_put (am->ip4_entry_pool, e);
 
@@ -720,6 +777,7 @@ arp_unset_ip4_over_ethernet (vnet_main_t * vm,
 void
 ip4_add_del_ethernet_neighbor (ethernet_arp_ip4_over_ethernet_address_t * a,
 			       u32 sw_if_index,
+			       u32 is_static,
 			       u32 is_del)
 {
   vnet_main_t * vm = &vnet_main;
@@ -728,9 +786,122 @@ ip4_add_del_ethernet_neighbor (ethernet_arp_ip4_over_ethernet_address_t * a,
   if (is_del)
     arp_unset_ip4_over_ethernet (vm, am, sw_if_index, a);
   else
-    arp_set_ip4_over_ethernet (vm, am, sw_if_index, a);
+    arp_set_ip4_over_ethernet (vm, am, sw_if_index, a, is_static);
 }
 
+static void
+arp_age_entries (vlib_main_t * vm, ethernet_arp_main_t * am)
+{
+  vnet_main_t * vnm = &vnet_main;
+  ip4_main_t * im = &ip4_main;
+  static u32 * expired;
+  static ip4_neighbor_probe_t * probes;
+  ethernet_arp_ip4_entry_t * e;
+  f64 now = vlib_time_now (vm);
+  u32 i;
+
+  vec_reset_length (expired);
+  vec_reset_length (probes);
+  expired = vnet_timer_wheel_advance (&am->aging_timer_wheel, now, expired);
+
+  for (i = 0; i < vec_len (expired); i++)
+    {
+      ethernet_arp_ip4_over_ethernet_address_t a;
+      vlib_counter_t c;
+      u32 adj_index;
+      f64 dt;
+
+      e = pool_elt_at_index (am->ip4_entry_pool, expired[i]);
+      e->age.timer_handle = ~0;
+
+      adj_index = ip4_fib_lookup_with_table (im, im->fib_index_by_sw_if_index[e->key.sw_if_index],
+					     &e->key.ip4_address,
+					     /* disable_default_route */ 0);
+      vnet_get_combined_counter (&im->lookup_main.adjacency_counters, adj_index, &c);
+
+      switch (ip_neighbor_age_timer_expired (&am->aging_config, &e->age, now, c.packets, &dt))
+	{
+	case IP_NEIGHBOR_STATE_FAILED:
+	  a.ip4 = e->key.ip4_address;
+	  memcpy (a.ethernet, e->ethernet_address, sizeof (a.ethernet));
+	  arp_unset_ip4_over_ethernet (vnm, am, e->key.sw_if_index, &a);
+	  am->n_aged_out += 1;
+	  continue;
+
+	case IP_NEIGHBOR_STATE_PROBE:
+	  {
+	    ip4_neighbor_probe_t * p;
+	    vec_add2 (probes, p, 1);
+	    p->address = e->key.ip4_address;
+	    p->sw_if_index = e->key.sw_if_index;
+	    memcpy (p->ethernet_address, e->ethernet_address, sizeof (p->ethernet_address));
+	  }
+	  break;
+
+	default:
+	  break;
+	}
+
+      e->age.timer_handle = vnet_timer_wheel_start (&am->aging_timer_wheel, expired[i], dt);
+    }
+
+  if (vec_len (probes) > 0)
+    {
+      clib_error_t * error;
+
+      /* Probes out same interface share frames. */
+      vec_sort (probes, p1, p2, (word) p1->sw_if_index - (word) p2->sw_if_index);
+
+      /* Probes for interfaces which lost their address fail and age out. */
+      error = ip4_probe_neighbors (vm, probes, vec_len (probes));
+      if (error)
+	clib_error_free (error);
+    }
+}
+
+static uword
+arp_aging_process (vlib_main_t * vm,
+		   vlib_node_runtime_t * rt,
+		   vlib_frame_t * f)
+{
+  ethernet_arp_main_t * am = &ethernet_arp_main;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, ARP_AGING_TICK_INTERVAL);
+
+      if (vnet_timer_wheel_n_running (&am->aging_timer_wheel) > 0)
+	arp_age_entries (vm, am);
+    }
+
+  return 0;
+}
+
+static VLIB_REGISTER_NODE (arp_aging_process_node) = {
+  .function = arp_aging_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "arp-aging",
+};
+
+static clib_error_t *
+ethernet_arp_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  ethernet_arp_main_t * am = &ethernet_arp_main;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat_user (input, unformat_ip_neighbor_aging_config, &am->aging_config))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (ethernet_arp_config, "arp");
+
 static void 
 increment_ip4_and_mac_address (ethernet_arp_ip4_over_ethernet_address_t *a)
 {
@@ -754,7 +925,6 @@ increment_ip4_and_mac_address (ethernet_arp_ip4_over_ethernet_address_t *a)
     }
 }
 
-#if CLIB_DEBUG > 0
 static clib_error_t *
 ip_arp_add_del_command_fn (vlib_main_t * vm,
 			   unformat_input_t * input,
@@ -766,6 +936,7 @@ ip_arp_add_del_command_fn (vlib_main_t * vm,
   ethernet_arp_ip4_over_ethernet_address_t addr;
   int addr_valid = 0;
   int is_del = 0;
+  int is_static = 0;
   int count = 1;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) 
@@ -780,6 +951,9 @@ ip_arp_add_del_command_fn (vlib_main_t * vm,
       else if (unformat (input, "delete") || unformat (input, "del"))
         is_del = 1;
 
+      else if (unformat (input, "static"))
+        is_static = 1;
+
       else if (unformat (input, "count %d", &count))
         ;
 
@@ -795,7 +969,7 @@ ip_arp_add_del_command_fn (vlib_main_t * vm,
       for (i = 0; i < count; i++) 
         {
           if (is_del == 0)
-            arp_set_ip4_over_ethernet (vnm, am, sw_if_index, &addr);
+            arp_set_ip4_over_ethernet (vnm, am, sw_if_index, &addr, is_static);
           else
             arp_unset_ip4_over_ethernet (vnm, am, sw_if_index, &addr);
 
@@ -808,7 +982,6 @@ ip_arp_add_del_command_fn (vlib_main_t * vm,
 
 static VLIB_CLI_COMMAND (ip_arp_add_del_command) = {
     .path = "set ip arp",
-    .short_help = "set ip arp",
+    .short_help = "set ip arp [del] [static] [count <n>] <intfc> <ip4> <mac>",
     .function = ip_arp_add_del_command_fn,
 };
-#endif	/* CLIB_DEBUG > 0 */
@@ -0,0 +1,919 @@
+/*
+ * bridge.c: ethernet L2 bridge domains
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/handoff.h>
+#include <vnet/ip/ip.h>
+#include <vnet/ethernet/ethernet.h>
+
+/* ethernet-input sends frames received on bridged interfaces here after
+   mapping any VLAN tag to its sub-interface.  Source addresses are learned;
+   frames to known unicast addresses go to the interface they were learned
+   on and all others are flooded to every other member of the bridge domain.
+   Buffers have no reference counts so flooded frames are copied for all
+   members but one which gets the original.
+
+   Interface, bridge domain and member vectors are copied and replaced,
+   never resized in place, while workers forward.  Old vectors are freed
+   by ip_lookup_defer_vec_free once every worker has passed its
+   ip-lookup-quiescent input node, which runs between frames on all
+   workers whether or not ip handoff is enabled. */
+
+ethernet_bridge_main_t ethernet_bridge_main = {
+  .log2_n_mac_buckets = 12,
+  .mac_age = 300,
+};
+
+/* Seconds between scans of MAC table for aged entries. */
+#define ETHERNET_BRIDGE_MAC_AGE_INTERVAL 5.0
+
+typedef struct {
+  /* Output buffers of frame being switched and their next indices. */
+  u32 * buffers;
+  u32 * nexts;
+} ethernet_bridge_worker_t;
+
+static ethernet_bridge_worker_t ethernet_bridge_workers[VNET_MAX_WORKERS];
+
+static vlib_node_registration_t ethernet_bridge_node;
+
+#define foreach_ethernet_bridge_error				\
+  _ (FORWARDED, "frames forwarded to known unicast address")	\
+  _ (FLOODED, "frames flooded")					\
+  _ (FILTERED, "frames to address learned on input interface")	\
+  _ (NO_MEMBERS, "no other bridge domain members")		\
+  _ (NO_BUFFERS, "no buffers to flood frame")			\
+  _ (NOT_BRIDGED, "input interface left bridge domain")
+
+typedef enum {
+#define _(sym,str) ETHERNET_BRIDGE_ERROR_##sym,
+  foreach_ethernet_bridge_error
+#undef _
+  ETHERNET_BRIDGE_N_ERROR,
+} ethernet_bridge_error_t;
+
+static char * ethernet_bridge_error_strings[] = {
+#define _(sym,string) string,
+  foreach_ethernet_bridge_error
+#undef _
+};
+
+typedef enum {
+  ETHERNET_BRIDGE_NEXT_DROP,
+  ETHERNET_BRIDGE_N_NEXT,
+} ethernet_bridge_next_t;
+
+typedef struct {
+  u32 bd_id;
+
+  /* Output interface of forwarded frames; ~0 otherwise. */
+  u32 sw_if_index;
+
+  u8 packet_data[32];
+} ethernet_bridge_trace_t;
+
+static u8 * format_ethernet_bridge_trace (u8 * s, va_list * va)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*va, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*va, vlib_node_t *);
+  ethernet_bridge_trace_t * t = va_arg (*va, ethernet_bridge_trace_t *);
+
+  s = format (s, "bridge-domain %d", t->bd_id);
+  if (t->sw_if_index != ~0)
+    s = format (s, " to %U", format_vnet_sw_if_index_name, &vnet_main, t->sw_if_index);
+  s = format (s, ": %U", format_ethernet_header, t->packet_data);
+
+  return s;
+}
+
+always_inline u64
+ethernet_bridge_mac_key (u8 * address, u32 bd_index)
+{ return ethernet_mac_address_u64 (address) | ((u64) bd_index << 48); }
+
+always_inline ethernet_bridge_mac_bucket_t *
+ethernet_bridge_mac_bucket (ethernet_bridge_main_t * bm, u64 key)
+{
+  u32 a = key, b = key >> 32, c = 0;
+  hash_v3_finalize32 (a, b, c);
+  return bm->mac_buckets + (c & ((1 << bm->log2_n_mac_buckets) - 1));
+}
+
+/* Returns interface address was learned on or ~0. */
+always_inline u32
+ethernet_bridge_mac_lookup (ethernet_bridge_mac_bucket_t * b, u64 key,
+			    u32 * time_last_seen)
+{
+  ethernet_bridge_mac_entry_t * e;
+  u32 version, sw_if_index, t;
+
+  do
+    {
+      version = b->version;
+      CLIB_MEMORY_BARRIER ();
+
+      sw_if_index = ~0;
+      t = 0;
+      for (e = b->entries; e < b->entries + ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES; e++)
+	if (e->key == key)
+	  {
+	    sw_if_index = e->sw_if_index;
+	    t = e->time_last_seen;
+	    break;
+	  }
+
+      CLIB_MEMORY_BARRIER ();
+    }
+  /* Retry when a writer changed bucket while we read it. */
+  while ((version & 1) || version != b->version);
+
+  *time_last_seen = t;
+  return sw_if_index;
+}
+
+always_inline void
+ethernet_bridge_mac_bucket_lock (ethernet_bridge_mac_bucket_t * b)
+{
+  while (__sync_lock_test_and_set (&b->lock, 1))
+    ;
+}
+
+always_inline void
+ethernet_bridge_mac_bucket_unlock (ethernet_bridge_mac_bucket_t * b)
+{ __sync_lock_release (&b->lock); }
+
+/* Called with bucket locked.  Version is odd while entry changes. */
+always_inline void
+ethernet_bridge_mac_entry_set (ethernet_bridge_mac_bucket_t * b,
+			       ethernet_bridge_mac_entry_t * e,
+			       u64 key, u32 sw_if_index, u32 now)
+{
+  b->version += 1;
+  CLIB_MEMORY_BARRIER ();
+
+  e->key = key;
+  e->sw_if_index = sw_if_index;
+  e->time_last_seen = now;
+
+  CLIB_MEMORY_BARRIER ();
+  b->version += 1;
+}
+
+/* Full buckets replace their least recently seen entry. */
+static void
+ethernet_bridge_mac_learn (ethernet_bridge_mac_bucket_t * b, u64 key,
+			   u32 sw_if_index, u32 now)
+{
+  ethernet_bridge_mac_entry_t * e, * empty = 0, * oldest = 0;
+  ethernet_bridge_mac_entry_t * end = b->entries + ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES;
+
+  ethernet_bridge_mac_bucket_lock (b);
+
+  for (e = b->entries; e < end; e++)
+    {
+      if (e->key == key)
+	break;
+      if (e->key == ETHERNET_BRIDGE_MAC_KEY_EMPTY)
+	empty = empty ? empty : e;
+      else if (! oldest || (i32) (e->time_last_seen - oldest->time_last_seen) < 0)
+	oldest = e;
+    }
+
+  if (e >= end)
+    e = empty ? empty : oldest;
+
+  ethernet_bridge_mac_entry_set (b, e, key, sw_if_index, now);
+
+  ethernet_bridge_mac_bucket_unlock (b);
+}
+
+/* Removes entries learned on given interface (any interface for ~0) which
+   have not been seen for max_age seconds.  Zero max_age removes all. */
+static void
+ethernet_bridge_mac_remove (ethernet_bridge_main_t * bm, u32 sw_if_index,
+			    u32 now, u32 max_age)
+{
+  ethernet_bridge_mac_bucket_t * b;
+  ethernet_bridge_mac_entry_t * e;
+
+  vec_foreach (b, bm->mac_buckets)
+    {
+      ethernet_bridge_mac_bucket_lock (b);
+
+      for (e = b->entries; e < b->entries + ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES; e++)
+	{
+	  if (e->key == ETHERNET_BRIDGE_MAC_KEY_EMPTY)
+	    continue;
+	  if (sw_if_index != ~0 && e->sw_if_index != sw_if_index)
+	    continue;
+	  /* Workers' clocks may be slightly ahead of ours. */
+	  if (max_age > 0 && (i32) (now - e->time_last_seen) < (i32) max_age)
+	    continue;
+	  ethernet_bridge_mac_entry_set (b, e, ETHERNET_BRIDGE_MAC_KEY_EMPTY, ~0, 0);
+	}
+
+      ethernet_bridge_mac_bucket_unlock (b);
+    }
+}
+
+static void
+ethernet_bridge_mac_table_init (ethernet_bridge_main_t * bm)
+{
+  ethernet_bridge_mac_bucket_t * b;
+  uword i;
+
+  vec_validate_aligned (bm->mac_buckets, (1 << bm->log2_n_mac_buckets) - 1,
+			CLIB_CACHE_LINE_BYTES);
+  vec_foreach (b, bm->mac_buckets)
+    for (i = 0; i < ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES; i++)
+      {
+	b->entries[i].key = ETHERNET_BRIDGE_MAC_KEY_EMPTY;
+	b->entries[i].sw_if_index = ~0;
+      }
+}
+
+/* Appends data to chain ending with a buffer from default free list.
+   Returns new last buffer or 0 when out of buffers. */
+static vlib_buffer_t *
+ethernet_bridge_append (vlib_main_t * vm, vlib_buffer_t * last, u8 * data, u32 n_bytes)
+{
+  while (n_bytes > 0)
+    {
+      i32 n_free = VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES - (last->current_data + last->current_length);
+      u32 n;
+
+      if (n_free <= 0)
+	{
+	  vlib_buffer_t * b;
+	  u32 bi;
+
+	  if (! vlib_buffer_alloc_from_free_list (vm, &bi, 1, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX))
+	    return 0;
+
+	  b = vlib_get_buffer (vm, bi);
+	  b->current_data = 0;
+	  b->current_length = 0;
+	  b->flags = 0;
+
+	  last->next_buffer = bi;
+	  last->flags |= VLIB_BUFFER_NEXT_PRESENT;
+	  last = b;
+	  continue;
+	}
+
+      n = clib_min (n_free, n_bytes);
+      memcpy (vlib_buffer_get_current (last) + last->current_length, data, n);
+      last->current_length += n;
+      data += n;
+      n_bytes -= n;
+    }
+
+  return last;
+}
+
+/* Copies frame into new buffer chain.  Returns ~0 when out of buffers. */
+static u32
+ethernet_bridge_copy (vlib_main_t * vm, vlib_buffer_t * b)
+{
+  vlib_buffer_t * c, * last;
+  u32 ci;
+
+  if (! vlib_buffer_alloc_from_free_list (vm, &ci, 1, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX))
+    return ~0;
+
+  c = vlib_get_buffer (vm, ci);
+
+  /* Same headroom as original so that VLAN tags can be pushed. */
+  c->current_data = b->current_data;
+  c->current_length = 0;
+  c->flags = 0;
+  c->error = b->error;
+  memcpy (c->opaque, b->opaque, sizeof (c->opaque));
+
+  last = c;
+  while (1)
+    {
+      last = ethernet_bridge_append (vm, last, vlib_buffer_get_current (b), b->current_length);
+      if (! last)
+	{
+	  vlib_buffer_free (vm, &ci, 1);
+	  return ~0;
+	}
+      if (! (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+	break;
+      b = vlib_get_buffer (vm, b->next_buffer);
+    }
+
+  return ci;
+}
+
+/* Pushes tags of output sub-interface.  Returns next index of output node. */
+always_inline u32
+ethernet_bridge_output (ethernet_bridge_main_t * bm, vlib_buffer_t * b, u32 sw_if_index)
+{
+  ethernet_bridge_interface_t * oi = vec_elt_at_index (bm->interfaces, sw_if_index);
+
+  vnet_buffer (b)->sw_if_index[VLIB_TX] = sw_if_index;
+
+  if (oi->vlan_id != ~0)
+    {
+      ethernet_header_t * e;
+      ethernet_vlan_header_t * v;
+      u32 n_tags = (oi->vlan_id & VNET_SUB_INTERFACE_ID_2) ? 2 : 1;
+      i32 n_bytes = n_tags * sizeof (v[0]);
+
+      ASSERT (b->current_data - n_bytes >= -VLIB_BUFFER_PRE_DATA_SIZE);
+      vlib_buffer_advance (b, -n_bytes);
+
+      e = vlib_buffer_get_current (b);
+      memmove (e, (u8 *) e + n_bytes, 2 * sizeof (e->dst_address));
+
+      /* Type of frame is already in place after tags. */
+      v = (void *) (e + 1);
+      e->type = clib_host_to_net_u16 (ETHERNET_TYPE_VLAN);
+      v->priority_cfi_and_id = clib_host_to_net_u16 (vnet_sub_interface_id_outer (oi->vlan_id));
+      if (n_tags > 1)
+	{
+	  v->type = clib_host_to_net_u16 (ETHERNET_TYPE_VLAN);
+	  v[1].priority_cfi_and_id = clib_host_to_net_u16 (vnet_sub_interface_id_inner (oi->vlan_id));
+	}
+    }
+
+  return oi->output_next_index;
+}
+
+/* Switches frame appending its output buffers and next indices to
+   worker's vectors.  Nothing is appended when frame is to be dropped. */
+static ethernet_bridge_error_t
+ethernet_bridge_switch (vlib_main_t * vm, ethernet_bridge_main_t * bm,
+			ethernet_bridge_worker_t * w, u32 bi, u32 now)
+{
+  vlib_buffer_t * b = vlib_get_buffer (vm, bi);
+  ethernet_bridge_domain_t * bd;
+  ethernet_header_t * e;
+  u32 rx, tx, bd_index, t, * members, * m;
+  i32 start;
+  u64 key;
+
+  rx = vnet_buffer (b)->sw_if_index[VLIB_RX];
+  bd_index = ethernet_bridge_domain_for_sw_interface (bm, rx);
+  if (bd_index == ~0)
+    return ETHERNET_BRIDGE_ERROR_NOT_BRIDGED;
+
+  bd = vec_elt_at_index (bm->bridge_domains, bd_index);
+
+  /* Move addresses next to type to pop tags consumed by ethernet-input;
+     frames are switched untagged. */
+  start = b->current_data - (i32) sizeof (e[0]);
+  if (start != vnet_buffer (b)->ethernet.start_of_ethernet_header)
+    memmove (b->data + start,
+	     b->data + vnet_buffer (b)->ethernet.start_of_ethernet_header,
+	     2 * sizeof (e->dst_address));
+  vlib_buffer_advance (b, -(word) sizeof (e[0]));
+  e = vlib_buffer_get_current (b);
+
+  if ((bd->flags & ETHERNET_BRIDGE_DOMAIN_FLAG_LEARN)
+      && ethernet_address_cast (e->src_address) == ETHERNET_ADDRESS_UNICAST)
+    {
+      ethernet_bridge_mac_bucket_t * mb;
+
+      key = ethernet_bridge_mac_key (e->src_address, bd_index);
+      mb = ethernet_bridge_mac_bucket (bm, key);
+
+      /* Shared bucket is written only for new or moved addresses and at
+	 most once a second to refresh time last seen. */
+      if (ethernet_bridge_mac_lookup (mb, key, &t) != rx || t != now)
+	ethernet_bridge_mac_learn (mb, key, rx, now);
+    }
+
+  if (ethernet_address_cast (e->dst_address) == ETHERNET_ADDRESS_UNICAST)
+    {
+      key = ethernet_bridge_mac_key (e->dst_address, bd_index);
+      tx = ethernet_bridge_mac_lookup (ethernet_bridge_mac_bucket (bm, key), key, &t);
+
+      if (tx == rx)
+	return ETHERNET_BRIDGE_ERROR_FILTERED;
+
+      /* Unknown addresses and those learned on interfaces which have
+	 since left bridge domain are flooded. */
+      if (ethernet_bridge_domain_for_sw_interface (bm, tx) == bd_index)
+	{
+	  vec_add1 (w->nexts, ethernet_bridge_output (bm, b, tx));
+	  vec_add1 (w->buffers, bi);
+	  return ETHERNET_BRIDGE_ERROR_FORWARDED;
+	}
+    }
+
+  /* Copies are made from untagged frame before original is rewritten. */
+  members = bd->members;
+  tx = ~0;
+  vec_foreach (m, members)
+    {
+      u32 ci;
+
+      if (m[0] == rx)
+	continue;
+
+      if (tx == ~0)
+	{
+	  tx = m[0];
+	  continue;
+	}
+
+      ci = ethernet_bridge_copy (vm, b);
+      if (ci == ~0)
+	{
+	  vlib_buffer_free (vm, w->buffers, vec_len (w->buffers));
+	  vec_reset_length (w->buffers);
+	  vec_reset_length (w->nexts);
+	  return ETHERNET_BRIDGE_ERROR_NO_BUFFERS;
+	}
+
+      vec_add1 (w->nexts, ethernet_bridge_output (bm, vlib_get_buffer (vm, ci), m[0]));
+      vec_add1 (w->buffers, ci);
+    }
+
+  if (tx == ~0)
+    return ETHERNET_BRIDGE_ERROR_NO_MEMBERS;
+
+  vec_add1 (w->nexts, ethernet_bridge_output (bm, b, tx));
+  vec_add1 (w->buffers, bi);
+
+  return ETHERNET_BRIDGE_ERROR_FLOODED;
+}
+
+static uword
+ethernet_bridge (vlib_main_t * vm,
+		 vlib_node_runtime_t * node,
+		 vlib_frame_t * frame)
+{
+  ethernet_bridge_main_t * bm = &ethernet_bridge_main;
+  ethernet_bridge_worker_t * w;
+  u32 * from, * to_next, n_left_from, n_left_to_next, next_index;
+  u32 n_forwarded = 0, n_flooded = 0, now = vlib_time_now (vm);
+  uword cpu = os_get_cpu_number ();
+
+  ASSERT (cpu < VNET_MAX_WORKERS);
+  w = &ethernet_bridge_workers[cpu];
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+
+  vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+  while (n_left_from > 0)
+    {
+      vlib_buffer_t * b0;
+      ethernet_bridge_error_t error0;
+      u32 bi0, bd_index0, i;
+
+      bi0 = from[0];
+      from += 1;
+      n_left_from -= 1;
+
+      b0 = vlib_get_buffer (vm, bi0);
+      bd_index0 = ethernet_bridge_domain_for_sw_interface (bm, vnet_buffer (b0)->sw_if_index[VLIB_RX]);
+
+      vec_reset_length (w->buffers);
+      vec_reset_length (w->nexts);
+      error0 = ethernet_bridge_switch (vm, bm, w, bi0, now);
+
+      n_forwarded += error0 == ETHERNET_BRIDGE_ERROR_FORWARDED;
+      n_flooded += error0 == ETHERNET_BRIDGE_ERROR_FLOODED;
+
+      if (vec_len (w->buffers) == 0)
+	{
+	  b0->error = node->errors[error0];
+	  vec_add1 (w->buffers, bi0);
+	  vec_add1 (w->nexts, ETHERNET_BRIDGE_NEXT_DROP);
+	}
+
+      if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+	{
+	  ethernet_bridge_trace_t * t0 = vlib_add_trace (vm, node, b0, sizeof (t0[0]));
+	  t0->bd_id = (bd_index0 != ~0
+		       ? vec_elt (bm->bridge_domains, bd_index0).bd_id
+		       : ~0);
+	  t0->sw_if_index = (error0 == ETHERNET_BRIDGE_ERROR_FORWARDED
+			     ? vnet_buffer (b0)->sw_if_index[VLIB_TX]
+			     : ~0);
+	  memcpy (t0->packet_data, vlib_buffer_get_current (b0), sizeof (t0->packet_data));
+	}
+
+      for (i = 0; i < vec_len (w->buffers); i++)
+	{
+	  u32 bi = w->buffers[i];
+
+	  if (n_left_to_next == 0)
+	    {
+	      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+	      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+	    }
+
+	  to_next[0] = bi;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+					   to_next, n_left_to_next,
+					   bi, w->nexts[i]);
+	}
+    }
+
+  vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+
+  vlib_error_count (vm, node->node_index, ETHERNET_BRIDGE_ERROR_FORWARDED, n_forwarded);
+  vlib_error_count (vm, node->node_index, ETHERNET_BRIDGE_ERROR_FLOODED, n_flooded);
+
+  return frame->n_vectors;
+}
+
+static VLIB_REGISTER_NODE (ethernet_bridge_node) = {
+  .function = ethernet_bridge,
+  .name = "ethernet-bridge",
+  /* Takes a vector of packets. */
+  .vector_size = sizeof (u32),
+
+  .n_errors = ETHERNET_BRIDGE_N_ERROR,
+  .error_strings = ethernet_bridge_error_strings,
+
+  .n_next_nodes = ETHERNET_BRIDGE_N_NEXT,
+  .next_nodes = {
+    [ETHERNET_BRIDGE_NEXT_DROP] = "error-drop",
+  },
+
+  .format_buffer = format_ethernet_header_with_length,
+  .format_trace = format_ethernet_bridge_trace,
+};
+
+static void
+ethernet_bridge_validate_interface (ethernet_bridge_main_t * bm, u32 sw_if_index)
+{
+  ethernet_bridge_interface_t * old = bm->interfaces, * new, empty;
+
+  if (sw_if_index < vec_len (old))
+    return;
+
+  empty.bd_index = ~0;
+  empty.output_next_index = ETHERNET_BRIDGE_NEXT_DROP;
+  empty.vlan_id = ~0;
+
+  new = vec_dup (old);
+  vec_validate_init_empty (new, sw_if_index, empty);
+
+  CLIB_MEMORY_BARRIER ();
+  bm->interfaces = new;
+  ip_lookup_defer_vec_free (old);
+}
+
+/* Returns index of bridge domain with given id, creating it if needed;
+   ~0 when there are too many bridge domains. */
+static u32
+ethernet_bridge_domain_get (ethernet_bridge_main_t * bm, u32 bd_id)
+{
+  ethernet_bridge_domain_t * old, * new, * bd;
+  uword * p;
+
+  p = hash_get (bm->bridge_domain_index_by_id, bd_id);
+  if (p)
+    return p[0];
+
+  /* Index must fit in high 16 bits of MAC table key. */
+  if (vec_len (bm->bridge_domains) >= (1 << 16))
+    return ~0;
+
+  if (! bm->mac_buckets)
+    ethernet_bridge_mac_table_init (bm);
+
+  old = bm->bridge_domains;
+  new = vec_dup (old);
+  vec_add2 (new, bd, 1);
+  bd->bd_id = bd_id;
+  bd->flags = ETHERNET_BRIDGE_DOMAIN_FLAG_LEARN;
+  bd->members = 0;
+
+  CLIB_MEMORY_BARRIER ();
+  bm->bridge_domains = new;
+  ip_lookup_defer_vec_free (old);
+
+  hash_set (bm->bridge_domain_index_by_id, bd_id, bd - new);
+
+  return bd - new;
+}
+
+static void
+ethernet_bridge_domain_set_member (ethernet_bridge_domain_t * bd, u32 sw_if_index, uword is_add)
+{
+  u32 * old = bd->members, * new = 0, * m;
+
+  vec_foreach (m, old)
+    if (m[0] != sw_if_index)
+      vec_add1 (new, m[0]);
+  if (is_add)
+    vec_add1 (new, sw_if_index);
+
+  CLIB_MEMORY_BARRIER ();
+  bd->members = new;
+  ip_lookup_defer_vec_free (old);
+}
+
+clib_error_t *
+ethernet_bridge_set_interface (vnet_main_t * vnm, u32 sw_if_index, u32 bd_id)
+{
+  ethernet_bridge_main_t * bm = &ethernet_bridge_main;
+  vnet_hw_interface_t * hi;
+  vnet_sw_interface_t * si;
+  ethernet_bridge_interface_t * bi;
+  u32 bd_index;
+
+  hi = vnet_get_sup_hw_interface (vnm, sw_if_index);
+  if (hi->hw_class_index != ethernet_hw_interface_class.index)
+    return clib_error_return (0, "interface %U is not ethernet",
+			      format_vnet_sw_if_index_name, vnm, sw_if_index);
+
+  bd_index = ~0;
+  if (bd_id != ~0)
+    {
+      bd_index = ethernet_bridge_domain_get (bm, bd_id);
+      if (bd_index == ~0)
+	return clib_error_return (0, "too many bridge domains");
+    }
+
+  ethernet_bridge_validate_interface (bm, sw_if_index);
+  bi = vec_elt_at_index (bm->interfaces, sw_if_index);
+
+  if (bi->bd_index == bd_index)
+    return 0;
+
+  if (bi->bd_index != ~0)
+    {
+      ethernet_bridge_domain_set_member (vec_elt_at_index (bm->bridge_domains, bi->bd_index),
+					 sw_if_index, /* is_add */ 0);
+      bi->bd_index = ~0;
+      bm->n_bridged_interfaces -= 1;
+      ethernet_bridge_mac_remove (bm, sw_if_index, 0, /* max_age */ 0);
+    }
+
+  if (bd_index != ~0)
+    {
+      si = vnet_get_sw_interface (vnm, sw_if_index);
+      bi->vlan_id = si->type == VNET_SW_INTERFACE_TYPE_SUB ? si->sub.id : ~0;
+      bi->output_next_index = vlib_node_add_next (vnm->vlib_main, ethernet_bridge_node.index,
+						  hi->output_node_index);
+      ethernet_bridge_domain_set_member (vec_elt_at_index (bm->bridge_domains, bd_index),
+					 sw_if_index, /* is_add */ 1);
+
+      /* Output state must be visible before frames are bridged. */
+      CLIB_MEMORY_BARRIER ();
+      bi->bd_index = bd_index;
+      bm->n_bridged_interfaces += 1;
+    }
+
+  return 0;
+}
+
+static clib_error_t *
+ethernet_bridge_sw_interface_add_del (vnet_main_t * vnm,
+				      u32 sw_if_index,
+				      u32 is_create)
+{
+  ethernet_bridge_main_t * bm = &ethernet_bridge_main;
+
+  if (is_create)
+    ethernet_bridge_validate_interface (bm, sw_if_index);
+  else if (ethernet_bridge_domain_for_sw_interface (bm, sw_if_index) != ~0)
+    return ethernet_bridge_set_interface (vnm, sw_if_index, ~0);
+
+  return 0;
+}
+
+static VNET_SW_INTERFACE_ADD_DEL_FUNCTION (ethernet_bridge_sw_interface_add_del);
+
+static uword
+ethernet_bridge_mac_age_process (vlib_main_t * vm,
+				 vlib_node_runtime_t * rt,
+				 vlib_frame_t * f)
+{
+  ethernet_bridge_main_t * bm = &ethernet_bridge_main;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, ETHERNET_BRIDGE_MAC_AGE_INTERVAL);
+
+      if (bm->n_bridged_interfaces > 0 && bm->mac_age > 0)
+	ethernet_bridge_mac_remove (bm, ~0, vlib_time_now (vm), bm->mac_age);
+    }
+
+  return 0;
+}
+
+static VLIB_REGISTER_NODE (ethernet_bridge_mac_age_process_node) = {
+  .function = ethernet_bridge_mac_age_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "ethernet-bridge-mac-aging",
+};
+
+static clib_error_t *
+ethernet_bridge_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  ethernet_bridge_main_t * bm = &ethernet_bridge_main;
+  u32 n_buckets = 1 << bm->log2_n_mac_buckets;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "mac-table-buckets %d", &n_buckets))
+	;
+      else if (unformat (input, "mac-age %d", &bm->mac_age))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_buckets == 0 || ! is_pow2 (n_buckets))
+    return clib_error_return (0, "MAC table buckets must be a power of 2");
+
+  if (bm->mac_buckets)
+    return clib_error_return (0, "MAC table already allocated");
+
+  bm->log2_n_mac_buckets = min_log2 (n_buckets);
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (ethernet_bridge_config, "bridge");
+
+static clib_error_t *
+set_interface_l2_bridge (vlib_main_t * vm,
+			 unformat_input_t * input,
+			 vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = &vnet_main;
+  u32 sw_if_index, bd_id;
+
+  if (! unformat_user (input, unformat_vnet_sw_interface, vnm, &sw_if_index))
+    return clib_error_return (0, "unknown interface `%U'",
+			      format_unformat_error, input);
+
+  if (! unformat (input, "%d", &bd_id) || bd_id == ~0)
+    return clib_error_return (0, "expected bridge domain id, got `%U'",
+			      format_unformat_error, input);
+
+  return ethernet_bridge_set_interface (vnm, sw_if_index, bd_id);
+}
+
+static VLIB_CLI_COMMAND (set_interface_l2_bridge_command) = {
+  .path = "set interface l2 bridge",
+  .short_help = "Add interface to bridge domain: <intfc> <bd-id>",
+  .function = set_interface_l2_bridge,
+};
+
+static clib_error_t *
+set_interface_l3 (vlib_main_t * vm,
+		  unformat_input_t * input,
+		  vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = &vnet_main;
+  u32 sw_if_index;
+
+  if (! unformat_user (input, unformat_vnet_sw_interface, vnm, &sw_if_index))
+    return clib_error_return (0, "unknown interface `%U'",
+			      format_unformat_error, input);
+
+  return ethernet_bridge_set_interface (vnm, sw_if_index, ~0);
+}
+
+static VLIB_CLI_COMMAND (set_interface_l3_command) = {
+  .path = "set interface l3",
+  .short_help = "Remove interface from its bridge domain",
+  .function = set_interface_l3,
+};
+
+static clib_error_t *
+set_bridge_domain_learn (vlib_main_t * vm,
+			 unformat_input_t * input,
+			 vlib_cli_command_t * cmd)
+{
+  ethernet_bridge_main_t * bm = &ethernet_bridge_main;
+  ethernet_bridge_domain_t * bd;
+  u32 bd_id, is_enable = 1;
+  uword * p;
+
+  if (! unformat (input, "%d", &bd_id))
+    return clib_error_return (0, "expected bridge domain id, got `%U'",
+			      format_unformat_error, input);
+
+  if (unformat (input, "disable"))
+    is_enable = 0;
+
+  p = hash_get (bm->bridge_domain_index_by_id, bd_id);
+  if (! p)
+    return clib_error_return (0, "unknown bridge domain %d", bd_id);
+
+  bd = vec_elt_at_index (bm->bridge_domains, p[0]);
+  if (is_enable)
+    bd->flags |= ETHERNET_BRIDGE_DOMAIN_FLAG_LEARN;
+  else
+    bd->flags &= ~ETHERNET_BRIDGE_DOMAIN_FLAG_LEARN;
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (set_bridge_domain_learn_command) = {
+  .path = "set bridge-domain learn",
+  .short_help = "Enable/disable MAC learning: <bd-id> [disable]",
+  .function = set_bridge_domain_learn,
+};
+
+static clib_error_t *
+show_bridge_domain (vlib_main_t * vm,
+		    unformat_input_t * input,
+		    vlib_cli_command_t * cmd)
+{
+  ethernet_bridge_main_t * bm = &ethernet_bridge_main;
+  vnet_main_t * vnm = &vnet_main;
+  ethernet_bridge_domain_t * bd;
+  ethernet_bridge_mac_bucket_t * b;
+  ethernet_bridge_mac_entry_t * e;
+  u32 * m, now, show_macs = 0;
+  uword n_macs = 0;
+
+  if (unformat (input, "mac"))
+    show_macs = 1;
+
+  now = vlib_time_now (vm);
+
+  vec_foreach (bd, bm->bridge_domains)
+    {
+      vlib_cli_output (vm, "bridge-domain %d: %d members, learning %s",
+		       bd->bd_id, vec_len (bd->members),
+		       (bd->flags & ETHERNET_BRIDGE_DOMAIN_FLAG_LEARN) ? "on" : "off");
+      vec_foreach (m, bd->members)
+	vlib_cli_output (vm, "  %U", format_vnet_sw_if_index_name, vnm, m[0]);
+    }
+
+  vec_foreach (b, bm->mac_buckets)
+    {
+      ethernet_bridge_mac_entry_t entries[ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES];
+
+      /* Copy bucket since workers may be changing it. */
+      ethernet_bridge_mac_bucket_lock (b);
+      memcpy (entries, b->entries, sizeof (entries));
+      ethernet_bridge_mac_bucket_unlock (b);
+
+      for (e = entries; e < entries + ARRAY_LEN (entries); e++)
+	{
+	  u8 address[6];
+	  uword i;
+
+	  if (e->key == ETHERNET_BRIDGE_MAC_KEY_EMPTY)
+	    continue;
+
+	  n_macs += 1;
+	  if (! show_macs)
+	    continue;
+
+	  for (i = 0; i < ARRAY_LEN (address); i++)
+	    address[i] = e->key >> (8 * (ARRAY_LEN (address) - 1 - i));
+
+	  vlib_cli_output (vm, "%U bridge-domain %d %U age %d",
+			   format_ethernet_address, address,
+			   vec_elt (bm->bridge_domains, e->key >> 48).bd_id,
+			   format_vnet_sw_if_index_name, vnm, e->sw_if_index,
+			   now - e->time_last_seen);
+	}
+    }
+
+  vlib_cli_output (vm, "%d learned MAC addresses in %d buckets, age %d sec",
+		   n_macs, vec_len (bm->mac_buckets), bm->mac_age);
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (show_bridge_domain_command) = {
+  .path = "show bridge-domain",
+  .short_help = "Show bridge domains and learned MAC addresses [mac]",
+  .function = show_bridge_domain,
+};
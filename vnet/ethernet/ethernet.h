@@ -91,6 +91,16 @@ typedef struct {
   u32 * vlan_to_sw_if_index;
 } ethernet_vlan_mapping_t;
 
+/* Entry of table mapping 2 VLAN tags to QinQ sub-interface. */
+typedef struct {
+  /* Receiving sw_if_index << 24 | inner VLAN << 12 | outer VLAN. */
+  u64 key;
+
+  u32 sw_if_index;
+} ethernet_qinq_entry_t;
+
+#define ETHERNET_QINQ_KEY_EMPTY (~0ULL)
+
 /* Per VLAN state. */
 typedef struct {
   /* ARP table. */
@@ -122,11 +132,13 @@ typedef struct {
   /* Per VLAN state. */
   ethernet_vlan_t * vlans;
 
-  /* Hash indexed by VLAN ID. */
-  uword * vlan_index_by_1_vlan_id;
+  /* Open addressed power of 2 sized table of QinQ sub-interfaces which
+     are up; at most half full.  Read without locks by ethernet-input so
+     entries are only added in place; table is replaced to remove them. */
+  ethernet_qinq_entry_t * qinq_table;
 
-  /* Hash indexed by 24 bits of (inner << 12) | outer VLAN IDs. */
-  uword * vlan_index_by_2_vlan_id;
+  /* Same mapping from key to sw_if_index used to rebuild table. */
+  uword * qinq_sw_if_index_by_key;
 
   /* Set to one to use AB.CD.EF instead of A:B:C:D:E:F as ethernet format. */
   int format_ethernet_address_16bit;
@@ -160,6 +172,138 @@ ethernet_vlan_to_sw_if_index (ethernet_vlan_mapping_t * m,
   return m->vlan_to_sw_if_index[i];
 }
 
+always_inline u64
+ethernet_qinq_key (u32 sw_if_index, u32 outer, u32 inner)
+{ return ((u64) sw_if_index << 24) | (inner << 12) | outer; }
+
+always_inline u32
+ethernet_qinq_hash (u64 key)
+{
+  u32 a = key, b = key >> 32, c = 0;
+  hash_v3_finalize32 (a, b, c);
+  return c;
+}
+
+/* Returns QinQ sub-interface of given interface and tags or ~0. */
+always_inline u32
+ethernet_qinq_lookup (ethernet_qinq_entry_t * table, u32 sw_if_index, u32 outer, u32 inner)
+{
+  ethernet_qinq_entry_t * e;
+  u64 key = ethernet_qinq_key (sw_if_index, outer, inner);
+  u32 mask = vec_len (table) - 1, i;
+
+  if (vec_len (table) == 0)
+    return ~0;
+
+  /* Table always has empty entries. */
+  for (i = ethernet_qinq_hash (key) & mask; ; i = (i + 1) & mask)
+    {
+      e = table + i;
+      if (e->key == key)
+	return e->sw_if_index;
+      if (e->key == ETHERNET_QINQ_KEY_EMPTY)
+	return ~0;
+    }
+}
+
+/* L2 bridging (bridge.c).  Interfaces and VLAN sub-interfaces which join
+   a bridge domain have all their frames switched by ethernet-bridge
+   instead of being dispatched to L3 by ethernet type. */
+typedef struct {
+  /* Id given by user. */
+  u32 bd_id;
+
+  u32 flags;
+  /* Learn source MAC addresses. */
+#define ETHERNET_BRIDGE_DOMAIN_FLAG_LEARN (1 << 0)
+
+  /* Member sw interfaces.  Forwarding reads this without locks so it is
+     replaced, never modified, when members join or leave. */
+  u32 * members;
+} ethernet_bridge_domain_t;
+
+typedef struct {
+  /* Bridge domain index or ~0 when interface is not bridged. */
+  u32 bd_index;
+
+  /* ethernet-bridge next index to interface's output node. */
+  u32 output_next_index;
+
+  /* Sub-interface id (1 VLAN or QinQ); tags are popped on input and
+     pushed on output.  ~0 for untagged interfaces. */
+  u32 vlan_id;
+} ethernet_bridge_interface_t;
+
+typedef struct {
+  /* MAC address in low 48 bits; bridge domain index in high 16 bits. */
+  u64 key;
+
+  u32 sw_if_index;
+
+  /* Seconds since vlib start when source was last seen. */
+  u32 time_last_seen;
+} ethernet_bridge_mac_entry_t;
+
+#define ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES 3
+
+/* Empty entries have all ones key: broadcast address is never learned. */
+#define ETHERNET_BRIDGE_MAC_KEY_EMPTY (~0ULL)
+
+/* MAC table is shared by all workers.  Lookups take no locks: writers
+   make version odd while changing a bucket and readers retry until they
+   see the same even version before and after reading it. */
+typedef struct {
+  volatile u32 version;
+
+  /* Serializes writers. */
+  volatile u32 lock;
+
+  ethernet_bridge_mac_entry_t entries[ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES];
+
+  u8 pad[CLIB_CACHE_LINE_BYTES - 2 * sizeof (u32)
+	 - ETHERNET_BRIDGE_MAC_BUCKET_N_ENTRIES * sizeof (ethernet_bridge_mac_entry_t)];
+} ethernet_bridge_mac_bucket_t;
+
+/* Vectors read by forwarding are copied when they grow and old copy is
+   freed after lookup grace period (ip_lookup_defer_vec_free). */
+typedef struct {
+  /* Bridge domains are never deleted; index is 16 bits of MAC table key. */
+  ethernet_bridge_domain_t * bridge_domains;
+
+  /* Maps user bridge domain id to pool index. */
+  uword * bridge_domain_index_by_id;
+
+  /* Indexed by sw_if_index. */
+  ethernet_bridge_interface_t * interfaces;
+
+  /* ethernet-input skips bridging checks when no interface is bridged. */
+  u32 n_bridged_interfaces;
+
+  /* Power of 2 sized table of MAC buckets. */
+  ethernet_bridge_mac_bucket_t * mac_buckets;
+
+  u32 log2_n_mac_buckets;
+
+  /* Learned addresses not seen for this many seconds are removed. */
+  u32 mac_age;
+} ethernet_bridge_main_t;
+
+extern ethernet_bridge_main_t ethernet_bridge_main;
+
+/* Bridge domain index of given sw interface or ~0. */
+always_inline u32
+ethernet_bridge_domain_for_sw_interface (ethernet_bridge_main_t * bm, u32 sw_if_index)
+{
+  return (sw_if_index < vec_len (bm->interfaces)
+	  ? bm->interfaces[sw_if_index].bd_index
+	  : ~0);
+}
+
+/* Adds interface to bridge domain with given id which is created if
+   needed.  Bridge domain id ~0 returns interface to L3. */
+clib_error_t *
+ethernet_bridge_set_interface (vnet_main_t * vnm, u32 sw_if_index, u32 bd_id);
+
 clib_error_t *
 ethernet_register_interface (vnet_main_t * vm,
 			     u32 dev_class_index,
@@ -179,6 +323,7 @@ ethernet_register_input_type (vlib_main_t * vm,
 void
 ip4_add_del_ethernet_neighbor (ethernet_arp_ip4_over_ethernet_address_t * a,
 			       u32 sw_if_index,
+			       u32 is_static,
 			       u32 is_del);
 
 /* Formats ethernet address X:X:X:X:X:X */
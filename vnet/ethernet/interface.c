@@ -46,6 +46,8 @@ ethernet_rewrite_for_sw_interface (vnet_main_t * vm,
 
   if (sub_sw != sup_sw)
     n_bytes += sizeof (ethernet_vlan_header_t);
+  if (sub_sw->sub.id & VNET_SUB_INTERFACE_ID_2)
+    n_bytes += sizeof (ethernet_vlan_header_t);
 
   if (n_bytes > max_rewrite_bytes)
     return 0;
@@ -72,10 +74,20 @@ ethernet_rewrite_for_sw_interface (vnet_main_t * vm,
   if (sub_sw != sup_sw)
     {
       ethernet_vlan_header_t * vh = (void *) (h + 1);
+      u32 id = sub_sw->sub.id;
 
       h->type = clib_host_to_net_u16 (ETHERNET_TYPE_VLAN);
-      ASSERT (sub_sw->sub.id < 4096);
-      vh->priority_cfi_and_id = clib_host_to_net_u16 (sub_sw->sub.id);
+      ASSERT (id < 4096 || (id & VNET_SUB_INTERFACE_ID_2));
+      vh->priority_cfi_and_id = clib_host_to_net_u16 (vnet_sub_interface_id_outer (id));
+
+      /* QinQ: inner tag follows outer. */
+      if (id & VNET_SUB_INTERFACE_ID_2)
+	{
+	  vh->type = clib_host_to_net_u16 (ETHERNET_TYPE_VLAN);
+	  vh += 1;
+	  vh->priority_cfi_and_id = clib_host_to_net_u16 (vnet_sub_interface_id_inner (id));
+	}
+
       vh->type = clib_host_to_net_u16 (type);
     }
   else
@@ -26,12 +26,14 @@
 #include <vlib/vlib.h>
 #include <vnet/pg/pg.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vnet/ip/ip.h>
 #include <clib/sparse_vec.h>
 
 #define foreach_ethernet_input_next		\
   _ (PUNT, "error-punt")			\
   _ (DROP, "error-drop")			\
-  _ (LLC, "llc-input")
+  _ (LLC, "llc-input")				\
+  _ (BRIDGE, "ethernet-bridge")
 
 typedef enum {
 #define _(s,n) ETHERNET_INPUT_NEXT_##s,
@@ -63,17 +65,177 @@ typedef enum {
   ETHERNET_INPUT_VARIANT_VLAN,
 } ethernet_input_variant_t;
 
+/* Frames on interfaces in a bridge domain are switched by ethernet-bridge
+   instead of being sent to L3.  Tagged frames are bridged by the
+   sub-interface their tags map to; frames with unknown tags are dropped. */
+always_inline uword
+ethernet_input_is_bridged (ethernet_bridge_main_t * bm,
+			   vlib_buffer_t * b,
+			   ethernet_input_variant_t variant)
+{
+  return (variant != ETHERNET_INPUT_VARIANT_ETHERNET_TYPE
+	  && ethernet_bridge_domain_for_sw_interface (bm, vnet_buffer (b)->sw_if_index[VLIB_RX]) != ~0);
+}
+
+/* Maps 1 or 2 VLAN tags at current data to a sub-interface of receiving
+   interface and skips them.  Single tags index receiving interface's
+   direct table; 2 tags are looked up in QinQ table first.  Returns ~0
+   when no sub-interface matches. */
+always_inline u32
+ethernet_input_map_vlan (ethernet_main_t * em, vlib_buffer_t * b, u32 * type)
+{
+  ethernet_vlan_header_t * h = vlib_buffer_get_current (b);
+  ethernet_vlan_mapping_t * m;
+  ethernet_qinq_entry_t * qinq_table = em->qinq_table;
+  u32 sw_if_index, outer, inner, sub_sw_if_index;
+
+  sw_if_index = vnet_buffer (b)->sw_if_index[VLIB_RX];
+  outer = clib_net_to_host_u16 (h[0].priority_cfi_and_id) & 0xfff;
+
+  if (PREDICT_FALSE (vec_len (qinq_table) > 0)
+      && h[0].type == clib_host_to_net_u16 (ETHERNET_TYPE_VLAN))
+    {
+      inner = clib_net_to_host_u16 (h[1].priority_cfi_and_id) & 0xfff;
+      sub_sw_if_index = ethernet_qinq_lookup (qinq_table, sw_if_index, outer, inner);
+      if (sub_sw_if_index != ~0)
+	{
+	  *type = h[1].type;
+	  vlib_buffer_advance (b, 2 * sizeof (h[0]));
+	  return sub_sw_if_index;
+	}
+    }
+
+  m = vec_elt_at_index (em->vlan_mapping_by_sw_if_index, sw_if_index);
+  sub_sw_if_index = (outer < vec_len (m->vlan_to_sw_if_index)
+		     ? m->vlan_to_sw_if_index[outer]
+		     : ~0);
+
+  *type = h[0].type;
+  vlib_buffer_advance (b, sizeof (h[0]));
+  return sub_sw_if_index;
+}
+
+typedef struct {
+  /* RX counters of sub-interfaces are summed while consecutive frames
+     map to the same sub-interface. */
+  u32 sw_if_index, n_packets, n_bytes;
+
+  u32 cpu;
+} ethernet_input_stats_t;
+
+always_inline void
+ethernet_input_stats_flush (ethernet_input_stats_t * s)
+{
+  vnet_main_t * vnm = &vnet_main;
+
+  if (s->n_packets > 0)
+    vnet_increment_combined_counter (vnm->interface_main.combined_sw_if_counters
+				     + VNET_INTERFACE_COUNTER_RX,
+				     s->cpu,
+				     s->sw_if_index,
+				     s->n_packets,
+				     s->n_bytes);
+  s->n_packets = s->n_bytes = 0;
+}
+
+/* Skips ethernet header and any VLAN tags which map to a sub-interface.
+   Sets buffer error and returns next index. */
+static_always_inline u32
+ethernet_input_one (vlib_main_t * vm,
+		    ethernet_main_t * em,
+		    vlib_node_runtime_t * error_node,
+		    vlib_buffer_t * b0,
+		    ethernet_input_variant_t variant,
+		    ethernet_input_stats_t * stats)
+{
+  u32 i0, type0, next0;
+  u8 error0 = ETHERNET_ERROR_NONE;
+
+  if (variant == ETHERNET_INPUT_VARIANT_ETHERNET)
+    {
+      ethernet_header_t * e0 = vlib_buffer_get_current (b0);
+
+      vnet_buffer (b0)->ethernet.start_of_ethernet_header = b0->current_data;
+
+      vlib_buffer_advance (b0, sizeof (e0[0]));
+
+      /* Index sparse array with network byte order. */
+      type0 = e0->type;
+    }
+  else if (variant == ETHERNET_INPUT_VARIANT_ETHERNET_TYPE)
+    {
+      u16 * e0 = vlib_buffer_get_current (b0);
+
+      vlib_buffer_advance (b0, sizeof (e0[0]));
+
+      type0 = e0[0];
+    }
+  else
+    type0 = clib_host_to_net_u16 (ETHERNET_TYPE_VLAN);
+
+  /* Tags are mapped here rather than by another pass through
+     ethernet-input-vlan so that tagged frames go straight to L3. */
+  if (variant != ETHERNET_INPUT_VARIANT_ETHERNET_TYPE
+      && type0 == clib_host_to_net_u16 (ETHERNET_TYPE_VLAN))
+    {
+      u32 sw_if_index0, len0;
+
+      sw_if_index0 = ethernet_input_map_vlan (em, b0, &type0);
+
+      if (sw_if_index0 == ~0)
+	error0 = ETHERNET_ERROR_UNKNOWN_VLAN;
+      else
+	{
+	  vnet_buffer (b0)->sw_if_index[VLIB_RX] = sw_if_index0;
+
+	  len0 = vlib_buffer_length_in_chain (vm, b0) + b0->current_data
+	    - vnet_buffer (b0)->ethernet.start_of_ethernet_header;
+
+	  if (PREDICT_FALSE (sw_if_index0 != stats->sw_if_index))
+	    {
+	      ethernet_input_stats_flush (stats);
+	      stats->sw_if_index = sw_if_index0;
+	    }
+	  stats->n_packets += 1;
+	  stats->n_bytes += len0;
+	}
+    }
+
+  i0 = sparse_vec_index (em->input_next_by_type, type0);
+
+  next0 = vec_elt (em->input_next_by_type, i0);
+
+  /* LLC frames have length instead of type. */
+  if (variant != ETHERNET_INPUT_VARIANT_ETHERNET_TYPE
+      && clib_net_to_host_u16 (type0) < 0x600)
+    next0 = ETHERNET_INPUT_NEXT_LLC;
+
+  if (PREDICT_FALSE (ethernet_bridge_main.n_bridged_interfaces > 0)
+      && error0 == ETHERNET_ERROR_NONE
+      && ethernet_input_is_bridged (&ethernet_bridge_main, b0, variant))
+    next0 = ETHERNET_INPUT_NEXT_BRIDGE;
+  else
+    {
+      next0 = error0 != ETHERNET_ERROR_NONE ? ETHERNET_INPUT_NEXT_DROP : next0;
+
+      error0 = i0 == SPARSE_VEC_INVALID_INDEX ? ETHERNET_ERROR_UNKNOWN_TYPE : error0;
+    }
+
+  b0->error = error_node->errors[error0];
+
+  return next0;
+}
+
 static_always_inline uword
 ethernet_input_inline (vlib_main_t * vm,
 		       vlib_node_runtime_t * node,
 		       vlib_frame_t * from_frame,
 		       ethernet_input_variant_t variant)
 {
-  vnet_main_t * vnm = &vnet_main;
   ethernet_main_t * em = &ethernet_main;
   vlib_node_runtime_t * error_node;
   u32 n_left_from, next_index, * from, * to_next;
-  u32 stats_sw_if_index, stats_n_packets, stats_n_bytes;
+  ethernet_input_stats_t stats;
 
   if (variant != ETHERNET_INPUT_VARIANT_ETHERNET)
     error_node = vlib_node_get_runtime (vm, ethernet_input_node.index);
@@ -91,8 +253,9 @@ ethernet_input_inline (vlib_main_t * vm,
 				   sizeof (ethernet_input_trace_t));
 
   next_index = node->cached_next_index;
-  stats_sw_if_index = node->runtime_data[0];
-  stats_n_packets = stats_n_bytes = 0;
+  stats.sw_if_index = node->runtime_data[0];
+  stats.n_packets = stats.n_bytes = 0;
+  stats.cpu = os_get_cpu_number ();
 
   while (n_left_from > 0)
     {
@@ -100,229 +263,91 @@ ethernet_input_inline (vlib_main_t * vm,
 
       vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
 
-      while (n_left_from >= 4 && n_left_to_next >= 2)
+      /* Quad loop: tag and type lookups of 4 frames are independent so
+	 their cache misses overlap. */
+      while (n_left_from >= 8 && n_left_to_next >= 4)
 	{
-	  u32 bi0, bi1;
-	  vlib_buffer_t * b0, * b1;
-	  u32 i0, i1, type0, type1;
-	  u8 next0, next1, error0, error1, enqueue_code;
+	  u32 bi0, bi1, bi2, bi3;
+	  vlib_buffer_t * b0, * b1, * b2, * b3;
+	  u32 next0, next1, next2, next3, wrong_next;
 
 	  /* Prefetch next iteration. */
 	  {
-	    vlib_buffer_t * b2, * b3;
-
-	    b2 = vlib_get_buffer (vm, from[2]);
-	    b3 = vlib_get_buffer (vm, from[3]);
-
-	    vlib_prefetch_buffer_header (b2, LOAD);
-	    vlib_prefetch_buffer_header (b3, LOAD);
-
-	    CLIB_PREFETCH (b2->data, sizeof (ethernet_header_t), LOAD);
-	    CLIB_PREFETCH (b3->data, sizeof (ethernet_header_t), LOAD);
+	    vlib_buffer_t * b4, * b5, * b6, * b7;
+
+	    b4 = vlib_get_buffer (vm, from[4]);
+	    b5 = vlib_get_buffer (vm, from[5]);
+	    b6 = vlib_get_buffer (vm, from[6]);
+	    b7 = vlib_get_buffer (vm, from[7]);
+
+	    vlib_prefetch_buffer_header (b4, LOAD);
+	    vlib_prefetch_buffer_header (b5, LOAD);
+	    vlib_prefetch_buffer_header (b6, LOAD);
+	    vlib_prefetch_buffer_header (b7, LOAD);
+
+	    CLIB_PREFETCH (b4->data, sizeof (ethernet_max_header_t), LOAD);
+	    CLIB_PREFETCH (b5->data, sizeof (ethernet_max_header_t), LOAD);
+	    CLIB_PREFETCH (b6->data, sizeof (ethernet_max_header_t), LOAD);
+	    CLIB_PREFETCH (b7->data, sizeof (ethernet_max_header_t), LOAD);
 	  }
 
-	  bi0 = from[0];
-	  bi1 = from[1];
-	  to_next[0] = bi0;
-	  to_next[1] = bi1;
-	  from += 2;
-	  to_next += 2;
-	  n_left_to_next -= 2;
-	  n_left_from -= 2;
+	  bi0 = to_next[0] = from[0];
+	  bi1 = to_next[1] = from[1];
+	  bi2 = to_next[2] = from[2];
+	  bi3 = to_next[3] = from[3];
+	  from += 4;
+	  to_next += 4;
+	  n_left_to_next -= 4;
+	  n_left_from -= 4;
 
 	  b0 = vlib_get_buffer (vm, bi0);
 	  b1 = vlib_get_buffer (vm, bi1);
+	  b2 = vlib_get_buffer (vm, bi2);
+	  b3 = vlib_get_buffer (vm, bi3);
 
-	  error0 = error1 = ETHERNET_ERROR_NONE;
+	  next0 = ethernet_input_one (vm, em, error_node, b0, variant, &stats);
+	  next1 = ethernet_input_one (vm, em, error_node, b1, variant, &stats);
+	  next2 = ethernet_input_one (vm, em, error_node, b2, variant, &stats);
+	  next3 = ethernet_input_one (vm, em, error_node, b3, variant, &stats);
 
-	  if (variant == ETHERNET_INPUT_VARIANT_ETHERNET)
+	  wrong_next = ((next0 != next_index) | (next1 != next_index)
+			| (next2 != next_index) | (next3 != next_index));
+	  if (PREDICT_FALSE (wrong_next != 0))
 	    {
-	      ethernet_header_t * e0, * e1;
-
-	      e0 = (void *) (b0->data + b0->current_data);
-	      e1 = (void *) (b1->data + b1->current_data);
-
-	      vnet_buffer (b0)->ethernet.start_of_ethernet_header = b0->current_data;
-	      vnet_buffer (b1)->ethernet.start_of_ethernet_header = b1->current_data;
-
-	      vlib_buffer_advance (b0, sizeof (e0[0]));
-	      vlib_buffer_advance (b1, sizeof (e1[0]));
-
-	      /* Index sparse array with network byte order. */
-	      type0 = e0->type;
-	      type1 = e1->type;
-	    }
-	  else if (variant == ETHERNET_INPUT_VARIANT_ETHERNET_TYPE)
-	    {
-	      u16 * e0, * e1;
-
-	      e0 = (void *) (b0->data + b0->current_data);
-	      e1 = (void *) (b1->data + b1->current_data);
-
-	      vlib_buffer_advance (b0, sizeof (e0[0]));
-	      vlib_buffer_advance (b1, sizeof (e1[0]));
-
-	      type0 = e0[0];
-	      type1 = e1[0];
-	    }
-	  else if (variant == ETHERNET_INPUT_VARIANT_VLAN)
-	    {
-	      ethernet_vlan_header_t * h0, * h1;
-	      ethernet_vlan_mapping_t * m0, * m1;
-	      u32 old_sw_if_index0, new_sw_if_index0, len0;
-	      u32 old_sw_if_index1, new_sw_if_index1, len1;
-	      u16 tag0, tag1, id0, id1;
-
-	      h0 = (void *) (b0->data + b0->current_data);
-	      h1 = (void *) (b1->data + b1->current_data);
-
-	      tag0 = clib_net_to_host_u16 (h0->priority_cfi_and_id);
-	      tag1 = clib_net_to_host_u16 (h1->priority_cfi_and_id);
-
-	      id0 = tag0 & 0xfff;
-	      id1 = tag1 & 0xfff;
-
-	      type0 = h0->type;
-	      type1 = h1->type;
-
-	      vlib_buffer_advance (b0, sizeof (h0[0]));
-	      vlib_buffer_advance (b1, sizeof (h1[0]));
-
-	      old_sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
-	      old_sw_if_index1 = vnet_buffer (b1)->sw_if_index[VLIB_RX];
-
-	      m0 = vec_elt_at_index (em->vlan_mapping_by_sw_if_index, old_sw_if_index0);
-	      m1 = vec_elt_at_index (em->vlan_mapping_by_sw_if_index, old_sw_if_index1);
-
-	      new_sw_if_index0 = (id0 < vec_len (m0->vlan_to_sw_if_index) 
-				  ? m0->vlan_to_sw_if_index[id0]
-				  : ~0);
-	      new_sw_if_index1 = (id1 < vec_len (m1->vlan_to_sw_if_index) 
-				  ? m1->vlan_to_sw_if_index[id1]
-				  : ~0);
-
-	      error0 = new_sw_if_index0 != ~0 ? error0 : ETHERNET_ERROR_UNKNOWN_VLAN;
-	      error1 = new_sw_if_index1 != ~0 ? error1 : ETHERNET_ERROR_UNKNOWN_VLAN;
-
-	      len0 = vlib_buffer_length_in_chain (vm, b0) + b0->current_data
-                  - vnet_buffer (b0)->ethernet.start_of_ethernet_header;
-	      len1 = vlib_buffer_length_in_chain (vm, b1) + b1->current_data
-                  - vnet_buffer (b1)->ethernet.start_of_ethernet_header;
-
-	      stats_n_packets += 2;
-	      stats_n_bytes += len0 + len1;
+	      u32 i, bis[4], nexts[4];
 
-	      vnet_buffer (b0)->sw_if_index[VLIB_RX] = error0 != ETHERNET_ERROR_NONE ? old_sw_if_index0 : new_sw_if_index0;
-	      vnet_buffer (b1)->sw_if_index[VLIB_RX] = error1 != ETHERNET_ERROR_NONE ? old_sw_if_index1 : new_sw_if_index1;
+	      bis[0] = bi0; bis[1] = bi1; bis[2] = bi2; bis[3] = bi3;
+	      nexts[0] = next0; nexts[1] = next1; nexts[2] = next2; nexts[3] = next3;
 
-	      if (PREDICT_FALSE (! (new_sw_if_index0 == stats_sw_if_index && new_sw_if_index1 == stats_sw_if_index)))
+	      /* Take back speculatively enqueued buffers and re-enqueue in order. */
+	      to_next -= 4;
+	      n_left_to_next += 4;
+	      for (i = 0; i < ARRAY_LEN (bis); i++)
 		{
-		  stats_n_packets -= 2;
-		  stats_n_bytes -= len0 + len1;
-
-		  if (new_sw_if_index0 != ~0)
-		    vlib_increment_combined_counter (vnm->interface_main.combined_sw_if_counters
-						     + VNET_INTERFACE_COUNTER_RX,
-						     new_sw_if_index0,
-						     1,
-						     len0);
-		  if (new_sw_if_index1 != ~0)
-		    vlib_increment_combined_counter (vnm->interface_main.combined_sw_if_counters
-						     + VNET_INTERFACE_COUNTER_RX,
-						     new_sw_if_index1,
-						     1,
-						     len1);
-
-		  if (new_sw_if_index0 == new_sw_if_index1)
+		  if (nexts[i] == next_index)
 		    {
-		      if (stats_n_packets > 0)
-			{
-			  vlib_increment_combined_counter (vnm->interface_main.combined_sw_if_counters
-							   + VNET_INTERFACE_COUNTER_RX,
-							   stats_sw_if_index,
-							   stats_n_packets,
-							   stats_n_bytes);
-			  stats_n_packets = stats_n_bytes = 0;
-			}
-		      stats_sw_if_index = new_sw_if_index0;
+		      to_next[0] = bis[i];
+		      to_next += 1;
+		      n_left_to_next -= 1;
 		    }
+		  else
+		    vlib_set_next_frame_buffer (vm, node, nexts[i], bis[i]);
 		}
-	    }
-
-	  sparse_vec_index2 (em->input_next_by_type, type0, type1, &i0, &i1);
-
-	  next0 = vec_elt (em->input_next_by_type, i0);
-	  next1 = vec_elt (em->input_next_by_type, i1);
-
-	  next0 = error0 != ETHERNET_ERROR_NONE ? ETHERNET_INPUT_NEXT_DROP : next0;
-	  next1 = error1 != ETHERNET_ERROR_NONE ? ETHERNET_INPUT_NEXT_DROP : next1;
-
-	  error0 = i0 == SPARSE_VEC_INVALID_INDEX ? ETHERNET_ERROR_UNKNOWN_TYPE : error0;
-	  error1 = i1 == SPARSE_VEC_INVALID_INDEX ? ETHERNET_ERROR_UNKNOWN_TYPE : error1;
-
-	  b0->error = error_node->errors[error0];
-	  b1->error = error_node->errors[error1];
-
-	  if (variant == ETHERNET_INPUT_VARIANT_ETHERNET)
-	    {
-	      u32 len0, len1;
-	      u8 is_llc0, is_llc1;
-
-	      len0 = clib_net_to_host_u16 (type0);
-	      len1 = clib_net_to_host_u16 (type1);
-
-	      is_llc0 = len0 < 0x600;
-	      is_llc1 = len1 < 0x600;
-
-	      next0 = is_llc0 ? ETHERNET_INPUT_NEXT_LLC : next0;
-	      next1 = is_llc1 ? ETHERNET_INPUT_NEXT_LLC : next1;
-	    }
-
-	  enqueue_code = (next0 != next_index) + 2*(next1 != next_index);
 
-	  if (PREDICT_FALSE (enqueue_code != 0))
-	    {
-	      switch (enqueue_code)
+	      /* All 4 went somewhere else: switch cached next frame. */
+	      if (next0 == next1 && next0 == next2 && next0 == next3)
 		{
-		case 1:
-		  /* A B A */
-		  to_next[-2] = bi1;
-		  to_next -= 1;
-		  n_left_to_next += 1;
-		  vlib_set_next_frame_buffer (vm, node, next0, bi0);
-		  break;
-
-		case 2:
-		  /* A A B */
-		  to_next -= 1;
-		  n_left_to_next += 1;
-		  vlib_set_next_frame_buffer (vm, node, next1, bi1);
-		  break;
-
-		case 3:
-		  /* A B B or A B C */
-		  to_next -= 2;
-		  n_left_to_next += 2;
-		  vlib_set_next_frame_buffer (vm, node, next0, bi0);
-		  vlib_set_next_frame_buffer (vm, node, next1, bi1);
-
-		  if (i0 == i1)
-		    {
-		      vlib_put_next_frame (vm, node, next_index,
-					   n_left_to_next);
-		      next_index = next1;
-		      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
-		    }
+		  vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+		  next_index = next0;
+		  vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
 		}
 	    }
 	}
     
       while (n_left_from > 0 && n_left_to_next > 0)
 	{
-	  u32 bi0;
+	  u32 bi0, next0;
 	  vlib_buffer_t * b0;
-	  u32 i0, next0, type0;
-	  u8 error0;
 
 	  bi0 = from[0];
 	  to_next[0] = bi0;
@@ -333,111 +358,7 @@ ethernet_input_inline (vlib_main_t * vm,
 
 	  b0 = vlib_get_buffer (vm, bi0);
 
-	  error0 = ETHERNET_ERROR_NONE;
-
-	  if (variant == ETHERNET_INPUT_VARIANT_ETHERNET)
-	    {
-	      ethernet_header_t * e0;
-
-	      e0 = (void *) (b0->data + b0->current_data);
-
-	      vnet_buffer (b0)->ethernet.start_of_ethernet_header = b0->current_data;
-
-	      vlib_buffer_advance (b0, sizeof (e0[0]));
-
-	      /* Index sparse array with network byte order. */
-	      type0 = e0->type;
-	    }
-	  else if (variant == ETHERNET_INPUT_VARIANT_ETHERNET_TYPE)
-	    {
-	      u16 * e0;
-
-	      e0 = (void *) (b0->data + b0->current_data);
-
-	      vlib_buffer_advance (b0, sizeof (e0[0]));
-
-	      type0 = e0[0];
-	    }
-	  else if (variant == ETHERNET_INPUT_VARIANT_VLAN)
-	    {
-	      ethernet_vlan_header_t * h0;
-	      ethernet_vlan_mapping_t * m0;
-	      u32 old_sw_if_index0, new_sw_if_index0, len0;
-	      u16 tag0, id0;
-
-	      h0 = (void *) (b0->data + b0->current_data);
-
-	      tag0 = clib_net_to_host_u16 (h0->priority_cfi_and_id);
-
-	      id0 = tag0 & 0xfff;
-
-	      type0 = h0->type;
-
-	      vlib_buffer_advance (b0, sizeof (h0[0]));
-
-	      old_sw_if_index0 = vnet_buffer (b0)->sw_if_index[VLIB_RX];
-
-	      m0 = vec_elt_at_index (em->vlan_mapping_by_sw_if_index, old_sw_if_index0);
-
-	      new_sw_if_index0 = (id0 < vec_len (m0->vlan_to_sw_if_index) 
-				  ? m0->vlan_to_sw_if_index[id0]
-				  : ~0);
-
-	      error0 = new_sw_if_index0 != ~0 ? error0 : ETHERNET_ERROR_UNKNOWN_VLAN;
-
-	      len0 = vlib_buffer_length_in_chain (vm, b0) + b0->current_data
-                  - vnet_buffer (b0)->ethernet.start_of_ethernet_header;
-
-	      stats_n_packets += 1;
-	      stats_n_bytes += len0;
-
-	      vnet_buffer (b0)->sw_if_index[VLIB_RX] = error0 != ETHERNET_ERROR_NONE ? old_sw_if_index0 : new_sw_if_index0;
-
-	      if (PREDICT_FALSE (new_sw_if_index0 != stats_sw_if_index))
-		{
-		  stats_n_packets -= 1;
-		  stats_n_bytes -= len0;
-
-		  if (new_sw_if_index0 != ~0)
-		    vlib_increment_combined_counter (vnm->interface_main.combined_sw_if_counters
-						     + VNET_INTERFACE_COUNTER_RX,
-						     new_sw_if_index0,
-						     1,
-						     len0);
-		  if (stats_n_packets > 0)
-		    {
-		      vlib_increment_combined_counter (vnm->interface_main.combined_sw_if_counters
-						       + VNET_INTERFACE_COUNTER_RX,
-						       stats_sw_if_index,
-						       stats_n_packets,
-						       stats_n_bytes);
-		      stats_n_packets = stats_n_bytes = 0;
-		    }
-		  stats_sw_if_index = new_sw_if_index0;
-		}
-	    }
-
-	  i0 = sparse_vec_index (em->input_next_by_type, type0);
-
-	  next0 = vec_elt (em->input_next_by_type, i0);
-
-	  next0 = error0 != ETHERNET_ERROR_NONE ? ETHERNET_INPUT_NEXT_DROP : next0;
-
-	  error0 = i0 == SPARSE_VEC_INVALID_INDEX ? ETHERNET_ERROR_UNKNOWN_TYPE : error0;
-
-	  b0->error = error_node->errors[error0];
-	  
-	  if (variant == ETHERNET_INPUT_VARIANT_ETHERNET)
-	    {
-	      u32 len0;
-	      u8 is_llc0;
-
-	      len0 = clib_net_to_host_u16 (type0);
-
-	      is_llc0 = len0 < 0x600;
-
-	      next0 = is_llc0 ? ETHERNET_INPUT_NEXT_LLC : next0;
-	    }
+	  next0 = ethernet_input_one (vm, em, error_node, b0, variant, &stats);
 
 	  /* Sent packet to wrong next? */
 	  if (PREDICT_FALSE (next0 != next_index))
@@ -457,16 +378,8 @@ ethernet_input_inline (vlib_main_t * vm,
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
     }
 
-  if (variant == ETHERNET_INPUT_VARIANT_VLAN)
-    {
-      if (stats_n_packets > 0)
-	vlib_increment_combined_counter (vnm->interface_main.combined_sw_if_counters
-					 + VNET_INTERFACE_COUNTER_RX,
-					 stats_sw_if_index,
-					 stats_n_packets,
-					 stats_n_bytes);
-      node->runtime_data[0] = stats_sw_if_index;
-    }
+  ethernet_input_stats_flush (&stats);
+  node->runtime_data[0] = stats.sw_if_index;
 
   return from_frame->n_vectors;
 }
@@ -490,6 +403,80 @@ ethernet_input_vlan (vlib_main_t * vm,
 		     vlib_frame_t * from_frame)
 { return ethernet_input_inline (vm, node, from_frame, ETHERNET_INPUT_VARIANT_VLAN); }
 
+/* Sets entry in place: key is written last so that ethernet-input never
+   matches a key before its sw_if_index is valid. */
+static void
+ethernet_qinq_table_set (ethernet_qinq_entry_t * table, u64 key, u32 sw_if_index)
+{
+  ethernet_qinq_entry_t * e;
+  u32 mask = vec_len (table) - 1, i;
+
+  for (i = ethernet_qinq_hash (key) & mask; ; i = (i + 1) & mask)
+    {
+      e = table + i;
+      if (e->key == key || e->key == ETHERNET_QINQ_KEY_EMPTY)
+	break;
+    }
+
+  e->sw_if_index = sw_if_index;
+  CLIB_MEMORY_BARRIER ();
+  e->key = key;
+}
+
+/* Open addressed entries cannot be removed in place: table is rebuilt
+   and old one is freed after ethernet-input can no longer be using it,
+   i.e. once every worker has passed ip-lookup-quiescent. */
+static void
+ethernet_qinq_table_rebuild (ethernet_main_t * em)
+{
+  ethernet_qinq_entry_t * old = em->qinq_table, * new = 0, * e;
+  uword n = hash_elts (em->qinq_sw_if_index_by_key);
+  hash_pair_t * p;
+
+  if (n > 0)
+    {
+      vec_validate_aligned (new, max_pow2 (2 * n) - 1, CLIB_CACHE_LINE_BYTES);
+      vec_foreach (e, new)
+	{
+	  e->key = ETHERNET_QINQ_KEY_EMPTY;
+	  e->sw_if_index = ~0;
+	}
+      hash_foreach_pair (p, em->qinq_sw_if_index_by_key, ({
+	ethernet_qinq_table_set (new, p->key, p->value[0]);
+      }));
+    }
+
+  CLIB_MEMORY_BARRIER ();
+  em->qinq_table = new;
+  ip_lookup_defer_vec_free (old);
+}
+
+static void
+ethernet_qinq_sub_interface_up_down (ethernet_main_t * em,
+				     vnet_sw_interface_t * si,
+				     uword is_up)
+{
+  u64 key = ethernet_qinq_key (si->sup_sw_if_index,
+			       vnet_sub_interface_id_outer (si->sub.id),
+			       vnet_sub_interface_id_inner (si->sub.id));
+
+  if (is_up)
+    {
+      hash_set (em->qinq_sw_if_index_by_key, key, si->sw_if_index);
+
+      /* Keep table at most half full. */
+      if (2 * hash_elts (em->qinq_sw_if_index_by_key) > vec_len (em->qinq_table))
+	ethernet_qinq_table_rebuild (em);
+      else
+	ethernet_qinq_table_set (em->qinq_table, key, si->sw_if_index);
+    }
+  else if (hash_get (em->qinq_sw_if_index_by_key, key))
+    {
+      hash_unset (em->qinq_sw_if_index_by_key, key);
+      ethernet_qinq_table_rebuild (em);
+    }
+}
+
 static clib_error_t *
 ethernet_sw_interface_up_down (vnet_main_t * vm,
 			       u32 sw_if_index,
@@ -499,6 +486,7 @@ ethernet_sw_interface_up_down (vnet_main_t * vm,
   vnet_sw_interface_t * si;
   ethernet_vlan_mapping_t * m;
   clib_error_t * error = 0;
+  uword is_up = (flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP) != 0;
 
   si = vnet_get_sw_interface (vm, sw_if_index);
   if (si->type != VNET_SW_INTERFACE_TYPE_SUB)
@@ -508,11 +496,13 @@ ethernet_sw_interface_up_down (vnet_main_t * vm,
 			si->sup_sw_if_index);
 
   /* Sub-interface may not be ethernet. */
-  if (! m)
+  if (vec_len (m->vlan_to_sw_if_index) == 0)
     goto done;
 
-  m->vlan_to_sw_if_index[si->sub.id] =
-    ((flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP) ? sw_if_index : ~0);
+  if (si->sub.id & VNET_SUB_INTERFACE_ID_2)
+    ethernet_qinq_sub_interface_up_down (em, si, is_up);
+  else if (si->sub.id < vec_len (m->vlan_to_sw_if_index))
+    m->vlan_to_sw_if_index[si->sub.id] = is_up ? sw_if_index : ~0;
 
  done:
   return error;
@@ -529,6 +519,10 @@ ethernet_sw_interface_add_del (vnet_main_t * vm,
   vnet_hw_interface_t * hi;
   vnet_sw_interface_t * sup_si;
 
+  /* Deleted sub-interfaces must no longer be mapped by ethernet-input. */
+  if (! is_create)
+    return ethernet_sw_interface_up_down (vm, sw_if_index, /* flags */ 0);
+
   vec_validate (em->vlan_mapping_by_sw_if_index, sw_if_index);
   sup_si = vnet_get_sup_sw_interface (vm, sw_if_index);
 
@@ -0,0 +1,308 @@
+/*
+ * gso.c: split TCP super segments at interface output
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/gso.h>
+#include <vnet/ip/ip.h>
+
+vnet_gso_main_t vnet_gso_main;
+
+/* Moves data of buffer beyond its first n_keep bytes to new buffer
+   chained after it.  Returns 0 if out of buffers. */
+static uword
+gso_buffer_split (vlib_main_t * vm, vlib_buffer_t * b, u32 n_keep)
+{
+  vlib_buffer_t * n;
+  u32 bi, n_move;
+
+  n_move = b->current_length - n_keep;
+  if (n_move > VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES
+      || ! vlib_buffer_alloc_from_free_list (vm, &bi, 1, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX))
+    return 0;
+
+  n = vlib_get_buffer (vm, bi);
+  n->current_data = 0;
+  n->current_length = n_move;
+  n->flags = b->flags & VLIB_BUFFER_NEXT_PRESENT;
+  n->next_buffer = b->next_buffer;
+  memcpy (vlib_buffer_get_current (n), vlib_buffer_get_current (b) + n_keep, n_move);
+
+  b->current_length = n_keep;
+  b->flags |= VLIB_BUFFER_NEXT_PRESENT;
+  b->next_buffer = bi;
+
+  return 1;
+}
+
+/* Checksum of segment data starting offset bytes into given buffer. */
+static u16
+gso_data_checksum (vlib_main_t * vm, vlib_buffer_t * b, u32 offset, u32 n_bytes)
+{
+  ip_csum_t sum = 0;
+  u32 n, n_done = 0;
+
+  while (1)
+    {
+      n = clib_min (n_bytes - n_done, b->current_length - offset);
+      sum = ip_csum_add_block
+	(sum, ip_csum_fold (ip_incremental_checksum (0, vlib_buffer_get_current (b) + offset, n)),
+	 n_done);
+      n_done += n;
+      if (n_done >= n_bytes || ! (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+	break;
+      b = vlib_get_buffer (vm, b->next_buffer);
+      offset = 0;
+    }
+
+  return ip_csum_fold (sum);
+}
+
+/* Splits super segment into segments appended to worker's buffers.
+   Data buffers are relinked behind a copy of the headers; data is only
+   copied when a segment ends inside a buffer.  Headers are fixed with
+   incremental checksum updates. */
+static void
+gso_segment (vlib_main_t * vm, vnet_gso_worker_t * w, u32 bi0)
+{
+  vlib_buffer_t * b0, * b, * last;
+  vnet_gso_segment_t * s;
+  tcp_header_t * tcp0;
+  void * l3;
+  ip_csum_t data_sum, tcp_sum;
+  u32 * heads, n_header_bytes, n_l3_bytes, n_data_bytes, segment_size, seq, offset, n_segments;
+  u32 n_alloc;
+  u8 is_ip6, flags, last_flags;
+  i32 i;
+
+  b0 = vlib_get_buffer (vm, bi0);
+  b0->flags &= ~VNET_BUFFER_GSO;
+  segment_size = vnet_buffer (b0)->ip.gso.segment_size;
+  ASSERT (segment_size > 0);
+
+  l3 = b0->data + vnet_buffer (b0)->ip.gso.l3_header_offset;
+  is_ip6 = (((u8 *) l3)[0] >> 4) == 6;
+  tcp0 = is_ip6 ? ip6_next_header (l3) : ip4_next_header (l3);
+  n_l3_bytes = (void *) tcp0 - l3;
+  n_header_bytes = ((void *) tcp0 + tcp_header_bytes (tcp0)) - vlib_buffer_get_current (b0);
+  ASSERT (n_header_bytes <= b0->current_length);
+
+  vec_reset_length (w->segments);
+  vec_add2 (w->segments, s, 1);
+  s->head_buffer_index = s->data_buffer_index = bi0;
+  s->n_data_bytes = 0;
+
+  /* Cut chain after every segment size data bytes. */
+  b = b0;
+  offset = n_header_bytes;
+  while (1)
+    {
+      if (s->n_data_bytes + b->current_length - offset > segment_size
+	  && ! gso_buffer_split (vm, b, offset + segment_size - s->n_data_bytes))
+	goto drop;
+
+      s->n_data_bytes += b->current_length - offset;
+      if (! (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+	break;
+
+      last = b;
+      b = vlib_get_buffer (vm, last->next_buffer);
+      offset = 0;
+
+      if (s->n_data_bytes == segment_size && b->current_length > 0)
+	{
+	  last->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+	  vec_add2 (w->segments, s, 1);
+	  s->head_buffer_index = ~0;
+	  s->data_buffer_index = last->next_buffer;
+	  s->n_data_bytes = 0;
+	}
+    }
+
+  n_segments = vec_len (w->segments);
+  if (n_segments == 1)
+    {
+      vec_add1 (w->buffers, bi0);
+      return;
+    }
+
+  /* Headers for all but first segment which keeps super segment's. */
+  vec_add2 (w->buffers, heads, n_segments);
+  heads[0] = bi0;
+  n_alloc = vlib_buffer_alloc_from_free_list (vm, heads + 1, n_segments - 1,
+					      VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
+  if (n_alloc != n_segments - 1)
+    {
+      vlib_buffer_free_no_next (vm, heads + 1, n_alloc);
+      _vec_len (w->buffers) -= n_segments;
+      goto drop;
+    }
+
+  /* Data checksums from TCP when segment boundaries match its own. */
+  data_sum = 0;
+  n_data_bytes = 0;
+  vec_foreach (s, w->segments)
+    {
+      b = vlib_get_buffer (vm, s->data_buffer_index);
+      if ((s == w->segments || (b->flags & VNET_BUFFER_GSO_SEGMENT_START))
+	  && vnet_buffer (b)->ip.gso.n_data_bytes == s->n_data_bytes)
+	s->data_ip_checksum = vnet_buffer (b)->ip.gso.data_ip_checksum;
+      else
+	s->data_ip_checksum = gso_data_checksum (vm, b, s == w->segments ? n_header_bytes : 0,
+						 s->n_data_bytes);
+      b->flags &= ~VNET_BUFFER_GSO_SEGMENT_START;
+
+      data_sum = ip_csum_add_block (data_sum, s->data_ip_checksum, n_data_bytes);
+      n_data_bytes += s->n_data_bytes;
+    }
+
+  /* Remove super segment's data, length and sequence number from its
+     checksum.  FIN and PSH only stay on last segment. */
+  seq = clib_net_to_host_u32 (tcp0->seq_number);
+  last_flags = tcp0->flags;
+  flags = last_flags &~ (TCP_FLAG_FIN | TCP_FLAG_PSH);
+  tcp_sum = tcp0->checksum;
+  tcp_sum = ip_csum_sub_even (tcp_sum, ip_csum_fold (data_sum));
+  tcp_sum = ip_csum_sub_even (tcp_sum, clib_host_to_net_u16 (n_data_bytes));
+  tcp_sum = ip_csum_sub_even (tcp_sum, tcp0->seq_number);
+  tcp_sum = ip_csum_update (tcp_sum, last_flags, flags, tcp_header_t, flags);
+
+  /* Last to first so that super segment's headers are copied before
+     they are changed for first segment. */
+  for (i = n_segments - 1; i >= 0; i--)
+    {
+      vlib_buffer_t * h;
+      tcp_header_t * tcp;
+      ip_csum_t sum;
+      u32 seq_net;
+      void * ip;
+
+      s = vec_elt_at_index (w->segments, i);
+      h = vlib_get_buffer (vm, heads[i]);
+
+      if (i > 0)
+	{
+	  h->current_data = b0->current_data;
+	  h->current_length = n_header_bytes;
+	  /* Segments of traced super segment are traced too. */
+	  h->flags = VLIB_BUFFER_NEXT_PRESENT | (b0->flags & VLIB_BUFFER_IS_TRACED);
+	  h->trace_index = b0->trace_index;
+	  h->next_buffer = s->data_buffer_index;
+	  h->error = b0->error;
+	  memcpy (h->opaque, b0->opaque, sizeof (h->opaque));
+	  memcpy (vlib_buffer_get_current (h), vlib_buffer_get_current (b0), n_header_bytes);
+	}
+
+      ip = vlib_buffer_get_current (h) + (l3 - vlib_buffer_get_current (b0));
+      tcp = ip + n_l3_bytes;
+
+      sum = tcp_sum;
+      if (i == n_segments - 1)
+	sum = ip_csum_update (sum, flags, last_flags, tcp_header_t, flags);
+      tcp->flags = i == n_segments - 1 ? last_flags : flags;
+
+      seq_net = clib_host_to_net_u32 (seq + i * segment_size);
+      tcp->seq_number = seq_net;
+      sum = ip_csum_add_even (sum, seq_net);
+      sum = ip_csum_add_even (sum, clib_host_to_net_u16 (s->n_data_bytes));
+      sum = ip_csum_add_even (sum, s->data_ip_checksum);
+      tcp->checksum = ip_csum_fold (sum);
+
+      if (is_ip6)
+	{
+	  ip6_header_t * ip6 = ip;
+	  ip6->payload_length = clib_host_to_net_u16 (tcp_header_bytes (tcp) + s->n_data_bytes);
+	}
+      else
+	{
+	  ip4_header_t * ip4 = ip;
+	  u16 old_length, new_length;
+
+	  old_length = ip4->length;
+	  new_length = clib_host_to_net_u16 (n_l3_bytes + tcp_header_bytes (tcp) + s->n_data_bytes);
+	  ip4->length = new_length;
+	  sum = ip_csum_update (ip4->checksum, old_length, new_length, ip4_header_t, length);
+	  ip4->checksum = ip_csum_fold (sum);
+	  ASSERT (ip4->checksum == ip4_header_checksum (ip4));
+	}
+    }
+
+  w->n_super_segments += 1;
+  w->n_segments += n_segments;
+  return;
+
+ drop:
+  vec_foreach (s, w->segments)
+    vlib_buffer_free (vm, &s->data_buffer_index, 1);
+  w->n_drops += 1;
+}
+
+u32 *
+vnet_gso_segment_buffers (vlib_main_t * vm, u32 * buffers, uword n_buffers)
+{
+  uword i, cpu = os_get_cpu_number ();
+  vnet_gso_worker_t * w;
+
+  ASSERT (cpu < VNET_MAX_WORKERS);
+  w = &vnet_gso_main.workers[cpu];
+
+  vec_reset_length (w->buffers);
+  for (i = 0; i < n_buffers; i++)
+    {
+      if (vlib_get_buffer (vm, buffers[i])->flags & VNET_BUFFER_GSO)
+	gso_segment (vm, w, buffers[i]);
+      else
+	vec_add1 (w->buffers, buffers[i]);
+    }
+
+  return w->buffers;
+}
+
+static clib_error_t *
+show_gso (vlib_main_t * vm,
+	  unformat_input_t * input,
+	  vlib_cli_command_t * cmd)
+{
+  vnet_gso_main_t * gm = &vnet_gso_main;
+  vnet_gso_worker_t * w;
+  u64 n_super_segments = 0, n_segments = 0, n_drops = 0;
+
+  for (w = gm->workers; w < gm->workers + ARRAY_LEN (gm->workers); w++)
+    {
+      n_super_segments += w->n_super_segments;
+      n_segments += w->n_segments;
+      n_drops += w->n_drops;
+    }
+
+  vlib_cli_output (vm, "%Ld super segments split into %Ld segments, %Ld dropped out of buffers",
+		   n_super_segments, n_segments, n_drops);
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (show_gso_command) = {
+  .path = "show gso",
+  .short_help = "Show TCP super segment splitting statistics",
+  .function = show_gso,
+};
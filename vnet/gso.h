@@ -0,0 +1,83 @@
+/*
+ * gso.h: split TCP super segments at interface output
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef included_vnet_gso_h
+#define included_vnet_gso_h
+
+#include <vlib/vlib.h>
+#include <vnet/handoff.h>
+
+/* TCP hands ip4/ip6 super segments with up to 64k of data and a single
+   header to forwarding.  Interface output splits them into segments of
+   at most segment size data bytes each with a copy of the headers. */
+
+typedef struct {
+  u32 head_buffer_index;
+
+  /* First buffer of segment's data: head buffer itself for first segment. */
+  u32 data_buffer_index;
+
+  u32 n_data_bytes;
+
+  /* Checksum of data (not complemented). */
+  u16 data_ip_checksum;
+} vnet_gso_segment_t;
+
+typedef struct {
+  /* Buffers to transmit with super segments replaced by their segments. */
+  u32 * buffers;
+
+  /* Segments of super segment being split. */
+  vnet_gso_segment_t * segments;
+
+  u64 n_super_segments, n_segments, n_drops;
+} vnet_gso_worker_t;
+
+typedef struct {
+  /* Indexed by cpu number. */
+  vnet_gso_worker_t workers[VNET_MAX_WORKERS];
+} vnet_gso_main_t;
+
+extern vnet_gso_main_t vnet_gso_main;
+
+/* Non-zero if any of given buffers is a super segment. */
+always_inline uword
+vnet_gso_any (vlib_main_t * vm, u32 * buffers, uword n_buffers)
+{
+  u32 flags = 0;
+  uword i;
+
+  for (i = 0; i < n_buffers; i++)
+    flags |= vlib_get_buffer (vm, buffers[i])->flags;
+
+  return (flags & VNET_BUFFER_GSO) != 0;
+}
+
+/* Returns vector of given buffers with super segments replaced by their
+   segments.  Vector belongs to calling worker and is valid until its
+   next call. */
+u32 * vnet_gso_segment_buffers (vlib_main_t * vm, u32 * buffers, uword n_buffers);
+
+#endif /* included_vnet_gso_h */
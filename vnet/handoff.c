@@ -0,0 +1,173 @@
+/*
+ * handoff.c: steer packets between forwarding worker threads
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/handoff.h>
+#include <vnet/ip/ip.h>
+
+vnet_worker_main_t vnet_worker_main;
+
+/* Queues are allocated once before worker threads start so that forwarding
+   never sees them move. */
+static void
+vnet_worker_main_init (vnet_worker_main_t * wm, u32 n_workers)
+{
+  vnet_worker_t * w;
+  vnet_handoff_queue_t * q;
+  uword i;
+
+  vec_validate (wm->workers, n_workers - 1);
+  vec_foreach (w, wm->workers)
+    {
+      vec_validate_aligned (w->queue_by_src_worker, n_workers - 1, CLIB_CACHE_LINE_BYTES);
+      vec_foreach (q, w->queue_by_src_worker)
+	vec_validate_aligned (q->buffers, wm->queue_size - 1, CLIB_CACHE_LINE_BYTES);
+    }
+
+  /* Spread flow hash buckets round robin over workers. */
+  vec_validate (wm->worker_by_flow_hash_bucket, 255);
+  for (i = 0; i < vec_len (wm->worker_by_flow_hash_bucket); i++)
+    wm->worker_by_flow_hash_bucket[i] = i % n_workers;
+}
+
+void vnet_worker_register (vlib_main_t * vm)
+{
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  uword cpu = os_get_cpu_number ();
+
+  if (cpu >= vec_len (wm->workers))
+    clib_error ("cpu %d is not a configured worker (%d workers)",
+		cpu, vec_len (wm->workers));
+
+  wm->workers[cpu].vlib_main = vm;
+
+  /* Handoff was enabled before this worker started. */
+  if (wm->n_handoff_interfaces > 0)
+    vlib_node_set_state (vm, wm->handoff_input_node_index,
+			 VLIB_NODE_STATE_POLLING);
+}
+
+void vnet_worker_set_handoff_input_state (vnet_worker_main_t * wm, uword is_enable)
+{
+  vnet_worker_t * w;
+
+  vec_foreach (w, wm->workers)
+    if (w->vlib_main)
+      vlib_node_set_state (w->vlib_main, wm->handoff_input_node_index,
+			   (is_enable
+			    ? VLIB_NODE_STATE_POLLING
+			    : VLIB_NODE_STATE_DISABLED));
+}
+
+static clib_error_t *
+workers_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  u32 n_workers = 1;
+
+  wm->queue_size = 4 * VLIB_FRAME_SIZE;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "n %d", &n_workers))
+	;
+      else if (unformat (input, "queue-size %d", &wm->queue_size))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_workers < 1 || n_workers > VNET_MAX_WORKERS)
+    return clib_error_return (0, "number of workers must be 1 to %d", VNET_MAX_WORKERS);
+
+  if (! is_pow2 (wm->queue_size) || wm->queue_size < VLIB_FRAME_SIZE)
+    return clib_error_return (0, "queue size must be a power of 2 >= %d", VLIB_FRAME_SIZE);
+
+  vnet_worker_main_init (wm, n_workers);
+
+  /* Every worker reports quiescent points for deferred frees of forwarding
+     state; size their slots before any of them runs. */
+  ip_lookup_epoch_validate_threads (n_workers);
+
+  /* Likewise ARP/ND request limiter state. */
+  ip_neighbor_request_limit_validate_workers (&ip4_main.lookup_main, n_workers);
+  ip_neighbor_request_limit_validate_workers (&ip6_main.lookup_main, n_workers);
+
+  /* Pending neighbor request rings; forwarding path never allocates them. */
+  ip_neighbor_pending_validate_workers (&ip4_main.lookup_main, n_workers);
+  ip_neighbor_pending_validate_workers (&ip6_main.lookup_main, n_workers);
+
+  /* Counters validated by init functions need shards for new workers. */
+  vnet_counters_add_worker_shards ();
+
+  /* Main thread is worker 0. */
+  vnet_worker_register (vm);
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (workers_config, "workers");
+
+static clib_error_t *
+show_workers (vlib_main_t * vm,
+	      unformat_input_t * input,
+	      vlib_cli_command_t * cmd)
+{
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  vnet_worker_t * w;
+  vnet_handoff_queue_t * q;
+  u32 n_queued;
+
+  if (vec_len (wm->workers) == 0)
+    {
+      vlib_cli_output (vm, "Single threaded: no workers configured");
+      return 0;
+    }
+
+  vlib_cli_output (vm, "%=8s%=10s%=16s%=16s%=16s%=16s",
+		   "Worker", "Running", "Sent", "Received", "Full drops", "Queued");
+
+  vec_foreach (w, wm->workers)
+    {
+      n_queued = 0;
+      vec_foreach (q, w->queue_by_src_worker)
+	n_queued += q->tail - q->head;
+
+      vlib_cli_output (vm, "%=8d%=10s%=16Ld%=16Ld%=16Ld%=16d",
+		       w - wm->workers,
+		       w->vlib_main ? "yes" : "no",
+		       w->n_sent, w->n_received, w->n_queue_full_drops,
+		       n_queued);
+    }
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (show_workers_command) = {
+  .path = "show workers",
+  .short_help = "Show forwarding workers and handoff queues",
+  .function = show_workers,
+};
@@ -0,0 +1,162 @@
+/*
+ * handoff.h: steer packets between forwarding worker threads
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef included_vnet_handoff_h
+#define included_vnet_handoff_h
+
+#include <vlib/vlib.h>
+#include <clib/cache.h>
+
+/* Each worker runs its own copy of the node graph on its own input queues.
+   Workers are identified by cpu number (os_get_cpu_number); main thread is
+   worker 0.  Packets are steered to a worker by flow hash so that all
+   packets of a flow are forwarded by the same worker and stay in order.
+
+   vnet does not start worker threads: the "workers" config sizes queues
+   and registers main thread as worker 0, and whatever launches the other
+   threads must call vnet_worker_register on each.  Handoff can only be
+   enabled once every configured worker has registered. */
+#define VNET_MAX_WORKERS 32
+
+/* Single producer/single consumer ring of buffer indices.
+   Producer and consumer indices live on separate cache lines. */
+typedef struct {
+  /* Next slot to dequeue.  Written only by receiving worker. */
+  volatile u32 head;
+
+  u8 pad0[CLIB_CACHE_LINE_BYTES - 1 * sizeof (u32)];
+
+  /* Next slot to enqueue.  Written only by sending worker. */
+  volatile u32 tail;
+
+  u8 pad1[CLIB_CACHE_LINE_BYTES - 1 * sizeof (u32)];
+
+  /* Power of 2 sized vector of buffer indices. */
+  u32 * buffers;
+} vnet_handoff_queue_t;
+
+typedef struct {
+  /* Queues of buffers sent to this worker indexed by sending worker. */
+  vnet_handoff_queue_t * queue_by_src_worker;
+
+  /* Set when worker thread registers itself. */
+  vlib_main_t * vlib_main;
+
+  /* Buffers received from other workers. */
+  u64 n_received;
+
+  /* Buffers sent to other workers and dropped when their queue was full. */
+  u64 n_sent, n_queue_full_drops;
+} vnet_worker_t;
+
+typedef struct {
+  /* Vector of workers indexed by cpu number. */
+  vnet_worker_t * workers;
+
+  /* Number of buffers per handoff queue; power of 2. */
+  u32 queue_size;
+
+  /* Maps top 8 bits of flow hash to worker index (like a NIC RSS
+     indirection table).  Power of 2 sized; at most 256 entries. */
+  u8 * worker_by_flow_hash_bucket;
+
+  /* Interfaces with ip4 handoff enabled.  Handoff input node polls on
+     every registered worker while non-zero. */
+  u32 n_handoff_interfaces;
+  u32 handoff_input_node_index;
+} vnet_worker_main_t;
+
+extern vnet_worker_main_t vnet_worker_main;
+
+always_inline uword
+vnet_n_workers (vnet_worker_main_t * wm)
+{ return clib_max (vec_len (wm->workers), 1); }
+
+/* Uses high bits of flow hash: ECMP adjacency selection uses low bits, so
+   selecting worker by them too would give each worker a subset of paths. */
+always_inline u32
+vnet_worker_for_flow_hash (vnet_worker_main_t * wm, u32 flow_hash)
+{
+  u32 n = vec_len (wm->worker_by_flow_hash_bucket);
+  return n > 0 ? wm->worker_by_flow_hash_bucket[(flow_hash >> 24) & (n - 1)] : 0;
+}
+
+/* vlib main of calling worker; main thread's if workers are not configured. */
+always_inline vlib_main_t *
+vnet_worker_vlib_main (vlib_main_t * main_vm)
+{
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  uword cpu = os_get_cpu_number ();
+
+  if (cpu < vec_len (wm->workers) && wm->workers[cpu].vlib_main)
+    return wm->workers[cpu].vlib_main;
+  return main_vm;
+}
+
+/* Returns number of buffers actually enqueued. */
+always_inline u32
+vnet_handoff_enqueue (vnet_handoff_queue_t * q, u32 * buffers, u32 n_buffers)
+{
+  u32 mask = vec_len (q->buffers) - 1;
+  u32 head = q->head, tail = q->tail, n_free, i;
+
+  n_free = vec_len (q->buffers) - (tail - head);
+  n_buffers = clib_min (n_buffers, n_free);
+
+  for (i = 0; i < n_buffers; i++)
+    q->buffers[(tail + i) & mask] = buffers[i];
+
+  /* Buffer indices must be visible before new tail. */
+  CLIB_MEMORY_BARRIER ();
+  q->tail = tail + n_buffers;
+
+  return n_buffers;
+}
+
+/* Returns number of buffers dequeued. */
+always_inline u32
+vnet_handoff_dequeue (vnet_handoff_queue_t * q, u32 * buffers, u32 n_max)
+{
+  u32 mask = vec_len (q->buffers) - 1;
+  u32 head = q->head, tail = q->tail, n, i;
+
+  n = clib_min (tail - head, n_max);
+  for (i = 0; i < n; i++)
+    buffers[i] = q->buffers[(head + i) & mask];
+
+  /* Slots are free for producer only after we have read them. */
+  CLIB_MEMORY_BARRIER ();
+  q->head = head + n;
+
+  return n;
+}
+
+/* Called by each worker thread before it starts dispatching its node graph. */
+void vnet_worker_register (vlib_main_t * vm);
+
+/* Sets handoff input node polling or disabled on every registered worker. */
+void vnet_worker_set_handoff_input_state (vnet_worker_main_t * wm, uword is_enable);
+
+#endif /* included_vnet_handoff_h */
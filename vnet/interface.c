@@ -430,14 +430,14 @@ vnet_create_sw_interface_no_callbacks (vnet_main_t * vm, vnet_sw_interface_t * t
 
     for (i = 0; i < vec_len (im->sw_if_counters); i++)
       {
-	vlib_validate_counter (&im->sw_if_counters[i], sw_if_index);
-	vlib_zero_simple_counter (&im->sw_if_counters[i], sw_if_index);
+	vnet_validate_simple_counter (&im->sw_if_counters[i], sw_if_index);
+	vnet_zero_simple_counter (&im->sw_if_counters[i], sw_if_index);
       }
 
     for (i = 0; i < vec_len (im->combined_sw_if_counters); i++)
       {
-	vlib_validate_counter (&im->combined_sw_if_counters[i], sw_if_index);
-	vlib_zero_combined_counter (&im->combined_sw_if_counters[i], sw_if_index);
+	vnet_validate_combined_counter (&im->combined_sw_if_counters[i], sw_if_index);
+	vnet_zero_combined_counter (&im->combined_sw_if_counters[i], sw_if_index);
       }
   }
 
@@ -547,6 +547,7 @@ vnet_register_interface (vnet_main_t * vm,
   hw->max_rate_bits_per_sec = 0;
   hw->min_packet_bytes = 0;
   hw->per_packet_overhead_bytes = 0;
+  hw->output_scheduler_index = ~0;
   hw->max_l3_packet_bytes[VLIB_RX] = ~0;
   hw->max_l3_packet_bytes[VLIB_TX] = ~0;
 
@@ -609,6 +610,7 @@ vnet_register_interface (vnet_main_t * vm,
 	static char * e[] = {
 	  "interface is down",
 	  "interface is deleted",
+	  "output scheduler queue full",
 	};
 
 	r.n_errors = ARRAY_LEN (e);
@@ -207,6 +207,10 @@ typedef struct vnet_hw_interface_t {
      = max (length + per_packet_overhead_bytes, min_packet_bytes). */
   u32 per_packet_overhead_bytes;
 
+  /* Output scheduler queueing packets between output and tx nodes
+     (see vnet/sched.h); ~0 when packets go straight to tx. */
+  u32 output_scheduler_index;
+
   /* Receive and transmit layer 3 packet size limits (MRU/MTU). */
   u32 max_l3_packet_bytes[VLIB_N_RX_TX];
 
@@ -227,6 +231,22 @@ typedef struct {
   u32 id;
 } vnet_sub_interface_t;
 
+/* Sub-interfaces identified by 2 ids (e.g. QinQ outer and inner VLAN)
+   have this bit set in their id with inner << 12 | outer below it. */
+#define VNET_SUB_INTERFACE_ID_2 (1 << 24)
+
+always_inline u32
+vnet_sub_interface_id_2 (u32 outer, u32 inner)
+{ return VNET_SUB_INTERFACE_ID_2 | (inner << 12) | outer; }
+
+always_inline u32
+vnet_sub_interface_id_outer (u32 id)
+{ return id & 0xfff; }
+
+always_inline u32
+vnet_sub_interface_id_inner (u32 id)
+{ return (id >> 12) & 0xfff; }
+
 /* Software-interface.  This corresponds to a Ethernet VLAN, ATM vc, a
    tunnel, etc.  Configuration (e.g. IP address) gets attached to
    software interface. */
@@ -296,9 +316,9 @@ typedef struct {
   vnet_sw_interface_t * sw_interfaces;
 
   /* Software interface counters both simple and combined
-     packet and byte counters. */
-  vlib_simple_counter_main_t * sw_if_counters;
-  vlib_combined_counter_main_t * combined_sw_if_counters;
+     packet and byte counters.  Sharded per worker. */
+  vnet_simple_counter_main_t * sw_if_counters;
+  vnet_combined_counter_main_t * combined_sw_if_counters;
 
   vnet_hw_interface_nodes_t * deleted_hw_interface_nodes;
 } vnet_interface_main_t;
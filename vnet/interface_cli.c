@@ -165,13 +165,13 @@ clear_interface_counters (vlib_main_t * vm,
 {
   vnet_main_t * vnm = &vnet_main;
   vnet_interface_main_t * im = &vnm->interface_main;
-  vlib_simple_counter_main_t * sm;
-  vlib_combined_counter_main_t * cm;
+  vnet_simple_counter_main_t * sm;
+  vnet_combined_counter_main_t * cm;
 
   vec_foreach (sm, im->sw_if_counters)
-    vlib_clear_simple_counters (sm);
+    vnet_clear_simple_counters (sm);
   vec_foreach (cm, im->combined_sw_if_counters)
-    vlib_clear_combined_counters (cm);
+    vnet_clear_combined_counters (cm);
 
   return 0;
 }
@@ -191,7 +191,7 @@ create_sub_interfaces (vlib_main_t * vm,
   clib_error_t * error = 0;
   u32 hw_if_index, sw_if_index;
   vnet_hw_interface_t * hi;
-  u32 id, id_min, id_max;
+  u32 id, id_min, id_max, outer, inner;
 
   hw_if_index = ~0;
   if (! unformat_user (input, unformat_vnet_hw_interface, vnm, &hw_if_index))
@@ -201,7 +201,13 @@ create_sub_interfaces (vlib_main_t * vm,
       goto done;
     }
 
-  if (unformat (input, "%d-%d", &id_min, &id_max))
+  if (unformat (input, "%d.%d", &outer, &inner))
+    {
+      if (outer >= (1 << 12) || inner >= (1 << 12))
+	goto id_error;
+      id_min = id_max = vnet_sub_interface_id_2 (outer, inner);
+    }
+  else if (unformat (input, "%d-%d", &id_min, &id_max))
     {
       if (id_min > id_max)
 	goto id_error;
@@ -211,7 +217,7 @@ create_sub_interfaces (vlib_main_t * vm,
   else
     {
     id_error:
-      error = clib_error_return (0, "expected ID or ID MIN-MAX, got `%U'",
+      error = clib_error_return (0, "expected ID, ID MIN-MAX or OUTER.INNER, got `%U'",
 				 format_unformat_error, input);
       goto done;
     }
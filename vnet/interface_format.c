@@ -24,6 +24,7 @@
  */
 
 #include <vnet/vnet.h>
+#include <vnet/sched.h>
 
 u8 * format_vnet_sw_interface_flags (u8 * s, va_list * args)
 {
@@ -82,6 +83,11 @@ u8 * format_vnet_hw_interface (u8 * s, va_list * args)
 	s = format (s, "\n%U%U",
 		    format_white_space, indent + 2,
 		    dev_class->format_device, hi->dev_instance);
+
+      if (hi->output_scheduler_index != ~0)
+	s = format (s, "\n%U%U",
+		    format_white_space, indent + 2,
+		    format_vnet_sched, hi->output_scheduler_index);
     }
 
   return s;
@@ -99,7 +105,13 @@ u8 * format_vnet_sw_interface_name (u8 * s, va_list * args)
 
   s = format (s, "%v", hi_sup->name);
 
-  if (si->type != VNET_SW_INTERFACE_TYPE_HARDWARE)
+  if (si->type == VNET_SW_INTERFACE_TYPE_HARDWARE)
+    ;
+  else if (si->sub.id & VNET_SUB_INTERFACE_ID_2)
+    s = format (s, ".%d.%d",
+		vnet_sub_interface_id_outer (si->sub.id),
+		vnet_sub_interface_id_inner (si->sub.id));
+  else
     s = format (s, ".%d", si->sub.id);
 
   return s;
@@ -133,13 +145,13 @@ u8 * format_vnet_sw_interface (u8 * s, va_list * args)
   n_printed = 0;
 
   {
-    vlib_combined_counter_main_t * cm;
+    vnet_combined_counter_main_t * cm;
     vlib_counter_t v;
     u8 * n = 0;
 
     vec_foreach (cm, im->combined_sw_if_counters)
       {
-	vlib_get_combined_counter (cm, si->sw_if_index, &v);
+	vnet_get_combined_counter (cm, si->sw_if_index, &v);
 
 	/* Only display non-zero counters. */
 	if (v.packets == 0)
@@ -165,12 +177,12 @@ u8 * format_vnet_sw_interface (u8 * s, va_list * args)
   }
 
   {
-    vlib_simple_counter_main_t * cm;
+    vnet_simple_counter_main_t * cm;
     u64 v;
 
     vec_foreach (cm, im->sw_if_counters)
       {
-	v = vlib_get_simple_counter (cm, si->sw_if_index);
+	v = vnet_get_simple_counter (cm, si->sw_if_index);
 
 	/* Only display non-zero counters. */
 	if (v == 0)
@@ -211,12 +223,22 @@ uword unformat_vnet_sw_interface (unformat_input_t * input, va_list * args)
   vnet_main_t * vm = va_arg (*args, vnet_main_t *);
   u32 * result = va_arg (*args, u32 *);
   vnet_hw_interface_t * hi;
-  u32 hw_if_index, id, id_specified;
+  u32 hw_if_index, id, inner, id_specified;
   u8 * if_name = 0;
   uword * p, error = 0;
 
+  /* NAME.OUTER.INNER for sub-interfaces with 2 ids. */
   id = ~0;
-  if (unformat (input, "%_%v.%d%_", &if_name, &id)
+  if (unformat (input, "%_%v.%d.%d%_", &if_name, &id, &inner))
+    id = vnet_sub_interface_id_2 (id, inner);
+  else
+    {
+      vec_free (if_name);
+      id = ~0;
+      unformat (input, "%_%v.%d%_", &if_name, &id);
+    }
+
+  if (id != ~0
       && ((p = hash_get (vm->interface_main.hw_interface_by_name, if_name))))
     {
       hw_if_index = p[0];
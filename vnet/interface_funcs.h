@@ -176,6 +176,7 @@ typedef enum {
 typedef enum {
   VNET_INTERFACE_OUTPUT_ERROR_INTERFACE_DOWN,
   VNET_INTERFACE_OUTPUT_ERROR_INTERFACE_DELETED,
+  VNET_INTERFACE_OUTPUT_ERROR_SCHED_QUEUE_FULL,
 } vnet_interface_output_error_t;
 
 /* Format for interface output traces. */
@@ -24,6 +24,8 @@
  */
 
 #include <vnet/vnet.h>
+#include <vnet/gso.h>
+#include <vnet/sched.h>
 
 typedef struct {
   u32 sw_if_index;
@@ -166,8 +168,9 @@ vnet_interface_output_node (vlib_main_t * vm,
   vnet_main_t * vnm = &vnet_main;
   vnet_interface_output_runtime_t * rt = (void *) node->runtime_data;
   vnet_sw_interface_t * si;
-  u32 n_left_to_tx, * from, * from_end, * to_tx;
-  u32 n_bytes, n_buffers, n_packets;
+  vnet_hw_interface_t * hi;
+  u32 n_left_to_tx, scheduler_index, * from, * from_end, * to_tx;
+  u32 n_bytes, n_buffers, n_packets, * sched_from = 0;
 
   n_buffers = frame->n_vectors;
 
@@ -195,7 +198,35 @@ vnet_interface_output_node (vlib_main_t * vm,
 				    node->node_index,
 				    VNET_INTERFACE_OUTPUT_ERROR_INTERFACE_DOWN);
 
-  from_end = from + n_buffers;
+  /* Split TCP super segments before driver sees them. */
+  if (PREDICT_FALSE (vnet_gso_any (vm, from, n_buffers)))
+    {
+      from = vnet_gso_segment_buffers (vm, from, n_buffers);
+      from_end = from + vec_len (from);
+    }
+  else
+    from_end = from + n_buffers;
+
+  /* Queue by class; transmit what scheduler lets through now. */
+  hi = vnet_get_hw_interface (vnm, rt->hw_if_index);
+  scheduler_index = hi->output_scheduler_index;
+  if (PREDICT_FALSE (scheduler_index != ~0))
+    {
+      u32 * drops;
+
+      from = sched_from = vnet_sched_output (vm, hi, scheduler_index,
+					     from, from_end - from, &drops);
+      from_end = from + vec_len (from);
+
+      if (vec_len (drops) > 0)
+	vlib_error_drop_buffers (vm, node,
+				 drops,
+				 /* buffer stride */ 1,
+				 vec_len (drops),
+				 VNET_INTERFACE_OUTPUT_NEXT_DROP,
+				 node->node_index,
+				 VNET_INTERFACE_OUTPUT_ERROR_SCHED_QUEUE_FULL);
+    }
 
   /* Total byte count of all buffers. */
   n_bytes = 0;
@@ -319,16 +350,21 @@ vnet_interface_output_node (vlib_main_t * vm,
       vlib_put_next_frame (vm, node, VNET_INTERFACE_OUTPUT_NEXT_TX, n_left_to_tx);
     }
 
-  /* Update interface stats. */
-  {
-    vnet_interface_main_t * im = &vnm->interface_main;
-
-    vlib_increment_combined_counter (im->combined_sw_if_counters
-				     + VNET_INTERFACE_COUNTER_TX,
-				     rt->sw_if_index,
-				     n_packets,
-				     n_bytes);
-  }
+  /* Update interface stats.  Scheduler returns packets queued from any
+     sub-interface of hardware interface. */
+  if (PREDICT_FALSE (sched_from != 0))
+    vnet_sched_count_tx (vm, sched_from, vec_len (sched_from));
+  else
+    {
+      vnet_interface_main_t * im = &vnm->interface_main;
+
+      vnet_increment_combined_counter (im->combined_sw_if_counters
+				       + VNET_INTERFACE_COUNTER_TX,
+				       os_get_cpu_number (),
+				       rt->sw_if_index,
+				       n_packets,
+				       n_bytes);
+    }
 
   return n_buffers;
 }
@@ -609,10 +645,11 @@ process_drop_punt (vlib_main_t * vm,
     trace_errors_with_buffers (vm, node, frame);
   
   n_errors_left = frame->n_vectors;
-  cm = vec_elt_at_index (vnm->interface_main.sw_if_counters,
-			 (disposition == VNET_ERROR_DISPOSITION_PUNT
-			  ? VNET_INTERFACE_COUNTER_PUNT
-			  : VNET_INTERFACE_COUNTER_DROP));
+  cm = vnet_simple_counter_shard (vec_elt_at_index (vnm->interface_main.sw_if_counters,
+						   (disposition == VNET_ERROR_DISPOSITION_PUNT
+						    ? VNET_INTERFACE_COUNTER_PUNT
+						    : VNET_INTERFACE_COUNTER_DROP)),
+				  os_get_cpu_number ());
 
   while (n_errors_left >= 2)
     {
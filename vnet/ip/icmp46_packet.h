@@ -177,6 +177,17 @@ typedef CLIB_PACKED (struct {
   u16 checksum;
 }) icmp46_header_t;
 
+/* ICMP4 destination unreachable, fragmentation needed (RFC 1191).
+   Followed by quoted ip4 header and data of offending packet. */
+typedef CLIB_PACKED (struct {
+  icmp46_header_t icmp;
+
+  u16 unused;
+
+  /* MTU of next hop link. */
+  u16 next_hop_mtu;
+}) icmp4_fragmentation_needed_header_t;
+
 /* ip6 neighbor discovery */
 #define foreach_icmp6_neighbor_discovery_option	\
   _ (1, source_link_layer_address)		\
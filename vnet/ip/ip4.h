@@ -29,6 +29,7 @@
 #include <vnet/ip/ip4_mtrie.h>
 #include <vnet/ip/ip4_packet.h>
 #include <vnet/ip/lookup.h>
+#include <vnet/ip/tcp_packet.h>	/* for ip4_compute_flow_hash */
 
 typedef struct ip4_fib_t {
   /* Hash table for each prefix length mapping. */
@@ -37,8 +38,9 @@ typedef struct ip4_fib_t {
   /* Temporary vectors for holding new/old values for hash_set. */
   uword * new_hash_values, * old_hash_values;
 
-  /* Mtrie for fast lookups.  Hash is used to maintain overlapping prefixes. */
-  ip4_fib_mtrie_t mtrie;
+  /* Mtrie for fast lookups.  Hash is used to maintain overlapping prefixes.
+     Pointer so that a rebuilt mtrie is published to lookups with one store. */
+  ip4_fib_mtrie_t * mtrie;
 
   /* Table ID (hash key) for this FIB. */
   u32 table_id;
@@ -80,7 +82,11 @@ typedef struct {
 } ip4_add_del_interface_address_callback_t;
 
 typedef enum {
-  /* First check access list to either permit or deny this
+  /* Steer packet to worker selected by flow hash so that all
+     following features run on that worker. */
+  IP4_RX_FEATURE_HANDOFF,
+
+  /* Check access list to either permit or deny this
      packet based on classification. */
   IP4_RX_FEATURE_CHECK_ACCESS,
 
@@ -125,6 +131,9 @@ typedef struct ip4_main_t {
   /* Seed for Jenkins hash used to compute ip4 flow hash. */
   u32 flow_hash_seed;
 
+  /* Mtrie layout for newly created FIBs (set by startup config). */
+  ip4_fib_mtrie_layout_t mtrie_layout;
+
   struct {
     /* TTL to use for host generated packets. */
     u8 ttl;
@@ -143,10 +152,48 @@ extern ip4_main_t ip4_main;
 extern vlib_node_registration_t ip4_input_node;
 extern vlib_node_registration_t ip4_rewrite_node;
 extern vlib_node_registration_t ip4_arp_node;
+extern vlib_node_registration_t ip4_handoff_node;
+
+/* Next nodes of ip4-rewrite-transit and its siblings (ip4-rewrite-local,
+   ip4-frag).  Adjacency rewrite next indices follow these. */
+typedef enum {
+  IP4_REWRITE_NEXT_DROP,
+  IP4_REWRITE_NEXT_FRAGMENT,
+  IP4_REWRITE_NEXT_ICMP_ERROR,
+  IP4_REWRITE_N_NEXT,
+} ip4_rewrite_next_t;
 
 u32 ip4_fib_lookup_with_table (ip4_main_t * im, u32 fib_index, ip4_address_t * dst,
 			       u32 disable_default_route);
 
+/* Rebuild FIB mtrie from FIB hash tables using given layout. */
+void ip4_fib_rebuild_mtrie (ip4_main_t * im, ip4_fib_t * fib,
+			    ip4_fib_mtrie_layout_t layout);
+
+/* Compute flow hash.  We'll use it to select which adjacency to use for this
+   flow.  And other things. */
+always_inline u32
+ip4_compute_flow_hash (ip4_header_t * ip, u32 flow_hash_seed)
+{
+    tcp_header_t * tcp = (void *) (ip + 1);
+    u32 a, b, c;
+    uword is_tcp_udp = (ip->protocol == IP_PROTOCOL_TCP
+			|| ip->protocol == IP_PROTOCOL_UDP);
+
+    /* Only first fragment has ports; all fragments must hash alike so
+       that they are reassembled by the same worker. */
+    is_tcp_udp &= ! ip4_is_fragment (ip);
+
+    c = ip->dst_address.data_u32;
+    b = ip->src_address.data_u32;
+    a = is_tcp_udp ? tcp->ports.src_and_dst : 0;
+    a ^= ip->protocol ^ flow_hash_seed;
+
+    hash_v3_finalize32 (a, b, c);
+
+    return c;
+}
+
 always_inline u32
 ip4_fib_lookup_buffer (ip4_main_t * im, u32 sw_if_index, ip4_address_t * dst,
 		       vlib_buffer_t * b)
@@ -236,6 +283,9 @@ int ip4_address_compare (ip4_address_t * a1, ip4_address_t * a2);
 #define IP4_ROUTE_FLAG_NO_REDISTRIBUTE (1 << 3)
 /* Not last add/del in group.  Facilities batching requests into packets. */
 #define IP4_ROUTE_FLAG_NOT_LAST_IN_GROUP (1 << 4)
+/* Only update FIB hash tables; caller rebuilds mtrie when done
+   (see ip4_add_del_route_next_hop_bulk). */
+#define IP4_ROUTE_FLAG_DEFER_MTRIE_UPDATE (1 << 5)
 
 typedef struct {
   /* IP4_ROUTE_FLAG_* */
@@ -269,6 +319,24 @@ void ip4_add_del_route_next_hop (ip4_main_t * im,
 				 u32 next_hop_sw_if_index,
 				 u32 next_hop_weight);
 
+typedef struct {
+  /* IP4_ROUTE_FLAG_ADD or IP4_ROUTE_FLAG_DEL. */
+  u32 flags;
+
+  ip4_address_t dst_address;
+  u32 dst_address_length;
+
+  ip4_address_t next_hop;
+  u32 next_hop_sw_if_index;
+  u32 next_hop_weight;
+} ip4_add_del_route_next_hop_args_t;
+
+/* Add/delete many routes: updates FIB hash tables for each route and then
+   rebuilds mtrie of each affected FIB once. */
+void ip4_add_del_route_next_hop_bulk (ip4_main_t * im,
+				      ip4_add_del_route_next_hop_args_t * routes,
+				      u32 n_routes);
+
 void *
 ip4_get_route (ip4_main_t * im,
 	       u32 fib_index_or_table_id,
@@ -304,6 +372,20 @@ void ip4_adjacency_set_interface_route (vnet_main_t * vm,
 clib_error_t *
 ip4_probe_neighbor (vlib_main_t * vm, ip4_address_t * dst, u32 sw_if_index);
 
+typedef struct {
+  ip4_address_t address;
+  u32 sw_if_index;
+
+  /* Cached address to send unicast probe to; broadcast if zero. */
+  u8 ethernet_address[6];
+} ip4_neighbor_probe_t;
+
+/* Send ARP requests for many neighbors; consecutive probes out same
+   interface share a frame.  Returns error for first probe which could not
+   be sent; others are still sent. */
+clib_error_t *
+ip4_probe_neighbors (vlib_main_t * vm, ip4_neighbor_probe_t * probes, u32 n_probes);
+
 uword
 ip4_tcp_register_listener (vlib_main_t * vm,
 			   u16 dst_port,
@@ -40,7 +40,6 @@
   _ (TIME_EXPIRED, "ip4 ttl <= 1")					\
 									\
   /* Errors signalled by ip4-rewrite. */				\
-  _ (MTU_EXCEEDED, "ip4 MTU exceeded and DF set")			\
   _ (DST_LOOKUP_MISS, "ip4 destination lookup miss")			\
   _ (SRC_LOOKUP_MISS, "ip4 source lookup miss")				\
   _ (ADJACENCY_DROP, "ip4 adjacency drop")				\
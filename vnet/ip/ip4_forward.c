@@ -25,6 +25,7 @@
 
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
+#include <vnet/handoff.h>
 #include <vnet/ethernet/ethernet.h>	/* for ethernet_header_t */
 #include <vnet/ethernet/arp_packet.h>	/* for ethernet_arp_header_t */
 #include <vnet/ppp/ppp.h>
@@ -67,11 +68,23 @@ ip4_fib_lookup_with_table (ip4_main_t * im, u32 fib_index,
 static ip4_fib_t *
 create_fib_with_table_id (ip4_main_t * im, u32 table_id)
 {
-  ip4_fib_t * fib;
-  hash_set (im->fib_index_by_table_id, table_id, vec_len (im->fibs));
-  vec_add2 (im->fibs, fib, 1);
+  ip4_fib_t * fib, * old_fibs, * new_fibs;
+
+  /* Lookups index FIB vector without locks: add to a copy, publish it and
+     free old vector after grace period. */
+  old_fibs = im->fibs;
+  new_fibs = vec_dup (old_fibs);
+  vec_add2 (new_fibs, fib, 1);
   fib->table_id = table_id;
-  fib->index = fib - im->fibs;
+  fib->index = fib - new_fibs;
+  fib->mtrie = clib_mem_alloc_aligned (sizeof (fib->mtrie[0]), CLIB_CACHE_LINE_BYTES);
+  ip4_fib_mtrie_init (fib->mtrie, im->mtrie_layout);
+
+  CLIB_MEMORY_BARRIER ();
+  im->fibs = new_fibs;
+  ip_lookup_defer_vec_free (old_fibs);
+
+  hash_set (im->fib_index_by_table_id, table_id, fib->index);
   return fib;
 }
 
@@ -357,9 +370,10 @@ void ip4_add_del_route (ip4_main_t * im, ip4_add_del_route_args_t * a)
 
   old_adj_index = fib->old_hash_values[0];
 
-  ip4_fib_mtrie_add_del_route (fib, a->dst_address, dst_address_length,
-			       is_del ? old_adj_index : adj_index,
-			       is_del);
+  if (! (a->flags & IP4_ROUTE_FLAG_DEFER_MTRIE_UPDATE))
+    ip4_fib_mtrie_add_del_route (fib, a->dst_address, dst_address_length,
+				 is_del ? old_adj_index : adj_index,
+				 is_del);
 
   /* Delete old adjacency index if present and changed. */
   if (! (a->flags & IP4_ROUTE_FLAG_KEEP_OLD_ADJACENCY)
@@ -546,7 +560,9 @@ ip4_add_del_route_next_hop (ip4_main_t * im,
       a.flags = ((is_del && ! new_mp ? IP4_ROUTE_FLAG_DEL : IP4_ROUTE_FLAG_ADD)
 		 | IP4_ROUTE_FLAG_FIB_INDEX
 		 | IP4_ROUTE_FLAG_KEEP_OLD_ADJACENCY
-		 | (flags & (IP4_ROUTE_FLAG_NO_REDISTRIBUTE | IP4_ROUTE_FLAG_NOT_LAST_IN_GROUP)));
+		 | (flags & (IP4_ROUTE_FLAG_NO_REDISTRIBUTE
+			     | IP4_ROUTE_FLAG_NOT_LAST_IN_GROUP
+			     | IP4_ROUTE_FLAG_DEFER_MTRIE_UPDATE)));
       a.dst_address = dst_address[0];
       a.dst_address_length = dst_address_length;
       a.adj_index = new_mp ? new_mp->adj_index : dst_adj_index;
@@ -561,6 +577,51 @@ ip4_add_del_route_next_hop (ip4_main_t * im,
     clib_error_report (error);
 }
 
+void
+ip4_add_del_route_next_hop_bulk (ip4_main_t * im,
+				 ip4_add_del_route_next_hop_args_t * routes,
+				 u32 n_routes)
+{
+  vlib_main_t * vm = &vlib_global_main;
+  ip4_add_del_route_next_hop_args_t * r;
+  uword * fib_bitmap = 0;
+  u32 i, fib_index, flags;
+
+  /* Redistributed routes are applied one at a time by each receiver,
+     so just batch them into as few messages as possible. */
+  if (vm->mc_main)
+    {
+      for (i = 0; i < n_routes; i++)
+	{
+	  r = routes + i;
+	  flags = r->flags | (i + 1 < n_routes ? IP4_ROUTE_FLAG_NOT_LAST_IN_GROUP : 0);
+	  ip4_add_del_route_next_hop (im, flags,
+				      &r->dst_address, r->dst_address_length,
+				      &r->next_hop, r->next_hop_sw_if_index,
+				      r->next_hop_weight);
+	}
+      return;
+    }
+
+  for (i = 0; i < n_routes; i++)
+    {
+      r = routes + i;
+      ip4_add_del_route_next_hop (im, r->flags | IP4_ROUTE_FLAG_DEFER_MTRIE_UPDATE,
+				  &r->dst_address, r->dst_address_length,
+				  &r->next_hop, r->next_hop_sw_if_index,
+				  r->next_hop_weight);
+      fib_index = vec_elt (im->fib_index_by_sw_if_index, r->next_hop_sw_if_index);
+      fib_bitmap = clib_bitmap_ori (fib_bitmap, fib_index);
+    }
+
+  clib_bitmap_foreach (fib_index, fib_bitmap, ({
+    ip4_fib_t * fib = vec_elt_at_index (im->fibs, fib_index);
+    ip4_fib_rebuild_mtrie (im, fib, fib->mtrie->layout);
+  }));
+
+  clib_bitmap_free (fib_bitmap);
+}
+
 void *
 ip4_get_route (ip4_main_t * im,
 	       u32 table_index_or_table_id,
@@ -686,7 +747,7 @@ void ip4_maybe_remap_adjacencies (ip4_main_t * im,
     }
 
   /* Also remap adjacencies in mtrie. */
-  ip4_mtrie_maybe_remap_adjacencies (lm, &fib->mtrie);
+  ip4_mtrie_maybe_remap_adjacencies (lm, fib->mtrie);
 
   /* Reset mapping table. */
   vec_zero (lm->adjacency_remap_table);
@@ -738,7 +799,8 @@ ip4_lookup_inline (vlib_main_t * vm,
 {
   ip4_main_t * im = &ip4_main;
   ip_lookup_main_t * lm = &im->lookup_main;
-  vlib_combined_counter_main_t * cm = &im->lookup_main.adjacency_counters;
+  vlib_combined_counter_main_t * cm
+    = vnet_combined_counter_shard (&im->lookup_main.adjacency_counters, os_get_cpu_number ());
   u32 n_left_from, n_left_to_next, * from, * to_next;
   ip_lookup_next_t next;
 
@@ -751,6 +813,271 @@ ip4_lookup_inline (vlib_main_t * vm,
       vlib_get_next_frame (vm, node, next,
 			   to_next, n_left_to_next);
 
+      /* Quad loop: walk mtries of 4 packets in lock step so that ply cache
+	 misses for different packets overlap. */
+      while (n_left_from >= 8 && n_left_to_next >= 4)
+	{
+	  vlib_buffer_t * p0, * p1, * p2, * p3;
+	  ip4_header_t * ip0, * ip1, * ip2, * ip3;
+	  tcp_header_t * tcp0, * tcp1, * tcp2, * tcp3;
+	  ip_lookup_next_t next0, next1, next2, next3;
+	  ip_adjacency_t * adj0, * adj1, * adj2, * adj3;
+	  ip4_fib_mtrie_t * mtrie0, * mtrie1, * mtrie2, * mtrie3;
+	  ip4_fib_mtrie_leaf_t leaf0, leaf1, leaf2, leaf3;
+	  u32 pi0, fib_index0, adj_index0, is_tcp_udp0;
+	  u32 pi1, fib_index1, adj_index1, is_tcp_udp1;
+	  u32 pi2, fib_index2, adj_index2, is_tcp_udp2;
+	  u32 pi3, fib_index3, adj_index3, is_tcp_udp3;
+	  u32 hash_a0, hash_b0, hash_c0;
+	  u32 hash_a1, hash_b1, hash_c1;
+	  u32 hash_a2, hash_b2, hash_c2;
+	  u32 hash_a3, hash_b3, hash_c3;
+	  u32 wrong_next;
+
+	  /* Prefetch next iteration. */
+	  {
+	    vlib_buffer_t * p4, * p5, * p6, * p7;
+
+	    p4 = vlib_get_buffer (vm, from[4]);
+	    p5 = vlib_get_buffer (vm, from[5]);
+	    p6 = vlib_get_buffer (vm, from[6]);
+	    p7 = vlib_get_buffer (vm, from[7]);
+
+	    vlib_prefetch_buffer_header (p4, LOAD);
+	    vlib_prefetch_buffer_header (p5, LOAD);
+	    vlib_prefetch_buffer_header (p6, LOAD);
+	    vlib_prefetch_buffer_header (p7, LOAD);
+
+	    CLIB_PREFETCH (p4->data, sizeof (ip0[0]), LOAD);
+	    CLIB_PREFETCH (p5->data, sizeof (ip0[0]), LOAD);
+	    CLIB_PREFETCH (p6->data, sizeof (ip0[0]), LOAD);
+	    CLIB_PREFETCH (p7->data, sizeof (ip0[0]), LOAD);
+	  }
+
+	  pi0 = to_next[0] = from[0];
+	  pi1 = to_next[1] = from[1];
+	  pi2 = to_next[2] = from[2];
+	  pi3 = to_next[3] = from[3];
+
+	  p0 = vlib_get_buffer (vm, pi0);
+	  p1 = vlib_get_buffer (vm, pi1);
+	  p2 = vlib_get_buffer (vm, pi2);
+	  p3 = vlib_get_buffer (vm, pi3);
+
+	  ip0 = vlib_buffer_get_current (p0);
+	  ip1 = vlib_buffer_get_current (p1);
+	  ip2 = vlib_buffer_get_current (p2);
+	  ip3 = vlib_buffer_get_current (p3);
+
+	  fib_index0 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p0)->sw_if_index[VLIB_RX]);
+	  fib_index1 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p1)->sw_if_index[VLIB_RX]);
+	  fib_index2 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p2)->sw_if_index[VLIB_RX]);
+	  fib_index3 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p3)->sw_if_index[VLIB_RX]);
+
+	  if (! lookup_for_responses_to_locally_received_packets)
+	    {
+	      mtrie0 = vec_elt_at_index (im->fibs, fib_index0)->mtrie;
+	      mtrie1 = vec_elt_at_index (im->fibs, fib_index1)->mtrie;
+	      mtrie2 = vec_elt_at_index (im->fibs, fib_index2)->mtrie;
+	      mtrie3 = vec_elt_at_index (im->fibs, fib_index3)->mtrie;
+
+	      leaf0 = leaf1 = leaf2 = leaf3 = IP4_FIB_MTRIE_LEAF_ROOT;
+
+	      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip0->dst_address, 0);
+	      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, &ip1->dst_address, 0);
+	      leaf2 = ip4_fib_mtrie_lookup_step (mtrie2, leaf2, &ip2->dst_address, 0);
+	      leaf3 = ip4_fib_mtrie_lookup_step (mtrie3, leaf3, &ip3->dst_address, 0);
+
+	      ip4_fib_mtrie_prefetch_step (mtrie0, leaf0, &ip0->dst_address, 1);
+	      ip4_fib_mtrie_prefetch_step (mtrie1, leaf1, &ip1->dst_address, 1);
+	      ip4_fib_mtrie_prefetch_step (mtrie2, leaf2, &ip2->dst_address, 1);
+	      ip4_fib_mtrie_prefetch_step (mtrie3, leaf3, &ip3->dst_address, 1);
+	    }
+
+	  tcp0 = (void *) (ip0 + 1);
+	  tcp1 = (void *) (ip1 + 1);
+	  tcp2 = (void *) (ip2 + 1);
+	  tcp3 = (void *) (ip3 + 1);
+
+	  is_tcp_udp0 = (ip0->protocol == IP_PROTOCOL_TCP
+			 || ip0->protocol == IP_PROTOCOL_UDP);
+	  is_tcp_udp1 = (ip1->protocol == IP_PROTOCOL_TCP
+			 || ip1->protocol == IP_PROTOCOL_UDP);
+	  is_tcp_udp2 = (ip2->protocol == IP_PROTOCOL_TCP
+			 || ip2->protocol == IP_PROTOCOL_UDP);
+	  is_tcp_udp3 = (ip3->protocol == IP_PROTOCOL_TCP
+			 || ip3->protocol == IP_PROTOCOL_UDP);
+
+	  hash_c0 = ip0->dst_address.data_u32;
+	  hash_c1 = ip1->dst_address.data_u32;
+	  hash_c2 = ip2->dst_address.data_u32;
+	  hash_c3 = ip3->dst_address.data_u32;
+	  hash_b0 = ip0->src_address.data_u32;
+	  hash_b1 = ip1->src_address.data_u32;
+	  hash_b2 = ip2->src_address.data_u32;
+	  hash_b3 = ip3->src_address.data_u32;
+	  hash_a0 = is_tcp_udp0 ? tcp0->ports.src_and_dst : 0;
+	  hash_a1 = is_tcp_udp1 ? tcp1->ports.src_and_dst : 0;
+	  hash_a2 = is_tcp_udp2 ? tcp2->ports.src_and_dst : 0;
+	  hash_a3 = is_tcp_udp3 ? tcp3->ports.src_and_dst : 0;
+	  hash_a0 ^= ip0->protocol ^ im->flow_hash_seed;
+	  hash_a1 ^= ip1->protocol ^ im->flow_hash_seed;
+	  hash_a2 ^= ip2->protocol ^ im->flow_hash_seed;
+	  hash_a3 ^= ip3->protocol ^ im->flow_hash_seed;
+
+	  if (! lookup_for_responses_to_locally_received_packets)
+	    {
+	      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip0->dst_address, 1);
+	      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, &ip1->dst_address, 1);
+	      leaf2 = ip4_fib_mtrie_lookup_step (mtrie2, leaf2, &ip2->dst_address, 1);
+	      leaf3 = ip4_fib_mtrie_lookup_step (mtrie3, leaf3, &ip3->dst_address, 1);
+
+	      ip4_fib_mtrie_prefetch_step (mtrie0, leaf0, &ip0->dst_address, 2);
+	      ip4_fib_mtrie_prefetch_step (mtrie1, leaf1, &ip1->dst_address, 2);
+	      ip4_fib_mtrie_prefetch_step (mtrie2, leaf2, &ip2->dst_address, 2);
+	      ip4_fib_mtrie_prefetch_step (mtrie3, leaf3, &ip3->dst_address, 2);
+	    }
+
+	  hash_v3_finalize32_step1 (hash_a0, hash_b0, hash_c0);
+	  hash_v3_finalize32_step1 (hash_a1, hash_b1, hash_c1);
+	  hash_v3_finalize32_step1 (hash_a2, hash_b2, hash_c2);
+	  hash_v3_finalize32_step1 (hash_a3, hash_b3, hash_c3);
+
+	  if (! lookup_for_responses_to_locally_received_packets)
+	    {
+	      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip0->dst_address, 2);
+	      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, &ip1->dst_address, 2);
+	      leaf2 = ip4_fib_mtrie_lookup_step (mtrie2, leaf2, &ip2->dst_address, 2);
+	      leaf3 = ip4_fib_mtrie_lookup_step (mtrie3, leaf3, &ip3->dst_address, 2);
+
+	      ip4_fib_mtrie_prefetch_step (mtrie0, leaf0, &ip0->dst_address, 3);
+	      ip4_fib_mtrie_prefetch_step (mtrie1, leaf1, &ip1->dst_address, 3);
+	      ip4_fib_mtrie_prefetch_step (mtrie2, leaf2, &ip2->dst_address, 3);
+	      ip4_fib_mtrie_prefetch_step (mtrie3, leaf3, &ip3->dst_address, 3);
+	    }
+
+	  hash_v3_finalize32_step2 (hash_a0, hash_b0, hash_c0);
+	  hash_v3_finalize32_step2 (hash_a1, hash_b1, hash_c1);
+	  hash_v3_finalize32_step2 (hash_a2, hash_b2, hash_c2);
+	  hash_v3_finalize32_step2 (hash_a3, hash_b3, hash_c3);
+
+	  if (! lookup_for_responses_to_locally_received_packets)
+	    {
+	      leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip0->dst_address, 3);
+	      leaf1 = ip4_fib_mtrie_lookup_step (mtrie1, leaf1, &ip1->dst_address, 3);
+	      leaf2 = ip4_fib_mtrie_lookup_step (mtrie2, leaf2, &ip2->dst_address, 3);
+	      leaf3 = ip4_fib_mtrie_lookup_step (mtrie3, leaf3, &ip3->dst_address, 3);
+	    }
+
+	  hash_v3_finalize32_step3 (hash_a0, hash_b0, hash_c0);
+	  hash_v3_finalize32_step3 (hash_a1, hash_b1, hash_c1);
+	  hash_v3_finalize32_step3 (hash_a2, hash_b2, hash_c2);
+	  hash_v3_finalize32_step3 (hash_a3, hash_b3, hash_c3);
+
+	  if (lookup_for_responses_to_locally_received_packets)
+	    {
+	      adj_index0 = vnet_buffer (p0)->ip.adj_index[VLIB_RX];
+	      adj_index1 = vnet_buffer (p1)->ip.adj_index[VLIB_RX];
+	      adj_index2 = vnet_buffer (p2)->ip.adj_index[VLIB_RX];
+	      adj_index3 = vnet_buffer (p3)->ip.adj_index[VLIB_RX];
+	    }
+	  else
+	    {
+	      /* Handle default route. */
+	      leaf0 = (leaf0 == IP4_FIB_MTRIE_LEAF_EMPTY ? mtrie0->default_leaf : leaf0);
+	      leaf1 = (leaf1 == IP4_FIB_MTRIE_LEAF_EMPTY ? mtrie1->default_leaf : leaf1);
+	      leaf2 = (leaf2 == IP4_FIB_MTRIE_LEAF_EMPTY ? mtrie2->default_leaf : leaf2);
+	      leaf3 = (leaf3 == IP4_FIB_MTRIE_LEAF_EMPTY ? mtrie3->default_leaf : leaf3);
+
+	      adj_index0 = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
+	      adj_index1 = ip4_fib_mtrie_leaf_get_adj_index (leaf1);
+	      adj_index2 = ip4_fib_mtrie_leaf_get_adj_index (leaf2);
+	      adj_index3 = ip4_fib_mtrie_leaf_get_adj_index (leaf3);
+	    }
+
+	  adj0 = ip_get_adjacency (lm, adj_index0);
+	  adj1 = ip_get_adjacency (lm, adj_index1);
+	  adj2 = ip_get_adjacency (lm, adj_index2);
+	  adj3 = ip_get_adjacency (lm, adj_index3);
+
+	  next0 = adj0->lookup_next_index;
+	  next1 = adj1->lookup_next_index;
+	  next2 = adj2->lookup_next_index;
+	  next3 = adj3->lookup_next_index;
+
+	  /* Use flow hash to compute multipath adjacency. */
+	  vnet_buffer (p0)->ip.flow_hash = hash_c0;
+	  vnet_buffer (p1)->ip.flow_hash = hash_c1;
+	  vnet_buffer (p2)->ip.flow_hash = hash_c2;
+	  vnet_buffer (p3)->ip.flow_hash = hash_c3;
+
+	  ASSERT (adj0->n_adj > 0);
+	  ASSERT (adj1->n_adj > 0);
+	  ASSERT (adj2->n_adj > 0);
+	  ASSERT (adj3->n_adj > 0);
+	  ASSERT (is_pow2 (adj0->n_adj));
+	  ASSERT (is_pow2 (adj1->n_adj));
+	  ASSERT (is_pow2 (adj2->n_adj));
+	  ASSERT (is_pow2 (adj3->n_adj));
+	  adj_index0 += (hash_c0 & (adj0->n_adj - 1));
+	  adj_index1 += (hash_c1 & (adj1->n_adj - 1));
+	  adj_index2 += (hash_c2 & (adj2->n_adj - 1));
+	  adj_index3 += (hash_c3 & (adj3->n_adj - 1));
+
+	  vnet_buffer (p0)->ip.adj_index[VLIB_TX] = adj_index0;
+	  vnet_buffer (p1)->ip.adj_index[VLIB_TX] = adj_index1;
+	  vnet_buffer (p2)->ip.adj_index[VLIB_TX] = adj_index2;
+	  vnet_buffer (p3)->ip.adj_index[VLIB_TX] = adj_index3;
+
+	  vlib_increment_combined_counter (cm, adj_index0, 1,
+					   vlib_buffer_length_in_chain (vm, p0));
+	  vlib_increment_combined_counter (cm, adj_index1, 1,
+					   vlib_buffer_length_in_chain (vm, p1));
+	  vlib_increment_combined_counter (cm, adj_index2, 1,
+					   vlib_buffer_length_in_chain (vm, p2));
+	  vlib_increment_combined_counter (cm, adj_index3, 1,
+					   vlib_buffer_length_in_chain (vm, p3));
+
+	  from += 4;
+	  to_next += 4;
+	  n_left_to_next -= 4;
+	  n_left_from -= 4;
+
+	  wrong_next = ((next0 != next) | (next1 != next)
+			| (next2 != next) | (next3 != next));
+	  if (PREDICT_FALSE (wrong_next != 0))
+	    {
+	      u32 i, pis[4], nexts[4];
+
+	      pis[0] = pi0; pis[1] = pi1; pis[2] = pi2; pis[3] = pi3;
+	      nexts[0] = next0; nexts[1] = next1; nexts[2] = next2; nexts[3] = next3;
+
+	      /* Take back speculatively enqueued buffers and re-enqueue in order. */
+	      to_next -= 4;
+	      n_left_to_next += 4;
+	      for (i = 0; i < ARRAY_LEN (pis); i++)
+		{
+		  if (nexts[i] == next)
+		    {
+		      to_next[0] = pis[i];
+		      to_next += 1;
+		      n_left_to_next -= 1;
+		    }
+		  else
+		    vlib_set_next_frame_buffer (vm, node, nexts[i], pis[i]);
+		}
+
+	      /* All 4 went somewhere else: switch cached next frame. */
+	      if (next0 == next1 && next0 == next2 && next0 == next3)
+		{
+		  vlib_put_next_frame (vm, node, next, n_left_to_next);
+		  next = next0;
+		  vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+		}
+	    }
+	}
+
+
       while (n_left_from >= 4 && n_left_to_next >= 2)
 	{
 	  vlib_buffer_t * p0, * p1;
@@ -794,8 +1121,8 @@ ip4_lookup_inline (vlib_main_t * vm,
 
 	  if (! lookup_for_responses_to_locally_received_packets)
 	    {
-	      mtrie0 = &vec_elt_at_index (im->fibs, fib_index0)->mtrie;
-	      mtrie1 = &vec_elt_at_index (im->fibs, fib_index1)->mtrie;
+	      mtrie0 = vec_elt_at_index (im->fibs, fib_index0)->mtrie;
+	      mtrie1 = vec_elt_at_index (im->fibs, fib_index1)->mtrie;
 
 	      leaf0 = leaf1 = IP4_FIB_MTRIE_LEAF_ROOT;
 
@@ -862,12 +1189,6 @@ ip4_lookup_inline (vlib_main_t * vm,
 	      adj_index1 = ip4_fib_mtrie_leaf_get_adj_index (leaf1);
 	    }
 
-	  ASSERT (adj_index0 == ip4_fib_lookup_with_table (im, fib_index0,
-							   &ip0->dst_address,
-							   /* no_default_route */ 0));
-	  ASSERT (adj_index1 == ip4_fib_lookup_with_table (im, fib_index1,
-							   &ip1->dst_address,
-							   /* no_default_route */ 0));
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 	  adj1 = ip_get_adjacency (lm, adj_index1);
 
@@ -957,7 +1278,7 @@ ip4_lookup_inline (vlib_main_t * vm,
 	  fib_index0 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p0)->sw_if_index[VLIB_RX]);
 	  if (! lookup_for_responses_to_locally_received_packets)
 	    {
-	      mtrie0 = &vec_elt_at_index (im->fibs, fib_index0)->mtrie;
+	      mtrie0 = vec_elt_at_index (im->fibs, fib_index0)->mtrie;
 
 	      leaf0 = IP4_FIB_MTRIE_LEAF_ROOT;
 
@@ -998,10 +1319,6 @@ ip4_lookup_inline (vlib_main_t * vm,
 	      adj_index0 = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
 	    }
 
-	  ASSERT (adj_index0 == ip4_fib_lookup_with_table (im, fib_index0,
-							   &ip0->dst_address,
-							   /* no_default_route */ 0));
-
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 
 	  next0 = adj0->lookup_next_index;
@@ -1511,6 +1828,7 @@ ip4_sw_interface_add_del (vnet_main_t * vnm,
 	    {
 	      static char * start_nodes[] = { "ip4-input", "ip4-input-no-checksum", };
 	      static char * feature_nodes[] = {
+		[IP4_RX_FEATURE_HANDOFF] = "ip4-handoff",
 		[IP4_RX_FEATURE_SOURCE_CHECK_REACHABLE_VIA_RX] = "ip4-source-check-via-rx",
 		[IP4_RX_FEATURE_SOURCE_CHECK_REACHABLE_VIA_ANY] = "ip4-source-check-via-any",
 		[IP4_RX_FEATURE_LOOKUP] = "ip4-lookup",
@@ -1930,8 +2248,8 @@ ip4_local (vlib_main_t * vm,
 	  u32 pi0, ip_len0, udp_len0, flags0, next0, fib_index0, adj_index0;
 	  u32 pi1, ip_len1, udp_len1, flags1, next1, fib_index1, adj_index1;
 	  i32 len_diff0, len_diff1;
-	  u8 error0, is_udp0, is_tcp_udp0, good_tcp_udp0, proto0;
-	  u8 error1, is_udp1, is_tcp_udp1, good_tcp_udp1, proto1;
+	  u8 error0, is_udp0, is_tcp_udp0, good_tcp_udp0, proto0, is_frag0;
+	  u8 error1, is_udp1, is_tcp_udp1, good_tcp_udp1, proto1, is_frag1;
 	  u8 enqueue_code;
       
 	  pi0 = to_next[0] = from[0];
@@ -1950,8 +2268,8 @@ ip4_local (vlib_main_t * vm,
 	  fib_index0 = vec_elt (im->fib_index_by_sw_if_index, vnet_main.local_interface_sw_if_index);
 	  fib_index1 = vec_elt (im->fib_index_by_sw_if_index, vnet_main.local_interface_sw_if_index);
 
-	  mtrie0 = &vec_elt_at_index (im->fibs, fib_index0)->mtrie;
-	  mtrie1 = &vec_elt_at_index (im->fibs, fib_index1)->mtrie;
+	  mtrie0 = vec_elt_at_index (im->fibs, fib_index0)->mtrie;
+	  mtrie1 = vec_elt_at_index (im->fibs, fib_index1)->mtrie;
 
 	  leaf0 = leaf1 = IP4_FIB_MTRIE_LEAF_ROOT;
 
@@ -1960,10 +2278,14 @@ ip4_local (vlib_main_t * vm,
 
 	  proto0 = ip0->protocol;
 	  proto1 = ip1->protocol;
-	  is_udp0 = proto0 == IP_PROTOCOL_UDP;
-	  is_udp1 = proto1 == IP_PROTOCOL_UDP;
-	  is_tcp_udp0 = is_udp0 || proto0 == IP_PROTOCOL_TCP;
-	  is_tcp_udp1 = is_udp1 || proto1 == IP_PROTOCOL_TCP;
+	  is_frag0 = ip4_is_fragment (ip0);
+	  is_frag1 = ip4_is_fragment (ip1);
+
+	  /* Fragments are checked once reassembled. */
+	  is_udp0 = proto0 == IP_PROTOCOL_UDP && ! is_frag0;
+	  is_udp1 = proto1 == IP_PROTOCOL_UDP && ! is_frag1;
+	  is_tcp_udp0 = is_udp0 || (proto0 == IP_PROTOCOL_TCP && ! is_frag0);
+	  is_tcp_udp1 = is_udp1 || (proto1 == IP_PROTOCOL_TCP && ! is_frag1);
 
 	  flags0 = p0->flags;
 	  flags1 = p1->flags;
@@ -2041,13 +2363,6 @@ ip4_local (vlib_main_t * vm,
 	  vnet_buffer (p0)->ip.adj_index[VLIB_RX] = adj_index0 = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
 	  vnet_buffer (p1)->ip.adj_index[VLIB_RX] = adj_index1 = ip4_fib_mtrie_leaf_get_adj_index (leaf1);
 
-	  ASSERT (adj_index0 == ip4_fib_lookup_with_table (im, fib_index0,
-							   &ip0->src_address,
-							   /* no_default_route */ 0));
-	  ASSERT (adj_index1 == ip4_fib_lookup_with_table (im, fib_index1,
-							   &ip1->src_address,
-							   /* no_default_route */ 0));
-
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 	  adj1 = ip_get_adjacency (lm, adj_index1);
 
@@ -2061,8 +2376,8 @@ ip4_local (vlib_main_t * vm,
 		    ? IP4_ERROR_SRC_LOOKUP_MISS
 		    : error1);
 
-	  next0 = lm->local_next_by_ip_protocol[proto0];
-	  next1 = lm->local_next_by_ip_protocol[proto1];
+	  next0 = is_frag0 ? IP_LOCAL_NEXT_REASSEMBLY : lm->local_next_by_ip_protocol[proto0];
+	  next1 = is_frag1 ? IP_LOCAL_NEXT_REASSEMBLY : lm->local_next_by_ip_protocol[proto1];
 
 	  next0 = error0 != IP4_ERROR_UNKNOWN_PROTOCOL ? IP_LOCAL_NEXT_DROP : next0;
 	  next1 = error1 != IP4_ERROR_UNKNOWN_PROTOCOL ? IP_LOCAL_NEXT_DROP : next1;
@@ -2118,7 +2433,7 @@ ip4_local (vlib_main_t * vm,
 	  ip_adjacency_t * adj0;
 	  u32 pi0, next0, ip_len0, udp_len0, flags0, fib_index0, adj_index0;
 	  i32 len_diff0;
-	  u8 error0, is_udp0, is_tcp_udp0, good_tcp_udp0, proto0;
+	  u8 error0, is_udp0, is_tcp_udp0, good_tcp_udp0, proto0, is_frag0;
       
 	  pi0 = to_next[0] = from[0];
 	  from += 1;
@@ -2132,15 +2447,18 @@ ip4_local (vlib_main_t * vm,
 
 	  fib_index0 = vec_elt (im->fib_index_by_sw_if_index, vnet_main.local_interface_sw_if_index);
 
-	  mtrie0 = &vec_elt_at_index (im->fibs, fib_index0)->mtrie;
+	  mtrie0 = vec_elt_at_index (im->fibs, fib_index0)->mtrie;
 
 	  leaf0 = IP4_FIB_MTRIE_LEAF_ROOT;
 
 	  leaf0 = ip4_fib_mtrie_lookup_step (mtrie0, leaf0, &ip0->src_address, 0);
 
 	  proto0 = ip0->protocol;
-	  is_udp0 = proto0 == IP_PROTOCOL_UDP;
-	  is_tcp_udp0 = is_udp0 || proto0 == IP_PROTOCOL_TCP;
+	  is_frag0 = ip4_is_fragment (ip0);
+
+	  /* Fragments are checked once reassembled. */
+	  is_udp0 = proto0 == IP_PROTOCOL_UDP && ! is_frag0;
+	  is_tcp_udp0 = is_udp0 || (proto0 == IP_PROTOCOL_TCP && ! is_frag0);
 
 	  flags0 = p0->flags;
 
@@ -2191,10 +2509,6 @@ ip4_local (vlib_main_t * vm,
 
 	  vnet_buffer (p0)->ip.adj_index[VLIB_RX] = adj_index0 = ip4_fib_mtrie_leaf_get_adj_index (leaf0);
 
-	  ASSERT (adj_index0 == ip4_fib_lookup_with_table (im, fib_index0,
-							   &ip0->src_address,
-							   /* no_default_route */ 0));
-
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 
 	  /* Must have a route to source otherwise we drop the packet. */
@@ -2203,7 +2517,7 @@ ip4_local (vlib_main_t * vm,
 		    ? IP4_ERROR_SRC_LOOKUP_MISS
 		    : error0);
 
-	  next0 = lm->local_next_by_ip_protocol[proto0];
+	  next0 = is_frag0 ? IP_LOCAL_NEXT_REASSEMBLY : lm->local_next_by_ip_protocol[proto0];
 
 	  next0 = error0 != IP4_ERROR_UNKNOWN_PROTOCOL ? IP_LOCAL_NEXT_DROP : next0;
 
@@ -2242,6 +2556,7 @@ static VLIB_REGISTER_NODE (ip4_local_node) = {
     [IP_LOCAL_NEXT_TCP_LOOKUP] = "ip4-tcp-lookup",
     [IP_LOCAL_NEXT_UDP_LOOKUP] = "ip4-udp-lookup",
     [IP_LOCAL_NEXT_ICMP] = "ip4-icmp-input",
+    [IP_LOCAL_NEXT_REASSEMBLY] = "ip4-reassembly",
   },
 };
 
@@ -2261,8 +2576,10 @@ typedef enum {
 } ip4_arp_next_t;
 
 typedef enum {
-  IP4_ARP_ERROR_DROP,
   IP4_ARP_ERROR_REQUEST_SENT,
+  IP4_ARP_ERROR_DST_RATE_LIMITED,
+  IP4_ARP_ERROR_INTERFACE_RATE_LIMITED,
+  IP4_ARP_ERROR_HELD,
 } ip4_arp_error_t;
 
 static uword
@@ -2275,29 +2592,12 @@ ip4_arp (vlib_main_t * vm,
   ip_lookup_main_t * lm = &im->lookup_main;
   u32 * from, * to_next_drop;
   uword n_left_from, n_left_to_next_drop, next_index;
-  static f64 time_last_seed_change = -1e100;
-  static u32 hash_seeds[3];
-  static uword hash_bitmap[256 / BITS (uword)]; 
   f64 time_now;
 
   if (node->flags & VLIB_NODE_FLAG_TRACE)
     ip4_forward_next_trace (vm, node, frame, VLIB_TX);
 
   time_now = vlib_time_now (vm);
-  if (time_now - time_last_seed_change > 1e-3)
-    {
-      uword i;
-      u32 * r = clib_random_buffer_get_data (&vm->random_buffer,
-					     sizeof (hash_seeds));
-      for (i = 0; i < ARRAY_LEN (hash_seeds); i++)
-	hash_seeds[i] = r[i];
-
-      /* Mark all hash keys as been not-seen before. */
-      for (i = 0; i < ARRAY_LEN (hash_bitmap); i++)
-	hash_bitmap[i] = 0;
-
-      time_last_seed_change = time_now;
-    }
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors;
@@ -2314,8 +2614,8 @@ ip4_arp (vlib_main_t * vm,
 	{
 	  vlib_buffer_t * p0;
 	  ip4_header_t * ip0;
-	  u32 pi0, adj_index0, a0, b0, c0, m0, sw_if_index0, drop0;
-	  uword bm0;
+	  u32 pi0, adj_index0, sw_if_index0, error0;
+	  ip_neighbor_request_limit_result_t limit0;
 	  ip_adjacency_t * adj0;
 
 	  pi0 = from[0];
@@ -2328,70 +2628,66 @@ ip4_arp (vlib_main_t * vm,
 
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 
-	  a0 = hash_seeds[0];
-	  b0 = hash_seeds[1];
-	  c0 = hash_seeds[2];
-
 	  sw_if_index0 = adj0->rewrite_header.sw_if_index;
 	  vnet_buffer (p0)->sw_if_index[VLIB_TX] = sw_if_index0;
 
-	  a0 ^= ip0->dst_address.data_u32;
-	  b0 ^= sw_if_index0;
-
-	  hash_v3_finalize32 (a0, b0, c0);
-
-	  c0 &= BITS (hash_bitmap) - 1;
-	  c0 = c0 / BITS (uword);
-	  m0 = (uword) 1 << (c0 % BITS (uword));
-
-	  bm0 = hash_bitmap[c0];
-	  drop0 = (bm0 & m0) != 0;
-
-	  /* Mark it as seen. */
-	  hash_bitmap[c0] = bm0 | m0;
+	  limit0 = ip_neighbor_request_limit (vm, lm, sw_if_index0, &ip0->dst_address, time_now);
+	  error0 = (limit0 == IP_NEIGHBOR_REQUEST_SEND
+		    ? IP4_ARP_ERROR_REQUEST_SENT
+		    : (limit0 == IP_NEIGHBOR_REQUEST_DST_LIMITED
+		       ? IP4_ARP_ERROR_DST_RATE_LIMITED
+		       : IP4_ARP_ERROR_INTERFACE_RATE_LIMITED));
 
 	  from += 1;
 	  n_left_from -= 1;
-	  to_next_drop[0] = pi0;
-	  to_next_drop += 1;
-	  n_left_to_next_drop -= 1;
 
-	  p0->error = node->errors[drop0 ? IP4_ARP_ERROR_DROP : IP4_ARP_ERROR_REQUEST_SENT];
+	  /* Send ARP request. */
+	  if (limit0 == IP_NEIGHBOR_REQUEST_SEND)
+	    {
+	      u32 bi0;
+	      vlib_buffer_t * b0;
+	      ethernet_arp_header_t * h0;
+	      vnet_hw_interface_t * hw_if0;
 
-	  if (drop0)
-	    continue;
+	      h0 = vlib_packet_template_get_packet (vm, &im->ip4_arp_request_packet_template, &bi0);
 
-	  /* Send ARP request. */
-	  {
-	    u32 bi0;
-	    vlib_buffer_t * b0;
-	    ethernet_arp_header_t * h0;
-	    vnet_hw_interface_t * hw_if0;
+	      /* Add rewrite/encap string for ARP packet. */
+	      vnet_rewrite_one_header (adj0[0], h0, sizeof (ethernet_header_t));
 
-	    h0 = vlib_packet_template_get_packet (vm, &im->ip4_arp_request_packet_template, &bi0);
+	      hw_if0 = vnet_get_sup_hw_interface (vnm, sw_if_index0);
 
-	    /* Add rewrite/encap string for ARP packet. */
-	    vnet_rewrite_one_header (adj0[0], h0, sizeof (ethernet_header_t));
+	      /* Src ethernet address in ARP header. */
+	      memcpy (h0->ip4_over_ethernet[0].ethernet, hw_if0->hw_address,
+		      sizeof (h0->ip4_over_ethernet[0].ethernet));
 
-	    hw_if0 = vnet_get_sup_hw_interface (vnm, sw_if_index0);
+	      ip4_src_address_for_packet (im, p0, &h0->ip4_over_ethernet[0].ip4, sw_if_index0);
 
-	    /* Src ethernet address in ARP header. */
-	    memcpy (h0->ip4_over_ethernet[0].ethernet, hw_if0->hw_address,
-		    sizeof (h0->ip4_over_ethernet[0].ethernet));
+	      /* Copy in destination address we are requesting. */
+	      h0->ip4_over_ethernet[1].ip4.data_u32 = ip0->dst_address.data_u32;
 
-	    ip4_src_address_for_packet (im, p0, &h0->ip4_over_ethernet[0].ip4, sw_if_index0);
+	      vlib_buffer_copy_trace_flag (vm, p0, bi0);
+	      b0 = vlib_get_buffer (vm, bi0);
+	      vnet_buffer (b0)->sw_if_index[VLIB_TX] = sw_if_index0;
 
-	    /* Copy in destination address we are requesting. */
-	    h0->ip4_over_ethernet[1].ip4.data_u32 = ip0->dst_address.data_u32;
+	      vlib_buffer_advance (b0, -adj0->rewrite_header.data_bytes);
 
-	    vlib_buffer_copy_trace_flag (vm, p0, bi0);
-	    b0 = vlib_get_buffer (vm, bi0);
-	    vnet_buffer (b0)->sw_if_index[VLIB_TX] = sw_if_index0;
+	      vlib_set_next_frame_buffer (vm, node, adj0->rewrite_header.next_index, bi0);
+	    }
 
-	    vlib_buffer_advance (b0, -adj0->rewrite_header.data_bytes);
+	  /* Hold packet until neighbor is resolved instead of dropping it. */
+	  if (ip_neighbor_pending_enqueue (vm, lm, sw_if_index0, &ip0->dst_address, pi0,
+					   ip4_lookup_node.index))
+	    {
+	      vlib_error_count (vm, node->node_index, IP4_ARP_ERROR_HELD, 1);
+	      vlib_error_count (vm, node->node_index, error0, 1);
+	      continue;
+	    }
 
-	    vlib_set_next_frame_buffer (vm, node, adj0->rewrite_header.next_index, bi0);
-	  }
+	  to_next_drop[0] = pi0;
+	  to_next_drop += 1;
+	  n_left_to_next_drop -= 1;
+
+	  p0->error = node->errors[error0];
 	}
 
       vlib_put_next_frame (vm, node, IP4_ARP_NEXT_DROP, n_left_to_next_drop);
@@ -2401,8 +2697,10 @@ ip4_arp (vlib_main_t * vm,
 }
 
 static char * ip4_arp_error_strings[] = {
-  [IP4_ARP_ERROR_DROP] = "address overflow drops",
   [IP4_ARP_ERROR_REQUEST_SENT] = "ARP requests sent",
+  [IP4_ARP_ERROR_DST_RATE_LIMITED] = "ARP requests suppressed by destination rate limit",
+  [IP4_ARP_ERROR_INTERFACE_RATE_LIMITED] = "ARP requests suppressed by interface rate limit",
+  [IP4_ARP_ERROR_HELD] = "packets held awaiting ARP reply",
 };
 
 VLIB_REGISTER_NODE (ip4_arp_node) = {
@@ -2424,55 +2722,99 @@ VLIB_REGISTER_NODE (ip4_arp_node) = {
 /* Send an ARP request to see if given destination is reachable on given interface. */
 clib_error_t *
 ip4_probe_neighbor (vlib_main_t * vm, ip4_address_t * dst, u32 sw_if_index)
+{
+  ip4_neighbor_probe_t p;
+
+  memset (&p, 0, sizeof (p));
+  p.address = dst[0];
+  p.sw_if_index = sw_if_index;
+
+  return ip4_probe_neighbors (vm, &p, 1);
+}
+
+clib_error_t *
+ip4_probe_neighbors (vlib_main_t * vm, ip4_neighbor_probe_t * probes, u32 n_probes)
 {
   vnet_main_t * vnm = &vnet_main;
   ip4_main_t * im = &ip4_main;
-  ethernet_arp_header_t * h;
-  ip4_address_t * src;
-  ip_interface_address_t * ia;
-  ip_adjacency_t * adj;
-  vnet_hw_interface_t * hi;
-  vlib_buffer_t * b;
-  u32 bi;
+  clib_error_t * error = 0;
+  vlib_frame_t * f = 0;
+  u32 * to_next = 0, output_node_index = ~0;
+  u32 i;
+
+  for (i = 0; i < n_probes; i++)
+    {
+      ip4_neighbor_probe_t * p = probes + i;
+      ethernet_arp_header_t * h;
+      ip4_address_t * src;
+      ip_interface_address_t * ia;
+      ip_adjacency_t * adj;
+      vnet_hw_interface_t * hi;
+      vlib_buffer_t * b;
+      u32 bi, is_unicast;
 
-  src = ip4_interface_address_matching_destination (im, dst, sw_if_index, &ia);
-  if (! src)
-    return clib_error_return (0, "no matching interface address for destination %U (interface %U)",
-			      format_ip4_address, dst,
-			      format_vnet_sw_if_index_name, vnm, sw_if_index);
+      src = ip4_interface_address_matching_destination (im, &p->address, p->sw_if_index, &ia);
+      if (! src)
+	{
+	  if (! error)
+	    error = clib_error_return (0, "no matching interface address for destination %U (interface %U)",
+				       format_ip4_address, &p->address,
+				       format_vnet_sw_if_index_name, vnm, p->sw_if_index);
+	  continue;
+	}
 
-  adj = ip_get_adjacency (&im->lookup_main, ia->neighbor_probe_adj_index);
+      adj = ip_get_adjacency (&im->lookup_main, ia->neighbor_probe_adj_index);
 
-  h = vlib_packet_template_get_packet (vm, &im->ip4_arp_request_packet_template, &bi);
+      h = vlib_packet_template_get_packet (vm, &im->ip4_arp_request_packet_template, &bi);
 
-  hi = vnet_get_sup_hw_interface (vnm, sw_if_index);
+      hi = vnet_get_sup_hw_interface (vnm, p->sw_if_index);
 
-  memcpy (h->ip4_over_ethernet[0].ethernet, hi->hw_address, sizeof (h->ip4_over_ethernet[0].ethernet));
+      memcpy (h->ip4_over_ethernet[0].ethernet, hi->hw_address, sizeof (h->ip4_over_ethernet[0].ethernet));
 
-  h->ip4_over_ethernet[0].ip4 = src[0];
-  h->ip4_over_ethernet[1].ip4 = dst[0];
+      h->ip4_over_ethernet[0].ip4 = src[0];
+      h->ip4_over_ethernet[1].ip4 = p->address;
 
-  b = vlib_get_buffer (vm, bi);
-  vnet_buffer (b)->sw_if_index[VLIB_RX] = vnet_buffer (b)->sw_if_index[VLIB_TX] = sw_if_index;
+      b = vlib_get_buffer (vm, bi);
+      vnet_buffer (b)->sw_if_index[VLIB_RX] = vnet_buffer (b)->sw_if_index[VLIB_TX] = p->sw_if_index;
 
-  /* Add encapsulation string for software interface (e.g. ethernet header). */
-  vnet_rewrite_one_header (adj[0], h, sizeof (ethernet_header_t));
-  vlib_buffer_advance (b, -adj->rewrite_header.data_bytes);
+      /* Add encapsulation string for software interface (e.g. ethernet header). */
+      vnet_rewrite_one_header (adj[0], h, sizeof (ethernet_header_t));
+      vlib_buffer_advance (b, -adj->rewrite_header.data_bytes);
 
-  {
-    vlib_frame_t * f = vlib_get_frame_to_node (vm, hi->output_node_index);
-    u32 * to_next = vlib_frame_vector_args (f);
-    to_next[0] = bi;
-    f->n_vectors = 1;
-    vlib_put_frame_to_node (vm, hi->output_node_index, f);
-  }
+      /* Re-validate cached address without broadcasting (RFC 1122 2.3.2.1). */
+      is_unicast = (p->ethernet_address[0] | p->ethernet_address[1] | p->ethernet_address[2]
+		    | p->ethernet_address[3] | p->ethernet_address[4] | p->ethernet_address[5]) != 0;
+      if (is_unicast)
+	{
+	  ethernet_header_t * e = vlib_buffer_get_current (b);
+	  memcpy (e->dst_address, p->ethernet_address, sizeof (e->dst_address));
+	  memcpy (h->ip4_over_ethernet[1].ethernet, p->ethernet_address,
+		  sizeof (h->ip4_over_ethernet[1].ethernet));
+	}
 
-  return /* no error */ 0;
-}
+      if (f && (hi->output_node_index != output_node_index
+		|| f->n_vectors == VLIB_FRAME_SIZE))
+	{
+	  vlib_put_frame_to_node (vm, output_node_index, f);
+	  f = 0;
+	}
 
-typedef enum {
-  IP4_REWRITE_NEXT_DROP,
-} ip4_rewrite_next_t;
+      if (! f)
+	{
+	  output_node_index = hi->output_node_index;
+	  f = vlib_get_frame_to_node (vm, output_node_index);
+	  to_next = vlib_frame_vector_args (f);
+	  f->n_vectors = 0;
+	}
+
+      to_next[f->n_vectors++] = bi;
+    }
+
+  if (f)
+    vlib_put_frame_to_node (vm, output_node_index, f);
+
+  return error;
+}
 
 always_inline uword
 ip4_rewrite_inline (vlib_main_t * vm,
@@ -2481,6 +2823,8 @@ ip4_rewrite_inline (vlib_main_t * vm,
 		    int rewrite_for_locally_received_packets)
 {
   ip_lookup_main_t * lm = &ip4_main.lookup_main;
+  vlib_combined_counter_main_t * cm
+    = vnet_combined_counter_shard (&lm->adjacency_counters, os_get_cpu_number ());
   u32 * from = vlib_frame_vector_args (frame);
   u32 n_left_from, n_left_to_next, * to_next, next_index;
   vlib_node_runtime_t * error_node = vlib_node_get_runtime (vm, ip4_input_node.index);
@@ -2498,8 +2842,8 @@ ip4_rewrite_inline (vlib_main_t * vm,
 	  ip_adjacency_t * adj0, * adj1;
 	  vlib_buffer_t * p0, * p1;
 	  ip4_header_t * ip0, * ip1;
-	  u32 pi0, rw_len0, next0, error0, checksum0, adj_index0;
-	  u32 pi1, rw_len1, next1, error1, checksum1, adj_index1;
+	  u32 pi0, rw_len0, next0, error0, checksum0, adj_index0, fragment0;
+	  u32 pi1, rw_len1, next1, error1, checksum1, adj_index1, fragment1;
       
 	  /* Prefetch next iteration. */
 	  {
@@ -2577,22 +2921,21 @@ ip4_rewrite_inline (vlib_main_t * vm,
 	  rw_len0 = adj0[0].rewrite_header.data_bytes;
 	  rw_len1 = adj1[0].rewrite_header.data_bytes;
 
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index0,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len0);
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index1,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len1);
 
-	  /* Check MTU of outgoing interface. */
-	  error0 = (vlib_buffer_length_in_chain (vm, p0) > adj0[0].rewrite_header.max_l3_packet_bytes
-		    ? IP4_ERROR_MTU_EXCEEDED
-		    : error0);
-	  error1 = (vlib_buffer_length_in_chain (vm, p1) > adj1[0].rewrite_header.max_l3_packet_bytes
-		    ? IP4_ERROR_MTU_EXCEEDED
-		    : error1);
+	  /* Check MTU of outgoing interface.  TCP super segments are split
+	     at interface output. */
+	  fragment0 = (vlib_buffer_length_in_chain (vm, p0) > adj0[0].rewrite_header.max_l3_packet_bytes
+		       && ! (p0->flags & VNET_BUFFER_GSO));
+	  fragment1 = (vlib_buffer_length_in_chain (vm, p1) > adj1[0].rewrite_header.max_l3_packet_bytes
+		       && ! (p1->flags & VNET_BUFFER_GSO));
 
 	  p0->current_data -= rw_len0;
 	  p1->current_data -= rw_len1;
@@ -2606,6 +2949,18 @@ ip4_rewrite_inline (vlib_main_t * vm,
 	  next0 = adj0[0].rewrite_header.next_index;
 	  next1 = adj1[0].rewrite_header.next_index;
 
+	  /* ip4-frag finds rewrite and MTU from TX adjacency. */
+	  if (PREDICT_FALSE (fragment0))
+	    {
+	      vnet_buffer (p0)->ip.adj_index[VLIB_TX] = adj_index0;
+	      next0 = IP4_REWRITE_NEXT_FRAGMENT;
+	    }
+	  if (PREDICT_FALSE (fragment1))
+	    {
+	      vnet_buffer (p1)->ip.adj_index[VLIB_TX] = adj_index1;
+	      next1 = IP4_REWRITE_NEXT_FRAGMENT;
+	    }
+
 	  p0->error = error_node->errors[error0];
 	  p1->error = error_node->errors[error1];
 
@@ -2668,22 +3023,26 @@ ip4_rewrite_inline (vlib_main_t * vm,
 	  /* Update packet buffer attributes/set output interface. */
 	  rw_len0 = adj0[0].rewrite_header.data_bytes;
 
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index0,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len0);
 
-	  /* Check MTU of outgoing interface. */
-	  error0 = (vlib_buffer_length_in_chain (vm, p0) > adj0[0].rewrite_header.max_l3_packet_bytes
-		    ? IP4_ERROR_MTU_EXCEEDED
-		    : error0);
-
 	  p0->current_data -= rw_len0;
 	  p0->current_length += rw_len0;
 	  vnet_buffer (p0)->sw_if_index[VLIB_TX] = adj0[0].rewrite_header.sw_if_index;
       
 	  next0 = adj0[0].rewrite_header.next_index;
 
+	  /* Check MTU of outgoing interface. */
+	  if (PREDICT_FALSE (vlib_buffer_length_in_chain (vm, p0) - rw_len0
+			     > adj0[0].rewrite_header.max_l3_packet_bytes
+			     && ! (p0->flags & VNET_BUFFER_GSO)))
+	    {
+	      vnet_buffer (p0)->ip.adj_index[VLIB_TX] = adj_index0;
+	      next0 = IP4_REWRITE_NEXT_FRAGMENT;
+	    }
+
 	  from += 1;
 	  n_left_from -= 1;
 	  to_next += 1;
@@ -2729,9 +3088,11 @@ VLIB_REGISTER_NODE (ip4_rewrite_node) = {
 
   .format_trace = format_ip4_forward_next_trace,
 
-  .n_next_nodes = 1,
+  .n_next_nodes = IP4_REWRITE_N_NEXT,
   .next_nodes = {
     [IP4_REWRITE_NEXT_DROP] = "error-drop",
+    [IP4_REWRITE_NEXT_FRAGMENT] = "ip4-frag",
+    [IP4_REWRITE_NEXT_ICMP_ERROR] = "ip4-lookup",
   },
 };
 
@@ -2744,9 +3105,11 @@ static VLIB_REGISTER_NODE (ip4_rewrite_local_node) = {
 
   .format_trace = format_ip4_forward_next_trace,
 
-  .n_next_nodes = 1,
+  .n_next_nodes = IP4_REWRITE_N_NEXT,
   .next_nodes = {
     [IP4_REWRITE_NEXT_DROP] = "error-drop",
+    [IP4_REWRITE_NEXT_FRAGMENT] = "ip4-frag",
+    [IP4_REWRITE_NEXT_ICMP_ERROR] = "ip4-lookup",
   },
 };
 
@@ -2795,26 +3158,102 @@ static VLIB_CLI_COMMAND (set_interface_ip_table_command) = {
   .short_help = "Add/delete FIB table id for interface",
 };
 
-/* Compute flow hash.  We'll use it to select which adjacency to use for this
-   flow.  And other things. */
-always_inline u32
-ip4_compute_flow_hash (ip4_header_t * ip, u32 flow_hash_seed)
+static void ip4_fib_mtrie_free_deferred (uword opaque0, uword opaque1)
+{
+  ip4_fib_mtrie_t * m = uword_to_pointer (opaque0, ip4_fib_mtrie_t *);
+  ip4_fib_mtrie_free (m);
+  clib_mem_free (m);
+}
+
+void ip4_fib_rebuild_mtrie (ip4_main_t * im, ip4_fib_t * fib,
+			    ip4_fib_mtrie_layout_t layout)
+{
+  ip4_fib_mtrie_t * old, * new;
+
+  /* Build new mtrie off to the side; forwarding uses old one until
+     pointer is swapped.  Old mtrie is freed after all lookup threads
+     have passed a quiescent point. */
+  new = clib_mem_alloc_aligned (sizeof (new[0]), CLIB_CACHE_LINE_BYTES);
+  ip4_fib_mtrie_build (new, fib, layout);
+
+  old = fib->mtrie;
+  CLIB_MEMORY_BARRIER ();
+  fib->mtrie = new;
+  ip_lookup_defer_free (ip4_fib_mtrie_free_deferred, pointer_to_uword (old), 0);
+}
+
+static clib_error_t *
+set_ip4_mtrie_layout (vlib_main_t * vm,
+		      unformat_input_t * input,
+		      vlib_cli_command_t * cmd)
+{
+  ip4_main_t * im = &ip4_main;
+  ip4_fib_mtrie_layout_t layout;
+  u32 table_id = 0;
+  uword * p;
+
+  if (unformat (input, "table %d", &table_id))
+    ;
+
+  if (! unformat (input, "%U", unformat_ip4_fib_mtrie_layout, &layout))
+    return clib_error_return (0, "expected mtrie layout `%U'",
+			      format_unformat_error, input);
+
+  p = hash_get (im->fib_index_by_table_id, table_id);
+  if (! p)
+    return clib_error_return (0, "unknown fib table id %d", table_id);
+
+  ip4_fib_rebuild_mtrie (im, vec_elt_at_index (im->fibs, p[0]), layout);
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (set_ip4_mtrie_layout_command) = {
+  .path = "set ip mtrie-layout",
+  .function = set_ip4_mtrie_layout,
+  .short_help = "Rebuild FIB mtrie: [table <table-id>] 8-8-8-8 | 16-8-8",
+};
+
+static clib_error_t *
+ip4_config (vlib_main_t * vm, unformat_input_t * input)
 {
-    tcp_header_t * tcp = (void *) (ip + 1);
-    u32 a, b, c;
-    uword is_tcp_udp = (ip->protocol == IP_PROTOCOL_TCP
-			|| ip->protocol == IP_PROTOCOL_UDP);
+  ip4_main_t * im = &ip4_main;
+  ip4_fib_t * fib;
+  u32 n_adj;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "mtrie-layout %U",
+		    unformat_ip4_fib_mtrie_layout, &im->mtrie_layout))
+	;
+      else if (unformat (input, "adjacency-heap-size %d", &n_adj))
+	ip_adjacency_heap_reserve (&im->lookup_main, n_adj);
+      else if (unformat (input, "neighbor-hold-packets %d",
+			 &im->lookup_main.neighbor_pending.max_buffers_per_neighbor))
+	;
+      else if (unformat (input, "neighbor-request-limit %U",
+			 unformat_ip_neighbor_request_limit_config,
+			 &im->lookup_main.neighbor_request_limit))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
 
-    c = ip->dst_address.data_u32;
-    b = ip->src_address.data_u32;
-    a = is_tcp_udp ? tcp->ports.src_and_dst : 0;
-    a ^= ip->protocol ^ flow_hash_seed;
+  /* Held packets are re-injected as a single frame. */
+  if (im->lookup_main.neighbor_pending.max_buffers_per_neighbor > VLIB_FRAME_SIZE)
+    return clib_error_return (0, "neighbor-hold-packets must be at most %d", VLIB_FRAME_SIZE);
 
-    hash_v3_finalize32 (a, b, c);
+  /* FIBs created by init functions (e.g. table 0) precede config. */
+  vec_foreach (fib, im->fibs)
+    if (fib->mtrie->layout != im->mtrie_layout)
+      ip4_fib_rebuild_mtrie (im, fib, im->mtrie_layout);
 
-    return c;
+  return 0;
 }
 
+VLIB_CONFIG_FUNCTION (ip4_config, "ip4");
+
 static uword
 ip4_lookup_multicast (vlib_main_t * vm,
 		      vlib_node_runtime_t * node,
@@ -2822,7 +3261,8 @@ ip4_lookup_multicast (vlib_main_t * vm,
 {
   ip4_main_t * im = &ip4_main;
   ip_lookup_main_t * lm = &im->lookup_main;
-  vlib_combined_counter_main_t * cm = &im->lookup_main.adjacency_counters;
+  vlib_combined_counter_main_t * cm
+    = vnet_combined_counter_shard (&im->lookup_main.adjacency_counters, os_get_cpu_number ());
   u32 n_left_from, n_left_to_next, * from, * to_next;
   ip_lookup_next_t next;
 
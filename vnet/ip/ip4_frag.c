@@ -0,0 +1,591 @@
+/*
+ * ip4_frag.c: fragment ip4 packets larger than adjacency MTU
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/handoff.h>
+#include <vnet/ip/ip.h>
+
+/* ip4-rewrite sends packets longer than their adjacency's MTU here after
+   writing their L2 header.  Packets with DF set are turned into ICMP
+   fragmentation needed messages; others are cut into fragments.  Buffers
+   have no reference counts so data buffers are relinked behind a copy of
+   the headers; data is only copied when a fragment ends inside a buffer. */
+
+/* ICMP errors quote as much of offending packet as fits in 576 bytes (RFC 1812). */
+#define IP4_FRAG_ICMP_MAX_BYTES 576
+
+/* Per worker limit of ICMP fragmentation needed messages. */
+#define IP4_FRAG_ICMP_RATE 1000
+#define IP4_FRAG_ICMP_BURST 100
+
+typedef struct {
+  /* Fragments of packet being fragmented. */
+  u32 * buffers;
+
+  ip_token_bucket_t icmp_bucket;
+} ip4_frag_worker_t;
+
+typedef struct {
+  ip4_frag_worker_t workers[VNET_MAX_WORKERS];
+} ip4_frag_main_t;
+
+static ip4_frag_main_t ip4_frag_main;
+
+#define foreach_ip4_frag_error					\
+  _ (FRAGMENTED, "ip4 packets fragmented")			\
+  _ (FRAGMENTS_SENT, "ip4 fragments sent")			\
+  _ (ICMP_SENT, "icmp fragmentation needed sent")		\
+  _ (DONT_FRAGMENT, "ip4 MTU exceeded and DF set")		\
+  _ (ICMP_RATE_LIMITED, "icmp fragmentation needed rate limited")	\
+  _ (MTU_TOO_SMALL, "ip4 MTU too small to fragment")		\
+  _ (NO_BUFFERS, "no buffers to fragment packet")
+
+typedef enum {
+#define _(sym,str) IP4_FRAG_ERROR_##sym,
+  foreach_ip4_frag_error
+#undef _
+  IP4_FRAG_N_ERROR,
+} ip4_frag_error_t;
+
+static char * ip4_frag_error_strings[] = {
+#define _(sym,string) string,
+  foreach_ip4_frag_error
+#undef _
+};
+
+typedef struct {
+  u16 n_bytes;
+
+  u16 mtu;
+
+  /* Zero when packet was turned into ICMP error or dropped. */
+  u16 n_fragments;
+} ip4_frag_trace_t;
+
+static u8 * format_ip4_frag_trace (u8 * s, va_list * va)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*va, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*va, vlib_node_t *);
+  ip4_frag_trace_t * t = va_arg (*va, ip4_frag_trace_t *);
+
+  s = format (s, "length %d, mtu %d: ", t->n_bytes, t->mtu);
+  if (t->n_fragments > 0)
+    s = format (s, "%d fragments", t->n_fragments);
+  else
+    s = format (s, "not fragmented");
+
+  return s;
+}
+
+/* Appends data to chain ending with a buffer from default free list.
+   Returns new last buffer or 0 when out of buffers. */
+static vlib_buffer_t *
+ip4_frag_append (vlib_main_t * vm, vlib_buffer_t * last, u8 * data, u32 n_bytes)
+{
+  while (n_bytes > 0)
+    {
+      i32 n_free = VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES - (last->current_data + last->current_length);
+      u32 n;
+
+      if (n_free <= 0)
+	{
+	  vlib_buffer_t * b;
+	  u32 bi;
+
+	  if (! vlib_buffer_alloc_from_free_list (vm, &bi, 1, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX))
+	    return 0;
+
+	  b = vlib_get_buffer (vm, bi);
+	  b->current_data = 0;
+	  b->current_length = 0;
+	  b->flags = 0;
+
+	  last->next_buffer = bi;
+	  last->flags |= VLIB_BUFFER_NEXT_PRESENT;
+	  last = b;
+	  continue;
+	}
+
+      n = clib_min (n_free, n_bytes);
+      memcpy (vlib_buffer_get_current (last) + last->current_length, data, n);
+      last->current_length += n;
+      data += n;
+      n_bytes -= n;
+    }
+
+  return last;
+}
+
+/* Set length and fragment offset of header copied from original packet. */
+always_inline void
+ip4_frag_fix_header (ip4_header_t * ip, u32 n_data_bytes, u32 offset, uword more_fragments)
+{
+  ip_csum_t sum;
+  u16 old_length, new_length, old_flags, new_flags;
+
+  old_length = ip->length;
+  old_flags = ip->flags_and_fragment_offset;
+
+  new_length = clib_host_to_net_u16 (ip4_header_bytes (ip) + n_data_bytes);
+  new_flags = clib_net_to_host_u16 (old_flags) &~ (IP4_HEADER_FLAG_MORE_FRAGMENTS | 0x1fff);
+  new_flags |= (offset / 8) | (more_fragments ? IP4_HEADER_FLAG_MORE_FRAGMENTS : 0);
+  new_flags = clib_host_to_net_u16 (new_flags);
+
+  sum = ip->checksum;
+  sum = ip_csum_update (sum, old_length, new_length, ip4_header_t, length);
+  sum = ip_csum_update (sum, old_flags, new_flags, ip4_header_t, flags_and_fragment_offset);
+
+  ip->length = new_length;
+  ip->flags_and_fragment_offset = new_flags;
+  ip->checksum = ip_csum_fold (sum);
+
+  ASSERT (ip->checksum == ip4_header_checksum (ip));
+}
+
+/* Writes ip4 header for fragments after the first: only options with
+   copy bit set are kept (RFC 791).  Returns header bytes. */
+static u32
+ip4_frag_later_header (ip4_header_t * dst, ip4_header_t * src)
+{
+  u8 * o = (u8 *) (src + 1);
+  u8 * end = (u8 *) src + ip4_header_bytes (src);
+  u8 * d = (u8 *) (dst + 1);
+  u32 n_bytes;
+
+  dst[0] = src[0];
+
+  /* Option 0 ends list; option 1 is a single byte no-op. */
+  while (o < end && o[0] != 0)
+    {
+      u32 n = 1;
+
+      if (o[0] != 1)
+	{
+	  if (o + 1 >= end || o[1] < 2 || o + o[1] > end)
+	    break;
+	  n = o[1];
+	}
+
+      if (o[0] & 0x80)
+	{
+	  memcpy (d, o, n);
+	  d += n;
+	}
+      o += n;
+    }
+
+  /* Pad with end of list to a multiple of 4 bytes. */
+  while ((d - (u8 *) dst) % sizeof (u32))
+    *d++ = 0;
+
+  n_bytes = d - (u8 *) dst;
+  dst->ip_version_and_header_length = (4 << 4) | (n_bytes / sizeof (u32));
+  dst->checksum = ip4_header_checksum (dst);
+
+  return n_bytes;
+}
+
+/* Cuts packet into fragments appended to worker's buffers.  L2 rewrite
+   and ip4 header are copied to every fragment; fragments after the first
+   carry only options which must be copied. */
+static ip4_frag_error_t
+ip4_frag_packet (vlib_main_t * vm, ip4_frag_worker_t * w, u32 pi,
+		 u32 rw_len, u32 mtu)
+{
+  vlib_buffer_t * p, * h, * last, * straddle;
+  ip4_header_t * ip;
+  u32 n_hdr, n_ip_hdr, n_data, n_frag_data, n_have, offset0, raw_bi;
+  u32 straddle_offset, straddle_end, i, n_frags, n_first, n_later_ip_hdr;
+  uword has_raw, more_fragments0;
+  u32 later_ip[15];
+
+  p = vlib_get_buffer (vm, pi);
+  ip = vlib_buffer_get_current (p) + rw_len;
+  n_ip_hdr = ip4_header_bytes (ip);
+  n_hdr = rw_len + n_ip_hdr;
+
+  /* Fragment data must be a multiple of 8 bytes. */
+  if (mtu < n_ip_hdr + 8)
+    return IP4_FRAG_ERROR_MTU_TOO_SMALL;
+  n_frag_data = (mtu - n_ip_hdr) &~ 7;
+
+  n_data = clib_net_to_host_u16 (ip->length) - n_ip_hdr;
+  n_frags = (n_data + n_frag_data - 1) / n_frag_data;
+  offset0 = ip4_get_fragment_offset_bytes (ip);
+  more_fragments0 = (ip->flags_and_fragment_offset
+		     & clib_host_to_net_u16 (IP4_HEADER_FLAG_MORE_FRAGMENTS)) != 0;
+
+  /* Fragments after first may have a shorter header; data size is
+     kept the same for all fragments. */
+  n_later_ip_hdr = ip4_frag_later_header ((ip4_header_t *) later_ip, ip);
+
+  n_first = vec_len (w->buffers);
+  vec_add1 (w->buffers, pi);
+
+  /* First fragment keeps original headers and first buffer. */
+  last = p;
+  n_have = p->current_length - n_hdr;
+  has_raw = (p->flags & VLIB_BUFFER_NEXT_PRESENT) != 0;
+  raw_bi = p->next_buffer;
+  straddle = 0;
+  straddle_offset = straddle_end = 0;
+
+  for (i = 0; i < n_frags; i++)
+    {
+      u32 n_this = clib_min (n_frag_data, n_data - i * n_frag_data);
+
+      if (i > 0)
+	{
+	  u32 hi;
+
+	  if (! vlib_buffer_alloc_from_free_list (vm, &hi, 1, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX))
+	    goto no_buffers;
+
+	  h = vlib_get_buffer (vm, hi);
+	  h->current_data = p->current_data;
+	  h->current_length = rw_len + n_later_ip_hdr;
+	  h->flags = p->flags & VLIB_BUFFER_IS_TRACED;
+	  h->trace_index = p->trace_index;
+	  h->error = p->error;
+	  memcpy (h->opaque, p->opaque, sizeof (h->opaque));
+	  memcpy (vlib_buffer_get_current (h), vlib_buffer_get_current (p), rw_len);
+	  memcpy (vlib_buffer_get_current (h) + rw_len, later_ip, n_later_ip_hdr);
+	  vec_add1 (w->buffers, hi);
+
+	  ip4_frag_fix_header (vlib_buffer_get_current (h) + rw_len, n_this,
+			       offset0 + i * n_frag_data,
+			       more_fragments0 || i + 1 < n_frags);
+
+	  last = h;
+	  n_have = 0;
+
+	  /* Copy data left in buffer where previous fragment ended. */
+	  if (straddle)
+	    {
+	      u32 n = clib_min (n_this, straddle->current_length - straddle_offset);
+
+	      last = ip4_frag_append (vm, h, vlib_buffer_get_current (straddle) + straddle_offset, n);
+	      if (! last)
+		goto no_buffers;
+
+	      n_have = n;
+	      straddle_offset += n;
+	      if (straddle_offset >= straddle->current_length)
+		{
+		  straddle->current_length = straddle_end;
+		  straddle = 0;
+		}
+	    }
+	}
+
+      /* Relink whole buffers from original chain. */
+      while (n_have < n_this && has_raw)
+	{
+	  vlib_buffer_t * r = vlib_get_buffer (vm, raw_bi);
+
+	  last->next_buffer = raw_bi;
+	  last->flags |= VLIB_BUFFER_NEXT_PRESENT;
+	  last = r;
+	  n_have += r->current_length;
+	  has_raw = (r->flags & VLIB_BUFFER_NEXT_PRESENT) != 0;
+	  raw_bi = r->next_buffer;
+	}
+
+      /* ip4-input checks that ip4 length fits in packet. */
+      ASSERT (n_have >= n_this);
+
+      last->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+
+      /* Fragment ends inside last buffer. */
+      if (n_have > n_this)
+	{
+	  u32 excess = n_have - n_this;
+
+	  ASSERT (excess < last->current_length);
+	  if (i + 1 < n_frags)
+	    {
+	      straddle = last;
+	      straddle_offset = straddle_end = last->current_length - excess;
+	    }
+	  else
+	    /* Trailing L2 padding. */
+	    last->current_length -= excess;
+	}
+    }
+
+  /* Drop trailing L2 padding. */
+  if (straddle)
+    straddle->current_length = straddle_end;
+  if (has_raw)
+    vlib_buffer_free (vm, &raw_bi, 1);
+
+  /* Original header is fixed last since it is copied to all fragments. */
+  ip4_frag_fix_header (ip, clib_min (n_frag_data, n_data), offset0,
+		       more_fragments0 || n_frags > 1);
+
+  return IP4_FRAG_ERROR_FRAGMENTS_SENT;
+
+ no_buffers:
+  /* Every buffer is either in a fragment or still on original chain. */
+  vlib_buffer_free (vm, w->buffers + n_first, vec_len (w->buffers) - n_first);
+  _vec_len (w->buffers) = n_first;
+  if (has_raw)
+    vlib_buffer_free (vm, &raw_bi, 1);
+  return IP4_FRAG_ERROR_NO_BUFFERS;
+}
+
+always_inline uword
+icmp4_type_is_error (u8 type)
+{
+  return (type == ICMP4_destination_unreachable
+	  || type == ICMP4_source_quench
+	  || type == ICMP4_redirect
+	  || type == ICMP4_time_exceeded
+	  || type == ICMP4_parameter_problem);
+}
+
+static ip4_address_t *
+ip4_frag_icmp_source_address (ip4_main_t * im, u32 sw_if_index)
+{
+  ip_lookup_main_t * lm = &im->lookup_main;
+  ip_interface_address_t * ia;
+  u32 ai;
+
+  if (sw_if_index >= vec_len (lm->if_address_pool_index_by_sw_if_index))
+    return 0;
+
+  ai = lm->if_address_pool_index_by_sw_if_index[sw_if_index];
+  if (ai == ~0)
+    return 0;
+
+  ia = pool_elt_at_index (lm->if_address_pool, ai);
+  return ip_interface_address_get_address (lm, ia);
+}
+
+/* Turns packet in place into ICMP fragmentation needed message back to its
+   source which is then forwarded by ip4-lookup. */
+static ip4_frag_error_t
+ip4_frag_icmp_fragmentation_needed (vlib_main_t * vm, ip4_frag_worker_t * w,
+				    vlib_buffer_t * p, u32 rw_len, u32 mtu)
+{
+  ip4_main_t * im = &ip4_main;
+  ip4_header_t * ip0, * ip;
+  icmp4_fragmentation_needed_header_t * icmp;
+  ip4_address_t * src;
+  u32 n_quote, n_hdr;
+
+  /* Strip L2 rewrite. */
+  p->current_data += rw_len;
+  p->current_length -= rw_len;
+  ip0 = vlib_buffer_get_current (p);
+
+  /* Only for first fragments and never in response to ICMP errors (RFC 1812). */
+  if (ip4_get_fragment_offset (ip0) != 0)
+    return IP4_FRAG_ERROR_DONT_FRAGMENT;
+  if (ip0->protocol == IP_PROTOCOL_ICMP)
+    {
+      icmp46_header_t * i0 = ip4_next_header (ip0);
+      if (icmp4_type_is_error (i0->type))
+	return IP4_FRAG_ERROR_DONT_FRAGMENT;
+    }
+
+  src = ip4_frag_icmp_source_address (im, vnet_buffer (p)->sw_if_index[VLIB_RX]);
+  if (! src)
+    src = ip4_frag_icmp_source_address (im, vnet_buffer (p)->sw_if_index[VLIB_TX]);
+  if (! src)
+    return IP4_FRAG_ERROR_DONT_FRAGMENT;
+
+  if (! ip_token_bucket_take (&w->icmp_bucket, vlib_time_now (vm),
+			      IP4_FRAG_ICMP_RATE, IP4_FRAG_ICMP_BURST))
+    return IP4_FRAG_ERROR_ICMP_RATE_LIMITED;
+
+  /* Quote start of packet in first buffer. */
+  n_hdr = sizeof (ip[0]) + sizeof (icmp[0]);
+  n_quote = clib_min (clib_net_to_host_u16 (ip0->length), IP4_FRAG_ICMP_MAX_BYTES - n_hdr);
+  n_quote = clib_min (n_quote, p->current_length);
+  if (p->flags & VLIB_BUFFER_NEXT_PRESENT)
+    {
+      vlib_buffer_free (vm, &p->next_buffer, 1);
+      p->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+    }
+
+  ASSERT (p->current_data - (i32) n_hdr >= -VLIB_BUFFER_PRE_DATA_SIZE);
+  p->current_data -= n_hdr;
+  p->current_length = n_hdr + n_quote;
+
+  ip = vlib_buffer_get_current (p);
+  icmp = (void *) (ip + 1);
+
+  icmp->icmp.type = ICMP4_destination_unreachable;
+  icmp->icmp.code = ICMP4_destination_unreachable_fragmentation_needed_and_dont_fragment_set;
+  icmp->icmp.checksum = 0;
+  icmp->unused = 0;
+  icmp->next_hop_mtu = clib_host_to_net_u16 (mtu);
+  icmp->icmp.checksum = ~ip_csum_fold (ip_incremental_checksum (0, icmp, sizeof (icmp[0]) + n_quote));
+
+  ip->ip_version_and_header_length = IP4_VERSION_AND_HEADER_LENGTH_NO_OPTIONS;
+  ip->tos = im->host_config.tos;
+  ip->length = clib_host_to_net_u16 (p->current_length);
+  ip->fragment_id = * (u16 *) clib_random_buffer_get_data (&vm->random_buffer, sizeof (u16));
+  ip->flags_and_fragment_offset = 0;
+  ip->ttl = im->host_config.ttl;
+  ip->protocol = IP_PROTOCOL_ICMP;
+  ip->dst_address = ip0->src_address;
+  ip->src_address = src[0];
+  ip->checksum = ip4_header_checksum (ip);
+
+  return IP4_FRAG_ERROR_ICMP_SENT;
+}
+
+static uword
+ip4_frag (vlib_main_t * vm,
+	  vlib_node_runtime_t * node,
+	  vlib_frame_t * frame)
+{
+  ip_lookup_main_t * lm = &ip4_main.lookup_main;
+  ip4_frag_worker_t * w;
+  u32 * from, * to_next, n_left_from, n_left_to_next, next_index;
+  u32 n_fragmented = 0, n_fragments = 0, n_icmp_sent = 0;
+  uword cpu = os_get_cpu_number ();
+
+  ASSERT (cpu < VNET_MAX_WORKERS);
+  w = &ip4_frag_main.workers[cpu];
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+
+  vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+  while (n_left_from > 0)
+    {
+      vlib_buffer_t * p0;
+      ip_adjacency_t * adj0;
+      ip4_header_t * ip0;
+      ip4_frag_trace_t * t0 = 0;
+      ip4_frag_error_t error0;
+      u32 pi0, next0, rw_len0, mtu0, i;
+
+      pi0 = from[0];
+      from += 1;
+      n_left_from -= 1;
+
+      p0 = vlib_get_buffer (vm, pi0);
+      adj0 = ip_get_adjacency (lm, vnet_buffer (p0)->ip.adj_index[VLIB_TX]);
+      rw_len0 = adj0->rewrite_header.data_bytes;
+      mtu0 = adj0->rewrite_header.max_l3_packet_bytes;
+      ip0 = vlib_buffer_get_current (p0) + rw_len0;
+
+      if (PREDICT_FALSE (p0->flags & VLIB_BUFFER_IS_TRACED))
+	{
+	  t0 = vlib_add_trace (vm, node, p0, sizeof (t0[0]));
+	  t0->n_bytes = clib_net_to_host_u16 (ip0->length);
+	  t0->mtu = mtu0;
+	  t0->n_fragments = 0;
+	}
+
+      vec_reset_length (w->buffers);
+      if (ip0->flags_and_fragment_offset & clib_host_to_net_u16 (IP4_HEADER_FLAG_DONT_FRAGMENT))
+	{
+	  error0 = ip4_frag_icmp_fragmentation_needed (vm, w, p0, rw_len0, mtu0);
+	  next0 = IP4_REWRITE_NEXT_ICMP_ERROR;
+	  if (error0 == IP4_FRAG_ERROR_ICMP_SENT)
+	    {
+	      vec_add1 (w->buffers, pi0);
+	      n_icmp_sent += 1;
+	    }
+	}
+      else
+	{
+	  error0 = ip4_frag_packet (vm, w, pi0, rw_len0, mtu0);
+	  next0 = adj0->rewrite_header.next_index;
+	  if (error0 == IP4_FRAG_ERROR_FRAGMENTS_SENT)
+	    {
+	      n_fragmented += 1;
+	      n_fragments += vec_len (w->buffers);
+	      if (t0)
+		t0->n_fragments = vec_len (w->buffers);
+	    }
+	}
+
+      /* Out of buffers: packet and its fragments have already been freed. */
+      if (error0 == IP4_FRAG_ERROR_NO_BUFFERS)
+	vlib_error_count (vm, node->node_index, error0, 1);
+      else if (vec_len (w->buffers) == 0)
+	{
+	  p0->error = node->errors[error0];
+	  vec_add1 (w->buffers, pi0);
+	  next0 = IP4_REWRITE_NEXT_DROP;
+	}
+
+      /* All fragments go out in same frame when they fit. */
+      for (i = 0; i < vec_len (w->buffers); i++)
+	{
+	  u32 bi = w->buffers[i];
+
+	  if (n_left_to_next == 0)
+	    {
+	      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+	      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+	    }
+
+	  to_next[0] = bi;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+					   to_next, n_left_to_next,
+					   bi, next0);
+	}
+    }
+
+  vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+
+  vlib_error_count (vm, node->node_index, IP4_FRAG_ERROR_FRAGMENTED, n_fragmented);
+  vlib_error_count (vm, node->node_index, IP4_FRAG_ERROR_FRAGMENTS_SENT, n_fragments);
+  vlib_error_count (vm, node->node_index, IP4_FRAG_ERROR_ICMP_SENT, n_icmp_sent);
+
+  return frame->n_vectors;
+}
+
+static VLIB_REGISTER_NODE (ip4_frag_node) = {
+  .function = ip4_frag,
+  .name = "ip4-frag",
+  .vector_size = sizeof (u32),
+
+  .sibling_of = "ip4-rewrite-transit",
+
+  .format_trace = format_ip4_frag_trace,
+
+  .n_errors = IP4_FRAG_N_ERROR,
+  .error_strings = ip4_frag_error_strings,
+
+  .n_next_nodes = IP4_REWRITE_N_NEXT,
+  .next_nodes = {
+    [IP4_REWRITE_NEXT_DROP] = "error-drop",
+    [IP4_REWRITE_NEXT_FRAGMENT] = "ip4-frag",
+    [IP4_REWRITE_NEXT_ICMP_ERROR] = "ip4-lookup",
+  },
+};
@@ -0,0 +1,333 @@
+/*
+ * ip/ip4_handoff.c: steer ip4 packets to forwarding workers by flow hash
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/ip/ip.h>
+#include <vnet/handoff.h>
+
+/* ip4-handoff is the first ip4 rx feature.  Packets whose flow hash maps to
+   another worker are queued to that worker; its ip4-handoff-input node feeds
+   them back into ip4-handoff which then continues with the next feature. */
+
+typedef struct {
+  u8 packet_data[64];
+} ip4_handoff_trace_t;
+
+static u8 * format_ip4_handoff_trace (u8 * s, va_list * va)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*va, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*va, vlib_node_t *);
+  ip4_handoff_trace_t * t = va_arg (*va, ip4_handoff_trace_t *);
+
+  s = format (s, "%U",
+	      format_ip4_header,
+	      t->packet_data, sizeof (t->packet_data));
+
+  return s;
+}
+
+typedef enum {
+  IP4_HANDOFF_NEXT_DROP,
+  IP4_HANDOFF_N_NEXT,
+} ip4_handoff_next_t;
+
+#define foreach_ip4_handoff_error				\
+  _ (HANDED_OFF, "packets handed off to other workers")		\
+  _ (QUEUE_FULL, "handoff queue full drops")
+
+typedef enum {
+#define _(sym,str) IP4_HANDOFF_ERROR_##sym,
+  foreach_ip4_handoff_error
+#undef _
+  IP4_HANDOFF_N_ERROR,
+} ip4_handoff_error_t;
+
+static char * ip4_handoff_error_strings[] = {
+#define _(sym,string) string,
+  foreach_ip4_handoff_error
+#undef _
+};
+
+static uword
+ip4_handoff (vlib_main_t * vm,
+	     vlib_node_runtime_t * node,
+	     vlib_frame_t * frame)
+{
+  ip4_main_t * im = &ip4_main;
+  ip_lookup_main_t * lm = &im->lookup_main;
+  ip_config_main_t * cm = &lm->rx_config_mains[VNET_UNICAST];
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  u32 n_left_from, * from, * to_next, next_index;
+  u32 remote_buffers[VLIB_FRAME_SIZE], n_remote;
+  u8 remote_workers[VLIB_FRAME_SIZE];
+  u32 self = os_get_cpu_number ();
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+  n_remote = 0;
+
+  if (node->flags & VLIB_NODE_FLAG_TRACE)
+    vlib_trace_frame_buffers_only (vm, node, from, frame->n_vectors,
+				   /* stride */ 1,
+				   sizeof (ip4_handoff_trace_t));
+
+  while (n_left_from > 0)
+    {
+      u32 n_left_to_next;
+
+      vlib_get_next_frame (vm, node, next_index,
+			   to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+	{
+	  vlib_buffer_t * p0;
+	  ip4_header_t * ip0;
+	  u32 pi0, next0, hash0, worker0;
+
+	  pi0 = from[0];
+	  from += 1;
+	  n_left_from -= 1;
+
+	  p0 = vlib_get_buffer (vm, pi0);
+	  ip0 = vlib_buffer_get_current (p0);
+
+	  hash0 = ip4_compute_flow_hash (ip0, im->flow_hash_seed);
+	  vnet_buffer (p0)->ip.flow_hash = hash0;
+
+	  worker0 = vnet_worker_for_flow_hash (wm, hash0);
+	  if (worker0 != self)
+	    {
+	      /* Feature config index is left pointing at handoff so that
+		 receiving worker picks up here. */
+	      remote_buffers[n_remote] = pi0;
+	      remote_workers[n_remote] = worker0;
+	      n_remote += 1;
+	      continue;
+	    }
+
+	  vnet_get_config_data (&cm->config_main,
+				&vnet_buffer (p0)->ip.current_config_index,
+				&next0,
+				/* # bytes of config data */ 0);
+
+	  to_next[0] = pi0;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+					   to_next, n_left_to_next,
+					   pi0, next0);
+	}
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  /* Queue remote packets one destination worker at a time. */
+  while (n_remote > 0)
+    {
+      u32 buffers[VLIB_FRAME_SIZE];
+      u32 i, n, n_keep, n_enqueued, worker;
+      vnet_worker_t * w;
+
+      worker = remote_workers[0];
+      n = n_keep = 0;
+      for (i = 0; i < n_remote; i++)
+	{
+	  if (remote_workers[i] == worker)
+	    buffers[n++] = remote_buffers[i];
+	  else
+	    {
+	      remote_buffers[n_keep] = remote_buffers[i];
+	      remote_workers[n_keep] = remote_workers[i];
+	      n_keep++;
+	    }
+	}
+      n_remote = n_keep;
+
+      w = vec_elt_at_index (wm->workers, worker);
+      n_enqueued = vnet_handoff_enqueue (vec_elt_at_index (w->queue_by_src_worker, self),
+					 buffers, n);
+
+      wm->workers[self].n_sent += n_enqueued;
+      vlib_error_count (vm, node->node_index, IP4_HANDOFF_ERROR_HANDED_OFF, n_enqueued);
+
+      for (i = n_enqueued; i < n; i++)
+	{
+	  vlib_buffer_t * p = vlib_get_buffer (vm, buffers[i]);
+	  p->error = node->errors[IP4_HANDOFF_ERROR_QUEUE_FULL];
+	  vlib_set_next_frame_buffer (vm, node, IP4_HANDOFF_NEXT_DROP, buffers[i]);
+	}
+      wm->workers[self].n_queue_full_drops += n - n_enqueued;
+    }
+
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (ip4_handoff_node) = {
+  .function = ip4_handoff,
+  .name = "ip4-handoff",
+  .vector_size = sizeof (u32),
+
+  .format_buffer = format_ip4_header,
+  .format_trace = format_ip4_handoff_trace,
+
+  .n_errors = IP4_HANDOFF_N_ERROR,
+  .error_strings = ip4_handoff_error_strings,
+
+  .n_next_nodes = IP4_HANDOFF_N_NEXT,
+  .next_nodes = {
+    [IP4_HANDOFF_NEXT_DROP] = "error-drop",
+  },
+};
+
+/* Polls this worker's handoff queues. */
+static uword
+ip4_handoff_input (vlib_main_t * vm,
+		   vlib_node_runtime_t * node,
+		   vlib_frame_t * frame)
+{
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  u32 cpu = os_get_cpu_number ();
+  vnet_worker_t * w = vec_elt_at_index (wm->workers, cpu);
+  vnet_handoff_queue_t * q;
+  u32 * to_next, n_left_to_next, n, n_received = 0;
+
+  vec_foreach (q, w->queue_by_src_worker)
+    {
+      if (q->tail == q->head)
+	continue;
+
+      vlib_get_next_frame (vm, node, /* next_index */ 0, to_next, n_left_to_next);
+
+      n = vnet_handoff_dequeue (q, to_next, n_left_to_next);
+      n_left_to_next -= n;
+      n_received += n;
+
+      vlib_put_next_frame (vm, node, /* next_index */ 0, n_left_to_next);
+    }
+
+  w->n_received += n_received;
+
+  return n_received;
+}
+
+static VLIB_REGISTER_NODE (ip4_handoff_input_node) = {
+  .function = ip4_handoff_input,
+  .name = "ip4-handoff-input",
+  .type = VLIB_NODE_TYPE_INPUT,
+
+  /* Enabled when handoff is configured on some interface. */
+  .state = VLIB_NODE_STATE_DISABLED,
+
+  .vector_size = sizeof (u32),
+
+  .n_next_nodes = 1,
+  .next_nodes = {
+    [0] = "ip4-handoff",
+  },
+};
+
+/* Interfaces with handoff feature; counted in vnet_worker_main. */
+static uword * handoff_enabled_by_sw_if_index;
+
+static clib_error_t *
+set_ip_handoff (vlib_main_t * vm,
+		unformat_input_t * input,
+		vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = &vnet_main;
+  ip4_main_t * im = &ip4_main;
+  ip_lookup_main_t * lm = &im->lookup_main;
+  ip_config_main_t * rx_cm = &lm->rx_config_mains[VNET_UNICAST];
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  vnet_worker_t * w;
+  u32 sw_if_index, is_del, ci;
+
+  if (! unformat_user (input, unformat_vnet_sw_interface, vnm, &sw_if_index))
+    return clib_error_return (0, "unknown interface `%U'",
+			      format_unformat_error, input);
+
+  is_del = unformat (input, "del");
+
+  /* Nothing to do when already in requested state. */
+  if (is_del == ! clib_bitmap_get (handoff_enabled_by_sw_if_index, sw_if_index))
+    return 0;
+
+  if (! is_del)
+    {
+      if (vec_len (wm->workers) <= 1)
+	return clib_error_return (0, "handoff needs more than one worker (see `workers' config)");
+
+      /* Packets queued to a worker which is not running would never be
+	 received. */
+      vec_foreach (w, wm->workers)
+	if (! w->vlib_main)
+	  return clib_error_return (0, "worker %d is not running",
+				    w - wm->workers);
+    }
+
+  ci = rx_cm->config_index_by_sw_if_index[sw_if_index];
+  ci = (is_del
+	? vnet_config_del_feature
+	: vnet_config_add_feature)
+    (vm, &rx_cm->config_main,
+     ci,
+     IP4_RX_FEATURE_HANDOFF,
+     /* config data */ 0,
+     /* # bytes of config data */ 0);
+  rx_cm->config_index_by_sw_if_index[sw_if_index] = ci;
+
+  handoff_enabled_by_sw_if_index
+    = clib_bitmap_set (handoff_enabled_by_sw_if_index, sw_if_index, ! is_del);
+
+  if (is_del)
+    {
+      wm->n_handoff_interfaces -= 1;
+      if (wm->n_handoff_interfaces == 0)
+	vnet_worker_set_handoff_input_state (wm, /* is_enable */ 0);
+    }
+  else
+    {
+      wm->n_handoff_interfaces += 1;
+      if (wm->n_handoff_interfaces == 1)
+	vnet_worker_set_handoff_input_state (wm, /* is_enable */ 1);
+    }
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (set_interface_ip_handoff_command) = {
+  .path = "set interface ip handoff",
+  .function = set_ip_handoff,
+  .short_help = "Steer IP4 packets received on interface to workers by flow hash",
+};
+
+clib_error_t * ip4_handoff_init (vlib_main_t * vm)
+{
+  vnet_worker_main.handoff_input_node_index = ip4_handoff_input_node.index;
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (ip4_handoff_init);
@@ -25,11 +25,69 @@
 
 #include <vnet/ip/ip.h>
 
+/* Ply index used to refer to 16-8-8 root ply (which is not in ply pool). */
+#define ROOT16_PLY_INDEX (~0)
+
+/* Leaves, prefix lengths and non-empty count of either root or pool ply. */
+typedef struct {
+  ip4_fib_mtrie_leaf_t * leaves;
+  u8 * dst_address_bits_of_leaves;
+  i32 * n_non_empty_leafs;
+} ply_ref_t;
+
+always_inline void
+ply_ref (ip4_fib_mtrie_t * m, u32 ply_index, ply_ref_t * r)
+{
+  if (ply_index == ROOT16_PLY_INDEX)
+    {
+      r->leaves = m->root16_leaves;
+      r->dst_address_bits_of_leaves = m->root16_dst_address_bits_of_leaves;
+      r->n_non_empty_leafs = &m->root16_n_non_empty_leafs;
+    }
+  else
+    {
+      ip4_fib_mtrie_ply_t * p = vec_elt_at_index (m->plies, ply_index);
+      ip4_fib_mtrie_ply_info_t * pi = vec_elt_at_index (m->ply_info, ply_index);
+      r->leaves = p->leaves;
+      r->dst_address_bits_of_leaves = pi->dst_address_bits_of_leaves;
+      r->n_non_empty_leafs = &pi->n_non_empty_leafs;
+    }
+}
+
+always_inline uword
+is_16_8_8 (ip4_fib_mtrie_t * m)
+{ return m->layout == IP4_FIB_MTRIE_LAYOUT_16_8_8; }
+
+always_inline u32
+root_ply_index (ip4_fib_mtrie_t * m)
+{ return is_16_8_8 (m) ? ROOT16_PLY_INDEX : 0; }
+
+/* Number of address bits used to index ply at given level (root is level 0). */
+always_inline u32
+ply_n_bits (ip4_fib_mtrie_t * m, u32 level)
+{ return level == 0 && is_16_8_8 (m) ? 16 : BITS (u8); }
+
+/* Number of address bits consumed after lookup in ply at given level. */
+always_inline u32
+ply_end_bit (ip4_fib_mtrie_t * m, u32 level)
+{ return BITS (u8) * (level + 1 + is_16_8_8 (m)); }
+
+always_inline uword
+ply_leaf_index (ip4_fib_mtrie_t * m, ip4_address_t * a, u32 level)
+{
+  if (! is_16_8_8 (m))
+    return a->as_u8[level];
+  return (level == 0
+	  ? (a->as_u8[0] << 8) | a->as_u8[1]
+	  : a->as_u8[level + 1]);
+}
+
 static void
-ply_init (ip4_fib_mtrie_ply_t * p, ip4_fib_mtrie_leaf_t init, uword prefix_len)
+ply_init (ip4_fib_mtrie_ply_t * p, ip4_fib_mtrie_ply_info_t * pi,
+	  ip4_fib_mtrie_leaf_t init, uword prefix_len)
 {
-  p->n_non_empty_leafs = ip4_fib_mtrie_leaf_is_empty (init) ? 0 : ARRAY_LEN (p->leaves);
-  memset (p->dst_address_bits_of_leaves, prefix_len, sizeof (p->dst_address_bits_of_leaves));
+  pi->n_non_empty_leafs = ip4_fib_mtrie_leaf_is_empty (init) ? 0 : ARRAY_LEN (p->leaves);
+  memset (pi->dst_address_bits_of_leaves, prefix_len, sizeof (pi->dst_address_bits_of_leaves));
 
   /* Initialize leaves. */
 #ifdef CLIB_HAVE_VEC128
@@ -60,74 +118,105 @@ ply_init (ip4_fib_mtrie_ply_t * p, ip4_fib_mtrie_leaf_t init, uword prefix_len)
 #endif
 }
 
-static ip4_fib_mtrie_leaf_t
-ply_create (ip4_fib_mtrie_t * m, ip4_fib_mtrie_leaf_t init_leaf, uword prefix_len)
+/* Grow ply vector by copying.  Lookups may still be reading old vector
+   so it is freed only after all threads have passed a quiescent point. */
+static void
+ply_grow (ip4_fib_mtrie_t * m)
 {
-  ip4_fib_mtrie_ply_t * p;
+  ip4_fib_mtrie_ply_t * old = m->plies, * new = 0;
+  uword i, n_old = vec_len (old);
+  uword n_new = n_old > 0 ? 2*n_old : 16;
+
+  vec_validate_aligned (new, n_new - 1, CLIB_CACHE_LINE_BYTES);
+  if (n_old > 0)
+    memcpy (new, old, n_old * sizeof (old[0]));
+  vec_validate (m->ply_info, n_new - 1);
 
-  /* Get cache aligned ply. */
-  pool_get_aligned (m->ply_pool, p, sizeof (p[0]));
+  /* Push in reverse order so that lowest index is allocated first. */
+  for (i = n_new; i > n_old; i--)
+    {
+      vec_add1 (m->free_ply_indices, i - 1);
+      m->free_ply_bitmap = clib_bitmap_ori (m->free_ply_bitmap, i - 1);
+    }
 
-  ply_init (p, init_leaf, prefix_len);
-  return ip4_fib_mtrie_leaf_set_next_ply_index (p - m->ply_pool);
+  /* Make copy visible before publishing it. */
+  CLIB_MEMORY_BARRIER ();
+  m->plies = new;
+
+  if (old)
+    ip_lookup_defer_vec_free (old);
 }
 
-always_inline ip4_fib_mtrie_ply_t *
-get_next_ply_for_leaf (ip4_fib_mtrie_t * m, ip4_fib_mtrie_leaf_t l)
+static u32
+ply_alloc (ip4_fib_mtrie_t * m)
 {
-  uword n = ip4_fib_mtrie_leaf_get_next_ply_index (l);
-  /* It better not be the root ply. */
-  ASSERT (n != 0);
-  return pool_elt_at_index (m->ply_pool, n);
+  u32 pi;
+
+  if (vec_len (m->free_ply_indices) == 0)
+    ply_grow (m);
+
+  pi = vec_pop (m->free_ply_indices);
+  m->free_ply_bitmap = clib_bitmap_andnoti (m->free_ply_bitmap, pi);
+  return pi;
 }
 
 static void
-ply_free (ip4_fib_mtrie_t * m, ip4_fib_mtrie_ply_t * p)
+ply_free_deferred (uword opaque, uword ply_index)
 {
-  uword i, is_root;
+  ip4_fib_mtrie_t * m = uword_to_pointer (opaque, ip4_fib_mtrie_t *);
+  ASSERT (! clib_bitmap_get (m->free_ply_bitmap, ply_index));
+  vec_add1 (m->free_ply_indices, ply_index);
+  m->free_ply_bitmap = clib_bitmap_ori (m->free_ply_bitmap, ply_index);
+}
 
-  is_root = p - m->ply_pool == 0;
+always_inline uword
+ply_is_free (ip4_fib_mtrie_t * m, uword ply_index)
+{ return clib_bitmap_get (m->free_ply_bitmap, ply_index); }
 
-  for (i = 0 ; i < ARRAY_LEN (p->leaves); i++)
-    {
-      ip4_fib_mtrie_leaf_t l = p->leaves[i];
-      if (ip4_fib_mtrie_leaf_is_next_ply (l))
-	ply_free (m, get_next_ply_for_leaf (m, l));
-    }      
+static ip4_fib_mtrie_leaf_t
+ply_create (ip4_fib_mtrie_t * m, ip4_fib_mtrie_leaf_t init_leaf, uword prefix_len)
+{
+  u32 pi = ply_alloc (m);
 
-  if (is_root)
-    ply_init (p, IP4_FIB_MTRIE_LEAF_EMPTY, /* prefix_len */ 0);
-  else
-    pool_put (m->ply_pool, p);
+  ply_init (vec_elt_at_index (m->plies, pi), vec_elt_at_index (m->ply_info, pi),
+	    init_leaf, prefix_len);
+
+  /* New ply must be fully initialized before caller links it into mtrie. */
+  CLIB_MEMORY_BARRIER ();
+
+  return ip4_fib_mtrie_leaf_set_next_ply_index (pi);
 }
 
-void ip4_fib_free (ip4_fib_mtrie_t * m)
+always_inline ip4_fib_mtrie_ply_t *
+get_next_ply_for_leaf (ip4_fib_mtrie_t * m, ip4_fib_mtrie_leaf_t l)
 {
-  ip4_fib_mtrie_ply_t * root_ply = pool_elt_at_index (m->ply_pool, 0);
-  ply_free (m, root_ply);
+  uword n = ip4_fib_mtrie_leaf_get_next_ply_index (l);
+  /* It better not be the root (or reserved) ply. */
+  ASSERT (n != 0);
+  return vec_elt_at_index (m->plies, n);
 }
 
 u32 ip4_mtrie_lookup_address (ip4_fib_mtrie_t * m, ip4_address_t dst)
 {
-  ip4_fib_mtrie_ply_t * p = pool_elt_at_index (m->ply_pool, 0);
   ip4_fib_mtrie_leaf_t l;
+  uword i;
 
-  l = p->leaves[dst.as_u8[0]];
-  if (ip4_fib_mtrie_leaf_is_terminal (l))
-    return ip4_fib_mtrie_leaf_get_adj_index (l);
-
-  p = get_next_ply_for_leaf (m, l);
-  l = p->leaves[dst.as_u8[1]];
-  if (ip4_fib_mtrie_leaf_is_terminal (l))
-    return ip4_fib_mtrie_leaf_get_adj_index (l);
-
-  p = get_next_ply_for_leaf (m, l);
-  l = p->leaves[dst.as_u8[2]];
-  if (ip4_fib_mtrie_leaf_is_terminal (l))
-    return ip4_fib_mtrie_leaf_get_adj_index (l);
+  if (is_16_8_8 (m))
+    {
+      l = m->root16_leaves[(dst.as_u8[0] << 8) | dst.as_u8[1]];
+      i = 2;
+    }
+  else
+    {
+      l = m->plies[0].leaves[dst.as_u8[0]];
+      i = 1;
+    }
 
-  p = get_next_ply_for_leaf (m, l);
-  l = p->leaves[dst.as_u8[3]];
+  for (; i < ARRAY_LEN (dst.as_u8) && ! ip4_fib_mtrie_leaf_is_terminal (l); i++)
+    {
+      ip4_fib_mtrie_ply_t * p = get_next_ply_for_leaf (m, l);
+      l = p->leaves[dst.as_u8[i]];
+    }
 
   ASSERT (ip4_fib_mtrie_leaf_is_terminal (l));
   return ip4_fib_mtrie_leaf_get_adj_index (l);
@@ -137,14 +226,21 @@ typedef struct {
   ip4_address_t dst_address;
   u32 dst_address_length;
   u32 adj_index;
+
+  /* Unset only: leaf of next less specific route (or empty) which replaces
+     deleted leaves. */
+  ip4_fib_mtrie_leaf_t cover_leaf;
+  u32 cover_dst_address_length;
 } ip4_fib_mtrie_set_unset_leaf_args_t;
 
 static void
 set_ply_with_more_specific_leaf (ip4_fib_mtrie_t * m,
-				 ip4_fib_mtrie_ply_t * ply,
+				 u32 ply_index,
 				 ip4_fib_mtrie_leaf_t new_leaf,
 				 uword new_leaf_dst_address_bits)
 {
+  ip4_fib_mtrie_ply_t * ply = vec_elt_at_index (m->plies, ply_index);
+  ip4_fib_mtrie_ply_info_t * pi = vec_elt_at_index (m->ply_info, ply_index);
   ip4_fib_mtrie_leaf_t old_leaf;
   uword i;
 
@@ -157,17 +253,15 @@ set_ply_with_more_specific_leaf (ip4_fib_mtrie_t * m,
 
       /* Recurse into sub plies. */
       if (! ip4_fib_mtrie_leaf_is_terminal (old_leaf))
-	{
-	  ip4_fib_mtrie_ply_t * sub_ply = get_next_ply_for_leaf (m, old_leaf);
-	  set_ply_with_more_specific_leaf (m, sub_ply, new_leaf, new_leaf_dst_address_bits);
-	}
+	set_ply_with_more_specific_leaf (m, ip4_fib_mtrie_leaf_get_next_ply_index (old_leaf),
+					 new_leaf, new_leaf_dst_address_bits);
 
       /* Replace more specific terminal leaves with new leaf. */
-      else if (new_leaf_dst_address_bits >= ply->dst_address_bits_of_leaves[i])
+      else if (new_leaf_dst_address_bits >= pi->dst_address_bits_of_leaves[i])
 	{
 	  ply->leaves[i] = new_leaf;
-	  ply->dst_address_bits_of_leaves[i] = new_leaf_dst_address_bits;
-	  ply->n_non_empty_leafs += ip4_fib_mtrie_leaf_is_empty (old_leaf);
+	  pi->dst_address_bits_of_leaves[i] = new_leaf_dst_address_bits;
+	  pi->n_non_empty_leafs += ip4_fib_mtrie_leaf_is_empty (old_leaf);
 	}
     }
 }
@@ -176,18 +270,19 @@ static void
 set_leaf (ip4_fib_mtrie_t * m,
 	  ip4_fib_mtrie_set_unset_leaf_args_t * a,
 	  u32 old_ply_index,
-	  u32 dst_address_byte_index)
+	  u32 level)
 {
   ip4_fib_mtrie_leaf_t old_leaf, new_leaf;
   i32 n_dst_bits_next_plies;
-  u8 dst_byte;
+  uword leaf_index;
+  ply_ref_t old_ply;
 
   ASSERT (a->dst_address_length > 0 && a->dst_address_length <= 32);
-  ASSERT (dst_address_byte_index < ARRAY_LEN (a->dst_address.as_u8));
+  ASSERT (ply_end_bit (m, level) <= 32);
 
-  n_dst_bits_next_plies = a->dst_address_length - BITS (u8) * (dst_address_byte_index + 1);
+  n_dst_bits_next_plies = a->dst_address_length - ply_end_bit (m, level);
 
-  dst_byte = a->dst_address.as_u8[dst_address_byte_index];
+  leaf_index = ply_leaf_index (m, &a->dst_address, level);
 
   /* Number of bits next plies <= 0 => insert leaves this ply. */
   if (n_dst_bits_next_plies <= 0)
@@ -195,113 +290,112 @@ set_leaf (ip4_fib_mtrie_t * m,
       uword i, n_dst_bits_this_ply, old_leaf_is_terminal;
 
       n_dst_bits_this_ply = -n_dst_bits_next_plies;
-      ASSERT ((a->dst_address.as_u8[dst_address_byte_index] & pow2_mask (n_dst_bits_this_ply)) == 0);
+      ASSERT ((leaf_index & pow2_mask (n_dst_bits_this_ply)) == 0);
 
-      for (i = dst_byte; i < dst_byte + (1 << n_dst_bits_this_ply); i++)
+      for (i = leaf_index; i < leaf_index + (1 << n_dst_bits_this_ply); i++)
 	{
-	  ip4_fib_mtrie_ply_t * old_ply, * new_ply;
-
-	  old_ply = pool_elt_at_index (m->ply_pool, old_ply_index);
+	  ply_ref (m, old_ply_index, &old_ply);
 
-	  old_leaf = old_ply->leaves[i];
+	  old_leaf = old_ply.leaves[i];
 	  old_leaf_is_terminal = ip4_fib_mtrie_leaf_is_terminal (old_leaf);
 
 	  /* Is leaf to be inserted more specific? */
-	  if (a->dst_address_length >= old_ply->dst_address_bits_of_leaves[i])
+	  if (a->dst_address_length >= old_ply.dst_address_bits_of_leaves[i])
 	    {
 	      new_leaf = ip4_fib_mtrie_leaf_set_adj_index (a->adj_index);
 
 	      if (old_leaf_is_terminal)
 		{
-		  old_ply->dst_address_bits_of_leaves[i] = a->dst_address_length;
-		  old_ply->leaves[i] = new_leaf;
-		  old_ply->n_non_empty_leafs += ip4_fib_mtrie_leaf_is_empty (old_leaf);
-		  ASSERT (old_ply->n_non_empty_leafs <= ARRAY_LEN (old_ply->leaves));
+		  old_ply.dst_address_bits_of_leaves[i] = a->dst_address_length;
+		  old_ply.leaves[i] = new_leaf;
+		  old_ply.n_non_empty_leafs[0] += ip4_fib_mtrie_leaf_is_empty (old_leaf);
 		}
 	      else
 		{
 		  /* Existing leaf points to another ply.  We need to place new_leaf into all
 		     more specific slots. */
-		  new_ply = get_next_ply_for_leaf (m, old_leaf);
-		  set_ply_with_more_specific_leaf (m, new_ply, new_leaf, a->dst_address_length);
+		  set_ply_with_more_specific_leaf (m, ip4_fib_mtrie_leaf_get_next_ply_index (old_leaf),
+						   new_leaf, a->dst_address_length);
 		}
 	    }
 
 	  else if (! old_leaf_is_terminal)
-	    {
-	      new_ply = get_next_ply_for_leaf (m, old_leaf);
-	      set_leaf (m, a, new_ply - m->ply_pool, dst_address_byte_index + 1);
-	    }
+	    set_leaf (m, a, ip4_fib_mtrie_leaf_get_next_ply_index (old_leaf), level + 1);
 	}
     }
   else
     {
-      ip4_fib_mtrie_ply_t * old_ply, * new_ply;
-
-      old_ply = pool_elt_at_index (m->ply_pool, old_ply_index);
-      old_leaf = old_ply->leaves[dst_byte];
+      ply_ref (m, old_ply_index, &old_ply);
+      old_leaf = old_ply.leaves[leaf_index];
       if (ip4_fib_mtrie_leaf_is_terminal (old_leaf))
 	{
-	  new_leaf = ply_create (m, old_leaf, old_ply->dst_address_bits_of_leaves[dst_byte]);
-	  new_ply = get_next_ply_for_leaf (m, new_leaf);
+	  new_leaf = ply_create (m, old_leaf, old_ply.dst_address_bits_of_leaves[leaf_index]);
 
-	  /* Refetch since ply_create may move pool. */
-	  old_ply = pool_elt_at_index (m->ply_pool, old_ply_index);
+	  /* Refetch since ply_create may move ply vector. */
+	  ply_ref (m, old_ply_index, &old_ply);
 
-	  old_ply->leaves[dst_byte] = new_leaf;
-	  old_ply->dst_address_bits_of_leaves[dst_byte] = 0;
+	  old_ply.leaves[leaf_index] = new_leaf;
+	  old_ply.dst_address_bits_of_leaves[leaf_index] = 0;
 
-	  old_ply->n_non_empty_leafs -= ip4_fib_mtrie_leaf_is_non_empty (old_leaf);
-	  ASSERT (old_ply->n_non_empty_leafs >= 0);
+	  /* Next ply pointer counts as non-empty leaf. */
+	  old_ply.n_non_empty_leafs[0] += ip4_fib_mtrie_leaf_is_empty (old_leaf);
 	}
       else
-	new_ply = get_next_ply_for_leaf (m, old_leaf);
+	new_leaf = old_leaf;
 
-      set_leaf (m, a, new_ply - m->ply_pool, dst_address_byte_index + 1);
+      set_leaf (m, a, ip4_fib_mtrie_leaf_get_next_ply_index (new_leaf), level + 1);
     }
 }
 
 static uword
 unset_leaf (ip4_fib_mtrie_t * m,
 	    ip4_fib_mtrie_set_unset_leaf_args_t * a,
-	    ip4_fib_mtrie_ply_t * old_ply,
-	    u32 dst_address_byte_index)
+	    u32 old_ply_index,
+	    u32 level)
 {
   ip4_fib_mtrie_leaf_t old_leaf, del_leaf;
   i32 n_dst_bits_next_plies;
-  uword i, n_dst_bits_this_ply, old_leaf_is_terminal;
-  u8 dst_byte;
+  uword i, leaf_index, n_dst_bits_this_ply, old_leaf_is_terminal;
+  ply_ref_t old_ply;
 
   ASSERT (a->dst_address_length > 0 && a->dst_address_length <= 32);
-  ASSERT (dst_address_byte_index < ARRAY_LEN (a->dst_address.as_u8));
-
-  n_dst_bits_next_plies = a->dst_address_length - BITS (u8) * (dst_address_byte_index + 1);
+  ASSERT (ply_end_bit (m, level) <= 32);
 
-  dst_byte = a->dst_address.as_u8[dst_address_byte_index];
-  if (n_dst_bits_next_plies < 0)
-    dst_byte &= ~pow2_mask (-n_dst_bits_next_plies);
+  n_dst_bits_next_plies = a->dst_address_length - ply_end_bit (m, level);
 
   n_dst_bits_this_ply = n_dst_bits_next_plies <= 0 ? -n_dst_bits_next_plies : 0;
-  n_dst_bits_this_ply = clib_min (8, n_dst_bits_this_ply);
+  n_dst_bits_this_ply = clib_min (ply_n_bits (m, level), n_dst_bits_this_ply);
+
+  leaf_index = ply_leaf_index (m, &a->dst_address, level);
+  leaf_index &= ~pow2_mask (n_dst_bits_this_ply);
 
   del_leaf = ip4_fib_mtrie_leaf_set_adj_index (a->adj_index);
 
-  for (i = dst_byte; i < dst_byte + (1 << n_dst_bits_this_ply); i++)
+  ply_ref (m, old_ply_index, &old_ply);
+
+  for (i = leaf_index; i < leaf_index + (1 << n_dst_bits_this_ply); i++)
     {
-      old_leaf = old_ply->leaves[i];
+      old_leaf = old_ply.leaves[i];
       old_leaf_is_terminal = ip4_fib_mtrie_leaf_is_terminal (old_leaf);
 
-      if (old_leaf == del_leaf
+      /* Only remove leaves placed by this prefix; a more specific prefix may share
+	 the same adjacency. */
+      if ((old_leaf == del_leaf
+	   && old_ply.dst_address_bits_of_leaves[i] == a->dst_address_length)
 	  || (! old_leaf_is_terminal
-	      && unset_leaf (m, a, get_next_ply_for_leaf (m, old_leaf), dst_address_byte_index + 1)))
+	      && unset_leaf (m, a, ip4_fib_mtrie_leaf_get_next_ply_index (old_leaf), level + 1)))
 	{
-	  old_ply->leaves[i] = IP4_FIB_MTRIE_LEAF_EMPTY;
-	  old_ply->dst_address_bits_of_leaves[i] = 0;
-	  old_ply->n_non_empty_leafs -= old_leaf_is_terminal;
-	  ASSERT (old_ply->n_non_empty_leafs >= 0);
-	  if (old_ply->n_non_empty_leafs == 0 && dst_address_byte_index > 0)
+	  /* Single store: lookups see either old leaf or covering leaf. */
+	  old_ply.leaves[i] = a->cover_leaf;
+	  old_ply.dst_address_bits_of_leaves[i] = a->cover_dst_address_length;
+	  if (! ip4_fib_mtrie_leaf_is_empty (a->cover_leaf))
+	    continue;
+	  old_ply.n_non_empty_leafs[0] -= 1;
+	  ASSERT (old_ply.n_non_empty_leafs[0] >= 0);
+	  if (old_ply.n_non_empty_leafs[0] == 0 && level > 0)
 	    {
-	      pool_put (m->ply_pool, old_ply);
+	      /* Lookups may still be walking old ply: reuse it after grace period. */
+	      ip_lookup_defer_free (ply_free_deferred, pointer_to_uword (m), old_ply_index);
 	      /* Old ply was deleted. */
 	      return 1;
 	    }
@@ -312,13 +406,38 @@ unset_leaf (ip4_fib_mtrie_t * m,
   return 0;
 }
 
-static void mtrie_init (ip4_fib_mtrie_t * m)
+void ip4_fib_mtrie_init (ip4_fib_mtrie_t * m, ip4_fib_mtrie_layout_t layout)
 {
-  ip4_fib_mtrie_leaf_t root;
+  ip4_fib_mtrie_leaf_t l;
+
   memset (m, 0, sizeof (m[0]));
   m->default_leaf = IP4_FIB_MTRIE_LEAF_EMPTY;
-  root = ply_create (m, IP4_FIB_MTRIE_LEAF_EMPTY, /* dst_address_bits_of_leaves */ 0);
-  ASSERT (ip4_fib_mtrie_leaf_get_next_ply_index (root) == 0);
+  m->layout = layout;
+
+  if (is_16_8_8 (m))
+    {
+      uword i;
+
+      vec_validate_aligned (m->root16_leaves, pow2_mask (16), CLIB_CACHE_LINE_BYTES);
+      vec_validate (m->root16_dst_address_bits_of_leaves, pow2_mask (16));
+      for (i = 0; i < vec_len (m->root16_leaves); i++)
+	m->root16_leaves[i] = IP4_FIB_MTRIE_LEAF_EMPTY;
+    }
+
+  /* Root ply for 8-8-8-8 layout; reserved empty ply for 16-8-8 layout. */
+  l = ply_create (m, IP4_FIB_MTRIE_LEAF_EMPTY, /* dst_address_bits_of_leaves */ 0);
+  ASSERT (ip4_fib_mtrie_leaf_get_next_ply_index (l) == 0);
+}
+
+void ip4_fib_mtrie_free (ip4_fib_mtrie_t * m)
+{
+  vec_free (m->plies);
+  vec_free (m->free_ply_indices);
+  clib_bitmap_free (m->free_ply_bitmap);
+  vec_free (m->ply_info);
+  vec_free (m->root16_leaves);
+  vec_free (m->root16_dst_address_bits_of_leaves);
+  memset (m, 0, sizeof (m[0]));
 }
 
 void
@@ -328,14 +447,11 @@ ip4_fib_mtrie_add_del_route (ip4_fib_t * fib,
 			     u32 adj_index,
 			     u32 is_del)
 {
-  ip4_fib_mtrie_t * m = &fib->mtrie;
-  ip4_fib_mtrie_ply_t * root_ply;
+  ip4_fib_mtrie_t * m = fib->mtrie;
   ip4_fib_mtrie_set_unset_leaf_args_t a;
 
-  if (pool_len (m->ply_pool) == 0)
-    mtrie_init (m);
-
-  root_ply = pool_elt_at_index (m->ply_pool, 0);
+  /* Mtrie is initialized when fib is created. */
+  ASSERT (vec_len (m->plies) > 0);
 
   a.dst_address = dst_address;
   a.dst_address_length = dst_address_length;
@@ -346,7 +462,7 @@ ip4_fib_mtrie_add_del_route (ip4_fib_t * fib,
       if (dst_address_length == 0)
 	m->default_leaf = ip4_fib_mtrie_leaf_set_adj_index (adj_index);
       else
-	set_leaf (m, &a, /* ply_index */ 0, /* dst_address_byte_index */ 0);
+	set_leaf (m, &a, root_ply_index (m), /* level */ 0);
     }
   else
     {
@@ -358,10 +474,11 @@ ip4_fib_mtrie_add_del_route (ip4_fib_t * fib,
 	  ip4_main_t * im = &ip4_main;
 	  uword i;
 
-	  unset_leaf (m, &a, root_ply, 0);
-
-	  /* Find next less specific route and insert into mtrie. */
-	  for (i = ARRAY_LEN (fib->adj_index_by_dst_address) - 1; i >= 1; i--)
+	  /* Deleted leaves are replaced by next less specific route so
+	     that lookups never miss while route is removed. */
+	  a.cover_leaf = IP4_FIB_MTRIE_LEAF_EMPTY;
+	  a.cover_dst_address_length = 0;
+	  for (i = dst_address_length - 1; i >= 1; i--)
 	    {
 	      uword * p;
 	      ip4_address_t key;
@@ -373,17 +490,46 @@ ip4_fib_mtrie_add_del_route (ip4_fib_t * fib,
 	      p = hash_get (fib->adj_index_by_dst_address[i], key.as_u32);
 	      if (p)
 		{
-		  a.dst_address = key;
-		  a.dst_address_length = i;
-		  a.adj_index = p[0];
-		  set_leaf (m, &a, /* ply_index */ 0, /* dst_address_byte_index */ 0);
+		  a.cover_leaf = ip4_fib_mtrie_leaf_set_adj_index (p[0]);
+		  a.cover_dst_address_length = i;
 		  break;
 		}
 	    }
+
+	  unset_leaf (m, &a, root_ply_index (m), /* level */ 0);
 	}
     }
 }
 
+void
+ip4_fib_mtrie_build (ip4_fib_mtrie_t * m,
+		     ip4_fib_t * fib,
+		     ip4_fib_mtrie_layout_t layout)
+{
+  ip4_fib_mtrie_set_unset_leaf_args_t a;
+  uword l, dst, adj_index;
+
+  ip4_fib_mtrie_init (m, layout);
+
+  /* Insert shortest prefixes first.  Each new leaf is then at least as specific
+     as any leaf already present so set_leaf never has to push it down into
+     existing plies; plies are created already filled with covering leaf. */
+  for (l = 0; l < ARRAY_LEN (fib->adj_index_by_dst_address); l++)
+    {
+      hash_foreach (dst, adj_index, fib->adj_index_by_dst_address[l], ({
+	if (l == 0)
+	  m->default_leaf = ip4_fib_mtrie_leaf_set_adj_index (adj_index);
+	else
+	  {
+	    a.dst_address.as_u32 = dst;
+	    a.dst_address_length = l;
+	    a.adj_index = adj_index;
+	    set_leaf (m, &a, root_ply_index (m), /* level */ 0);
+	  }
+      }));
+    }
+}
+
 always_inline uword
 maybe_remap_leaf (ip_lookup_main_t * lm, ip4_fib_mtrie_leaf_t * p)
 {
@@ -396,58 +542,50 @@ maybe_remap_leaf (ip_lookup_main_t * lm, ip4_fib_mtrie_leaf_t * p)
       if (m)
 	{
 	  was_remapped_to_empty_leaf = m == ~0;
-	  if (was_remapped_to_empty_leaf)
-	    p[0] = (was_remapped_to_empty_leaf
-		    ? IP4_FIB_MTRIE_LEAF_EMPTY
-		    : ip4_fib_mtrie_leaf_set_adj_index (m - 1));
+	  p[0] = (was_remapped_to_empty_leaf
+		  ? IP4_FIB_MTRIE_LEAF_EMPTY
+		  : ip4_fib_mtrie_leaf_set_adj_index (m - 1));
 	}
     }
   return was_remapped_to_empty_leaf;
 }
 
-static void maybe_remap_ply (ip_lookup_main_t * lm, ip4_fib_mtrie_ply_t * ply)
+static void maybe_remap_ply (ip_lookup_main_t * lm, ip4_fib_mtrie_t * m, u32 ply_index)
 {
+  ply_ref_t ply;
   u32 n_remapped_to_empty = 0;
-  u32 i;
-  for (i = 0; i < ARRAY_LEN (ply->leaves); i++)
-    n_remapped_to_empty += maybe_remap_leaf (lm, &ply->leaves[i]);
+  u32 i, n_leaves;
+
+  ply_ref (m, ply_index, &ply);
+  n_leaves = 1 << ply_n_bits (m, ply_index == ROOT16_PLY_INDEX ? 0 : 1);
+  for (i = 0; i < n_leaves; i++)
+    n_remapped_to_empty += maybe_remap_leaf (lm, &ply.leaves[i]);
   if (n_remapped_to_empty > 0)
     {
-      ASSERT (n_remapped_to_empty <= ply->n_non_empty_leafs);
-      ply->n_non_empty_leafs -= n_remapped_to_empty;
-      if (ply->n_non_empty_leafs == 0)
+      ASSERT (n_remapped_to_empty <= ply.n_non_empty_leafs[0]);
+      ply.n_non_empty_leafs[0] -= n_remapped_to_empty;
+      if (ply.n_non_empty_leafs[0] == 0 && ply_index != root_ply_index (m))
 	abort ();
     }
 }
 
 void ip4_mtrie_maybe_remap_adjacencies (ip_lookup_main_t * lm, ip4_fib_mtrie_t * m)
 {
-  ip4_fib_mtrie_ply_t * ply;
-  pool_foreach (ply, m->ply_pool, maybe_remap_ply (lm, ply));
+  uword i;
+  for (i = 0; i < vec_len (m->plies); i++)
+    if (! ply_is_free (m, i))
+      maybe_remap_ply (lm, m, i);
+  if (is_16_8_8 (m))
+    maybe_remap_ply (lm, m, ROOT16_PLY_INDEX);
   maybe_remap_leaf (lm, &m->default_leaf);
 }
 
 /* Returns number of bytes of memory used by mtrie. */
-static uword mtrie_memory_usage (ip4_fib_mtrie_t * m, ip4_fib_mtrie_ply_t * p)
+static uword mtrie_memory_usage (ip4_fib_mtrie_t * m)
 {
-  uword bytes, i;
-
-  if (! p)
-    {
-      if (pool_is_free_index (m->ply_pool, 0))
-	return 0;
-      p = pool_elt_at_index (m->ply_pool, 0);
-    }
-
-  bytes = sizeof (p[0]);
-  for (i = 0 ; i < ARRAY_LEN (p->leaves); i++)
-    {
-      ip4_fib_mtrie_leaf_t l = p->leaves[i];
-      if (ip4_fib_mtrie_leaf_is_next_ply (l))
-	bytes += mtrie_memory_usage (m, get_next_ply_for_leaf (m, l));
-    }
-
-  return bytes;
+  return (vec_len (m->plies) * (sizeof (m->plies[0]) + sizeof (m->ply_info[0]))
+	  + vec_bytes (m->root16_leaves)
+	  + vec_bytes (m->root16_dst_address_bits_of_leaves));
 }
 
 static u8 * format_ip4_fib_mtrie_leaf (u8 * s, va_list * va)
@@ -468,28 +606,32 @@ static u8 * format_ip4_fib_mtrie_ply (u8 * s, va_list * va)
   ip4_fib_mtrie_t * m = va_arg (*va, ip4_fib_mtrie_t *);
   u32 base_address = va_arg (*va, u32);
   u32 ply_index = va_arg (*va, u32);
-  u32 dst_address_byte_index = va_arg (*va, u32);
-  ip4_fib_mtrie_ply_t * p;
-  uword i, indent;
+  u32 level = va_arg (*va, u32);
+  ply_ref_t p;
+  uword i, indent, end_bit;
 
-  p = pool_elt_at_index (m->ply_pool, ply_index);
+  ply_ref (m, ply_index, &p);
+  end_bit = ply_end_bit (m, level);
   indent = format_get_indent (s);
-  s = format (s, "ply index %d, %d non-empty leaves", ply_index, p->n_non_empty_leafs);
-  for (i = 0; i < ARRAY_LEN (p->leaves); i++)
+  if (ply_index == ROOT16_PLY_INDEX)
+    s = format (s, "root ply, %d non-empty leaves", p.n_non_empty_leafs[0]);
+  else
+    s = format (s, "ply index %d, %d non-empty leaves", ply_index, p.n_non_empty_leafs[0]);
+  for (i = 0; i < (1 << ply_n_bits (m, level)); i++)
     {
-      ip4_fib_mtrie_leaf_t l = p->leaves[i];
+      ip4_fib_mtrie_leaf_t l = p.leaves[i];
 
       if (! ip4_fib_mtrie_leaf_is_empty (l))
 	{
 	  u32 a, ia_length;
 	  ip4_address_t ia;
 
-	  a = base_address + (i << (24 - 8*dst_address_byte_index));
+	  a = base_address + (i << (32 - end_bit));
 	  ia.as_u32 = clib_host_to_net_u32 (a);
 	  if (ip4_fib_mtrie_leaf_is_terminal (l))
-	    ia_length = p->dst_address_bits_of_leaves[i];
+	    ia_length = p.dst_address_bits_of_leaves[i];
 	  else
-	    ia_length = 8*(1 + dst_address_byte_index);
+	    ia_length = end_bit;
 	  s = format (s, "\n%U%20U %U",
 		      format_white_space, indent + 2,
 		      format_ip4_address_and_length, &ia, ia_length,
@@ -500,26 +642,58 @@ static u8 * format_ip4_fib_mtrie_ply (u8 * s, va_list * va)
 			format_white_space, indent + 2,
 			format_ip4_fib_mtrie_ply, m, a,
 			ip4_fib_mtrie_leaf_get_next_ply_index (l),
-			dst_address_byte_index + 1);
+			level + 1);
 	}
     }
 
   return s;
 }
 
+u8 * format_ip4_fib_mtrie_layout (u8 * s, va_list * va)
+{
+  ip4_fib_mtrie_layout_t l = va_arg (*va, ip4_fib_mtrie_layout_t);
+  char * t;
+
+  switch (l)
+    {
+    case IP4_FIB_MTRIE_LAYOUT_8_8_8_8: t = "8-8-8-8"; break;
+    case IP4_FIB_MTRIE_LAYOUT_16_8_8: t = "16-8-8"; break;
+    default:
+      return format (s, "unknown 0x%x", l);
+    }
+  return format (s, "%s", t);
+}
+
+uword unformat_ip4_fib_mtrie_layout (unformat_input_t * input, va_list * va)
+{
+  ip4_fib_mtrie_layout_t * result = va_arg (*va, ip4_fib_mtrie_layout_t *);
+
+  if (unformat (input, "8-8-8-8"))
+    *result = IP4_FIB_MTRIE_LAYOUT_8_8_8_8;
+  else if (unformat (input, "16-8-8"))
+    *result = IP4_FIB_MTRIE_LAYOUT_16_8_8;
+  else
+    return 0;
+  return 1;
+}
+
 u8 * format_ip4_fib_mtrie (u8 * s, va_list * va)
 {
   ip4_fib_mtrie_t * m = va_arg (*va, ip4_fib_mtrie_t *);
+  uword n_plies = vec_len (m->plies) - vec_len (m->free_ply_indices);
 
-  s = format (s, "%d plies, memory usage %U",
-	      pool_elts (m->ply_pool),
-	      format_memory_size, mtrie_memory_usage (m, 0));
+  /* Do not count reserved ply of 16-8-8 layout. */
+  s = format (s, "%U layout, %d plies, memory usage %U",
+	      format_ip4_fib_mtrie_layout, m->layout,
+	      n_plies - (is_16_8_8 (m) && n_plies > 0),
+	      format_memory_size, mtrie_memory_usage (m));
 
-  if (pool_elts (m->ply_pool) > 0)
+  if (n_plies > 0)
     {
       ip4_address_t base_address;
       base_address.as_u32 = 0;
-      s = format (s, "\n  %U", format_ip4_fib_mtrie_ply, m, base_address, 0, 0);
+      s = format (s, "\n  %U", format_ip4_fib_mtrie_ply, m, base_address,
+		  root_ply_index (m), /* level */ 0);
     }
 
   return s;
@@ -31,7 +31,7 @@
 #include <vnet/ip/lookup.h>
 #include <vnet/ip/ip4_packet.h>	/* for ip4_address_t */
 
-/* ip4 fib leafs: 4 ply 8-8-8-8 mtrie.
+/* ip4 fib leafs: either 4 ply 8-8-8-8 mtrie or 3 ply 16-8-8 mtrie.
    1 + 2*adj_index for terminal leaves.
    0 + 2*next_ply_index for non-terminals.
    1 => empty (adjacency index of zero is special miss adjacency). */
@@ -80,7 +80,17 @@ always_inline ip4_fib_mtrie_leaf_t ip4_fib_mtrie_leaf_set_next_ply_index (u32 i)
   return l;
 }
 
-/* One ply of the 4 ply mtrie fib. */
+typedef enum {
+  /* Root ply indexed by first byte of destination; 3 more 8 bit plies. */
+  IP4_FIB_MTRIE_LAYOUT_8_8_8_8,
+
+  /* Root ply indexed by first 2 bytes of destination; 2 more 8 bit plies.
+     Saves one dependent load for prefixes longer than /8. */
+  IP4_FIB_MTRIE_LAYOUT_16_8_8,
+} ip4_fib_mtrie_layout_t;
+
+/* One 8 bit ply of the mtrie fib.  Only holds leaves so that lookups
+   touch nothing but leaves and plies pack with no padding. */
 typedef struct {
   union {
     ip4_fib_mtrie_leaf_t leaves[256];
@@ -89,27 +99,53 @@ typedef struct {
     u32x4 leaves_as_u32x4[256 / 4];
 #endif
   };
+} ip4_fib_mtrie_ply_t;
 
+/* Per ply data only needed when adding/deleting routes. */
+typedef struct {
   /* Prefix length for terminal leaves. */
   u8 dst_address_bits_of_leaves[256];
 
   /* Number of non-empty leafs (whether terminal or not). */
   i32 n_non_empty_leafs;
-
-  /* Pad to cache line boundary. */
-  u8 pad[CLIB_CACHE_LINE_BYTES
-	 - 1 * sizeof (i32)];
-} ip4_fib_mtrie_ply_t;
+} ip4_fib_mtrie_ply_info_t;
 
 typedef struct {
-  /* Pool of plies.  Index zero is root ply. */
-  ip4_fib_mtrie_ply_t * ply_pool;
+  /* Vector of plies.  For 8-8-8-8 layout index zero is root ply.
+     For 16-8-8 layout index zero is a reserved empty ply so that lock step
+     lookups past a terminal leaf always read valid memory.
+     Not a pool: lookups run concurrently with route add/delete so vector is
+     only grown by copy and old copy is freed after a grace period
+     (see ip_lookup_defer_vec_free). */
+  ip4_fib_mtrie_ply_t * plies;
+
+  /* Free ply indices and bitmap of same.  Deleted plies are only put back
+     here after a grace period. */
+  u32 * free_ply_indices;
+  uword * free_ply_bitmap;
+
+  /* Route add/delete data for each ply indexed by ply index. */
+  ip4_fib_mtrie_ply_info_t * ply_info;
+
+  /* 16-8-8 layout root ply: 1 << 16 leaves indexed by first 2 bytes of destination.
+     Kept out of ply vector since it is 256 times the size of other plies. */
+  ip4_fib_mtrie_leaf_t * root16_leaves;
+
+  /* Prefix length for terminal root leaves. */
+  u8 * root16_dst_address_bits_of_leaves;
+
+  /* Number of non-empty root leafs. */
+  i32 root16_n_non_empty_leafs;
 
   /* Special case leaf for default route 0.0.0.0/0. */
   ip4_fib_mtrie_leaf_t default_leaf;
+
+  /* One of IP4_FIB_MTRIE_LAYOUT_*; fixed when mtrie is initialized. */
+  ip4_fib_mtrie_layout_t layout;
 } ip4_fib_mtrie_t;
 
-void ip4_fib_mtrie_init (ip4_fib_mtrie_t * m);
+void ip4_fib_mtrie_init (ip4_fib_mtrie_t * m, ip4_fib_mtrie_layout_t layout);
+void ip4_fib_mtrie_free (ip4_fib_mtrie_t * m);
 
 struct ip4_fib_t;
 
@@ -119,14 +155,23 @@ void ip4_fib_mtrie_add_del_route (struct ip4_fib_t * f,
 				  u32 adj_index,
 				  u32 is_del);
 
+/* Initialize mtrie with given layout and insert all routes of fib. */
+void ip4_fib_mtrie_build (ip4_fib_mtrie_t * m,
+			  struct ip4_fib_t * f,
+			  ip4_fib_mtrie_layout_t layout);
+
 /* Returns adjacency index. */
 u32 ip4_mtrie_lookup_address (ip4_fib_mtrie_t * m, ip4_address_t dst);
 
 void ip4_mtrie_maybe_remap_adjacencies (ip_lookup_main_t * lm, ip4_fib_mtrie_t * m);
 
 format_function_t format_ip4_fib_mtrie;
+format_function_t format_ip4_fib_mtrie_layout;
+unformat_function_t unformat_ip4_fib_mtrie_layout;
 
-/* Lookup step.  Processes 1 byte of 4 byte ip4 address. */
+/* Lookup step.  Processes 1 byte of 4 byte ip4 address.
+   For 16-8-8 layout byte 0 step consumes 2 bytes and byte 1 step is a no-op.
+   Byte index is constant in callers so layout test is a single predictable branch. */
 always_inline ip4_fib_mtrie_leaf_t
 ip4_fib_mtrie_lookup_step (ip4_fib_mtrie_t * m,
 			   ip4_fib_mtrie_leaf_t current_leaf,
@@ -135,13 +180,51 @@ ip4_fib_mtrie_lookup_step (ip4_fib_mtrie_t * m,
 {
   ip4_fib_mtrie_leaf_t next_leaf;
   ip4_fib_mtrie_ply_t * ply;
-  uword current_is_terminal = ip4_fib_mtrie_leaf_is_terminal (current_leaf);
+  uword current_is_terminal;
+
+  if (dst_address_byte_index < 2 && m->layout == IP4_FIB_MTRIE_LAYOUT_16_8_8)
+    {
+      if (dst_address_byte_index == 0)
+	current_leaf = m->root16_leaves[(dst_address->as_u8[0] << 8) | dst_address->as_u8[1]];
+      return current_leaf;
+    }
 
-  ply = m->ply_pool + (current_is_terminal ? 0 : (current_leaf >> 1));
+  current_is_terminal = ip4_fib_mtrie_leaf_is_terminal (current_leaf);
+  ply = m->plies + (current_is_terminal ? 0 : (current_leaf >> 1));
   next_leaf = ply->leaves[dst_address->as_u8[dst_address_byte_index]];
   next_leaf = current_is_terminal ? current_leaf : next_leaf;
 
   return next_leaf;
 }
 
+/* Prefetch leaf that next lookup step will read.  Called right after
+   previous lookup step so that miss latency overlaps other work. */
+always_inline void
+ip4_fib_mtrie_prefetch_step (ip4_fib_mtrie_t * m,
+			     ip4_fib_mtrie_leaf_t current_leaf,
+			     ip4_address_t * dst_address,
+			     u32 dst_address_byte_index)
+{
+  ip4_fib_mtrie_ply_t * ply;
+  uword current_is_terminal;
+
+  if (dst_address_byte_index < 2 && m->layout == IP4_FIB_MTRIE_LAYOUT_16_8_8)
+    {
+      if (dst_address_byte_index == 0)
+	{
+	  CLIB_PREFETCH (&m->root16_leaves[(dst_address->as_u8[0] << 8) | dst_address->as_u8[1]],
+			 sizeof (m->root16_leaves[0]), LOAD);
+	  return;
+	}
+
+      /* Byte 1 step is a no-op: prefetch for byte 2 step instead. */
+      dst_address_byte_index = 2;
+    }
+
+  current_is_terminal = ip4_fib_mtrie_leaf_is_terminal (current_leaf);
+  ply = m->plies + (current_is_terminal ? 0 : (current_leaf >> 1));
+  CLIB_PREFETCH (&ply->leaves[dst_address->as_u8[dst_address_byte_index]],
+		 sizeof (ply->leaves[0]), LOAD);
+}
+
 #endif /* included_ip_ip4_fib_h */
@@ -139,6 +139,14 @@ always_inline int
 ip4_get_fragment_offset_bytes (ip4_header_t * i)
 { return 8 * ip4_get_fragment_offset (i); }
 
+/* Non-zero for every fragment of a fragmented packet, first included. */
+always_inline int
+ip4_is_fragment (ip4_header_t * i)
+{
+  return (i->flags_and_fragment_offset
+	  & clib_host_to_net_u16 (IP4_HEADER_FLAG_MORE_FRAGMENTS | 0x1fff)) != 0;
+}
+
 always_inline int
 ip4_header_bytes (ip4_header_t * i)
 { return sizeof (u32) * (i->ip_version_and_header_length & 0xf); }
@@ -136,8 +136,8 @@ ip4_source_check_inline (vlib_main_t * vm,
 				     &next1,
 				     sizeof (c1[0]));
 
-	  mtrie0 = &vec_elt_at_index (im->fibs, c0->fib_index)->mtrie;
-	  mtrie1 = &vec_elt_at_index (im->fibs, c1->fib_index)->mtrie;
+	  mtrie0 = vec_elt_at_index (im->fibs, c0->fib_index)->mtrie;
+	  mtrie1 = vec_elt_at_index (im->fibs, c1->fib_index)->mtrie;
 
 	  leaf0 = leaf1 = IP4_FIB_MTRIE_LEAF_ROOT;
 
@@ -213,7 +213,7 @@ ip4_source_check_inline (vlib_main_t * vm,
 				     &next0,
 				     sizeof (c0[0]));
 
-	  mtrie0 = &vec_elt_at_index (im->fibs, c0->fib_index)->mtrie;
+	  mtrie0 = vec_elt_at_index (im->fibs, c0->fib_index)->mtrie;
 
 	  leaf0 = IP4_FIB_MTRIE_LEAF_ROOT;
 
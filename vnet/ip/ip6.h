@@ -27,6 +27,7 @@
 #define included_ip_ip6_h
 
 #include <vlib/mc.h>
+#include <vnet/ip/ip6_mtrie.h>
 #include <vnet/ip/ip6_packet.h>
 #include <vnet/ip/lookup.h>
 #include <clib/mhash.h>
@@ -38,7 +39,7 @@ typedef struct {
   u32 dst_address_length;
 } ip6_fib_mhash_t;
 
-typedef struct {
+typedef struct ip6_fib_t {
   ip6_fib_mhash_t * non_empty_dst_address_length_mhash;
 
   u8 mhash_index_by_dst_address_length[129];
@@ -46,6 +47,9 @@ typedef struct {
   /* Temporary vectors for holding new/old values for hash_set. */
   uword * new_hash_values, * old_hash_values;
 
+  /* Mtrie for fast lookups.  Mhashes are used to maintain overlapping prefixes. */
+  ip6_fib_mtrie_t mtrie;
+
   /* Table ID (hash key) for this FIB. */
   u32 table_id;
 
@@ -162,6 +166,9 @@ extern vlib_node_registration_t ip6_discover_neighbor_node;
 
 u32 ip6_fib_lookup (ip6_main_t * im, u32 sw_if_index, ip6_address_t * dst);
 
+/* Slow lookup by walking per prefix length mhashes.  Used to verify mtrie. */
+u32 ip6_fib_lookup_with_table (ip6_main_t * im, u32 fib_index, ip6_address_t * dst);
+
 always_inline uword
 ip6_destination_matches_route (ip6_main_t * im,
 			       ip6_address_t * key,
@@ -326,6 +333,30 @@ void ip6_adjacency_set_interface_route (vnet_main_t * vm,
 clib_error_t *
 ip6_probe_neighbor (vlib_main_t * vm, ip6_address_t * dst, u32 sw_if_index);
 
+/* Add or delete ethernet neighbor; static neighbors never age and are not
+   over-written by learned mappings. */
+void
+ip6_add_del_ethernet_neighbor (ip6_address_t * a,
+			       u8 * ethernet_address,
+			       u32 sw_if_index,
+			       u32 is_static,
+			       u32 is_del);
+
+typedef struct {
+  ip6_address_t address;
+  u32 sw_if_index;
+
+  /* Cached address to send unicast solicitation to; multicast to
+     solicited node address if zero. */
+  u8 ethernet_address[6];
+} ip6_neighbor_probe_t;
+
+/* Send neighbor solicitations for many neighbors; consecutive probes out
+   same interface share a frame.  Returns error for first probe which could
+   not be sent; others are still sent. */
+clib_error_t *
+ip6_probe_neighbors (vlib_main_t * vm, ip6_neighbor_probe_t * probes, u32 n_probes);
+
 uword
 ip6_tcp_register_listener (vlib_main_t * vm,
 			   u16 dst_port,
@@ -25,20 +25,18 @@
 
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
+#include <vnet/handoff.h>
 #include <vnet/ethernet/ethernet.h> /* for ethernet_header_t */
 #include <vnet/srp/srp.h>	/* for srp_hw_interface_class */
 
-u32 ip6_fib_lookup (ip6_main_t * im, u32 sw_if_index, ip6_address_t * dst)
+u32 ip6_fib_lookup_with_table (ip6_main_t * im, u32 fib_index, ip6_address_t * dst)
 {
   ip_lookup_main_t * lm = &im->lookup_main;
-  u32 fib_index;
   ip6_fib_t * fib;
   ip6_fib_mhash_t * fm;
   ip6_address_t masked_dst;
   uword i, * p;
 
-  fib_index = vec_elt (im->fib_index_by_sw_if_index, sw_if_index);
-
   fib = vec_elt_at_index (im->fibs, fib_index);
 
   vec_foreach (fm, fib->non_empty_dst_address_length_mhash)
@@ -56,6 +54,15 @@ u32 ip6_fib_lookup (ip6_main_t * im, u32 sw_if_index, ip6_address_t * dst)
   return lm->miss_adj_index;
 }
 
+u32 ip6_fib_lookup (ip6_main_t * im, u32 sw_if_index, ip6_address_t * dst)
+{
+  u32 fib_index = vec_elt (im->fib_index_by_sw_if_index, sw_if_index);
+  ip6_fib_t * fib = vec_elt_at_index (im->fibs, fib_index);
+  u32 adj_index = ip6_mtrie_lookup_address (&fib->mtrie, dst);
+  ASSERT (adj_index == ip6_fib_lookup_with_table (im, fib_index, dst));
+  return adj_index;
+}
+
 static void
 ip6_fib_init (ip6_main_t * im, u32 fib_index)
 {
@@ -300,7 +307,7 @@ void ip6_add_del_route (ip6_main_t * im, ip6_add_del_route_args_t * a)
   ip6_fib_t * fib;
   ip6_fib_mhash_t * mh;
   ip6_address_t dst_address;
-  u32 dst_address_length, adj_index;
+  u32 dst_address_length, adj_index, old_adj_index;
   uword is_del;
   ip6_add_del_route_callback_t * cb;
 
@@ -355,14 +362,19 @@ void ip6_add_del_route (ip6_main_t * im, ip6_add_del_route_args_t * a)
     ip6_fib_set_adj_index (im, fib, a->flags, &dst_address, dst_address_length,
 			   adj_index);
 
+  old_adj_index = fib->old_hash_values[0];
+
+  /* Deleting a prefix that was not in table leaves mtrie alone. */
+  if (! is_del || old_adj_index != ~0)
+    ip6_fib_mtrie_add_del_route (fib, &dst_address, dst_address_length,
+				 is_del ? old_adj_index : adj_index,
+				 is_del);
+
   /* Delete old adjacency index if present and changed. */
-  {
-    u32 old_adj_index = fib->old_hash_values[0];
-    if (! (a->flags & IP6_ROUTE_FLAG_KEEP_OLD_ADJACENCY)
-	&& old_adj_index != ~0
-	&& old_adj_index != adj_index)
-      ip_del_adjacency (lm, old_adj_index);
-  }
+  if (! (a->flags & IP6_ROUTE_FLAG_KEEP_OLD_ADJACENCY)
+      && old_adj_index != ~0
+      && old_adj_index != adj_index)
+    ip_del_adjacency (lm, old_adj_index);
 }
 
 static void serialize_ip6_add_del_route_next_hop_msg (serialize_main_t * m, va_list * va)
@@ -655,6 +667,10 @@ void ip6_maybe_remap_adjacencies (ip6_main_t * im,
 		/* Set new adjacency value. */
 		fib->new_hash_values[0] = v[0] = m - 1;
 
+		/* Replace leaves in mtrie. */
+		ip6_fib_mtrie_add_del_route (fib, k, mh->dst_address_length,
+					     m - 1, /* is_del */ 0);
+
 		vec_foreach (cb, im->add_del_route_callbacks)
 		  if ((flags & cb->required_flags) == cb->required_flags)
 		    cb->function (im, cb->function_opaque,
@@ -670,6 +686,11 @@ void ip6_maybe_remap_adjacencies (ip6_main_t * im,
       vec_foreach (k, to_delete)
 	{
 	  mhash_unset (&mh->adj_index_by_dst_address, k, fib->old_hash_values);
+
+	  /* Delete from mtrie after mhash so next less specific route is found. */
+	  ip6_fib_mtrie_add_del_route (fib, k, mh->dst_address_length,
+				       fib->old_hash_values[0], /* is_del */ 1);
+
 	  vec_foreach (cb, im->add_del_route_callbacks)
 	    if ((flags & cb->required_flags) == cb->required_flags)
 	      cb->function (im, cb->function_opaque,
@@ -726,7 +747,8 @@ ip6_lookup (vlib_main_t * vm,
 {
   ip6_main_t * im = &ip6_main;
   ip_lookup_main_t * lm = &im->lookup_main;
-  vlib_combined_counter_main_t * cm = &im->lookup_main.adjacency_counters;
+  vlib_combined_counter_main_t * cm
+    = vnet_combined_counter_shard (&im->lookup_main.adjacency_counters, os_get_cpu_number ());
   u32 n_left_from, n_left_to_next, * from, * to_next;
   ip_lookup_next_t next;
 
@@ -743,9 +765,12 @@ ip6_lookup (vlib_main_t * vm,
 	{
 	  vlib_buffer_t * p0, * p1;
 	  u32 pi0, pi1, adj_index0, adj_index1, wrong_next;
+	  u32 fib_index0, fib_index1, i;
 	  ip_lookup_next_t next0, next1;
 	  ip6_header_t * ip0, * ip1;
 	  ip_adjacency_t * adj0, * adj1;
+	  ip6_fib_mtrie_t * mtrie0, * mtrie1;
+	  ip6_fib_mtrie_leaf_t leaf0, leaf1;
 
 	  /* Prefetch next iteration. */
 	  {
@@ -767,8 +792,29 @@ ip6_lookup (vlib_main_t * vm,
 	  ip0 = vlib_buffer_get_current (p0);
 	  ip1 = vlib_buffer_get_current (p1);
 
-	  adj_index0 = ip6_fib_lookup (im, vnet_buffer (p0)->sw_if_index[VLIB_RX], &ip0->dst_address);
-	  adj_index1 = ip6_fib_lookup (im, vnet_buffer (p1)->sw_if_index[VLIB_RX], &ip1->dst_address);
+	  fib_index0 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p0)->sw_if_index[VLIB_RX]);
+	  fib_index1 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p1)->sw_if_index[VLIB_RX]);
+
+	  mtrie0 = &vec_elt_at_index (im->fibs, fib_index0)->mtrie;
+	  mtrie1 = &vec_elt_at_index (im->fibs, fib_index1)->mtrie;
+
+	  leaf0 = ip6_fib_mtrie_lookup_root (mtrie0, &ip0->dst_address);
+	  leaf1 = ip6_fib_mtrie_lookup_root (mtrie1, &ip1->dst_address);
+
+	  /* Walk both tries in lock step until both reach terminal leaves. */
+	  for (i = 2; i < ARRAY_LEN (ip0->dst_address.as_u8); i++)
+	    {
+	      if (ip6_fib_mtrie_leaf_is_terminal (leaf0 & leaf1))
+		break;
+	      leaf0 = ip6_fib_mtrie_lookup_step (mtrie0, leaf0, &ip0->dst_address, i);
+	      leaf1 = ip6_fib_mtrie_lookup_step (mtrie1, leaf1, &ip1->dst_address, i);
+	    }
+
+	  adj_index0 = ip6_fib_mtrie_leaf_to_adj_index (mtrie0, leaf0);
+	  adj_index1 = ip6_fib_mtrie_leaf_to_adj_index (mtrie1, leaf1);
+
+	  ASSERT (adj_index0 == ip6_fib_lookup_with_table (im, fib_index0, &ip0->dst_address));
+	  ASSERT (adj_index1 == ip6_fib_lookup_with_table (im, fib_index1, &ip1->dst_address));
 
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 	  adj1 = ip_get_adjacency (lm, adj_index1);
@@ -840,9 +886,11 @@ ip6_lookup (vlib_main_t * vm,
 	{
 	  vlib_buffer_t * p0;
 	  ip6_header_t * ip0;
-	  u32 pi0, adj_index0;
+	  u32 pi0, adj_index0, fib_index0, i;
 	  ip_lookup_next_t next0;
 	  ip_adjacency_t * adj0;
+	  ip6_fib_mtrie_t * mtrie0;
+	  ip6_fib_mtrie_leaf_t leaf0;
 
 	  pi0 = from[0];
 	  to_next[0] = pi0;
@@ -851,7 +899,19 @@ ip6_lookup (vlib_main_t * vm,
 
 	  ip0 = vlib_buffer_get_current (p0);
 
-	  adj_index0 = ip6_fib_lookup (im, vnet_buffer (p0)->sw_if_index[VLIB_RX], &ip0->dst_address);
+	  fib_index0 = vec_elt (im->fib_index_by_sw_if_index, vnet_buffer (p0)->sw_if_index[VLIB_RX]);
+	  mtrie0 = &vec_elt_at_index (im->fibs, fib_index0)->mtrie;
+
+	  leaf0 = ip6_fib_mtrie_lookup_root (mtrie0, &ip0->dst_address);
+	  for (i = 2; i < ARRAY_LEN (ip0->dst_address.as_u8); i++)
+	    {
+	      if (ip6_fib_mtrie_leaf_is_terminal (leaf0))
+		break;
+	      leaf0 = ip6_fib_mtrie_lookup_step (mtrie0, leaf0, &ip0->dst_address, i);
+	    }
+
+	  adj_index0 = ip6_fib_mtrie_leaf_to_adj_index (mtrie0, leaf0);
+	  ASSERT (adj_index0 == ip6_fib_lookup_with_table (im, fib_index0, &ip0->dst_address));
 
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 
@@ -1909,6 +1969,7 @@ static VLIB_REGISTER_NODE (ip6_local_node) = {
     [IP_LOCAL_NEXT_TCP_LOOKUP] = "ip6-tcp-lookup",
     [IP_LOCAL_NEXT_UDP_LOOKUP] = "ip6-udp-lookup",
     [IP_LOCAL_NEXT_ICMP] = "ip6-icmp-input",
+    [IP_LOCAL_NEXT_REASSEMBLY] = "ip6-reassembly",
   },
 };
 
@@ -1928,8 +1989,10 @@ typedef enum {
 } ip6_discover_neighbor_next_t;
 
 typedef enum {
-  IP6_DISCOVER_NEIGHBOR_ERROR_DROP,
   IP6_DISCOVER_NEIGHBOR_ERROR_REQUEST_SENT,
+  IP6_DISCOVER_NEIGHBOR_ERROR_DST_RATE_LIMITED,
+  IP6_DISCOVER_NEIGHBOR_ERROR_INTERFACE_RATE_LIMITED,
+  IP6_DISCOVER_NEIGHBOR_ERROR_HELD,
 } ip6_discover_neighbor_error_t;
 
 static uword
@@ -1942,29 +2005,12 @@ ip6_discover_neighbor (vlib_main_t * vm,
   ip_lookup_main_t * lm = &im->lookup_main;
   u32 * from, * to_next_drop;
   uword n_left_from, n_left_to_next_drop;
-  static f64 time_last_seed_change = -1e100;
-  static u32 hash_seeds[3];
-  static uword hash_bitmap[256 / BITS (uword)]; 
   f64 time_now;
 
   if (node->flags & VLIB_NODE_FLAG_TRACE)
     ip6_forward_next_trace (vm, node, frame, VLIB_TX);
 
   time_now = vlib_time_now (vm);
-  if (time_now - time_last_seed_change > 1e-3)
-    {
-      uword i;
-      u32 * r = clib_random_buffer_get_data (&vm->random_buffer,
-					     sizeof (hash_seeds));
-      for (i = 0; i < ARRAY_LEN (hash_seeds); i++)
-	hash_seeds[i] = r[i];
-
-      /* Mark all hash keys as been not-seen before. */
-      for (i = 0; i < ARRAY_LEN (hash_bitmap); i++)
-	hash_bitmap[i] = 0;
-
-      time_last_seed_change = time_now;
-    }
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors;
@@ -1978,8 +2024,8 @@ ip6_discover_neighbor (vlib_main_t * vm,
 	{
 	  vlib_buffer_t * p0;
 	  ip6_header_t * ip0;
-	  u32 pi0, adj_index0, a0, b0, c0, m0, sw_if_index0, drop0;
-	  uword bm0;
+	  u32 pi0, adj_index0, sw_if_index0, error0;
+	  ip_neighbor_request_limit_result_t limit0;
 	  ip_adjacency_t * adj0;
 	  u32 next0;
 
@@ -1993,85 +2039,76 @@ ip6_discover_neighbor (vlib_main_t * vm,
 
 	  adj0 = ip_get_adjacency (lm, adj_index0);
 
-	  a0 = hash_seeds[0];
-	  b0 = hash_seeds[1];
-	  c0 = hash_seeds[2];
-
 	  sw_if_index0 = adj0->rewrite_header.sw_if_index;
 	  vnet_buffer (p0)->sw_if_index[VLIB_TX] = sw_if_index0;
 
-	  a0 ^= sw_if_index0;
-	  b0 ^= ip0->dst_address.as_u32[0];
-	  c0 ^= ip0->dst_address.as_u32[1];
-
-	  hash_v3_mix32 (a0, b0, c0);
-
-	  b0 ^= ip0->dst_address.as_u32[2];
-	  c0 ^= ip0->dst_address.as_u32[3];
-
-	  hash_v3_finalize32 (a0, b0, c0);
-
-	  c0 &= BITS (hash_bitmap) - 1;
-	  c0 = c0 / BITS (uword);
-	  m0 = (uword) 1 << (c0 % BITS (uword));
-
-	  bm0 = hash_bitmap[c0];
-	  drop0 = (bm0 & m0) != 0;
-
-	  /* Mark it as seen. */
-	  hash_bitmap[c0] = bm0 | m0;
+	  limit0 = ip_neighbor_request_limit (vm, lm, sw_if_index0, &ip0->dst_address, time_now);
+	  error0 = (limit0 == IP_NEIGHBOR_REQUEST_SEND
+		    ? IP6_DISCOVER_NEIGHBOR_ERROR_REQUEST_SENT
+		    : (limit0 == IP_NEIGHBOR_REQUEST_DST_LIMITED
+		       ? IP6_DISCOVER_NEIGHBOR_ERROR_DST_RATE_LIMITED
+		       : IP6_DISCOVER_NEIGHBOR_ERROR_INTERFACE_RATE_LIMITED));
 
 	  from += 1;
 	  n_left_from -= 1;
-	  to_next_drop[0] = pi0;
-	  to_next_drop += 1;
-	  n_left_to_next_drop -= 1;
 
-	  p0->error = node->errors[drop0 ? IP6_DISCOVER_NEIGHBOR_ERROR_DROP : IP6_DISCOVER_NEIGHBOR_ERROR_REQUEST_SENT];
+	  /* Send neighbor solicitation. */
+	  if (limit0 == IP_NEIGHBOR_REQUEST_SEND)
+	    {
+	      u32 bi0;
+	      icmp6_neighbor_solicitation_header_t * h0;
+	      vnet_hw_interface_t * hw_if0;
+	      vlib_buffer_t * b0;
 
-	  if (drop0)
-	    continue;
+	      h0 = vlib_packet_template_get_packet (vm, &im->discover_neighbor_packet_template, &bi0);
 
-	  {
-	    u32 bi0;
-	    icmp6_neighbor_solicitation_header_t * h0;
-	    vnet_hw_interface_t * hw_if0;
-	    vlib_buffer_t * b0;
+	      /* Build ethernet header. */
+	      hw_if0 = vnet_get_sup_hw_interface (vnm, sw_if_index0);
 
-	    h0 = vlib_packet_template_get_packet (vm, &im->discover_neighbor_packet_template, &bi0);
+	      /* Choose source address based on destination lookup adjacency. */
+	      ip6_src_address_for_packet (im, p0, &h0->ip.src_address, sw_if_index0);
 
-	    /* Build ethernet header. */
-	    hw_if0 = vnet_get_sup_hw_interface (vnm, sw_if_index0);
+	      /* Destination address is a solicited node multicast address.  We need to fill in
+		 the low 24 bits with low 24 bits of target's address. */
+	      h0->ip.dst_address.as_u8[13] = ip0->dst_address.as_u8[13];
+	      h0->ip.dst_address.as_u8[14] = ip0->dst_address.as_u8[14];
+	      h0->ip.dst_address.as_u8[15] = ip0->dst_address.as_u8[15];
 
-	    /* Choose source address based on destination lookup adjacency. */
-	    ip6_src_address_for_packet (im, p0, &h0->ip.src_address, sw_if_index0);
+	      h0->neighbor.target_address = ip0->dst_address;
 
-	    /* Destination address is a solicited node multicast address.  We need to fill in
-	       the low 24 bits with low 24 bits of target's address. */
-	    h0->ip.dst_address.as_u8[13] = ip0->dst_address.as_u8[13];
-	    h0->ip.dst_address.as_u8[14] = ip0->dst_address.as_u8[14];
-	    h0->ip.dst_address.as_u8[15] = ip0->dst_address.as_u8[15];
+	      memcpy (h0->link_layer_option.ethernet_address, hw_if0->hw_address,
+		      vec_len (hw_if0->hw_address));
 
-	    h0->neighbor.target_address = ip0->dst_address;
+	      h0->neighbor.icmp.checksum = ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h0->ip);
+	      ASSERT (0 == ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h0->ip));
 
-	    memcpy (h0->link_layer_option.ethernet_address, hw_if0->hw_address,
-		    vec_len (hw_if0->hw_address));
+	      vlib_buffer_copy_trace_flag (vm, p0, bi0);
+	      b0 = vlib_get_buffer (vm, bi0);
+	      vnet_buffer (b0)->sw_if_index[VLIB_TX] = vnet_buffer (p0)->sw_if_index[VLIB_TX];
 
-	    h0->neighbor.icmp.checksum = ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h0->ip);
-	    ASSERT (0 == ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h0->ip));
+	      /* Add rewrite/encap string. */
+	      vnet_rewrite_one_header (adj0[0], h0, sizeof (ethernet_header_t));
+	      vlib_buffer_advance (b0, -adj0->rewrite_header.data_bytes);
 
-	    vlib_buffer_copy_trace_flag (vm, p0, bi0);
-	    b0 = vlib_get_buffer (vm, bi0);
-	    vnet_buffer (b0)->sw_if_index[VLIB_TX] = vnet_buffer (p0)->sw_if_index[VLIB_TX];
+	      next0 = vec_elt (im->discover_neighbor_next_index_by_hw_if_index, hw_if0->hw_if_index);
 
-	    /* Add rewrite/encap string. */
-	    vnet_rewrite_one_header (adj0[0], h0, sizeof (ethernet_header_t));
-	    vlib_buffer_advance (b0, -adj0->rewrite_header.data_bytes);
+	      vlib_set_next_frame_buffer (vm, node, next0, bi0);
+	    }
 
-	    next0 = vec_elt (im->discover_neighbor_next_index_by_hw_if_index, hw_if0->hw_if_index);
+	  /* Hold packet until neighbor is resolved instead of dropping it. */
+	  if (ip_neighbor_pending_enqueue (vm, lm, sw_if_index0, &ip0->dst_address, pi0,
+					   ip6_lookup_node.index))
+	    {
+	      vlib_error_count (vm, node->node_index, IP6_DISCOVER_NEIGHBOR_ERROR_HELD, 1);
+	      vlib_error_count (vm, node->node_index, error0, 1);
+	      continue;
+	    }
 
-	    vlib_set_next_frame_buffer (vm, node, next0, bi0);
-	  }
+	  to_next_drop[0] = pi0;
+	  to_next_drop += 1;
+	  n_left_to_next_drop -= 1;
+
+	  p0->error = node->errors[error0];
 	}
 
       vlib_put_next_frame (vm, node, IP6_DISCOVER_NEIGHBOR_NEXT_DROP, n_left_to_next_drop);
@@ -2081,8 +2118,10 @@ ip6_discover_neighbor (vlib_main_t * vm,
 }
 
 static char * ip6_discover_neighbor_error_strings[] = {
-  [IP6_DISCOVER_NEIGHBOR_ERROR_DROP] = "address overflow drops",
   [IP6_DISCOVER_NEIGHBOR_ERROR_REQUEST_SENT] = "neighbor solicitations sent",
+  [IP6_DISCOVER_NEIGHBOR_ERROR_DST_RATE_LIMITED] = "neighbor solicitations suppressed by destination rate limit",
+  [IP6_DISCOVER_NEIGHBOR_ERROR_INTERFACE_RATE_LIMITED] = "neighbor solicitations suppressed by interface rate limit",
+  [IP6_DISCOVER_NEIGHBOR_ERROR_HELD] = "packets held awaiting neighbor advertisement",
 };
 
 VLIB_REGISTER_NODE (ip6_discover_neighbor_node) = {
@@ -2123,58 +2162,110 @@ static VNET_HW_INTERFACE_LINK_UP_DOWN_FUNCTION (ip6_discover_neighbor_hw_interfa
 
 clib_error_t *
 ip6_probe_neighbor (vlib_main_t * vm, ip6_address_t * dst, u32 sw_if_index)
+{
+  ip6_neighbor_probe_t p;
+
+  memset (&p, 0, sizeof (p));
+  p.address = dst[0];
+  p.sw_if_index = sw_if_index;
+
+  return ip6_probe_neighbors (vm, &p, 1);
+}
+
+clib_error_t *
+ip6_probe_neighbors (vlib_main_t * vm, ip6_neighbor_probe_t * probes, u32 n_probes)
 {
   vnet_main_t * vnm = &vnet_main;
   ip6_main_t * im = &ip6_main;
-  icmp6_neighbor_solicitation_header_t * h;
-  ip6_address_t * src;
-  ip_interface_address_t * ia;
-  ip_adjacency_t * adj;
-  vnet_hw_interface_t * hi;
-  vlib_buffer_t * b;
-  u32 bi;
+  clib_error_t * error = 0;
+  vlib_frame_t * f = 0;
+  u32 * to_next = 0, output_node_index = ~0;
+  u32 i;
+
+  for (i = 0; i < n_probes; i++)
+    {
+      ip6_neighbor_probe_t * p = probes + i;
+      icmp6_neighbor_solicitation_header_t * h;
+      ip6_address_t * src;
+      ip_interface_address_t * ia;
+      ip_adjacency_t * adj;
+      vnet_hw_interface_t * hi;
+      vlib_buffer_t * b;
+      u32 bi, is_unicast;
+
+      src = ip6_interface_address_matching_destination (im, &p->address, p->sw_if_index, &ia);
+      if (! src)
+	{
+	  if (! error)
+	    error = clib_error_return (0, "no matching interface address for destination %U (interface %U)",
+				       format_ip6_address, &p->address,
+				       format_vnet_sw_if_index_name, vnm, p->sw_if_index);
+	  continue;
+	}
 
-  src = ip6_interface_address_matching_destination (im, dst, sw_if_index, &ia);
-  if (! src)
-    return clib_error_return (0, "no matching interface address for destination %U (interface %U)",
-			      format_ip6_address, dst,
-			      format_vnet_sw_if_index_name, vnm, sw_if_index);
+      h = vlib_packet_template_get_packet (vm, &im->discover_neighbor_packet_template, &bi);
 
-  h = vlib_packet_template_get_packet (vm, &im->discover_neighbor_packet_template, &bi);
+      hi = vnet_get_sup_hw_interface (vnm, p->sw_if_index);
 
-  hi = vnet_get_sup_hw_interface (vnm, sw_if_index);
+      is_unicast = (p->ethernet_address[0] | p->ethernet_address[1] | p->ethernet_address[2]
+		    | p->ethernet_address[3] | p->ethernet_address[4] | p->ethernet_address[5]) != 0;
 
-  /* Destination address is a solicited node multicast address.  We need to fill in
-     the low 24 bits with low 24 bits of target's address. */
-  h->ip.dst_address.as_u8[13] = dst->as_u8[13];
-  h->ip.dst_address.as_u8[14] = dst->as_u8[14];
-  h->ip.dst_address.as_u8[15] = dst->as_u8[15];
+      /* Unicast solicitation re-validates cached address (RFC 4861 7.3.3). */
+      if (is_unicast)
+	h->ip.dst_address = p->address;
+      else
+	{
+	  /* Destination address is a solicited node multicast address.  We need to fill in
+	     the low 24 bits with low 24 bits of target's address. */
+	  h->ip.dst_address.as_u8[13] = p->address.as_u8[13];
+	  h->ip.dst_address.as_u8[14] = p->address.as_u8[14];
+	  h->ip.dst_address.as_u8[15] = p->address.as_u8[15];
+	}
 
-  h->ip.src_address = src[0];
-  h->neighbor.target_address = dst[0];
+      h->ip.src_address = src[0];
+      h->neighbor.target_address = p->address;
 
-  memcpy (h->link_layer_option.ethernet_address, hi->hw_address, vec_len (hi->hw_address));
+      memcpy (h->link_layer_option.ethernet_address, hi->hw_address, vec_len (hi->hw_address));
 
-  h->neighbor.icmp.checksum = ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h->ip);
-  ASSERT (0 == ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h->ip));
+      h->neighbor.icmp.checksum = ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h->ip);
+      ASSERT (0 == ip6_tcp_udp_icmp_compute_checksum (vm, 0, &h->ip));
 
-  b = vlib_get_buffer (vm, bi);
-  vnet_buffer (b)->sw_if_index[VLIB_RX] = vnet_buffer (b)->sw_if_index[VLIB_TX] = sw_if_index;
+      b = vlib_get_buffer (vm, bi);
+      vnet_buffer (b)->sw_if_index[VLIB_RX] = vnet_buffer (b)->sw_if_index[VLIB_TX] = p->sw_if_index;
 
-  /* Add encapsulation string for software interface (e.g. ethernet header). */
-  adj = ip_get_adjacency (&im->lookup_main, ia->neighbor_probe_adj_index);
-  vnet_rewrite_one_header (adj[0], h, sizeof (ethernet_header_t));
-  vlib_buffer_advance (b, -adj->rewrite_header.data_bytes);
+      /* Add encapsulation string for software interface (e.g. ethernet header). */
+      adj = ip_get_adjacency (&im->lookup_main, ia->neighbor_probe_adj_index);
+      vnet_rewrite_one_header (adj[0], h, sizeof (ethernet_header_t));
+      vlib_buffer_advance (b, -adj->rewrite_header.data_bytes);
 
-  {
-    vlib_frame_t * f = vlib_get_frame_to_node (vm, hi->output_node_index);
-    u32 * to_next = vlib_frame_vector_args (f);
-    to_next[0] = bi;
-    f->n_vectors = 1;
-    vlib_put_frame_to_node (vm, hi->output_node_index, f);
-  }
+      if (is_unicast)
+	{
+	  ethernet_header_t * e = vlib_buffer_get_current (b);
+	  memcpy (e->dst_address, p->ethernet_address, sizeof (e->dst_address));
+	}
 
-  return /* no error */ 0;
+      if (f && (hi->output_node_index != output_node_index
+		|| f->n_vectors == VLIB_FRAME_SIZE))
+	{
+	  vlib_put_frame_to_node (vm, output_node_index, f);
+	  f = 0;
+	}
+
+      if (! f)
+	{
+	  output_node_index = hi->output_node_index;
+	  f = vlib_get_frame_to_node (vm, output_node_index);
+	  to_next = vlib_frame_vector_args (f);
+	  f->n_vectors = 0;
+	}
+
+      to_next[f->n_vectors++] = bi;
+    }
+
+  if (f)
+    vlib_put_frame_to_node (vm, output_node_index, f);
+
+  return error;
 }
 
 typedef enum {
@@ -2188,6 +2279,8 @@ ip6_rewrite_inline (vlib_main_t * vm,
 		    int rewrite_for_locally_received_packets)
 {
   ip_lookup_main_t * lm = &ip6_main.lookup_main;
+  vlib_combined_counter_main_t * cm
+    = vnet_combined_counter_shard (&lm->adjacency_counters, os_get_cpu_number ());
   u32 * from = vlib_frame_vector_args (frame);
   u32 n_left_from, n_left_to_next, * to_next, next_index;
   vlib_node_runtime_t * error_node = vlib_node_get_runtime (vm, ip6_input_node.index);
@@ -2269,20 +2362,23 @@ ip6_rewrite_inline (vlib_main_t * vm,
 	  rw_len0 = adj0[0].rewrite_header.data_bytes;
 	  rw_len1 = adj1[0].rewrite_header.data_bytes;
 
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index0,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len0);
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index1,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len1);
 
-	  /* Check MTU of outgoing interface. */
+	  /* Check MTU of outgoing interface.  TCP super segments are split
+	     at interface output. */
 	  error0 = (vlib_buffer_length_in_chain (vm, p0) > adj0[0].rewrite_header.max_l3_packet_bytes
+		    && ! (p0->flags & VNET_BUFFER_GSO)
 		    ? IP6_ERROR_MTU_EXCEEDED
 		    : error0);
 	  error1 = (vlib_buffer_length_in_chain (vm, p1) > adj1[0].rewrite_header.max_l3_packet_bytes
+		    && ! (p1->flags & VNET_BUFFER_GSO)
 		    ? IP6_ERROR_MTU_EXCEEDED
 		    : error1);
 
@@ -2347,13 +2443,14 @@ ip6_rewrite_inline (vlib_main_t * vm,
 	  /* Update packet buffer attributes/set output interface. */
 	  rw_len0 = adj0[0].rewrite_header.data_bytes;
 
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index0,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len0);
 
 	  /* Check MTU of outgoing interface. */
 	  error0 = (vlib_buffer_length_in_chain (vm, p0) > adj0[0].rewrite_header.max_l3_packet_bytes
+		    && ! (p0->flags & VNET_BUFFER_GSO)
 		    ? IP6_ERROR_MTU_EXCEEDED
 		    : error0);
 
@@ -2494,3 +2591,31 @@ ip6_lookup_init (vlib_main_t * vm)
 }
 
 VLIB_INIT_FUNCTION (ip6_lookup_init);
+
+static clib_error_t *
+ip6_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  ip6_main_t * im = &ip6_main;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "neighbor-hold-packets %d",
+		    &im->lookup_main.neighbor_pending.max_buffers_per_neighbor))
+	;
+      else if (unformat (input, "neighbor-request-limit %U",
+			 unformat_ip_neighbor_request_limit_config,
+			 &im->lookup_main.neighbor_request_limit))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  /* Held packets are re-injected as a single frame. */
+  if (im->lookup_main.neighbor_pending.max_buffers_per_neighbor > VLIB_FRAME_SIZE)
+    return clib_error_return (0, "neighbor-hold-packets must be at most %d", VLIB_FRAME_SIZE);
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (ip6_config, "ip6");
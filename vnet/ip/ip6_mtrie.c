@@ -0,0 +1,421 @@
+/*
+ * ip/ip6_mtrie.c: ip6 mtrie fib
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/ip/ip.h>
+
+/* Ply index used to refer to root ply (which is not in ply pool). */
+#define ROOT_PLY_INDEX (~0)
+
+/* Leaves, prefix lengths and non-empty count of either root or pool ply. */
+typedef struct {
+  ip6_fib_mtrie_leaf_t * leaves;
+  u8 * dst_address_bits_of_leaves;
+  i32 * n_non_empty_leafs;
+} ply_ref_t;
+
+always_inline void
+ply_ref (ip6_fib_mtrie_t * m, u32 ply_index, ply_ref_t * r)
+{
+  if (ply_index == ROOT_PLY_INDEX)
+    {
+      r->leaves = m->root_leaves;
+      r->dst_address_bits_of_leaves = m->root_dst_address_bits_of_leaves;
+      r->n_non_empty_leafs = &m->root_n_non_empty_leafs;
+    }
+  else
+    {
+      ip6_fib_mtrie_ply_t * p = pool_elt_at_index (m->ply_pool, ply_index);
+      r->leaves = p->leaves;
+      r->dst_address_bits_of_leaves = p->dst_address_bits_of_leaves;
+      r->n_non_empty_leafs = &p->n_non_empty_leafs;
+    }
+}
+
+/* Level 0 is root ply; level i > 0 is indexed by address byte i + 1. */
+always_inline u32 ply_n_bits (u32 level)
+{ return level == 0 ? IP6_FIB_MTRIE_ROOT_PLY_BITS : BITS (u8); }
+
+/* Number of address bits consumed after lookup in ply at given level. */
+always_inline u32 ply_end_bit (u32 level)
+{ return IP6_FIB_MTRIE_ROOT_PLY_BITS + BITS (u8) * level; }
+
+always_inline uword
+ply_leaf_index (ip6_address_t * a, u32 level)
+{
+  return (level == 0
+	  ? (a->as_u8[0] << 8) | a->as_u8[1]
+	  : a->as_u8[level + 1]);
+}
+
+static void
+ply_init (ip6_fib_mtrie_ply_t * p, ip6_fib_mtrie_leaf_t init, uword prefix_len)
+{
+  p->n_non_empty_leafs = ip6_fib_mtrie_leaf_is_empty (init) ? 0 : ARRAY_LEN (p->leaves);
+  memset (p->dst_address_bits_of_leaves, prefix_len, sizeof (p->dst_address_bits_of_leaves));
+
+  /* Initialize leaves. */
+#ifdef CLIB_HAVE_VEC128
+  {
+    u32x4 * l, init_x4;
+
+    init_x4 = u32x4_splat (init);
+    for (l = p->leaves_as_u32x4; l < p->leaves_as_u32x4 + ARRAY_LEN (p->leaves_as_u32x4); l += 4)
+      {
+	l[0] = init_x4;
+	l[1] = init_x4;
+	l[2] = init_x4;
+	l[3] = init_x4;
+      }
+  }
+#else
+  {
+    u32 * l;
+
+    for (l = p->leaves; l < p->leaves + ARRAY_LEN (p->leaves); l += 4)
+      {
+	l[0] = init;
+	l[1] = init;
+	l[2] = init;
+	l[3] = init;
+      }
+  }
+#endif
+}
+
+static ip6_fib_mtrie_leaf_t
+ply_create (ip6_fib_mtrie_t * m, ip6_fib_mtrie_leaf_t init_leaf, uword prefix_len)
+{
+  ip6_fib_mtrie_ply_t * p;
+
+  /* Get cache aligned ply. */
+  pool_get_aligned (m->ply_pool, p, CLIB_CACHE_LINE_BYTES);
+
+  ply_init (p, init_leaf, prefix_len);
+  return ip6_fib_mtrie_leaf_set_next_ply_index (p - m->ply_pool);
+}
+
+always_inline ip6_fib_mtrie_ply_t *
+get_next_ply_for_leaf (ip6_fib_mtrie_t * m, ip6_fib_mtrie_leaf_t l)
+{
+  uword n = ip6_fib_mtrie_leaf_get_next_ply_index (l);
+  /* It better not be the reserved ply. */
+  ASSERT (n != 0);
+  return pool_elt_at_index (m->ply_pool, n);
+}
+
+u32 ip6_mtrie_lookup_address (ip6_fib_mtrie_t * m, ip6_address_t * dst)
+{
+  ip6_fib_mtrie_leaf_t l;
+  uword i;
+
+  if (! m->root_leaves)
+    return IP_LOOKUP_MISS_ADJ_INDEX;
+
+  l = ip6_fib_mtrie_lookup_root (m, dst);
+  for (i = 2; i < ARRAY_LEN (dst->as_u8) && ! ip6_fib_mtrie_leaf_is_terminal (l); i++)
+    {
+      ip6_fib_mtrie_ply_t * p = get_next_ply_for_leaf (m, l);
+      l = p->leaves[dst->as_u8[i]];
+    }
+
+  return ip6_fib_mtrie_leaf_to_adj_index (m, l);
+}
+
+typedef struct {
+  ip6_address_t dst_address;
+  u32 dst_address_length;
+  u32 adj_index;
+} ip6_fib_mtrie_set_unset_leaf_args_t;
+
+static void
+set_ply_with_more_specific_leaf (ip6_fib_mtrie_t * m,
+				 ip6_fib_mtrie_ply_t * ply,
+				 ip6_fib_mtrie_leaf_t new_leaf,
+				 uword new_leaf_dst_address_bits)
+{
+  ip6_fib_mtrie_leaf_t old_leaf;
+  uword i;
+
+  ASSERT (ip6_fib_mtrie_leaf_is_terminal (new_leaf));
+  ASSERT (! ip6_fib_mtrie_leaf_is_empty (new_leaf));
+
+  for (i = 0; i < ARRAY_LEN (ply->leaves); i++)
+    {
+      old_leaf = ply->leaves[i];
+
+      /* Recurse into sub plies. */
+      if (! ip6_fib_mtrie_leaf_is_terminal (old_leaf))
+	{
+	  ip6_fib_mtrie_ply_t * sub_ply = get_next_ply_for_leaf (m, old_leaf);
+	  set_ply_with_more_specific_leaf (m, sub_ply, new_leaf, new_leaf_dst_address_bits);
+	}
+
+      /* Replace more specific terminal leaves with new leaf. */
+      else if (new_leaf_dst_address_bits >= ply->dst_address_bits_of_leaves[i])
+	{
+	  ply->leaves[i] = new_leaf;
+	  ply->dst_address_bits_of_leaves[i] = new_leaf_dst_address_bits;
+	  ply->n_non_empty_leafs += ip6_fib_mtrie_leaf_is_empty (old_leaf);
+	}
+    }
+}
+
+static void
+set_leaf (ip6_fib_mtrie_t * m,
+	  ip6_fib_mtrie_set_unset_leaf_args_t * a,
+	  u32 old_ply_index,
+	  u32 level)
+{
+  ip6_fib_mtrie_leaf_t old_leaf, new_leaf;
+  i32 n_dst_bits_next_plies;
+  uword leaf_index;
+  ply_ref_t old_ply;
+
+  ASSERT (a->dst_address_length > 0 && a->dst_address_length <= 128);
+  ASSERT (level <= IP6_FIB_MTRIE_N_NON_ROOT_PLY);
+
+  n_dst_bits_next_plies = a->dst_address_length - ply_end_bit (level);
+
+  leaf_index = ply_leaf_index (&a->dst_address, level);
+
+  /* Number of bits next plies <= 0 => insert leaves this ply. */
+  if (n_dst_bits_next_plies <= 0)
+    {
+      uword i, n_dst_bits_this_ply, old_leaf_is_terminal;
+
+      n_dst_bits_this_ply = -n_dst_bits_next_plies;
+      ASSERT ((leaf_index & pow2_mask (n_dst_bits_this_ply)) == 0);
+
+      for (i = leaf_index; i < leaf_index + (1 << n_dst_bits_this_ply); i++)
+	{
+	  ply_ref (m, old_ply_index, &old_ply);
+
+	  old_leaf = old_ply.leaves[i];
+	  old_leaf_is_terminal = ip6_fib_mtrie_leaf_is_terminal (old_leaf);
+
+	  /* Is leaf to be inserted more specific? */
+	  if (a->dst_address_length >= old_ply.dst_address_bits_of_leaves[i])
+	    {
+	      new_leaf = ip6_fib_mtrie_leaf_set_adj_index (a->adj_index);
+
+	      if (old_leaf_is_terminal)
+		{
+		  old_ply.dst_address_bits_of_leaves[i] = a->dst_address_length;
+		  old_ply.leaves[i] = new_leaf;
+		  old_ply.n_non_empty_leafs[0] += ip6_fib_mtrie_leaf_is_empty (old_leaf);
+		}
+	      else
+		{
+		  /* Existing leaf points to another ply.  We need to place new_leaf into all
+		     more specific slots. */
+		  ip6_fib_mtrie_ply_t * new_ply = get_next_ply_for_leaf (m, old_leaf);
+		  set_ply_with_more_specific_leaf (m, new_ply, new_leaf, a->dst_address_length);
+		}
+	    }
+
+	  else if (! old_leaf_is_terminal)
+	    set_leaf (m, a, ip6_fib_mtrie_leaf_get_next_ply_index (old_leaf), level + 1);
+	}
+    }
+  else
+    {
+      ply_ref (m, old_ply_index, &old_ply);
+      old_leaf = old_ply.leaves[leaf_index];
+      if (ip6_fib_mtrie_leaf_is_terminal (old_leaf))
+	{
+	  new_leaf = ply_create (m, old_leaf, old_ply.dst_address_bits_of_leaves[leaf_index]);
+
+	  /* Refetch since ply_create may move pool. */
+	  ply_ref (m, old_ply_index, &old_ply);
+
+	  old_ply.leaves[leaf_index] = new_leaf;
+	  old_ply.dst_address_bits_of_leaves[leaf_index] = 0;
+
+	  /* Next ply pointer counts as non-empty leaf. */
+	  old_ply.n_non_empty_leafs[0] += ip6_fib_mtrie_leaf_is_empty (old_leaf);
+	}
+      else
+	new_leaf = old_leaf;
+
+      set_leaf (m, a, ip6_fib_mtrie_leaf_get_next_ply_index (new_leaf), level + 1);
+    }
+}
+
+static uword
+unset_leaf (ip6_fib_mtrie_t * m,
+	    ip6_fib_mtrie_set_unset_leaf_args_t * a,
+	    u32 old_ply_index,
+	    u32 level)
+{
+  ip6_fib_mtrie_leaf_t old_leaf, del_leaf;
+  i32 n_dst_bits_next_plies;
+  uword i, leaf_index, n_dst_bits_this_ply, old_leaf_is_terminal;
+  ply_ref_t old_ply;
+
+  ASSERT (a->dst_address_length > 0 && a->dst_address_length <= 128);
+  ASSERT (level <= IP6_FIB_MTRIE_N_NON_ROOT_PLY);
+
+  n_dst_bits_next_plies = a->dst_address_length - ply_end_bit (level);
+
+  n_dst_bits_this_ply = n_dst_bits_next_plies <= 0 ? -n_dst_bits_next_plies : 0;
+  n_dst_bits_this_ply = clib_min (ply_n_bits (level), n_dst_bits_this_ply);
+
+  leaf_index = ply_leaf_index (&a->dst_address, level);
+  leaf_index &= ~pow2_mask (n_dst_bits_this_ply);
+
+  del_leaf = ip6_fib_mtrie_leaf_set_adj_index (a->adj_index);
+
+  ply_ref (m, old_ply_index, &old_ply);
+
+  for (i = leaf_index; i < leaf_index + (1 << n_dst_bits_this_ply); i++)
+    {
+      old_leaf = old_ply.leaves[i];
+      old_leaf_is_terminal = ip6_fib_mtrie_leaf_is_terminal (old_leaf);
+
+      /* Only remove leaves placed by this prefix; a more specific prefix may share
+	 the same adjacency. */
+      if ((old_leaf == del_leaf
+	   && old_ply.dst_address_bits_of_leaves[i] == a->dst_address_length)
+	  || (! old_leaf_is_terminal
+	      && unset_leaf (m, a, ip6_fib_mtrie_leaf_get_next_ply_index (old_leaf), level + 1)))
+	{
+	  old_ply.leaves[i] = IP6_FIB_MTRIE_LEAF_EMPTY;
+	  old_ply.dst_address_bits_of_leaves[i] = 0;
+	  old_ply.n_non_empty_leafs[0] -= 1;
+	  ASSERT (old_ply.n_non_empty_leafs[0] >= 0);
+	  if (old_ply.n_non_empty_leafs[0] == 0 && level > 0)
+	    {
+	      pool_put (m->ply_pool, pool_elt_at_index (m->ply_pool, old_ply_index));
+	      /* Old ply was deleted. */
+	      return 1;
+	    }
+	}
+    }
+
+  /* Old ply was not deleted. */
+  return 0;
+}
+
+static void mtrie_init (ip6_fib_mtrie_t * m)
+{
+  ip6_fib_mtrie_leaf_t reserved;
+  uword i;
+
+  memset (m, 0, sizeof (m[0]));
+  m->default_leaf = IP6_FIB_MTRIE_LEAF_EMPTY;
+
+  vec_validate_aligned (m->root_leaves, pow2_mask (IP6_FIB_MTRIE_ROOT_PLY_BITS),
+			CLIB_CACHE_LINE_BYTES);
+  vec_validate (m->root_dst_address_bits_of_leaves, pow2_mask (IP6_FIB_MTRIE_ROOT_PLY_BITS));
+  for (i = 0; i < vec_len (m->root_leaves); i++)
+    m->root_leaves[i] = IP6_FIB_MTRIE_LEAF_EMPTY;
+
+  reserved = ply_create (m, IP6_FIB_MTRIE_LEAF_EMPTY, /* dst_address_bits_of_leaves */ 0);
+  ASSERT (ip6_fib_mtrie_leaf_get_next_ply_index (reserved) == 0);
+}
+
+void
+ip6_fib_mtrie_add_del_route (ip6_fib_t * fib,
+			     ip6_address_t * dst_address,
+			     u32 dst_address_length,
+			     u32 adj_index,
+			     u32 is_del)
+{
+  ip6_fib_mtrie_t * m = &fib->mtrie;
+  ip6_fib_mtrie_set_unset_leaf_args_t a;
+
+  if (! m->root_leaves)
+    mtrie_init (m);
+
+  a.dst_address = dst_address[0];
+  a.dst_address_length = dst_address_length;
+  a.adj_index = adj_index;
+
+  if (! is_del)
+    {
+      if (dst_address_length == 0)
+	m->default_leaf = ip6_fib_mtrie_leaf_set_adj_index (adj_index);
+      else
+	set_leaf (m, &a, ROOT_PLY_INDEX, /* level */ 0);
+    }
+  else
+    {
+      if (dst_address_length == 0)
+	m->default_leaf = IP6_FIB_MTRIE_LEAF_EMPTY;
+
+      else
+	{
+	  ip6_main_t * im = &ip6_main;
+	  ip6_fib_mhash_t * mh;
+
+	  unset_leaf (m, &a, ROOT_PLY_INDEX, /* level */ 0);
+
+	  /* Find next less specific route and insert into mtrie.
+	     Mhash vector is sorted longest prefix length first. */
+	  vec_foreach (mh, fib->non_empty_dst_address_length_mhash)
+	    {
+	      ip6_address_t key;
+	      uword * p;
+
+	      if (mh->dst_address_length >= dst_address_length
+		  || mh->dst_address_length == 0)
+		continue;
+
+	      key = dst_address[0];
+	      ip6_address_mask (&key, &im->fib_masks[mh->dst_address_length]);
+	      p = mhash_get (&mh->adj_index_by_dst_address, &key);
+	      if (p)
+		{
+		  a.dst_address = key;
+		  a.dst_address_length = mh->dst_address_length;
+		  a.adj_index = p[0];
+		  set_leaf (m, &a, ROOT_PLY_INDEX, /* level */ 0);
+		  break;
+		}
+	    }
+	}
+    }
+}
+
+/* Returns number of bytes of memory used by mtrie. */
+static uword mtrie_memory_usage (ip6_fib_mtrie_t * m)
+{
+  return (vec_bytes (m->root_leaves)
+	  + vec_bytes (m->root_dst_address_bits_of_leaves)
+	  + pool_elts (m->ply_pool) * sizeof (m->ply_pool[0]));
+}
+
+u8 * format_ip6_fib_mtrie (u8 * s, va_list * va)
+{
+  ip6_fib_mtrie_t * m = va_arg (*va, ip6_fib_mtrie_t *);
+
+  /* Do not count reserved ply. */
+  s = format (s, "%d plies, %d non-empty root leaves, memory usage %U",
+	      pool_elts (m->ply_pool) > 0 ? pool_elts (m->ply_pool) - 1 : 0,
+	      m->root_n_non_empty_leafs,
+	      format_memory_size, mtrie_memory_usage (m));
+
+  return s;
+}
@@ -0,0 +1,182 @@
+/*
+ * ip/ip6_mtrie.h: ip6 mtrie fib
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef included_ip_ip6_mtrie_h
+#define included_ip_ip6_mtrie_h
+
+#include <clib/cache.h>
+#include <clib/vector.h>
+#include <vnet/ip/lookup.h>
+#include <vnet/ip/ip6_packet.h>	/* for ip6_address_t */
+
+/* ip6 fib leafs: 15 ply 16-8-8-...-8 mtrie.
+   Root ply is indexed by the first 16 bits of the destination;
+   each following ply by one more byte.
+   Leaf encoding is the same as for ip4 mtrie:
+   1 + 2*adj_index for terminal leaves.
+   0 + 2*next_ply_index for non-terminals.
+   1 => empty (adjacency index of zero is special miss adjacency).
+   Root ply is not in ply pool.  Ply pool index 0 is a reserved empty ply
+   so that lock step lookups past a terminal leaf always read valid memory. */
+typedef u32 ip6_fib_mtrie_leaf_t;
+
+#define IP6_FIB_MTRIE_LEAF_EMPTY (1 + 2*IP_LOOKUP_MISS_ADJ_INDEX)
+
+/* Number of bits consumed by root ply. */
+#define IP6_FIB_MTRIE_ROOT_PLY_BITS 16
+
+/* Number of plies below root needed to cover 128 bit address. */
+#define IP6_FIB_MTRIE_N_NON_ROOT_PLY ((128 - IP6_FIB_MTRIE_ROOT_PLY_BITS) / BITS (u8))
+
+always_inline u32 ip6_fib_mtrie_leaf_is_empty (ip6_fib_mtrie_leaf_t n)
+{ return n == IP6_FIB_MTRIE_LEAF_EMPTY; }
+
+always_inline u32 ip6_fib_mtrie_leaf_is_non_empty (ip6_fib_mtrie_leaf_t n)
+{ return n != IP6_FIB_MTRIE_LEAF_EMPTY; }
+
+always_inline u32 ip6_fib_mtrie_leaf_is_terminal (ip6_fib_mtrie_leaf_t n)
+{ return n & 1; }
+
+always_inline u32 ip6_fib_mtrie_leaf_get_adj_index (ip6_fib_mtrie_leaf_t n)
+{
+  ASSERT (ip6_fib_mtrie_leaf_is_terminal (n));
+  return n >> 1;
+}
+
+always_inline ip6_fib_mtrie_leaf_t ip6_fib_mtrie_leaf_set_adj_index (u32 adj_index)
+{
+  ip6_fib_mtrie_leaf_t l;
+  l = 1 + 2*adj_index;
+  ASSERT (ip6_fib_mtrie_leaf_get_adj_index (l) == adj_index);
+  return l;
+}
+
+always_inline u32 ip6_fib_mtrie_leaf_is_next_ply (ip6_fib_mtrie_leaf_t n)
+{ return (n & 1) == 0; }
+
+always_inline u32 ip6_fib_mtrie_leaf_get_next_ply_index (ip6_fib_mtrie_leaf_t n)
+{
+  ASSERT (ip6_fib_mtrie_leaf_is_next_ply (n));
+  return n >> 1;
+}
+
+always_inline ip6_fib_mtrie_leaf_t ip6_fib_mtrie_leaf_set_next_ply_index (u32 i)
+{
+  ip6_fib_mtrie_leaf_t l;
+  l = 0 + 2*i;
+  ASSERT (ip6_fib_mtrie_leaf_get_next_ply_index (l) == i);
+  return l;
+}
+
+/* One 8 bit ply of the mtrie (all plies except root). */
+typedef struct {
+  union {
+    ip6_fib_mtrie_leaf_t leaves[256];
+
+#ifdef CLIB_HAVE_VEC128
+    u32x4 leaves_as_u32x4[256 / 4];
+#endif
+  };
+
+  /* Prefix length for terminal leaves. */
+  u8 dst_address_bits_of_leaves[256];
+
+  /* Number of non-empty leafs (whether terminal or not). */
+  i32 n_non_empty_leafs;
+
+  /* Pad to cache line boundary. */
+  u8 pad[CLIB_CACHE_LINE_BYTES
+	 - 1 * sizeof (i32)];
+} ip6_fib_mtrie_ply_t;
+
+typedef struct {
+  /* Root ply: 1 << 16 leaves indexed by first 2 bytes of destination.
+     Kept out of ply pool since it is 256 times the size of other plies. */
+  ip6_fib_mtrie_leaf_t * root_leaves;
+
+  /* Prefix length for terminal root leaves. */
+  u8 * root_dst_address_bits_of_leaves;
+
+  /* Number of non-empty root leafs. */
+  i32 root_n_non_empty_leafs;
+
+  /* Pool of non-root plies.  Index zero is reserved (see above). */
+  ip6_fib_mtrie_ply_t * ply_pool;
+
+  /* Special case leaf for default route ::/0. */
+  ip6_fib_mtrie_leaf_t default_leaf;
+} ip6_fib_mtrie_t;
+
+struct ip6_fib_t;
+
+void ip6_fib_mtrie_add_del_route (struct ip6_fib_t * f,
+				  ip6_address_t * dst_address,
+				  u32 dst_address_length,
+				  u32 adj_index,
+				  u32 is_del);
+
+/* Returns adjacency index. */
+u32 ip6_mtrie_lookup_address (ip6_fib_mtrie_t * m, ip6_address_t * dst);
+
+format_function_t format_ip6_fib_mtrie;
+
+/* First lookup step: index root ply with first 16 bits of destination.
+   Destination may be unaligned (e.g. straight from packet header). */
+always_inline ip6_fib_mtrie_leaf_t
+ip6_fib_mtrie_lookup_root (ip6_fib_mtrie_t * m, ip6_address_t * dst_address)
+{
+  u32 i = (dst_address->as_u8[0] << 8) | dst_address->as_u8[1];
+  return m->root_leaves[i];
+}
+
+/* Lookup step for non-root plies.  Processes 1 byte of 16 byte ip6 address.
+   Terminal leaves are sticky so that lookups of a pair of packets can be
+   run in lock step. */
+always_inline ip6_fib_mtrie_leaf_t
+ip6_fib_mtrie_lookup_step (ip6_fib_mtrie_t * m,
+			   ip6_fib_mtrie_leaf_t current_leaf,
+			   ip6_address_t * dst_address,
+			   u32 dst_address_byte_index)
+{
+  ip6_fib_mtrie_leaf_t next_leaf;
+  ip6_fib_mtrie_ply_t * ply;
+  uword current_is_terminal = ip6_fib_mtrie_leaf_is_terminal (current_leaf);
+
+  ply = m->ply_pool + (current_is_terminal ? 0 : (current_leaf >> 1));
+  next_leaf = ply->leaves[dst_address->as_u8[dst_address_byte_index]];
+  next_leaf = current_is_terminal ? current_leaf : next_leaf;
+
+  return next_leaf;
+}
+
+/* Map final leaf to adjacency index handling default route. */
+always_inline u32
+ip6_fib_mtrie_leaf_to_adj_index (ip6_fib_mtrie_t * m, ip6_fib_mtrie_leaf_t l)
+{
+  l = ip6_fib_mtrie_leaf_is_empty (l) ? m->default_leaf : l;
+  return ip6_fib_mtrie_leaf_get_adj_index (l);
+}
+
+#endif /* included_ip_ip6_mtrie_h */
@@ -25,6 +25,7 @@
 
 #include <vnet/ip/ip.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vnet/timer_wheel.h>
 #include <clib/mhash.h>
 
 typedef struct {
@@ -35,7 +36,12 @@ typedef struct {
 typedef struct {
   ip6_neighbor_key_t key;
   u8 link_layer_address[8];
+
+  u16 flags;
+#define IP6_NEIGHBOR_FLAG_STATIC (1 << 0)
+
   u64 cpu_time_last_updated;
+  ip_neighbor_age_t age;
 } ip6_neighbor_t;
 
 typedef struct {
@@ -47,10 +53,21 @@ typedef struct {
   ip6_neighbor_t * neighbor_pool;
 
   mhash_t neighbor_index_by_key;
+
+  /* Aging timers; user data is neighbor pool index. */
+  vnet_timer_wheel_t aging_timer_wheel;
+
+  ip_neighbor_aging_config_t aging_config;
+
+  /* Neighbors deleted after failing to respond to probes or going unused. */
+  u64 n_aged_out;
 } ip6_neighbor_main_t;
 
 static ip6_neighbor_main_t ip6_neighbor_main;
 
+/* Seconds per aging timer wheel tick. */
+#define IP6_NEIGHBOR_AGING_TICK_INTERVAL 100e-3
+
 static u8 * format_ip6_neighbor_ip6_entry (u8 * s, va_list * va)
 {
   vlib_main_t * vm = va_arg (*va, vlib_main_t *);
@@ -59,13 +76,14 @@ static u8 * format_ip6_neighbor_ip6_entry (u8 * s, va_list * va)
   vnet_sw_interface_t * si;
 
   if (! n)
-    return format (s, "%=12s%=20s%=20s%=40s", "Time", "Address", "Link layer", "Interface");
+    return format (s, "%=12s%=20s%=20s%=12s%=40s", "Time", "Address", "Link layer", "State", "Interface");
 
   si = vnet_get_sw_interface (vnm, n->key.sw_if_index);
-  s = format (s, "%=12U%=20U%=20U%=40U",
+  s = format (s, "%=12U%=20U%=20U%=12U%=40U",
 	      format_vlib_cpu_time, vm, n->cpu_time_last_updated,
 	      format_ip6_address, &n->key.ip6_address,
 	      format_ethernet_address, n->link_layer_address,
+	      format_ip_neighbor_state, n->age.state,
 	      format_vnet_sw_interface_name, vnm, si);
 
   return s;
@@ -91,11 +109,15 @@ ip6_neighbor_sw_interface_up_down (vnet_main_t * vm,
       for (i = 0; i < vec_len (to_delete); i++)
 	{
 	  n = pool_elt_at_index (nm->neighbor_pool, to_delete[i]);
+	  if (n->age.timer_handle != ~0)
+	    vnet_timer_wheel_stop (&nm->aging_timer_wheel, n->age.timer_handle);
 	  mhash_unset (&nm->neighbor_index_by_key, &n->key, 0);
 	  pool_put (nm->neighbor_pool, n);
 	}
 
       vec_free (to_delete);
+
+      ip_neighbor_pending_flush (vm->vlib_main, &ip6_main.lookup_main, sw_if_index);
     }
 
   return 0;
@@ -109,7 +131,8 @@ set_ethernet_neighbor (vlib_main_t * vm,
 		       u32 sw_if_index,
 		       ip6_address_t * a,
 		       u8 * link_layer_address,
-		       uword n_bytes_link_layer_address)
+		       uword n_bytes_link_layer_address,
+		       uword is_static)
 {
   vnet_main_t * vnm = &vnet_main;
   ip6_neighbor_key_t k;
@@ -122,7 +145,13 @@ set_ethernet_neighbor (vlib_main_t * vm,
 
   p = mhash_get (&nm->neighbor_index_by_key, &k);
   if (p)
-    n = pool_elt_at_index (nm->neighbor_pool, p[0]);
+    {
+      n = pool_elt_at_index (nm->neighbor_pool, p[0]);
+
+      /* Refuse to over-write static neighbor with learned mapping. */
+      if ((n->flags & IP6_NEIGHBOR_FLAG_STATIC) && ! is_static)
+	return;
+    }
   else
     {
       ip6_add_del_route_args_t args;
@@ -152,11 +181,63 @@ set_ethernet_neighbor (vlib_main_t * vm,
       mhash_set (&nm->neighbor_index_by_key, &k, n - nm->neighbor_pool,
 		 /* old value */ 0);
       n->key = k;
+      n->flags = 0;
+      n->age.timer_handle = ~0;
+      n->age.n_packets_last = 0;
     }
 
   /* Update time stamp and ethernet address. */
   memcpy (n->link_layer_address, link_layer_address, n_bytes_link_layer_address);
   n->cpu_time_last_updated = clib_cpu_time_now ();
+
+  if (is_static)
+    {
+      /* Static neighbors never age. */
+      n->flags |= IP6_NEIGHBOR_FLAG_STATIC;
+      if (n->age.timer_handle != ~0)
+	vnet_timer_wheel_stop (&nm->aging_timer_wheel, n->age.timer_handle);
+      n->age.timer_handle = ~0;
+      n->age.state = IP_NEIGHBOR_STATE_STATIC;
+    }
+  else
+    {
+      /* Timer re-checks confirmation time when it expires so there is no
+	 need to restart a running timer. */
+      ip_neighbor_age_confirm (&n->age, vlib_time_now (vm));
+      if (n->age.timer_handle == ~0)
+	n->age.timer_handle = vnet_timer_wheel_start (&nm->aging_timer_wheel,
+						      n - nm->neighbor_pool,
+						      nm->aging_config.reachable_time);
+    }
+
+  /* Send packets held by ip6-discover-neighbor while address was being
+     resolved.  Entry may already exist (e.g. refreshed by a late
+     advertisement). */
+  ip_neighbor_pending_resolved (vm, &im->lookup_main, sw_if_index, a);
+}
+
+static void
+unset_ethernet_neighbor (ip6_neighbor_main_t * nm, ip6_neighbor_t * n)
+{
+  ip6_main_t * im = &ip6_main;
+  ip6_add_del_route_args_t args;
+
+  if (n->age.timer_handle != ~0)
+    vnet_timer_wheel_stop (&nm->aging_timer_wheel, n->age.timer_handle);
+
+  /* Old adjacency is deleted with route. */
+  args.table_index_or_table_id = im->fib_index_by_sw_if_index[n->key.sw_if_index];
+  args.flags = IP6_ROUTE_FLAG_FIB_INDEX | IP6_ROUTE_FLAG_DEL;
+  args.dst_address = n->key.ip6_address;
+  args.dst_address_length = 128;
+  args.adj_index = ~0;
+  args.add_adj = 0;
+  args.n_add_adj = 0;
+
+  ip6_add_del_route (im, &args);
+
+  mhash_unset (&nm->neighbor_index_by_key, &n->key, 0);
+  pool_put (nm->neighbor_pool, n);
 }
 
 static int
@@ -196,6 +277,8 @@ show_ip6_neighbors (vlib_main_t * vm,
   }
   vec_free (ns);
 
+  vlib_cli_output (vm, "%Ld neighbors aged out", nm->n_aged_out);
+
   return error;
 }
 
@@ -205,6 +288,73 @@ static VLIB_CLI_COMMAND (show_ip6_neighbors_command) = {
   .short_help = "Show ip6 neighbors",
 };
 
+void
+ip6_add_del_ethernet_neighbor (ip6_address_t * a,
+			       u8 * ethernet_address,
+			       u32 sw_if_index,
+			       u32 is_static,
+			       u32 is_del)
+{
+  vnet_main_t * vnm = &vnet_main;
+  ip6_neighbor_main_t * nm = &ip6_neighbor_main;
+  ip6_neighbor_key_t k;
+  uword * p;
+
+  if (! is_del)
+    {
+      set_ethernet_neighbor (vnm->vlib_main, nm, sw_if_index, a,
+			     ethernet_address, 6, is_static);
+      return;
+    }
+
+  k.sw_if_index = sw_if_index;
+  k.ip6_address = a[0];
+  p = mhash_get (&nm->neighbor_index_by_key, &k);
+  if (p)
+    unset_ethernet_neighbor (nm, pool_elt_at_index (nm->neighbor_pool, p[0]));
+}
+
+static clib_error_t *
+set_ip6_neighbor (vlib_main_t * vm,
+		  unformat_input_t * input,
+		  vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = &vnet_main;
+  ip6_address_t a;
+  u8 ethernet_address[6];
+  u32 sw_if_index;
+  int addr_valid = 0, is_del = 0, is_static = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U %U %U",
+		    unformat_vnet_sw_interface, vnm, &sw_if_index,
+		    unformat_ip6_address, &a,
+		    unformat_ethernet_address, ethernet_address))
+	addr_valid = 1;
+      else if (unformat (input, "delete") || unformat (input, "del"))
+	is_del = 1;
+      else if (unformat (input, "static"))
+	is_static = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (! addr_valid)
+    return clib_error_return (0, "expected interface, address and ethernet address");
+
+  ip6_add_del_ethernet_neighbor (&a, ethernet_address, sw_if_index, is_static, is_del);
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (set_ip6_neighbor_command) = {
+  .path = "set ip6 neighbor",
+  .function = set_ip6_neighbor,
+  .short_help = "set ip6 neighbor [del] [static] <intfc> <ip6> <mac>",
+};
+
 typedef enum {
   ICMP6_NEIGHBOR_SOLICITATION_NEXT_DROP,
   ICMP6_NEIGHBOR_SOLICITATION_NEXT_REPLY,
@@ -295,7 +445,8 @@ icmp6_neighbor_solicitation_or_advertisement (vlib_main_t * vm,
 	    set_ethernet_neighbor (vm, nm, sw_if_index0,
 				   is_solicitation ? &ip0->src_address : &h0->target_address,
 				   o0->ethernet_address,
-				   sizeof (o0->ethernet_address));
+				   sizeof (o0->ethernet_address),
+				   /* is_static */ 0);
 
 	  if (is_solicitation && error0 == ICMP6_ERROR_NONE)
 	    {
@@ -405,6 +556,114 @@ static VLIB_REGISTER_NODE (ip6_icmp_neighbor_advertisement_node) = {
   },
 };
 
+static void
+ip6_neighbor_age (vlib_main_t * vm, ip6_neighbor_main_t * nm)
+{
+  ip6_main_t * im = &ip6_main;
+  static u32 * expired;
+  static ip6_neighbor_probe_t * probes;
+  ip6_neighbor_t * n;
+  f64 now = vlib_time_now (vm);
+  u32 i;
+
+  vec_reset_length (expired);
+  vec_reset_length (probes);
+  expired = vnet_timer_wheel_advance (&nm->aging_timer_wheel, now, expired);
+
+  for (i = 0; i < vec_len (expired); i++)
+    {
+      vlib_counter_t c;
+      u32 adj_index;
+      f64 dt;
+
+      n = pool_elt_at_index (nm->neighbor_pool, expired[i]);
+      n->age.timer_handle = ~0;
+
+      adj_index = ip6_fib_lookup_with_table (im, im->fib_index_by_sw_if_index[n->key.sw_if_index],
+					     &n->key.ip6_address);
+      vnet_get_combined_counter (&im->lookup_main.adjacency_counters, adj_index, &c);
+
+      switch (ip_neighbor_age_timer_expired (&nm->aging_config, &n->age, now, c.packets, &dt))
+	{
+	case IP_NEIGHBOR_STATE_FAILED:
+	  unset_ethernet_neighbor (nm, n);
+	  nm->n_aged_out += 1;
+	  continue;
+
+	case IP_NEIGHBOR_STATE_PROBE:
+	  {
+	    ip6_neighbor_probe_t * p;
+	    vec_add2 (probes, p, 1);
+	    p->address = n->key.ip6_address;
+	    p->sw_if_index = n->key.sw_if_index;
+	    memcpy (p->ethernet_address, n->link_layer_address, sizeof (p->ethernet_address));
+	  }
+	  break;
+
+	default:
+	  break;
+	}
+
+      n->age.timer_handle = vnet_timer_wheel_start (&nm->aging_timer_wheel, expired[i], dt);
+    }
+
+  if (vec_len (probes) > 0)
+    {
+      clib_error_t * error;
+
+      /* Probes out same interface share frames. */
+      vec_sort (probes, p1, p2, (word) p1->sw_if_index - (word) p2->sw_if_index);
+
+      /* Probes for interfaces which lost their address fail and age out. */
+      error = ip6_probe_neighbors (vm, probes, vec_len (probes));
+      if (error)
+	clib_error_free (error);
+    }
+}
+
+static uword
+ip6_neighbor_aging_process (vlib_main_t * vm,
+			    vlib_node_runtime_t * rt,
+			    vlib_frame_t * f)
+{
+  ip6_neighbor_main_t * nm = &ip6_neighbor_main;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, IP6_NEIGHBOR_AGING_TICK_INTERVAL);
+
+      if (vnet_timer_wheel_n_running (&nm->aging_timer_wheel) > 0)
+	ip6_neighbor_age (vm, nm);
+    }
+
+  return 0;
+}
+
+static VLIB_REGISTER_NODE (ip6_neighbor_aging_process_node) = {
+  .function = ip6_neighbor_aging_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "ip6-neighbor-aging",
+};
+
+static clib_error_t *
+ip6_neighbor_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  ip6_neighbor_main_t * nm = &ip6_neighbor_main;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat_user (input, unformat_ip_neighbor_aging_config, &nm->aging_config))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (ip6_neighbor_config, "ip6-neighbor");
+
 static clib_error_t * ip6_neighbor_init (vlib_main_t * vm)
 {
   ip6_neighbor_main_t * nm = &ip6_neighbor_main;
@@ -413,6 +672,9 @@ static clib_error_t * ip6_neighbor_init (vlib_main_t * vm)
 	      /* value size */ sizeof (uword),
 	      /* key size */ sizeof (ip6_neighbor_key_t));
 
+  ip_neighbor_aging_config_init (&nm->aging_config);
+  vnet_timer_wheel_init (&nm->aging_timer_wheel, IP6_NEIGHBOR_AGING_TICK_INTERVAL, vlib_time_now (vm));
+
   icmp6_register_type (vm, ICMP6_neighbor_solicitation, ip6_icmp_neighbor_solicitation_node.index);
   icmp6_register_type (vm, ICMP6_neighbor_advertisement, ip6_icmp_neighbor_advertisement_node.index);
 
@@ -218,6 +218,30 @@ always_inline void *
 ip6_next_header (ip6_header_t * i)
 { return (void *) (i + 1); }
 
+/* Fragment extension header (IP_PROTOCOL_IPV6_FRAGMENTATION). */
+typedef CLIB_PACKED (struct {
+  /* Protocol of fragmented part of packet. */
+  u8 next_header;
+
+  u8 reserved;
+
+  /* 13 bits of fragment offset (in units of 8 byte quantities),
+     2 reserved bits and more fragments flag. */
+  u16 fragment_offset_and_more;
+#define IP6_FRAGMENT_HEADER_FLAG_MORE_FRAGMENTS (1 << 0)
+
+  u32 fragment_id;
+}) ip6_fragment_header_t;
+
+/* Fragment offset in bytes. */
+always_inline int
+ip6_fragment_header_offset_bytes (ip6_fragment_header_t * f)
+{ return clib_net_to_host_u16 (f->fragment_offset_and_more) &~ 7; }
+
+always_inline int
+ip6_fragment_header_more_fragments (ip6_fragment_header_t * f)
+{ return (clib_net_to_host_u16 (f->fragment_offset_and_more) & IP6_FRAGMENT_HEADER_FLAG_MORE_FRAGMENTS) != 0; }
+
 always_inline void
 ip6_tcp_reply_x1 (ip6_header_t * ip0, tcp_header_t * tcp0)
 {
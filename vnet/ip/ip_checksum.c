@@ -25,14 +25,329 @@
 
 #include <vnet/ip/ip.h>
 
+/* Checksum kernels sum whole 64 byte blocks of 8 byte aligned data.
+   Vector kernels are compiled for their instruction set regardless of
+   compiler flags and are used only when the cpu supports them. */
+#define IP_CSUM_BLOCK_BYTES 64
+
+typedef ip_csum_t (ip_csum_blocks_function_t) (ip_csum_t sum, void * data, uword n_blocks);
+
+typedef ip_csum_t (ip_csum_and_memcpy_blocks_function_t)
+  (ip_csum_t sum, void * dst, void * src, uword n_blocks);
+
+static ip_csum_t
+ip_csum_blocks_scalar (ip_csum_t sum, void * data, uword n_blocks)
+{
+  ip_csum_t * d = data;
+  ip_csum_t sum0 = sum, sum1 = 0;
+  uword i, n_words = n_blocks * (IP_CSUM_BLOCK_BYTES / sizeof (d[0]));
+
+  for (i = 0; i < n_words; i += 2)
+    {
+      sum0 = ip_csum_with_carry (sum0, d[i + 0]);
+      sum1 = ip_csum_with_carry (sum1, d[i + 1]);
+    }
+
+  return ip_csum_with_carry (sum0, sum1);
+}
+
+static ip_csum_t
+ip_csum_and_memcpy_blocks_scalar (ip_csum_t sum, void * dst, void * src, uword n_blocks)
+{
+  ip_csum_t * d = dst, * s = src;
+  ip_csum_t sum0 = sum, sum1 = 0;
+  uword i, n_words = n_blocks * (IP_CSUM_BLOCK_BYTES / sizeof (d[0]));
+
+  for (i = 0; i < n_words; i += 2)
+    {
+      ip_csum_t x0, x1;
+
+      x0 = clib_mem_unaligned (&s[i + 0], ip_csum_t);
+      x1 = clib_mem_unaligned (&s[i + 1], ip_csum_t);
+
+      d[i + 0] = x0;
+      d[i + 1] = x1;
+
+      sum0 = ip_csum_with_carry (sum0, x0);
+      sum1 = ip_csum_with_carry (sum1, x1);
+    }
+
+  return ip_csum_with_carry (sum0, sum1);
+}
+
+#ifdef __x86_64__
+
+#include <immintrin.h>
+
+/* Vector kernels add 32 bit halves of each 64 bit word into 64 bit lanes.
+   Since 2^32 = 1 mod 2^16 - 1 this is the same one's complement sum once
+   lanes are combined with carry.  Lanes overflow only after 2^30 blocks. */
+
+#define ip_csum_sse2_add(s0,s1,x,zero)			\
+do {							\
+  (s0) = _mm_add_epi64 ((s0), _mm_unpacklo_epi32 ((x), (zero)));	\
+  (s1) = _mm_add_epi64 ((s1), _mm_unpackhi_epi32 ((x), (zero)));	\
+} while (0)
+
+static __attribute__ ((target ("sse2"))) ip_csum_t
+ip_csum_sse2_combine (ip_csum_t sum, __m128i s0, __m128i s1)
+{
+  u64 r[2];
+
+  _mm_storeu_si128 ((__m128i *) r, _mm_add_epi64 (s0, s1));
+  sum = ip_csum_with_carry (sum, r[0]);
+  sum = ip_csum_with_carry (sum, r[1]);
+  return sum;
+}
+
+static __attribute__ ((target ("sse2"))) ip_csum_t
+ip_csum_blocks_sse2 (ip_csum_t sum, void * data, uword n_blocks)
+{
+  __m128i * d = data;
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i s0 = zero, s1 = zero;
+  uword i;
+
+  for (i = 0; i < n_blocks; i++)
+    {
+      __m128i x0, x1, x2, x3;
+
+      x0 = _mm_loadu_si128 (d + 0);
+      x1 = _mm_loadu_si128 (d + 1);
+      x2 = _mm_loadu_si128 (d + 2);
+      x3 = _mm_loadu_si128 (d + 3);
+
+      ip_csum_sse2_add (s0, s1, x0, zero);
+      ip_csum_sse2_add (s0, s1, x1, zero);
+      ip_csum_sse2_add (s0, s1, x2, zero);
+      ip_csum_sse2_add (s0, s1, x3, zero);
+
+      d += 4;
+    }
+
+  return ip_csum_sse2_combine (sum, s0, s1);
+}
+
+static __attribute__ ((target ("sse2"))) ip_csum_t
+ip_csum_and_memcpy_blocks_sse2 (ip_csum_t sum, void * dst, void * src, uword n_blocks)
+{
+  __m128i * d = dst, * s = src;
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i s0 = zero, s1 = zero;
+  uword i;
+
+  for (i = 0; i < n_blocks; i++)
+    {
+      __m128i x0, x1, x2, x3;
+
+      x0 = _mm_loadu_si128 (s + 0);
+      x1 = _mm_loadu_si128 (s + 1);
+      x2 = _mm_loadu_si128 (s + 2);
+      x3 = _mm_loadu_si128 (s + 3);
+
+      _mm_storeu_si128 (d + 0, x0);
+      _mm_storeu_si128 (d + 1, x1);
+      _mm_storeu_si128 (d + 2, x2);
+      _mm_storeu_si128 (d + 3, x3);
+
+      ip_csum_sse2_add (s0, s1, x0, zero);
+      ip_csum_sse2_add (s0, s1, x1, zero);
+      ip_csum_sse2_add (s0, s1, x2, zero);
+      ip_csum_sse2_add (s0, s1, x3, zero);
+
+      d += 4;
+      s += 4;
+    }
+
+  return ip_csum_sse2_combine (sum, s0, s1);
+}
+
+#define ip_csum_avx2_add(s0,s1,x,zero)			\
+do {							\
+  (s0) = _mm256_add_epi64 ((s0), _mm256_unpacklo_epi32 ((x), (zero)));	\
+  (s1) = _mm256_add_epi64 ((s1), _mm256_unpackhi_epi32 ((x), (zero)));	\
+} while (0)
+
+static __attribute__ ((target ("avx2"))) ip_csum_t
+ip_csum_avx2_combine (ip_csum_t sum, __m256i s0, __m256i s1)
+{
+  u64 r[4];
+  uword i;
+
+  _mm256_storeu_si256 ((__m256i *) r, _mm256_add_epi64 (s0, s1));
+  for (i = 0; i < ARRAY_LEN (r); i++)
+    sum = ip_csum_with_carry (sum, r[i]);
+  return sum;
+}
+
+static __attribute__ ((target ("avx2"))) ip_csum_t
+ip_csum_blocks_avx2 (ip_csum_t sum, void * data, uword n_blocks)
+{
+  __m256i * d = data;
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i s0 = zero, s1 = zero;
+  uword i;
+
+  for (i = 0; i < n_blocks; i++)
+    {
+      __m256i x0, x1;
+
+      x0 = _mm256_loadu_si256 (d + 0);
+      x1 = _mm256_loadu_si256 (d + 1);
+
+      ip_csum_avx2_add (s0, s1, x0, zero);
+      ip_csum_avx2_add (s0, s1, x1, zero);
+
+      d += 2;
+    }
+
+  return ip_csum_avx2_combine (sum, s0, s1);
+}
+
+static __attribute__ ((target ("avx2"))) ip_csum_t
+ip_csum_and_memcpy_blocks_avx2 (ip_csum_t sum, void * dst, void * src, uword n_blocks)
+{
+  __m256i * d = dst, * s = src;
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i s0 = zero, s1 = zero;
+  uword i;
+
+  for (i = 0; i < n_blocks; i++)
+    {
+      __m256i x0, x1;
+
+      x0 = _mm256_loadu_si256 (s + 0);
+      x1 = _mm256_loadu_si256 (s + 1);
+
+      _mm256_storeu_si256 (d + 0, x0);
+      _mm256_storeu_si256 (d + 1, x1);
+
+      ip_csum_avx2_add (s0, s1, x0, zero);
+      ip_csum_avx2_add (s0, s1, x1, zero);
+
+      d += 2;
+      s += 2;
+    }
+
+  return ip_csum_avx2_combine (sum, s0, s1);
+}
+
+#endif /* __x86_64__ */
+
+static struct {
+  ip_csum_blocks_function_t * blocks;
+  ip_csum_and_memcpy_blocks_function_t * and_memcpy_blocks;
+} ip_csum_kernels[IP_N_CSUM_IMPLEMENTATION] = {
+  [IP_CSUM_IMPLEMENTATION_scalar] = {
+    .blocks = ip_csum_blocks_scalar,
+    .and_memcpy_blocks = ip_csum_and_memcpy_blocks_scalar,
+  },
+#ifdef __x86_64__
+  [IP_CSUM_IMPLEMENTATION_sse2] = {
+    .blocks = ip_csum_blocks_sse2,
+    .and_memcpy_blocks = ip_csum_and_memcpy_blocks_sse2,
+  },
+  [IP_CSUM_IMPLEMENTATION_avx2] = {
+    .blocks = ip_csum_blocks_avx2,
+    .and_memcpy_blocks = ip_csum_and_memcpy_blocks_avx2,
+  },
+#endif
+};
+
+static ip_csum_blocks_function_t ip_csum_blocks_first_call;
+static ip_csum_and_memcpy_blocks_function_t ip_csum_and_memcpy_blocks_first_call;
+
+/* Best kernel is selected on first call. */
+static ip_csum_blocks_function_t * ip_csum_blocks = ip_csum_blocks_first_call;
+static ip_csum_and_memcpy_blocks_function_t * ip_csum_and_memcpy_blocks
+  = ip_csum_and_memcpy_blocks_first_call;
+
+static ip_csum_implementation_t ip_csum_implementation;
+
+static uword
+ip_csum_implementation_is_supported (ip_csum_implementation_t i)
+{
+  if (i >= IP_N_CSUM_IMPLEMENTATION || ! ip_csum_kernels[i].blocks)
+    return 0;
+
+#ifdef __x86_64__
+  __builtin_cpu_init ();
+  if (i == IP_CSUM_IMPLEMENTATION_sse2)
+    return __builtin_cpu_supports ("sse2");
+  if (i == IP_CSUM_IMPLEMENTATION_avx2)
+    return __builtin_cpu_supports ("avx2");
+#endif
+
+  return 1;
+}
+
+uword
+ip_csum_implementation_select (ip_csum_implementation_t i)
+{
+  if (! ip_csum_implementation_is_supported (i))
+    return 0;
+
+  ip_csum_implementation = i;
+  ip_csum_blocks = ip_csum_kernels[i].blocks;
+  ip_csum_and_memcpy_blocks = ip_csum_kernels[i].and_memcpy_blocks;
+  return 1;
+}
+
+static void
+ip_csum_implementation_select_best (void)
+{
+  ip_csum_implementation_t i = IP_N_CSUM_IMPLEMENTATION;
+
+  /* Implementations are listed slowest first. */
+  while (i-- > 0)
+    if (ip_csum_implementation_select (i))
+      break;
+}
+
+ip_csum_implementation_t
+ip_csum_implementation_current (void)
+{
+  if (ip_csum_blocks == ip_csum_blocks_first_call)
+    ip_csum_implementation_select_best ();
+  return ip_csum_implementation;
+}
+
+static ip_csum_t
+ip_csum_blocks_first_call (ip_csum_t sum, void * data, uword n_blocks)
+{
+  ip_csum_implementation_select_best ();
+  return ip_csum_blocks (sum, data, n_blocks);
+}
+
+static ip_csum_t
+ip_csum_and_memcpy_blocks_first_call (ip_csum_t sum, void * dst, void * src, uword n_blocks)
+{
+  ip_csum_implementation_select_best ();
+  return ip_csum_and_memcpy_blocks (sum, dst, src, n_blocks);
+}
+
 ip_csum_t
 ip_incremental_checksum (ip_csum_t sum, void * _data, uword n_bytes)
 {
   uword data = pointer_to_uword (_data);
+  uword is_odd = data % 2;
   ip_csum_t sum0, sum1;
 
-  sum0 = 0;
-  sum1 = sum;
+  sum0 = sum1 = 0;
+
+  if (n_bytes == 0)
+    return sum;
+
+  /* Words are summed at their memory address parity.  Data starting at an odd
+     address has its first byte in odd half of a 16 bit word; resulting sum
+     is byte swapped below. */
+  if (is_odd)
+    {
+      ip_csum_t b = * uword_to_pointer (data, u8 *);
+      sum0 = CLIB_ARCH_IS_LITTLE_ENDIAN ? b << 8 : b;
+      data += 1;
+      n_bytes -= 1;
+    }
 
   /* Align data pointer to 64 bits. */
 #define _(t)					\
@@ -47,13 +362,21 @@ do {						\
     }						\
 } while (0)
 
-  _ (u8);
   _ (u16);
   if (BITS (ip_csum_t) > 32)
     _ (u32);
 
 #undef _
 
+  if (n_bytes >= IP_CSUM_BLOCK_BYTES)
+    {
+      uword n_blocks = n_bytes / IP_CSUM_BLOCK_BYTES;
+
+      sum1 = ip_csum_blocks (sum1, uword_to_pointer (data, void *), n_blocks);
+      data += n_blocks * IP_CSUM_BLOCK_BYTES;
+      n_bytes -= n_blocks * IP_CSUM_BLOCK_BYTES;
+    }
+
  {
    ip_csum_t * d = uword_to_pointer (data, ip_csum_t *);
 
@@ -82,14 +405,20 @@ do {									\
    _ (u64);
  _ (u32);
  _ (u16);
- _ (u8);
 
 #undef _
 
+ /* Trailing byte is at even address. */
+ if (n_bytes > 0)
+   {
+     ip_csum_t b = * uword_to_pointer (data, u8 *);
+     sum0 = ip_csum_with_carry (sum0, CLIB_ARCH_IS_LITTLE_ENDIAN ? b : b << 8);
+   }
+
  /* Combine even and odd sums. */
  sum0 = ip_csum_with_carry (sum0, sum1);
 
- return sum0;
+ return ip_csum_add_block (sum, ip_csum_fold (sum0), is_odd);
 }
 
 ip_csum_t
@@ -105,11 +434,13 @@ ip_csum_and_memcpy (ip_csum_t sum, void * dst, void * src, uword n_bytes)
   src_even = src;
 
   n_left = n_bytes;
-  if ((n_left_odd = dst - (void *) dst_even))
+  if (dst != (void *) dst_even)
     {
       u8 * d8 = dst, * s8 = src;
       uword i, n_copy_odd;
 
+      /* Complete partial word left by previous call. */
+      n_left_odd = sizeof (dst_even[0]) - (dst - (void *) dst_even);
       n_copy_odd = clib_min (n_left, n_left_odd);
 
       for (i = 0; i < n_copy_odd; i++)
@@ -125,6 +456,16 @@ ip_csum_and_memcpy (ip_csum_t sum, void * dst, void * src, uword n_bytes)
     }
 
   sum1 = 0;
+  if (n_left >= IP_CSUM_BLOCK_BYTES)
+    {
+      uword n_blocks = n_left / IP_CSUM_BLOCK_BYTES;
+
+      sum1 = ip_csum_and_memcpy_blocks (sum1, dst_even, src_even, n_blocks);
+      dst_even += n_blocks * (IP_CSUM_BLOCK_BYTES / sizeof (dst_even[0]));
+      src_even += n_blocks * (IP_CSUM_BLOCK_BYTES / sizeof (dst_even[0]));
+      n_left -= n_blocks * IP_CSUM_BLOCK_BYTES;
+    }
+
   while (n_left >= 2 * sizeof (dst_even[0]))
     {
       ip_csum_t dst0, dst1;
@@ -158,9 +499,10 @@ ip_csum_and_memcpy (ip_csum_t sum, void * dst, void * src, uword n_bytes)
       sum0 = ip_csum_with_carry (sum0, dst0);
     }
 
+  /* Trailing partial word is summed by next call or by ip_csum_and_memcpy_fold. */
   if (n_left > 0)
     {
-      u8 * d8 = dst, * s8 = src;
+      u8 * d8 = (u8 *) dst_even, * s8 = (u8 *) src_even;
       uword i;
       for (i = 0; i < n_left; i++)
 	d8[i] = s8[i];
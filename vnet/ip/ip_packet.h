@@ -136,7 +136,22 @@ always_inline u16 ip_csum_fold (ip_csum_t c)
   return c;
 }
 
-/* Copy data and checksum at the same time. */
+/* Adds checksum (not complemented) of block of data starting at given
+   byte offset of a larger block.  Blocks at odd offsets contribute
+   their checksum byte swapped. */
+always_inline ip_csum_t
+ip_csum_add_block (ip_csum_t sum, u16 block_sum, uword block_offset)
+{
+  if (block_offset % 2)
+    block_sum = (block_sum >> 8) | (block_sum << 8);
+  return ip_csum_with_carry (sum, block_sum);
+}
+
+/* Copy data and checksum at the same time.  Checksum is summed in
+   ip_csum_t words at ip_csum_t aligned addresses of dst: the block being
+   built must start aligned, and successive calls must append contiguously
+   to it.  A trailing partial word is left unsummed in dst; the next call
+   completes it, or ip_csum_and_memcpy_fold zero pads and adds it. */
 ip_csum_t ip_csum_and_memcpy (ip_csum_t sum, void * dst, void * src, uword n_bytes);
 
 always_inline u16
@@ -154,7 +169,8 @@ ip_csum_and_memcpy_fold (ip_csum_t sum, void * dst)
       u8 * d8 = dst;
       uword i;
 
-      for (i = 0; i < n_zero; i++)
+      /* Zero pad partial word. */
+      for (i = 0; i < sizeof (sum) - n_zero; i++)
 	d8[i] = 0;
       
       sum = ip_csum_with_carry (sum, dst_even[0]);
@@ -166,4 +182,23 @@ ip_csum_and_memcpy_fold (ip_csum_t sum, void * dst)
 /* Checksum routine. */
 ip_csum_t ip_incremental_checksum (ip_csum_t sum, void * data, uword n_bytes);
 
+/* Checksum kernels; slowest first.  Fastest one supported by cpu is used
+   unless another is selected. */
+#define foreach_ip_csum_implementation		\
+  _ (scalar)					\
+  _ (sse2)					\
+  _ (avx2)
+
+typedef enum {
+#define _(f) IP_CSUM_IMPLEMENTATION_##f,
+  foreach_ip_csum_implementation
+#undef _
+  IP_N_CSUM_IMPLEMENTATION,
+} ip_csum_implementation_t;
+
+/* Returns zero if implementation is not supported by this cpu. */
+uword ip_csum_implementation_select (ip_csum_implementation_t i);
+
+ip_csum_implementation_t ip_csum_implementation_current (void);
+
 #endif /* included_ip_packet_h */
@@ -0,0 +1,871 @@
+/*
+ * ip_reass.c: reassemble ip4/ip6 fragments addressed to us
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/handoff.h>
+#include <vnet/timer_wheel.h>
+#include <vnet/ip/ip.h>
+
+/* ip4-local and ip6-local send fragments here.  Fragments are held in
+   place, linked through buffer opaque in order of data offset; once all
+   data has arrived they are chained into one packet without copying data
+   and handed back to ip4-local or ip6-local.
+
+   State is per worker and needs no locks: flow hash ignores ports of
+   fragments so all fragments of a datagram reach the same worker.  Timers
+   are advanced on each worker by ip-reassembly-expire so datagrams time
+   out even when no more fragments arrive; held buffers are also bounded
+   by memory and datagram limits which evict oldest datagrams first. */
+
+#define IP_REASS_TICK_INTERVAL 100e-3
+
+#define IP_REASS_BUCKET_N_SLOTS 4
+
+typedef struct {
+  union {
+    struct {
+      /* ip4 addresses use first 4 bytes; remaining bytes are zero. */
+      ip6_address_t src_address, dst_address;
+
+      u32 fragment_id;
+
+      u32 fib_index;
+
+      /* Zero for ip6 where protocol is only known from first fragment. */
+      u8 protocol;
+
+      u8 is_ip6;
+
+      u8 pad[6];
+    };
+
+    u64 as_u64[6];
+  };
+} ip_reass_key_t;
+
+typedef struct {
+  ip_reass_key_t key;
+
+  /* First fragment in order of data offset; next fragments are linked
+     through buffer opaque. */
+  u32 first_buffer_index;
+
+  /* Data bytes received.  Datagram is complete when this equals
+     data length which is ~0 until last fragment arrives. */
+  u32 n_data_bytes;
+  u32 data_length;
+
+  /* Bytes of headers in front of data of offset zero fragment. */
+  u32 first_header_bytes;
+
+  /* Buffers held including those chained within fragments. */
+  u32 n_buffers;
+
+  u32 timer_handle;
+
+  u32 bucket_index;
+
+  /* List in order of creation. */
+  u32 older_index, newer_index;
+
+  f64 time_created;
+} ip_reass_t;
+
+typedef struct {
+  /* Pool index of datagram or ~0 for free slot. */
+  u32 reass_index[IP_REASS_BUCKET_N_SLOTS];
+} ip_reass_bucket_t;
+
+typedef struct {
+  ip_reass_t * pool;
+
+  /* Fixed power of 2 sized table; allocated by first fragment. */
+  ip_reass_bucket_t * buckets;
+
+  vnet_timer_wheel_t timer_wheel;
+
+  u32 oldest_index, newest_index;
+
+  /* Buffers held by all datagrams. */
+  u32 n_buffers;
+
+  /* This worker's share of configured limits. */
+  u32 max_datagrams, max_buffers;
+
+  /* Buffers to be enqueued by node. */
+  u32 * drop_buffers;
+  u32 * local_buffers;
+
+  u32 * expired;
+
+  f64 time_last_expire;
+} ip_reass_worker_t;
+
+typedef struct {
+  ip_reass_worker_t workers[VNET_MAX_WORKERS];
+
+  /* Limits over all workers; each worker gets an equal share.
+     Memory is counted as buffers held times default buffer size. */
+  u32 max_datagrams;
+  u32 max_memory_bytes;
+
+  /* Datagrams not complete in this many seconds are dropped. */
+  f64 timeout;
+} ip_reass_main_t;
+
+static ip_reass_main_t ip_reass_main = {
+  .max_datagrams = 1024,
+  .max_memory_bytes = 4 << 20,
+  .timeout = 3,
+};
+
+#define foreach_ip_reass_error					\
+  _ (FRAGMENTS, "fragments received")				\
+  _ (REASSEMBLED, "datagrams reassembled")			\
+  _ (MALFORMED, "malformed fragments")				\
+  _ (TOO_LONG, "reassembled datagram too long")			\
+  _ (DUPLICATE, "duplicate fragments")				\
+  _ (OVERLAP, "overlapping fragments")				\
+  _ (TIMEOUT, "reassembly timeouts")				\
+  _ (EVICTED, "datagrams evicted from full reassembly table")	\
+  _ (MEMORY_LIMIT, "reassembly memory limit exceeded")
+
+typedef enum {
+#define _(sym,str) IP_REASS_ERROR_##sym,
+  foreach_ip_reass_error
+#undef _
+  IP_REASS_N_ERROR,
+} ip_reass_error_t;
+
+static char * ip_reass_error_strings[] = {
+#define _(sym,string) string,
+  foreach_ip_reass_error
+#undef _
+};
+
+typedef enum {
+  IP_REASS_NEXT_DROP,
+  IP_REASS_NEXT_LOCAL,
+  IP_REASS_N_NEXT,
+} ip_reass_next_t;
+
+typedef struct {
+  u32 fragment_id;
+
+  u16 data_first, data_last;
+
+  u8 more_fragments;
+} ip_reass_trace_t;
+
+static u8 * format_ip_reass_trace (u8 * s, va_list * va)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*va, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*va, vlib_node_t *);
+  ip_reass_trace_t * t = va_arg (*va, ip_reass_trace_t *);
+
+  s = format (s, "fragment id 0x%x, data %d-%d%s",
+	      t->fragment_id, t->data_first, t->data_last,
+	      t->more_fragments ? ", more fragments" : "");
+
+  return s;
+}
+
+always_inline u32
+ip_reass_key_hash (ip_reass_key_t * k)
+{
+  u32 a, b, c, i;
+
+  a = k->fragment_id ^ k->fib_index;
+  b = k->protocol;
+  c = 0;
+  for (i = 0; i < ARRAY_LEN (k->src_address.as_u32); i++)
+    {
+      b ^= k->src_address.as_u32[i];
+      c ^= k->dst_address.as_u32[i];
+    }
+
+  hash_v3_finalize32 (a, b, c);
+
+  return c;
+}
+
+always_inline uword
+ip_reass_key_equal (ip_reass_key_t * k0, ip_reass_key_t * k1)
+{
+  u64 x = 0;
+  u32 i;
+
+  for (i = 0; i < ARRAY_LEN (k0->as_u64); i++)
+    x |= k0->as_u64[i] ^ k1->as_u64[i];
+
+  return x == 0;
+}
+
+static void
+ip_reass_worker_init (ip_reass_main_t * rm, ip_reass_worker_t * w, f64 now)
+{
+  u32 n_workers = vnet_n_workers (&vnet_worker_main);
+
+  w->max_datagrams = clib_max (rm->max_datagrams / n_workers, 1);
+  w->max_buffers = clib_max (rm->max_memory_bytes / VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES / n_workers, 1);
+
+  /* At most a quarter of slots are in use. */
+  vec_validate (w->buckets, max_pow2 (w->max_datagrams) - 1);
+  memset (w->buckets, ~0, vec_len (w->buckets) * sizeof (w->buckets[0]));
+
+  vnet_timer_wheel_init (&w->timer_wheel, IP_REASS_TICK_INTERVAL, now);
+  w->time_last_expire = now;
+
+  w->oldest_index = w->newest_index = ~0;
+}
+
+/* Frees datagram state but not its buffers. */
+static void
+ip_reass_free (ip_reass_worker_t * w, ip_reass_t * r)
+{
+  ip_reass_bucket_t * b = w->buckets + r->bucket_index;
+  u32 ri = r - w->pool, i;
+
+  for (i = 0; i < IP_REASS_BUCKET_N_SLOTS; i++)
+    if (b->reass_index[i] == ri)
+      b->reass_index[i] = ~0;
+
+  if (r->timer_handle != ~0)
+    vnet_timer_wheel_stop (&w->timer_wheel, r->timer_handle);
+
+  if (r->older_index != ~0)
+    pool_elt_at_index (w->pool, r->older_index)->newer_index = r->newer_index;
+  else
+    w->oldest_index = r->newer_index;
+  if (r->newer_index != ~0)
+    pool_elt_at_index (w->pool, r->newer_index)->older_index = r->older_index;
+  else
+    w->newest_index = r->older_index;
+
+  w->n_buffers -= r->n_buffers;
+
+  pool_put (w->pool, r);
+}
+
+/* Drops all fragments of datagram. */
+static void
+ip_reass_drop (vlib_main_t * vm, vlib_node_runtime_t * node,
+	       ip_reass_worker_t * w, ip_reass_t * r,
+	       ip_reass_error_t error)
+{
+  u32 bi = r->first_buffer_index;
+
+  while (bi != ~0)
+    {
+      vlib_buffer_t * b = vlib_get_buffer (vm, bi);
+
+      b->error = node->errors[error];
+      vec_add1 (w->drop_buffers, bi);
+      bi = vnet_buffer (b)->ip.reass.next_fragment_buffer_index;
+    }
+
+  ip_reass_free (w, r);
+}
+
+static void
+ip_reass_expire (vlib_main_t * vm, vlib_node_runtime_t * node,
+		 ip_reass_worker_t * w, f64 now)
+{
+  ip_reass_t * r;
+  u32 i;
+
+  w->time_last_expire = now;
+
+  vec_reset_length (w->expired);
+  w->expired = vnet_timer_wheel_advance (&w->timer_wheel, now, w->expired);
+
+  for (i = 0; i < vec_len (w->expired); i++)
+    {
+      r = pool_elt_at_index (w->pool, w->expired[i]);
+      r->timer_handle = ~0;
+      ip_reass_drop (vm, node, w, r, IP_REASS_ERROR_TIMEOUT);
+    }
+}
+
+static ip_reass_t *
+ip_reass_find_or_create (vlib_main_t * vm, vlib_node_runtime_t * node,
+			 ip_reass_main_t * rm, ip_reass_worker_t * w,
+			 ip_reass_key_t * k, f64 now)
+{
+  ip_reass_bucket_t * b;
+  ip_reass_t * r, * victim;
+  u32 bucket_index, i, slot, victim_slot, ri;
+
+  bucket_index = ip_reass_key_hash (k) & (vec_len (w->buckets) - 1);
+  b = w->buckets + bucket_index;
+
+  slot = victim_slot = ~0;
+  victim = 0;
+  for (i = 0; i < IP_REASS_BUCKET_N_SLOTS; i++)
+    {
+      if (b->reass_index[i] == ~0)
+	{
+	  slot = i;
+	  continue;
+	}
+
+      r = pool_elt_at_index (w->pool, b->reass_index[i]);
+      if (ip_reass_key_equal (&r->key, k))
+	return r;
+
+      if (! victim || r->time_created < victim->time_created)
+	{
+	  victim = r;
+	  victim_slot = i;
+	}
+    }
+
+  /* Bucket full: evict its oldest datagram. */
+  if (slot == ~0)
+    {
+      ip_reass_drop (vm, node, w, victim, IP_REASS_ERROR_EVICTED);
+      slot = victim_slot;
+    }
+
+  if (pool_elts (w->pool) >= w->max_datagrams)
+    ip_reass_drop (vm, node, w, pool_elt_at_index (w->pool, w->oldest_index),
+		   IP_REASS_ERROR_EVICTED);
+
+  pool_get (w->pool, r);
+  ri = r - w->pool;
+
+  memset (r, 0, sizeof (r[0]));
+  r->key = k[0];
+  r->first_buffer_index = ~0;
+  r->data_length = ~0;
+  r->bucket_index = bucket_index;
+  r->time_created = now;
+  r->timer_handle = vnet_timer_wheel_start (&w->timer_wheel, ri, rm->timeout);
+
+  r->older_index = w->newest_index;
+  r->newer_index = ~0;
+  if (w->newest_index != ~0)
+    pool_elt_at_index (w->pool, w->newest_index)->newer_index = ri;
+  else
+    w->oldest_index = ri;
+  w->newest_index = ri;
+
+  b->reass_index[slot] = ri;
+
+  return r;
+}
+
+/* Trims L2 padding so that chain holds given number of bytes.  Returns
+   number of buffers left in chain or zero when chain is too short. */
+static u32
+ip_reass_trim (vlib_main_t * vm, vlib_buffer_t * b, u32 n_bytes)
+{
+  u32 n_buffers = 1;
+
+  while (n_bytes > b->current_length)
+    {
+      if (! (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+	return 0;
+      n_bytes -= b->current_length;
+      b = vlib_get_buffer (vm, b->next_buffer);
+      n_buffers++;
+    }
+
+  b->current_length = n_bytes;
+  if (b->flags & VLIB_BUFFER_NEXT_PRESENT)
+    {
+      vlib_buffer_free (vm, &b->next_buffer, 1);
+      b->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+    }
+
+  return n_buffers;
+}
+
+/* Chains fragments behind first one, restores headers of first fragment
+   and fixes them to describe whole datagram. */
+static ip_reass_error_t
+ip_reass_finish (vlib_main_t * vm, vlib_node_runtime_t * node,
+		 ip_reass_worker_t * w, ip_reass_t * r)
+{
+  vlib_buffer_t * head, * f, * b;
+  u32 head_bi = r->first_buffer_index;
+
+  if (! r->key.is_ip6 && r->first_header_bytes + r->data_length > 0xffff)
+    {
+      /* Caller's fragment is already held and dropped with the rest. */
+      ip_reass_drop (vm, node, w, r, IP_REASS_ERROR_TOO_LONG);
+      return IP_REASS_ERROR_FRAGMENTS;
+    }
+
+  head = vlib_get_buffer (vm, head_bi);
+  ASSERT (vnet_buffer (head)->ip.reass.data_first == 0);
+
+  f = head;
+  while (1)
+    {
+      u32 next_bi = vnet_buffer (f)->ip.reass.next_fragment_buffer_index;
+
+      b = f;
+      while (b->flags & VLIB_BUFFER_NEXT_PRESENT)
+	b = vlib_get_buffer (vm, b->next_buffer);
+
+      if (next_bi == ~0)
+	break;
+
+      b->next_buffer = next_bi;
+      b->flags |= VLIB_BUFFER_NEXT_PRESENT;
+      f = vlib_get_buffer (vm, next_bi);
+    }
+
+  vlib_buffer_advance (head, - (i32) r->first_header_bytes);
+
+  if (r->key.is_ip6)
+    {
+      ip6_header_t * ip = vlib_buffer_get_current (head);
+      ip6_fragment_header_t * frag = ip6_next_header (ip);
+      u8 protocol = frag->next_header;
+
+      /* Remove fragment header. */
+      memmove ((void *) ip + sizeof (frag[0]), ip, sizeof (ip[0]));
+      vlib_buffer_advance (head, sizeof (frag[0]));
+
+      ip = vlib_buffer_get_current (head);
+      ip->protocol = protocol;
+      ip->payload_length = clib_host_to_net_u16 (r->data_length);
+    }
+  else
+    {
+      ip4_header_t * ip = vlib_buffer_get_current (head);
+
+      ip->length = clib_host_to_net_u16 (r->first_header_bytes + r->data_length);
+      ip->flags_and_fragment_offset &= ~clib_host_to_net_u16 (IP4_HEADER_FLAG_MORE_FRAGMENTS | 0x1fff);
+      ip->checksum = ip4_header_checksum (ip);
+    }
+
+  /* Any hardware checksum was of first fragment only. */
+  head->flags &= ~(IP_BUFFER_L4_CHECKSUM_COMPUTED | IP_BUFFER_L4_CHECKSUM_CORRECT);
+
+  vec_add1 (w->local_buffers, head_bi);
+
+  /* Buffers now belong to reassembled packet. */
+  ip_reass_free (w, r);
+
+  return IP_REASS_ERROR_REASSEMBLED;
+}
+
+/* Adds fragment to its datagram.  Returns FRAGMENTS when fragment is held,
+   REASSEMBLED when it completed its datagram and otherwise error with
+   which caller drops fragment. */
+static ip_reass_error_t
+ip_reass_fragment (vlib_main_t * vm, vlib_node_runtime_t * node,
+		   ip_reass_main_t * rm, ip_reass_worker_t * w,
+		   u32 bi0, uword is_ip6, f64 now)
+{
+  vlib_buffer_t * b0, * b;
+  ip_reass_key_t k0;
+  ip_reass_t * r;
+  u32 n_header_bytes0, n_data0, first0, last0, n_buffers0, bi, prev_bi;
+  uword more0;
+
+  b0 = vlib_get_buffer (vm, bi0);
+
+  memset (&k0, 0, sizeof (k0));
+  if (is_ip6)
+    {
+      ip6_header_t * ip0 = vlib_buffer_get_current (b0);
+      ip6_fragment_header_t * frag0 = ip6_next_header (ip0);
+
+      /* ip6-local only sends fragment header following ip6 header. */
+      n_header_bytes0 = sizeof (ip0[0]) + sizeof (frag0[0]);
+      if (b0->current_length < n_header_bytes0
+	  || clib_net_to_host_u16 (ip0->payload_length) < sizeof (frag0[0]))
+	return IP_REASS_ERROR_MALFORMED;
+
+      n_data0 = clib_net_to_host_u16 (ip0->payload_length) - sizeof (frag0[0]);
+      first0 = ip6_fragment_header_offset_bytes (frag0);
+      more0 = ip6_fragment_header_more_fragments (frag0);
+
+      k0.src_address = ip0->src_address;
+      k0.dst_address = ip0->dst_address;
+      k0.fragment_id = frag0->fragment_id;
+      k0.fib_index = vec_elt (ip6_main.fib_index_by_sw_if_index,
+			      vnet_buffer (b0)->sw_if_index[VLIB_RX]);
+      k0.is_ip6 = 1;
+    }
+  else
+    {
+      ip4_header_t * ip0 = vlib_buffer_get_current (b0);
+
+      n_header_bytes0 = ip4_header_bytes (ip0);
+      if (b0->current_length < n_header_bytes0
+	  || clib_net_to_host_u16 (ip0->length) < n_header_bytes0)
+	return IP_REASS_ERROR_MALFORMED;
+
+      n_data0 = clib_net_to_host_u16 (ip0->length) - n_header_bytes0;
+      first0 = ip4_get_fragment_offset_bytes (ip0);
+      more0 = (ip0->flags_and_fragment_offset
+	       & clib_host_to_net_u16 (IP4_HEADER_FLAG_MORE_FRAGMENTS)) != 0;
+
+      k0.src_address.as_u32[0] = ip0->src_address.as_u32;
+      k0.dst_address.as_u32[0] = ip0->dst_address.as_u32;
+      k0.fragment_id = ip0->fragment_id;
+      k0.fib_index = vec_elt (ip4_main.fib_index_by_sw_if_index,
+			      vnet_buffer (b0)->sw_if_index[VLIB_RX]);
+      k0.protocol = ip0->protocol;
+    }
+
+  last0 = first0 + n_data0;
+
+  if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+    {
+      ip_reass_trace_t * t0 = vlib_add_trace (vm, node, b0, sizeof (t0[0]));
+      t0->fragment_id = (is_ip6
+			 ? clib_net_to_host_u32 (k0.fragment_id)
+			 : clib_net_to_host_u16 (k0.fragment_id));
+      t0->data_first = first0;
+      t0->data_last = last0;
+      t0->more_fragments = more0;
+    }
+
+  /* All but last fragment carry a multiple of 8 data bytes. */
+  if (n_data0 == 0 || (more0 && (n_data0 % 8) != 0))
+    return IP_REASS_ERROR_MALFORMED;
+
+  /* Opaque holds data offsets as u16. */
+  if (last0 > 0xffff)
+    return IP_REASS_ERROR_TOO_LONG;
+
+  n_buffers0 = ip_reass_trim (vm, b0, n_header_bytes0 + n_data0);
+  if (n_buffers0 == 0)
+    return IP_REASS_ERROR_MALFORMED;
+
+  /* Make room by evicting oldest datagrams. */
+  while (w->n_buffers + n_buffers0 > w->max_buffers && w->oldest_index != ~0)
+    ip_reass_drop (vm, node, w, pool_elt_at_index (w->pool, w->oldest_index),
+		   IP_REASS_ERROR_MEMORY_LIMIT);
+  if (w->n_buffers + n_buffers0 > w->max_buffers)
+    return IP_REASS_ERROR_MEMORY_LIMIT;
+
+  r = ip_reass_find_or_create (vm, node, rm, w, &k0, now);
+
+  /* Find fragments before and after this one. */
+  prev_bi = ~0;
+  bi = r->first_buffer_index;
+  while (bi != ~0)
+    {
+      b = vlib_get_buffer (vm, bi);
+      if (vnet_buffer (b)->ip.reass.data_first >= first0)
+	break;
+      prev_bi = bi;
+      bi = vnet_buffer (b)->ip.reass.next_fragment_buffer_index;
+    }
+
+  if (bi != ~0)
+    {
+      b = vlib_get_buffer (vm, bi);
+      if (vnet_buffer (b)->ip.reass.data_first == first0
+	  && vnet_buffer (b)->ip.reass.data_last == last0)
+	return IP_REASS_ERROR_DUPLICATE;
+
+      /* Overlaps are never legitimate (RFC 5722); drop whole datagram. */
+      if (vnet_buffer (b)->ip.reass.data_first < last0)
+	goto overlap;
+
+      /* Data beyond last fragment. */
+      if (! more0)
+	goto malformed;
+    }
+
+  if (prev_bi != ~0)
+    {
+      b = vlib_get_buffer (vm, prev_bi);
+      if (vnet_buffer (b)->ip.reass.data_last > first0)
+	goto overlap;
+    }
+
+  if (! more0)
+    {
+      if (r->data_length != ~0 && r->data_length != last0)
+	goto malformed;
+      r->data_length = last0;
+    }
+  else if (r->data_length != ~0 && last0 > r->data_length)
+    goto malformed;
+
+  /* Hold fragment data only; headers of first fragment are restored
+     when datagram is complete. */
+  vlib_buffer_advance (b0, n_header_bytes0);
+  if (first0 == 0)
+    r->first_header_bytes = n_header_bytes0;
+
+  vnet_buffer (b0)->ip.reass.next_fragment_buffer_index = bi;
+  vnet_buffer (b0)->ip.reass.data_first = first0;
+  vnet_buffer (b0)->ip.reass.data_last = last0;
+  if (prev_bi != ~0)
+    vnet_buffer (vlib_get_buffer (vm, prev_bi))->ip.reass.next_fragment_buffer_index = bi0;
+  else
+    r->first_buffer_index = bi0;
+
+  r->n_data_bytes += n_data0;
+  r->n_buffers += n_buffers0;
+  w->n_buffers += n_buffers0;
+
+  if (r->n_data_bytes == r->data_length)
+    return ip_reass_finish (vm, node, w, r);
+
+  return IP_REASS_ERROR_FRAGMENTS;
+
+ overlap:
+  ip_reass_drop (vm, node, w, r, IP_REASS_ERROR_OVERLAP);
+  return IP_REASS_ERROR_OVERLAP;
+
+ malformed:
+  ip_reass_drop (vm, node, w, r, IP_REASS_ERROR_MALFORMED);
+  return IP_REASS_ERROR_MALFORMED;
+}
+
+static void
+ip_reass_enqueue (vlib_main_t * vm, vlib_node_runtime_t * node,
+		  u32 next_index, u32 * buffers)
+{
+  u32 * to_next, n_left_to_next, n_left, n;
+
+  n_left = vec_len (buffers);
+  while (n_left > 0)
+    {
+      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+      n = clib_min (n_left, n_left_to_next);
+      memcpy (to_next, buffers, n * sizeof (buffers[0]));
+      buffers += n;
+      n_left -= n;
+      n_left_to_next -= n;
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+}
+
+always_inline uword
+ip_reass_inline (vlib_main_t * vm,
+		 vlib_node_runtime_t * node,
+		 vlib_frame_t * frame,
+		 uword is_ip6)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  ip_reass_worker_t * w;
+  u32 * from, n_left_from, n_reassembled = 0;
+  uword cpu = os_get_cpu_number ();
+  f64 now = vlib_time_now (vm);
+
+  ASSERT (cpu < VNET_MAX_WORKERS);
+  w = &rm->workers[cpu];
+
+  if (PREDICT_FALSE (! w->buckets))
+    ip_reass_worker_init (rm, w, now);
+
+  vec_reset_length (w->drop_buffers);
+  vec_reset_length (w->local_buffers);
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  while (n_left_from > 0)
+    {
+      ip_reass_error_t error0;
+      u32 bi0 = from[0];
+
+      from += 1;
+      n_left_from -= 1;
+
+      error0 = ip_reass_fragment (vm, node, rm, w, bi0, is_ip6, now);
+
+      if (error0 == IP_REASS_ERROR_REASSEMBLED)
+	n_reassembled += 1;
+      else if (error0 != IP_REASS_ERROR_FRAGMENTS)
+	{
+	  vlib_get_buffer (vm, bi0)->error = node->errors[error0];
+	  vec_add1 (w->drop_buffers, bi0);
+	}
+    }
+
+  ip_reass_enqueue (vm, node, IP_REASS_NEXT_LOCAL, w->local_buffers);
+  ip_reass_enqueue (vm, node, IP_REASS_NEXT_DROP, w->drop_buffers);
+
+  vlib_error_count (vm, node->node_index, IP_REASS_ERROR_FRAGMENTS, frame->n_vectors);
+  vlib_error_count (vm, node->node_index, IP_REASS_ERROR_REASSEMBLED, n_reassembled);
+
+  return frame->n_vectors;
+}
+
+static uword
+ip4_reassembly (vlib_main_t * vm,
+		vlib_node_runtime_t * node,
+		vlib_frame_t * frame)
+{ return ip_reass_inline (vm, node, frame, /* is_ip6 */ 0); }
+
+static uword
+ip6_reassembly (vlib_main_t * vm,
+		vlib_node_runtime_t * node,
+		vlib_frame_t * frame)
+{ return ip_reass_inline (vm, node, frame, /* is_ip6 */ 1); }
+
+static VLIB_REGISTER_NODE (ip4_reassembly_node) = {
+  .function = ip4_reassembly,
+  .name = "ip4-reassembly",
+  .vector_size = sizeof (u32),
+
+  .format_trace = format_ip_reass_trace,
+
+  .n_errors = IP_REASS_N_ERROR,
+  .error_strings = ip_reass_error_strings,
+
+  .n_next_nodes = IP_REASS_N_NEXT,
+  .next_nodes = {
+    [IP_REASS_NEXT_DROP] = "error-drop",
+    [IP_REASS_NEXT_LOCAL] = "ip4-local",
+  },
+};
+
+static VLIB_REGISTER_NODE (ip6_reassembly_node) = {
+  .function = ip6_reassembly,
+  .name = "ip6-reassembly",
+  .vector_size = sizeof (u32),
+
+  .format_trace = format_ip_reass_trace,
+
+  .n_errors = IP_REASS_N_ERROR,
+  .error_strings = ip_reass_error_strings,
+
+  .n_next_nodes = IP_REASS_N_NEXT,
+  .next_nodes = {
+    [IP_REASS_NEXT_DROP] = "error-drop",
+    [IP_REASS_NEXT_LOCAL] = "ip6-local",
+  },
+};
+
+/* Polls on every worker; drops datagrams of this worker which timed out.
+   Wheel is advanced even without datagrams so that timers started after
+   an idle period count from current time. */
+static uword
+ip_reass_expire_input (vlib_main_t * vm,
+		       vlib_node_runtime_t * node,
+		       vlib_frame_t * frame)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  ip_reass_worker_t * w;
+  uword cpu = os_get_cpu_number ();
+  f64 now;
+
+  if (cpu >= VNET_MAX_WORKERS)
+    return 0;
+
+  w = &rm->workers[cpu];
+  if (! w->buckets)
+    return 0;
+
+  now = vlib_time_now (vm);
+  if (now - w->time_last_expire < IP_REASS_TICK_INTERVAL)
+    return 0;
+
+  vec_reset_length (w->drop_buffers);
+  ip_reass_expire (vm, node, w, now);
+  ip_reass_enqueue (vm, node, IP_REASS_NEXT_DROP, w->drop_buffers);
+
+  return vec_len (w->drop_buffers);
+}
+
+static VLIB_REGISTER_NODE (ip_reass_expire_node) = {
+  .function = ip_reass_expire_input,
+  .name = "ip-reassembly-expire",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_POLLING,
+  .vector_size = sizeof (u32),
+
+  .n_errors = IP_REASS_N_ERROR,
+  .error_strings = ip_reass_error_strings,
+
+  .n_next_nodes = 1,
+  .next_nodes = {
+    [IP_REASS_NEXT_DROP] = "error-drop",
+  },
+};
+
+static clib_error_t *
+ip_reass_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "max-datagrams %d", &rm->max_datagrams))
+	;
+      else if (unformat (input, "max-memory %d", &rm->max_memory_bytes))
+	;
+      else if (unformat (input, "timeout %f", &rm->timeout))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (rm->max_datagrams < 1)
+    return clib_error_return (0, "max-datagrams must be at least 1");
+
+  if (rm->timeout <= 0)
+    return clib_error_return (0, "timeout must be positive");
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (ip_reass_config, "ip-reassembly");
+
+static clib_error_t *
+show_ip_reassembly (vlib_main_t * vm,
+		    unformat_input_t * input,
+		    vlib_cli_command_t * cmd)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  ip_reass_worker_t * w;
+  uword n_datagrams = 0, n_buffers = 0;
+
+  for (w = rm->workers; w < rm->workers + ARRAY_LEN (rm->workers); w++)
+    {
+      n_datagrams += pool_elts (w->pool);
+      n_buffers += w->n_buffers;
+    }
+
+  vlib_cli_output (vm, "%d datagrams being reassembled holding %d buffers",
+		   n_datagrams, n_buffers);
+  vlib_cli_output (vm, "Limits: %d datagrams, %d bytes, timeout %.2f sec",
+		   rm->max_datagrams, rm->max_memory_bytes, rm->timeout);
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (show_ip_reassembly_command) = {
+  .path = "show ip reassembly",
+  .short_help = "Show ip4/ip6 fragment reassembly state",
+  .function = show_ip_reassembly,
+};
@@ -25,6 +25,8 @@
 
 #include <clib/math.h>		/* for fabs */
 #include <vnet/ip/ip.h>
+#include <vnet/handoff.h>
+#include <sys/fcntl.h>		/* for open */
 
 static void
 ip_multipath_del_adjacency (ip_lookup_main_t * lm, u32 del_adj_index);
@@ -52,7 +54,7 @@ ip_add_adjacency (ip_lookup_main_t * lm,
   ip_poison_adjacencies (adj, n_adj);
 
   /* Validate adjacency counters. */
-  vlib_validate_counter (&lm->adjacency_counters, ai + n_adj - 1);
+  vnet_validate_combined_counter (&lm->adjacency_counters, ai + n_adj - 1);
 
   for (i = 0; i < n_adj; i++)
     {
@@ -66,31 +68,54 @@ ip_add_adjacency (ip_lookup_main_t * lm,
       adj[i].n_adj = n_adj;
 
       /* Zero possibly stale counters for re-used adjacencies. */
-      vlib_zero_combined_counter (&lm->adjacency_counters, ai + i);
+      vnet_zero_combined_counter (&lm->adjacency_counters, ai + i);
     }
 
   *adj_index_return = ai;
   return adj;
 }
 
-static void ip_del_adjacency2 (ip_lookup_main_t * lm, u32 adj_index, u32 delete_multipath_adjacency)
+void ip_adjacency_heap_reserve (ip_lookup_main_t * lm, u32 n_adj)
+{
+  u32 handle;
+
+  if (n_adj <= vec_len (lm->adjacency_heap))
+    return;
+
+  /* Heap vector keeps its size after block is freed. */
+  heap_alloc (lm->adjacency_heap, n_adj - vec_len (lm->adjacency_heap), handle);
+  heap_dealloc (lm->adjacency_heap, handle);
+
+  /* Counters are indexed by adjacency index; size them as well. */
+  vnet_validate_combined_counter (&lm->adjacency_counters, n_adj - 1);
+}
+
+/* Adjacency block is returned to heap only after lookups on all threads
+   are done with it. */
+static void ip_adjacency_free_deferred (uword opaque0, uword adj_index)
 {
+  ip_lookup_main_t * lm = uword_to_pointer (opaque0, ip_lookup_main_t *);
   ip_adjacency_t * adj;
   uword handle;
 
-  ip_call_add_del_adjacency_callbacks (lm, adj_index, /* is_del */ 1);
-
   adj = ip_get_adjacency (lm, adj_index);
   handle = adj->heap_handle;
 
-  if (delete_multipath_adjacency)
-    ip_multipath_del_adjacency (lm, adj_index);
-
   ip_poison_adjacencies (adj, adj->n_adj);
 
   heap_dealloc (lm->adjacency_heap, handle);
 }
 
+static void ip_del_adjacency2 (ip_lookup_main_t * lm, u32 adj_index, u32 delete_multipath_adjacency)
+{
+  ip_call_add_del_adjacency_callbacks (lm, adj_index, /* is_del */ 1);
+
+  if (delete_multipath_adjacency)
+    ip_multipath_del_adjacency (lm, adj_index);
+
+  ip_lookup_defer_free (ip_adjacency_free_deferred, pointer_to_uword (lm), adj_index);
+}
+
 void ip_del_adjacency (ip_lookup_main_t * lm, u32 adj_index)
 { ip_del_adjacency2 (lm, adj_index, /* delete_multipath_adjacency */ 1); }
 
@@ -747,7 +772,8 @@ void serialize_ip_lookup_main (serialize_main_t * m, va_list * va)
 
   /* Adjacency counters (FIXME disabled for now). */
   if (0)
-    serialize (m, serialize_vlib_combined_counter_main, &lm->adjacency_counters, /* incremental */ 0);
+    serialize (m, serialize_vlib_combined_counter_main,
+	       vnet_combined_counter_shard (&lm->adjacency_counters, 0), /* incremental */ 0);
 }
 
 void unserialize_ip_lookup_main (serialize_main_t * m, va_list * va)
@@ -772,17 +798,726 @@ void unserialize_ip_lookup_main (serialize_main_t * m, va_list * va)
   }
 
   /* Validate adjacency counters. */
-  vlib_validate_counter (&lm->adjacency_counters, vec_len (lm->adjacency_heap) - 1);
+  vnet_validate_combined_counter (&lm->adjacency_counters, vec_len (lm->adjacency_heap) - 1);
 
   /* Adjacency counters (FIXME disabled for now). */
   if (0)
-    unserialize (m, unserialize_vlib_combined_counter_main, &lm->adjacency_counters, /* incremental */ 0);
+    unserialize (m, unserialize_vlib_combined_counter_main,
+		 vnet_combined_counter_shard (&lm->adjacency_counters, 0), /* incremental */ 0);
+}
+
+ip_lookup_epoch_main_t ip_lookup_epoch_main;
+
+void ip_lookup_defer_free (void (* function) (uword opaque0, uword opaque1),
+			   uword opaque0, uword opaque1)
+{
+  ip_lookup_epoch_main_t * em = &ip_lookup_epoch_main;
+  ip_lookup_deferred_free_t * f;
+
+  vec_add2 (em->deferred_frees, f, 1);
+  f->function = function;
+  f->opaque[0] = opaque0;
+  f->opaque[1] = opaque1;
+  f->epoch = em->epoch;
+}
+
+static void ip_lookup_vec_free_deferred (uword opaque0, uword opaque1)
+{
+  void * v = uword_to_pointer (opaque0, void *);
+  vec_free (v);
+}
+
+void ip_lookup_defer_vec_free (void * v)
+{
+  if (v)
+    ip_lookup_defer_free (ip_lookup_vec_free_deferred, pointer_to_uword (v), 0);
+}
+
+void ip_lookup_epoch_validate_threads (u32 n_threads)
+{
+  ip_lookup_epoch_main_t * em = &ip_lookup_epoch_main;
+
+  if (vec_len (em->quiescent_epoch_by_thread) < n_threads)
+    vec_validate_init_empty (em->quiescent_epoch_by_thread, n_threads - 1, em->epoch);
+}
+
+static void ip_lookup_reclaim (ip_lookup_epoch_main_t * em)
+{
+  vnet_worker_main_t * wm = &vnet_worker_main;
+  ip_lookup_deferred_free_t f;
+  u64 safe_epoch;
+  uword i, n;
+
+  /* Objects unlinked before oldest epoch seen by any thread are unreachable.
+     Configured workers which have not started yet hold no references and
+     will only ever see state linked after they start. */
+  safe_epoch = em->epoch;
+  for (i = 0; i < vec_len (em->quiescent_epoch_by_thread); i++)
+    {
+      if (i > 0 && i < vec_len (wm->workers) && ! wm->workers[i].vlib_main)
+	continue;
+      safe_epoch = clib_min (safe_epoch, em->quiescent_epoch_by_thread[i]);
+    }
+
+  /* Free functions may defer more frees; copy each entry before calling. */
+  for (n = 0; n < vec_len (em->deferred_frees); n++)
+    {
+      f = em->deferred_frees[n];
+      if (f.epoch >= safe_epoch)
+	break;
+      f.function (f.opaque[0], f.opaque[1]);
+    }
+
+  if (n > 0)
+    vec_delete (em->deferred_frees, n, 0);
+  em->n_freed += n;
+
+  /* Start new epoch: everything unlinked so far was unlinked before it. */
+  CLIB_MEMORY_BARRIER ();
+  em->epoch++;
+}
+
+static uword
+ip_lookup_reclaim_process (vlib_main_t * vm,
+			   vlib_node_runtime_t * rt,
+			   vlib_frame_t * f)
+{
+  ip_lookup_epoch_main_t * em = &ip_lookup_epoch_main;
+
+  /* Main thread when no workers are configured. */
+  ip_lookup_epoch_validate_threads (1);
+
+  while (1)
+    {
+      vlib_process_suspend (vm, 10e-3);
+
+      /* Main thread is between node dispatches when processes run. */
+      ip_lookup_thread_quiescent (/* thread_index */ 0);
+
+      if (vec_len (em->deferred_frees) > 0)
+	ip_lookup_reclaim (em);
+    }
+
+  return 0;
+}
+
+static VLIB_REGISTER_NODE (ip_lookup_reclaim_process_node) = {
+  .function = ip_lookup_reclaim_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "ip-lookup-reclaim",
+};
+
+/* Input nodes run at top of each main loop pass when a thread has
+   finished with all frames of previous pass: record quiescent point. */
+static uword
+ip_lookup_quiescent_input (vlib_main_t * vm,
+			   vlib_node_runtime_t * node,
+			   vlib_frame_t * frame)
+{
+  ip_lookup_epoch_main_t * em = &ip_lookup_epoch_main;
+  uword cpu = os_get_cpu_number ();
+
+  if (cpu < vec_len (em->quiescent_epoch_by_thread))
+    ip_lookup_thread_quiescent (cpu);
+
+  return 0;
+}
+
+static VLIB_REGISTER_NODE (ip_lookup_quiescent_input_node) = {
+  .function = ip_lookup_quiescent_input,
+  .name = "ip-lookup-quiescent",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_POLLING,
+};
+
+always_inline void
+ip_neighbor_pending_lock (ip_neighbor_pending_main_t * pm)
+{
+  while (__sync_lock_test_and_set (&pm->lock, 1))
+    ;
+}
+
+always_inline void
+ip_neighbor_pending_unlock (ip_neighbor_pending_main_t * pm)
+{ __sync_lock_release (&pm->lock); }
+
+static void
+ip_neighbor_pending_key_init (ip_lookup_main_t * lm,
+			      ip_neighbor_pending_key_t * k,
+			      u32 sw_if_index, void * address)
+{
+  memset (k, 0, sizeof (k[0]));
+  k->sw_if_index = sw_if_index;
+  memcpy (k->address, address, lm->is_ip6 ? sizeof (ip6_address_t) : sizeof (ip4_address_t));
+}
+
+/* Called with lock held. */
+static void
+ip_neighbor_pending_free (vlib_main_t * vm,
+			  ip_neighbor_pending_main_t * pm,
+			  ip_neighbor_pending_t * p)
+{
+  if (vec_len (p->buffers) > 0)
+    vlib_buffer_free (vm, p->buffers, vec_len (p->buffers));
+  pm->n_buffers -= vec_len (p->buffers);
+  vec_free (p->buffers);
+  mhash_unset (&pm->pending_index_by_key, &p->key, /* old_value */ 0);
+  pool_put (pm->pending_pool, p);
+}
+
+/* Called with lock held.  Adds buffer to entry for its neighbor or frees
+   it if limits are reached. */
+static void
+ip_neighbor_pending_hold (vlib_main_t * vm,
+			  ip_neighbor_pending_main_t * pm,
+			  ip_neighbor_pending_request_t * r,
+			  f64 now)
+{
+  ip_neighbor_pending_t * p;
+  uword * q;
+
+  if (pm->n_buffers >= pm->max_buffers)
+    goto drop;
+
+  q = mhash_get (&pm->pending_index_by_key, &r->key);
+  if (q)
+    p = pool_elt_at_index (pm->pending_pool, q[0]);
+  else
+    {
+      pool_get (pm->pending_pool, p);
+      p->key = r->key;
+      p->buffers = 0;
+      p->resume_node_index = r->resume_node_index;
+      p->time_created = now;
+      mhash_set (&pm->pending_index_by_key, &p->key, p - pm->pending_pool, /* old_value */ 0);
+    }
+
+  if (vec_len (p->buffers) >= pm->max_buffers_per_neighbor)
+    goto drop;
+
+  vec_add1 (p->buffers, r->buffer_index);
+  pm->n_buffers += 1;
+  return;
+
+ drop:
+  vlib_buffer_free (vm, &r->buffer_index, 1);
+}
+
+/* Called with lock held.  Moves requests queued by workers into pool. */
+static void
+ip_neighbor_pending_drain (vlib_main_t * vm,
+			   ip_neighbor_pending_main_t * pm)
+{
+  ip_neighbor_pending_ring_t * r;
+  f64 now = vlib_time_now (vm);
+  u32 head, tail, mask;
+
+  vec_foreach (r, pm->rings)
+    {
+      head = r->head;
+      tail = r->tail;
+      if (head == tail)
+	continue;
+
+      /* Requests must be read after tail. */
+      CLIB_MEMORY_BARRIER ();
+
+      mask = vec_len (r->requests) - 1;
+      for (; head != tail; head++)
+	ip_neighbor_pending_hold (vm, pm, r->requests + (head & mask), now);
+
+      /* Slots are free for producer only after we have read them. */
+      CLIB_MEMORY_BARRIER ();
+      r->head = head;
+    }
+}
+
+/* Lock free check for held or queued buffers. */
+static uword
+ip_neighbor_pending_is_empty (ip_neighbor_pending_main_t * pm)
+{
+  ip_neighbor_pending_ring_t * r;
+
+  if (pool_elts (pm->pending_pool) > 0)
+    return 0;
+
+  vec_foreach (r, pm->rings)
+    if (r->head != r->tail)
+      return 0;
+
+  return 1;
+}
+
+/* Drops buffers for neighbors which never resolved. */
+static void
+ip_neighbor_pending_expire (vlib_main_t * vm,
+			    ip_neighbor_pending_main_t * pm,
+			    f64 now)
+{
+  ip_neighbor_pending_t * p;
+  u32 * expired = 0, * i;
+
+  if (ip_neighbor_pending_is_empty (pm))
+    return;
+
+  ip_neighbor_pending_lock (pm);
+
+  ip_neighbor_pending_drain (vm, pm);
+
+  pool_foreach (p, pm->pending_pool, ({
+    if (now - p->time_created > pm->timeout)
+      vec_add1 (expired, p - pm->pending_pool);
+  }));
+
+  vec_foreach (i, expired)
+    ip_neighbor_pending_free (vm, pm, pool_elt_at_index (pm->pending_pool, i[0]));
+
+  ip_neighbor_pending_unlock (pm);
+
+  vec_free (expired);
+}
+
+/* Held buffers must expire even when no more traffic arrives for their
+   neighbors.  Also moves queued requests into pending pool. */
+static uword
+ip_neighbor_pending_expire_process (vlib_main_t * vm,
+				    vlib_node_runtime_t * rt,
+				    vlib_frame_t * f)
+{
+  while (1)
+    {
+      vlib_process_suspend (vm, 0.5);
+      ip_neighbor_pending_expire (vm, &ip4_main.lookup_main.neighbor_pending, vlib_time_now (vm));
+      ip_neighbor_pending_expire (vm, &ip6_main.lookup_main.neighbor_pending, vlib_time_now (vm));
+    }
+
+  return 0;
+}
+
+static VLIB_REGISTER_NODE (ip_neighbor_pending_expire_process_node) = {
+  .function = ip_neighbor_pending_expire_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "ip-neighbor-pending-expire",
+};
+
+uword ip_neighbor_pending_enqueue (vlib_main_t * vm, ip_lookup_main_t * lm,
+				   u32 sw_if_index, void * address, u32 bi,
+				   u32 resume_node_index)
+{
+  ip_neighbor_pending_main_t * pm = &lm->neighbor_pending;
+  ip_neighbor_pending_ring_t * r;
+  ip_neighbor_pending_request_t * e;
+  uword cpu = os_get_cpu_number ();
+  u32 head, tail;
+
+  if (pm->max_buffers_per_neighbor == 0 || cpu >= vec_len (pm->rings))
+    return 0;
+
+  r = vec_elt_at_index (pm->rings, cpu);
+  head = r->head;
+  tail = r->tail;
+
+  /* Full: drop rather than wait for main thread. */
+  if (tail - head >= vec_len (r->requests))
+    return 0;
+
+  e = r->requests + (tail & (vec_len (r->requests) - 1));
+  ip_neighbor_pending_key_init (lm, &e->key, sw_if_index, address);
+  e->buffer_index = bi;
+  e->resume_node_index = resume_node_index;
+
+  /* Request must be visible before new tail. */
+  CLIB_MEMORY_BARRIER ();
+  r->tail = tail + 1;
+
+  return 1;
+}
+
+void ip_neighbor_pending_validate_workers (ip_lookup_main_t * lm, u32 n_workers)
+{
+  ip_neighbor_pending_main_t * pm = &lm->neighbor_pending;
+  ip_neighbor_pending_ring_t * r;
+
+  vec_validate_aligned (pm->rings, n_workers - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (r, pm->rings)
+    vec_validate_aligned (r->requests, pm->ring_size - 1, CLIB_CACHE_LINE_BYTES);
+}
+
+void ip_neighbor_pending_resolved (vlib_main_t * vm, ip_lookup_main_t * lm,
+				   u32 sw_if_index, void * address)
+{
+  ip_neighbor_pending_main_t * pm = &lm->neighbor_pending;
+  ip_neighbor_pending_key_t k;
+  ip_neighbor_pending_t * p;
+  vlib_frame_t * f;
+  u32 * buffers, * to_next, resume_node_index;
+  uword * q;
+
+  if (ip_neighbor_pending_is_empty (pm))
+    return;
+
+  ip_neighbor_pending_key_init (lm, &k, sw_if_index, address);
+
+  ip_neighbor_pending_lock (pm);
+
+  /* Buffers queued before neighbor resolved resume with held ones. */
+  ip_neighbor_pending_drain (vm, pm);
+
+  q = mhash_get (&pm->pending_index_by_key, &k);
+  if (! q)
+    {
+      ip_neighbor_pending_unlock (pm);
+      return;
+    }
+
+  /* Take buffers; entry is freed without freeing them. */
+  p = pool_elt_at_index (pm->pending_pool, q[0]);
+  buffers = p->buffers;
+  resume_node_index = p->resume_node_index;
+  p->buffers = 0;
+  pm->n_buffers -= vec_len (buffers);
+  ip_neighbor_pending_free (vm, pm, p);
+
+  ip_neighbor_pending_unlock (pm);
+
+  if (vec_len (buffers) > 0)
+    {
+      ASSERT (vec_len (buffers) <= VLIB_FRAME_SIZE);
+
+      f = vlib_get_frame_to_node (vm, resume_node_index);
+      to_next = vlib_frame_vector_args (f);
+      memcpy (to_next, buffers, vec_len (buffers) * sizeof (buffers[0]));
+      f->n_vectors = vec_len (buffers);
+      vlib_put_frame_to_node (vm, resume_node_index, f);
+    }
+
+  vec_free (buffers);
+}
+
+void ip_neighbor_pending_flush (vlib_main_t * vm, ip_lookup_main_t * lm,
+				u32 sw_if_index)
+{
+  ip_neighbor_pending_main_t * pm = &lm->neighbor_pending;
+  ip_neighbor_pending_t * p;
+  u32 * flushed = 0, * i;
+
+  ip_neighbor_pending_lock (pm);
+
+  ip_neighbor_pending_drain (vm, pm);
+
+  pool_foreach (p, pm->pending_pool, ({
+    if (sw_if_index == ~0 || p->key.sw_if_index == sw_if_index)
+      vec_add1 (flushed, p - pm->pending_pool);
+  }));
+
+  vec_foreach (i, flushed)
+    ip_neighbor_pending_free (vm, pm, pool_elt_at_index (pm->pending_pool, i[0]));
+
+  ip_neighbor_pending_unlock (pm);
+
+  vec_free (flushed);
+}
+
+#define IP_NEIGHBOR_REQUEST_LIMIT_MAX_KICKS 8
+
+always_inline u32
+request_limit_other_bucket (u32 bucket_index, u32 fingerprint, u32 mask)
+{ return (bucket_index ^ (fingerprint * 0x5bd1e995)) & mask; }
+
+/* Slot holds no state once its bucket would have refilled. */
+always_inline uword
+request_limit_slot_is_free (ip_neighbor_request_limiter_t * l,
+			    ip_token_bucket_t * t, f64 now)
+{
+  return (t->fingerprint == 0
+	  || t->tokens + (now - t->time_last_update) * l->dst_rate >= l->dst_burst);
+}
+
+static ip_token_bucket_t *
+request_limit_find (ip_neighbor_request_limiter_t * l, u32 i0, u32 i1, u32 fingerprint)
+{
+  ip_token_bucket_t * t;
+  uword i;
+
+  for (i = 0; i < IP_NEIGHBOR_REQUEST_LIMIT_BUCKET_SIZE; i++)
+    {
+      t = &l->buckets[i0].slots[i];
+      if (t->fingerprint == fingerprint)
+	return t;
+      t = &l->buckets[i1].slots[i];
+      if (t->fingerprint == fingerprint)
+	return t;
+    }
+
+  return 0;
+}
+
+static void
+request_limit_insert (ip_neighbor_request_limiter_t * l,
+		      u32 bucket_index, ip_token_bucket_t * t, f64 now)
+{
+  u32 mask = vec_len (l->buckets) - 1;
+  ip_token_bucket_t insert = t[0], victim, * s;
+  u32 i, j, n_kicks, bi[2];
+
+  bi[0] = bucket_index;
+  for (n_kicks = 0; n_kicks < IP_NEIGHBOR_REQUEST_LIMIT_MAX_KICKS; n_kicks++)
+    {
+      bi[1] = request_limit_other_bucket (bi[0], insert.fingerprint, mask);
+
+      for (j = 0; j < 2; j++)
+	for (i = 0; i < IP_NEIGHBOR_REQUEST_LIMIT_BUCKET_SIZE; i++)
+	  {
+	    s = &l->buckets[bi[j]].slots[i];
+	    if (request_limit_slot_is_free (l, s, now))
+	      {
+		s[0] = insert;
+		return;
+	      }
+	  }
+
+      /* Both buckets full: displace a slot and move it to its other bucket. */
+      s = &l->buckets[bi[0]].slots[(insert.fingerprint + n_kicks) % IP_NEIGHBOR_REQUEST_LIMIT_BUCKET_SIZE];
+      victim = s[0];
+      s[0] = insert;
+      insert = victim;
+      bi[0] = request_limit_other_bucket (bi[0], insert.fingerprint, mask);
+    }
+
+  /* Table is full: last displaced destination loses its state and will
+     get a full burst next time. */
+}
+
+void ip_neighbor_request_limit_validate_workers (ip_lookup_main_t * lm, u32 n_workers)
+{
+  vec_validate_aligned (lm->neighbor_request_limiters, n_workers - 1, CLIB_CACHE_LINE_BYTES);
+}
+
+ip_neighbor_request_limit_result_t
+ip_neighbor_request_limit (vlib_main_t * vm,
+			   ip_lookup_main_t * lm,
+			   u32 sw_if_index, void * address, f64 now)
+{
+  ip_neighbor_request_limit_config_t * c = &lm->neighbor_request_limit;
+  ip_neighbor_request_limiter_t * l;
+  ip_token_bucket_t * t, fresh, * ib;
+  u32 * d = address;
+  u32 a, b, h, fingerprint, mask, i0, i1;
+
+  /* Limiters are validated for every worker allowed to register. */
+  l = vec_elt_at_index (lm->neighbor_request_limiters, os_get_cpu_number ());
+
+  if (PREDICT_FALSE (! l->buckets))
+    {
+      u32 * r = clib_random_buffer_get_data (&vm->random_buffer, sizeof (l->hash_seeds));
+      f64 n_workers = vec_len (lm->neighbor_request_limiters);
+
+      memcpy (l->hash_seeds, r, sizeof (l->hash_seeds));
+      vec_validate_aligned (l->buckets, (1 << c->log2_n_buckets) - 1, CLIB_CACHE_LINE_BYTES);
+
+      /* Any worker may send requests for any destination or interface so
+	 each gets its share of configured rates.  Bursts must still let a
+	 single request through. */
+      l->dst_rate = c->dst_rate / n_workers;
+      l->dst_burst = clib_max (c->dst_burst / n_workers, 1);
+      l->interface_rate = c->interface_rate / n_workers;
+      l->interface_burst = clib_max (c->interface_burst / n_workers, 1);
+    }
+
+  a = l->hash_seeds[0];
+  b = l->hash_seeds[1];
+  h = l->hash_seeds[2];
+
+  a ^= sw_if_index;
+  b ^= d[0];
+  if (lm->is_ip6)
+    {
+      h ^= d[1];
+      hash_v3_mix32 (a, b, h);
+      b ^= d[2];
+      h ^= d[3];
+    }
+  hash_v3_finalize32 (a, b, h);
+
+  mask = vec_len (l->buckets) - 1;
+  fingerprint = b ? b : 1;
+  i0 = h & mask;
+  i1 = request_limit_other_bucket (i0, fingerprint, mask);
+
+  t = request_limit_find (l, i0, i1, fingerprint);
+  if (t)
+    {
+      if (! ip_token_bucket_take (t, now, l->dst_rate, l->dst_burst))
+	return IP_NEIGHBOR_REQUEST_DST_LIMITED;
+    }
+  else
+    {
+      fresh.fingerprint = fingerprint;
+      fresh.tokens = l->dst_burst;
+      fresh.time_last_update = now;
+      ip_token_bucket_take (&fresh, now, l->dst_rate, l->dst_burst);
+    }
+
+  vec_validate (l->bucket_by_sw_if_index, sw_if_index);
+  ib = vec_elt_at_index (l->bucket_by_sw_if_index, sw_if_index);
+  if (! ip_token_bucket_take (ib, now, l->interface_rate, l->interface_burst))
+    {
+      /* Request is not sent so destination keeps its token. */
+      if (t)
+	t->tokens += 1;
+      return IP_NEIGHBOR_REQUEST_INTERFACE_LIMITED;
+    }
+
+  if (! t)
+    request_limit_insert (l, i0, &fresh, now);
+
+  return IP_NEIGHBOR_REQUEST_SEND;
+}
+
+uword unformat_ip_neighbor_request_limit_config (unformat_input_t * input, va_list * args)
+{
+  ip_neighbor_request_limit_config_t * c = va_arg (*args, ip_neighbor_request_limit_config_t *);
+  uword n_matched = 0;
+  u32 n_buckets;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "dst-rate %f", &c->dst_rate))
+	;
+      else if (unformat (input, "dst-burst %f", &c->dst_burst))
+	;
+      else if (unformat (input, "interface-rate %f", &c->interface_rate))
+	;
+      else if (unformat (input, "interface-burst %f", &c->interface_burst))
+	;
+      else if (unformat (input, "buckets %d", &n_buckets))
+	{
+	  /* is_pow2 (0) is true and min_log2 (0) is undefined. */
+	  if (n_buckets == 0 || ! is_pow2 (n_buckets))
+	    return 0;
+	  c->log2_n_buckets = min_log2 (n_buckets);
+	}
+      else
+	break;
+      n_matched++;
+    }
+
+  return n_matched > 0 && c->dst_rate > 0 && c->interface_rate > 0
+    && c->dst_burst >= 1 && c->interface_burst >= 1;
+}
+
+void ip_neighbor_aging_config_init (ip_neighbor_aging_config_t * c)
+{
+  /* Defaults from RFC 4861 (REACHABLE_TIME, RETRANS_TIMER,
+     MAX_UNICAST_SOLICIT). */
+  c->reachable_time = 30;
+  c->stale_time = 60;
+  c->probe_interval = 1;
+  c->max_probes = 3;
+}
+
+ip_neighbor_state_t
+ip_neighbor_age_timer_expired (ip_neighbor_aging_config_t * c,
+			       ip_neighbor_age_t * a,
+			       f64 now, u64 n_adj_packets,
+			       f64 * next_timer_interval)
+{
+  f64 dt = now - a->time_last_confirmed;
+  uword is_used = n_adj_packets != a->n_packets_last;
+
+  a->n_packets_last = n_adj_packets;
+
+  /* Confirmed by reply since timer was started. */
+  if (dt < c->reachable_time)
+    {
+      ip_neighbor_age_confirm (a, a->time_last_confirmed);
+      *next_timer_interval = c->reachable_time - dt;
+      return a->state;
+    }
+
+  switch (a->state)
+    {
+    case IP_NEIGHBOR_STATE_REACHABLE:
+      if (is_used)
+	goto probe;
+      a->state = IP_NEIGHBOR_STATE_STALE;
+      *next_timer_interval = c->stale_time;
+      break;
+
+    case IP_NEIGHBOR_STATE_STALE:
+      if (is_used)
+	goto probe;
+      a->state = IP_NEIGHBOR_STATE_FAILED;
+      break;
+
+    case IP_NEIGHBOR_STATE_PROBE:
+      if (a->n_probes_sent >= c->max_probes)
+	{
+	  a->state = IP_NEIGHBOR_STATE_FAILED;
+	  break;
+	}
+    probe:
+      a->state = IP_NEIGHBOR_STATE_PROBE;
+      a->n_probes_sent += 1;
+      *next_timer_interval = c->probe_interval;
+      break;
+
+    default:
+      a->state = IP_NEIGHBOR_STATE_FAILED;
+      break;
+    }
+
+  return a->state;
+}
+
+u8 * format_ip_neighbor_state (u8 * s, va_list * args)
+{
+  ip_neighbor_state_t state = va_arg (*args, ip_neighbor_state_t);
+  char * t = 0;
+
+  switch (state)
+    {
+#define _(f,n) case IP_NEIGHBOR_STATE_##f: t = n; break;
+      foreach_ip_neighbor_state
+#undef _
+
+    default:
+      return format (s, "unknown 0x%x", state);
+    }
+
+  return format (s, "%s", t);
+}
+
+uword unformat_ip_neighbor_aging_config (unformat_input_t * input, va_list * args)
+{
+  ip_neighbor_aging_config_t * c = va_arg (*args, ip_neighbor_aging_config_t *);
+  uword n_matched = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "reachable-time %f", &c->reachable_time))
+	;
+      else if (unformat (input, "stale-time %f", &c->stale_time))
+	;
+      else if (unformat (input, "probe-interval %f", &c->probe_interval))
+	;
+      else if (unformat (input, "max-probes %d", &c->max_probes))
+	;
+      else
+	break;
+      n_matched++;
+    }
+
+  return n_matched > 0;
 }
 
 void ip_lookup_init (ip_lookup_main_t * lm, u32 is_ip6)
 {
   ip_adjacency_t * adj;
 
+  /* Reserve before any adjacency is added so lookups never see heap move. */
+  ip_adjacency_heap_reserve (lm, IP_LOOKUP_DEFAULT_ADJACENCY_HEAP_SIZE);
+
   /* Hand-craft special miss adjacency to use when nothing matches in the
      routing table.  Same for drop adjacency. */
   adj = ip_add_adjacency (lm, /* template */ 0, /* n-adj */ 1, &lm->miss_adj_index);
@@ -823,6 +1558,42 @@ void ip_lookup_init (ip_lookup_main_t * lm, u32 is_ip6)
       mhash_init (&lm->address_to_if_address_index, sizeof (uword), sizeof (ip4_address_t));
     }
 
+  {
+    ip_neighbor_pending_main_t * pm = &lm->neighbor_pending;
+
+    mhash_init (&pm->pending_index_by_key, sizeof (uword), sizeof (ip_neighbor_pending_key_t));
+
+    /* Enough to cover a TCP handshake or initial burst per neighbor. */
+    pm->max_buffers_per_neighbor = 4;
+    pm->max_buffers = 1024;
+
+    /* Covers a few frames of new neighbors between drains. */
+    pm->ring_size = 4 * VLIB_FRAME_SIZE;
+    ip_neighbor_pending_validate_workers (lm, vnet_n_workers (&vnet_worker_main));
+
+    /* About as long as a few request retransmits. */
+    pm->timeout = 3;
+  }
+
+  {
+    ip_neighbor_request_limit_config_t * c = &lm->neighbor_request_limit;
+
+    /* At most one request per second to any destination (RFC 1122
+       2.3.2.1; RFC 4861 RETRANS_TIMER). */
+    c->dst_rate = 1;
+    c->dst_burst = 1;
+
+    /* Bounds requests sent by a scan of a large subnet. */
+    c->interface_rate = 1000;
+    c->interface_burst = 100;
+
+    /* 4k destinations per worker. */
+    c->log2_n_buckets = 10;
+
+    /* Workers config validates more. */
+    ip_neighbor_request_limit_validate_workers (lm, vnet_n_workers (&vnet_worker_main));
+  }
+
   {
     int i;
 
@@ -836,6 +1607,9 @@ void ip_lookup_init (ip_lookup_main_t * lm, u32 is_ip6)
     lm->local_next_by_ip_protocol[IP_PROTOCOL_TCP] = IP_LOCAL_NEXT_TCP_LOOKUP;
     lm->local_next_by_ip_protocol[IP_PROTOCOL_UDP] = IP_LOCAL_NEXT_UDP_LOOKUP;
     lm->local_next_by_ip_protocol[is_ip6 ? IP_PROTOCOL_ICMP6 : IP_PROTOCOL_ICMP] = IP_LOCAL_NEXT_ICMP;
+    /* ip4 fragments are recognized by ip4-local from header flags. */
+    if (is_ip6)
+      lm->local_next_by_ip_protocol[IP_PROTOCOL_IPV6_FRAGMENTATION] = IP_LOCAL_NEXT_REASSEMBLY;
     lm->builtin_protocol_by_ip_protocol[IP_PROTOCOL_TCP] = IP_BUILTIN_PROTOCOL_TCP;
     lm->builtin_protocol_by_ip_protocol[IP_PROTOCOL_UDP] = IP_BUILTIN_PROTOCOL_UDP;
     lm->builtin_protocol_by_ip_protocol[is_ip6 ? IP_PROTOCOL_ICMP6 : IP_PROTOCOL_ICMP] = IP_BUILTIN_PROTOCOL_ICMP;
@@ -1025,6 +1799,102 @@ static uword unformat_ip_adjacency (unformat_input_t * input, va_list * args)
   return 1;
 }
 
+/* Load ip4 routes from file; one route per line:
+     [add|del] <prefix>/<length> via <next-hop> <interface> [weight <n>]
+   All routes are added to FIB hash tables first and then each FIB mtrie
+   is rebuilt once. */
+static clib_error_t *
+ip4_route_load_file (vlib_main_t * vm, char * file_name)
+{
+  vnet_main_t * vnm = &vnet_main;
+  clib_error_t * error = 0;
+  unformat_input_t input, _line_input, * line_input = &_line_input;
+  ip4_add_del_route_next_hop_args_t * routes = 0, * r;
+  u32 line_number = 0;
+  int fd;
+  f64 t[2];
+
+  fd = open (file_name, O_RDONLY);
+  if (fd < 0)
+    return clib_error_return_unix (0, "open `%s'", file_name);
+
+  unformat_init_unix_file (&input, fd);
+
+  while (unformat_user (&input, unformat_line_input, line_input))
+    {
+      line_number++;
+
+      /* Skip empty lines. */
+      if (unformat_check_input (line_input) == UNFORMAT_END_OF_INPUT)
+	{
+	  unformat_free (line_input);
+	  continue;
+	}
+
+      vec_add2 (routes, r, 1);
+      memset (r, 0, sizeof (r[0]));
+      r->flags = IP4_ROUTE_FLAG_ADD;
+      r->next_hop_sw_if_index = ~0;
+      r->next_hop_weight = 1;
+
+      while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+	{
+	  if (unformat (line_input, "add"))
+	    r->flags = IP4_ROUTE_FLAG_ADD;
+	  else if (unformat (line_input, "del"))
+	    r->flags = IP4_ROUTE_FLAG_DEL;
+	  else if (unformat (line_input, "%U/%d",
+			     unformat_ip4_address, &r->dst_address,
+			     &r->dst_address_length))
+	    ;
+	  else if (unformat (line_input, "via %U %U",
+			     unformat_ip4_address, &r->next_hop,
+			     unformat_vnet_sw_interface, vnm, &r->next_hop_sw_if_index))
+	    ;
+	  else if (unformat (line_input, "weight %u", &r->next_hop_weight))
+	    ;
+	  else
+	    {
+	      error = clib_error_return (0, "%s line %d: parse error `%U'",
+					 file_name, line_number,
+					 format_unformat_error, line_input);
+	      unformat_free (line_input);
+	      goto done;
+	    }
+	}
+
+      unformat_free (line_input);
+
+      if (r->next_hop_sw_if_index == ~0)
+	{
+	  error = clib_error_return (0, "%s line %d: expected via <next-hop> <interface>",
+				     file_name, line_number);
+	  goto done;
+	}
+
+      if (r->dst_address_length > 32)
+	{
+	  error = clib_error_return (0, "%s line %d: bad prefix length %d",
+				     file_name, line_number, r->dst_address_length);
+	  goto done;
+	}
+    }
+
+  t[0] = vlib_time_now (vm);
+  ip4_add_del_route_next_hop_bulk (&ip4_main, routes, vec_len (routes));
+  t[1] = vlib_time_now (vm);
+
+  vlib_cli_output (vm, "%d routes in %.3f sec, %.6e routes/sec",
+		   vec_len (routes), t[1] - t[0],
+		   t[1] > t[0] ? vec_len (routes) / (t[1] - t[0]) : 0.);
+
+ done:
+  unformat_free (&input);
+  close (fd);
+  vec_free (routes);
+  return error;
+}
+
 static clib_error_t *
 ip_route (vlib_main_t * vm, unformat_input_t * main_input, vlib_cli_command_t * cmd)
 {
@@ -1038,6 +1908,7 @@ ip_route (vlib_main_t * vm, unformat_input_t * main_input, vlib_cli_command_t *
   u32 dst_address_length, * dst_address_lengths = 0;
   ip_adjacency_t parse_adj, * add_adj = 0;
   unformat_input_t _line_input, * line_input = &_line_input;
+  char * file_name = 0;
   f64 count;
 
   is_del = 0;
@@ -1058,6 +1929,8 @@ ip_route (vlib_main_t * vm, unformat_input_t * main_input, vlib_cli_command_t *
 	is_del = 0;
       else if (unformat (line_input, "count %f", &count))
 	;
+      else if (unformat (line_input, "file %s", &file_name))
+	;
 
       else if (unformat (line_input, "%U/%d",
 			 unformat_ip4_address, &ip4_addr,
@@ -1132,6 +2005,12 @@ ip_route (vlib_main_t * vm, unformat_input_t * main_input, vlib_cli_command_t *
     
   unformat_free (line_input);
 
+  if (file_name)
+    {
+      error = ip4_route_load_file (vm, file_name);
+      goto done;
+    }
+
   if (vec_len (ip4_dst_addresses) + vec_len (ip6_dst_addresses) == 0)
     {
       error = clib_error_return (0, "expected ip4/ip6 destination address/length.");
@@ -1315,6 +2194,7 @@ ip_route (vlib_main_t * vm, unformat_input_t * main_input, vlib_cli_command_t *
   }
 
  done:
+  vec_free (file_name);
   vec_free (add_adj);
   vec_free (weights);
   vec_free (dst_address_lengths);
@@ -1347,7 +2227,7 @@ static VLIB_CLI_COMMAND (vlib_cli_show_ip6_command) = {
 
 static VLIB_CLI_COMMAND (ip_route_command) = {
   .path = "ip route",
-  .short_help = "Add/delete IP routes",
+  .short_help = "Add/delete IP routes; file <name> loads ip4 routes from file",
   .function = ip_route,
 };
 
@@ -1451,7 +2331,7 @@ ip4_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
 	}
 
       if (mtrie)
-	vlib_cli_output (vm, "%U", format_ip4_fib_mtrie, &fib->mtrie);
+	vlib_cli_output (vm, "%U", format_ip4_fib_mtrie, fib->mtrie);
 
       if (routes)
 	_vec_len (routes) = 0;
@@ -1540,7 +2420,7 @@ ip4_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
 	  for (i = j = 0; i < adj->n_adj; i++)
 	    {
 	      n_left -= 1;
-	      vlib_get_combined_counter (&lm->adjacency_counters, adj_index + i, &c);
+	      vnet_get_combined_counter (&lm->adjacency_counters, adj_index + i, &c);
 	      vlib_counter_add (&sum, &c);
 	      if (n_left == 0)
 		{
@@ -1613,14 +2493,24 @@ ip6_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
   ip6_fib_mhash_t * mh;
   ip_lookup_main_t * lm = &im6->lookup_main;
   uword * results;
-  int verbose;
+  int verbose, mtrie;
 
   routes = 0;
   results = 0;
   verbose = 1;
-  if (unformat (input, "brief") || unformat (input, "summary")
-      || unformat (input, "sum"))
-    verbose = 0;
+  mtrie = 0;
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "brief") || unformat (input, "summary")
+	  || unformat (input, "sum"))
+	verbose = 0;
+
+      else if (unformat (input, "mtrie"))
+	mtrie = 1;
+
+      else
+	break;
+    }
 
   vec_foreach (fib, im6->fibs)
     {
@@ -1639,6 +2529,9 @@ ip6_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
 	  continue;
 	}
 
+      if (mtrie)
+	vlib_cli_output (vm, "%U", format_ip6_fib_mtrie, &fib->mtrie);
+
       if (routes)
 	_vec_len (routes) = 0;
       if (results)
@@ -1705,7 +2598,7 @@ ip6_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
 	  for (i = j = 0; i < adj->n_adj; i++)
 	    {
 	      n_left -= 1;
-	      vlib_get_combined_counter (&lm->adjacency_counters, adj_index + i, &c);
+	      vnet_get_combined_counter (&lm->adjacency_counters, adj_index + i, &c);
 	      vlib_counter_add (&sum, &c);
 	      if (n_left == 0)
 		{
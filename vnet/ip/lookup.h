@@ -27,6 +27,7 @@
 #define included_ip_lookup_h
 
 #include <vnet/vnet.h>
+#include <clib/cache.h>
 
 /* Next index stored in adjacency. */
 typedef enum {
@@ -173,6 +174,7 @@ typedef enum {
   IP_LOCAL_NEXT_TCP_LOOKUP,
   IP_LOCAL_NEXT_UDP_LOOKUP,
   IP_LOCAL_NEXT_ICMP,
+  IP_LOCAL_NEXT_REASSEMBLY,
   IP_LOCAL_N_NEXT,
 } ip_local_next_t;
 
@@ -189,12 +191,158 @@ typedef struct {
   u32 * config_index_by_sw_if_index;
 } ip_config_main_t;
 
+/* Limits on ARP requests and neighbor solicitations. */
+typedef struct {
+  /* Requests per second and burst for a single destination. */
+  f64 dst_rate, dst_burst;
+
+  /* Requests per second and burst for all destinations on an interface. */
+  f64 interface_rate, interface_burst;
+
+  /* Log2 number of hash buckets per worker. */
+  u32 log2_n_buckets;
+} ip_neighbor_request_limit_config_t;
+
+/* Token bucket: tokens accrue at rate per second up to burst; sending
+   takes one token. */
+typedef struct {
+  f64 time_last_update;
+  f32 tokens;
+
+  /* Request limiter: hash fingerprint of (interface, destination);
+     zero when slot is free. */
+  u32 fingerprint;
+} ip_token_bucket_t;
+
+always_inline uword
+ip_token_bucket_take (ip_token_bucket_t * b, f64 now, f64 rate, f64 burst)
+{
+  f64 tokens = b->tokens + (now - b->time_last_update) * rate;
+
+  tokens = clib_min (tokens, burst);
+  b->time_last_update = now;
+
+  if (tokens < 1)
+    {
+      b->tokens = tokens;
+      return 0;
+    }
+
+  b->tokens = tokens - 1;
+  return 1;
+}
+
+/* Per destination buckets are kept in a partial key cuckoo hash:
+   each (interface, destination) may live in one of 2 cache line sized
+   buckets.  Idle destinations whose bucket has refilled hold no state and
+   their slots are reused. */
+#define IP_NEIGHBOR_REQUEST_LIMIT_BUCKET_SIZE 4
+
+typedef struct {
+  ip_token_bucket_t slots[IP_NEIGHBOR_REQUEST_LIMIT_BUCKET_SIZE];
+} ip_neighbor_request_limit_bucket_t;
+
+/* Per worker state used by ip4-arp and ip6-discover-neighbor to limit
+   requests per destination and per interface. */
+typedef struct {
+  /* Power of 2 sized vector of hash buckets. */
+  ip_neighbor_request_limit_bucket_t * buckets;
+
+  /* This worker's share of configured rates and bursts: destinations and
+     interfaces are served by all workers. */
+  f64 dst_rate, dst_burst;
+  f64 interface_rate, interface_burst;
+
+  u32 hash_seeds[3];
+
+  /* Per interface buckets indexed by sw_if_index. */
+  ip_token_bucket_t * bucket_by_sw_if_index;
+} ip_neighbor_request_limiter_t;
+
+/* Packets held by ip4-arp and ip6-discover-neighbor while a neighbor is
+   being resolved.  Once neighbor resolution installs an adjacency held
+   packets resume at node given by holder (its lookup node) and so take
+   whatever path forwarding now gives them. */
+typedef struct {
+  u32 sw_if_index;
+
+  /* ip4 addresses use first 4 bytes; remaining bytes are zero. */
+  u8 address[16];
+} ip_neighbor_pending_key_t;
+
+typedef struct {
+  ip_neighbor_pending_key_t key;
+
+  /* Vector of held buffer indices in arrival order. */
+  u32 * buffers;
+
+  /* Node held buffers are sent to once neighbor is resolved. */
+  u32 resume_node_index;
+
+  /* Time first buffer was held. */
+  f64 time_created;
+} ip_neighbor_pending_t;
+
+/* Buffer handed by forwarding path to be held. */
+typedef struct {
+  ip_neighbor_pending_key_t key;
+  u32 buffer_index;
+  u32 resume_node_index;
+} ip_neighbor_pending_request_t;
+
+/* Single producer/single consumer ring of requests from one worker.
+   Consumers are serialized by pending main lock. */
+typedef struct {
+  /* Next slot to dequeue.  Written only with lock held. */
+  volatile u32 head;
+
+  u8 pad0[CLIB_CACHE_LINE_BYTES - 1 * sizeof (u32)];
+
+  /* Next slot to enqueue.  Written only by owning worker. */
+  volatile u32 tail;
+
+  u8 pad1[CLIB_CACHE_LINE_BYTES - 1 * sizeof (u32)];
+
+  /* Power of 2 sized vector of requests. */
+  ip_neighbor_pending_request_t * requests;
+} ip_neighbor_pending_ring_t;
+
+typedef struct {
+  ip_neighbor_pending_t * pending_pool;
+
+  /* Forwarding path only writes to its worker's ring; requests are moved
+     into pending pool by main thread's expire process or when a neighbor
+     resolves.  Indexed by cpu number. */
+  ip_neighbor_pending_ring_t * rings;
+
+  /* Number of requests per ring; power of 2. */
+  u32 ring_size;
+
+  /* Maps key to index in pending pool. */
+  mhash_t pending_index_by_key;
+
+  /* Limits on buffers held per neighbor and in total.
+     Zero per neighbor limit disables holding. */
+  u32 max_buffers_per_neighbor, max_buffers;
+
+  /* Number of buffers currently held. */
+  u32 n_buffers;
+
+  /* Held buffers are dropped if neighbor is not resolved within this
+     many seconds.  Checked periodically by ip-neighbor-pending-expire. */
+  f64 timeout;
+
+  /* Serializes pool, hash and ring consumers; never taken by
+     ip_neighbor_pending_enqueue. */
+  volatile u32 lock;
+} ip_neighbor_pending_main_t;
+
 typedef struct ip_lookup_main_t {
   /* Adjacency heap. */
   ip_adjacency_t * adjacency_heap;
 
   /* Adjacency packet/byte counters indexed by adjacency index. */
-  vlib_combined_counter_main_t adjacency_counters;
+  vnet_combined_counter_main_t adjacency_counters;
 
   /* Heap of (next hop, weight) blocks.  Sorted by next hop. */
   ip_multipath_next_hop_t * next_hop_heap;
@@ -255,6 +403,17 @@ typedef struct ip_lookup_main_t {
 
   /* IP_BUILTIN_PROTOCOL_{TCP,UDP,ICMP,OTHER} by protocol in IP header. */
   u8 builtin_protocol_by_ip_protocol[256];
+
+  /* Packets waiting for neighbor resolution. */
+  ip_neighbor_pending_main_t neighbor_pending;
+
+  /* Limits on ARP requests/neighbor solicitations sent by ip4-arp and
+     ip6-discover-neighbor. */
+  ip_neighbor_request_limit_config_t neighbor_request_limit;
+
+  /* Request limiter state indexed by worker.  Sized for all configured
+     workers before they start so it never moves. */
+  ip_neighbor_request_limiter_t * neighbor_request_limiters;
 } ip_lookup_main_t;
 
 always_inline ip_adjacency_t *
@@ -358,6 +517,175 @@ do {									\
     }									\
 } while (0)
 
+typedef enum {
+  IP_NEIGHBOR_REQUEST_SEND,
+  IP_NEIGHBOR_REQUEST_DST_LIMITED,
+  IP_NEIGHBOR_REQUEST_INTERFACE_LIMITED,
+} ip_neighbor_request_limit_result_t;
+
+/* Decide whether to send a request for given destination.  Uses calling
+   worker's limiter state. */
+ip_neighbor_request_limit_result_t
+ip_neighbor_request_limit (vlib_main_t * vm,
+			   ip_lookup_main_t * lm,
+			   u32 sw_if_index, void * address, f64 now);
+
+void ip_neighbor_request_limit_validate_workers (ip_lookup_main_t * lm, u32 n_workers);
+
+unformat_function_t unformat_ip_neighbor_request_limit_config;
+
+/* ARP/ND neighbor cache entry states.  Entries confirmed by a reply within
+   reachable time are reachable.  After that they are stale until used
+   (probe) or until stale time passes unused (failed).  Probed entries are
+   re-confirmed by a reply or fail after max probes.  Failed entries are
+   deleted.  Static entries configured by user never age. */
+#define foreach_ip_neighbor_state		\
+  _ (REACHABLE, "reachable")			\
+  _ (STALE, "stale")				\
+  _ (PROBE, "probe")				\
+  _ (FAILED, "failed")				\
+  _ (STATIC, "static")
+
+typedef enum {
+#define _(f,s) IP_NEIGHBOR_STATE_##f,
+  foreach_ip_neighbor_state
+#undef _
+} ip_neighbor_state_t;
+
+typedef struct {
+  /* Seconds neighbor is reachable after being confirmed. */
+  f64 reachable_time;
+
+  /* Seconds unused stale neighbor is kept. */
+  f64 stale_time;
+
+  /* Seconds between unicast probes and number of probes before failing. */
+  f64 probe_interval;
+  u32 max_probes;
+} ip_neighbor_aging_config_t;
+
+/* Aging state kept in each neighbor cache entry. */
+typedef struct {
+  f64 time_last_confirmed;
+
+  /* Adjacency packet count when timer last expired; change means
+     neighbor is in use. */
+  u64 n_packets_last;
+
+  /* Aging timer handle; ~0 if none running. */
+  u32 timer_handle;
+
+  /* ip_neighbor_state_t */
+  u8 state;
+
+  u8 n_probes_sent;
+} ip_neighbor_age_t;
+
+always_inline void
+ip_neighbor_age_confirm (ip_neighbor_age_t * a, f64 now)
+{
+  a->state = IP_NEIGHBOR_STATE_REACHABLE;
+  a->n_probes_sent = 0;
+  a->time_last_confirmed = now;
+}
+
+/* Called when entry's aging timer expires.  Returns new state; for states
+   other than failed sets seconds until timer should expire again.  Caller
+   sends unicast probe for probe state and deletes failed entries. */
+ip_neighbor_state_t
+ip_neighbor_age_timer_expired (ip_neighbor_aging_config_t * c,
+			       ip_neighbor_age_t * a,
+			       f64 now, u64 n_adj_packets,
+			       f64 * next_timer_interval);
+
+format_function_t format_ip_neighbor_state;
+unformat_function_t unformat_ip_neighbor_aging_config;
+
+void ip_neighbor_aging_config_init (ip_neighbor_aging_config_t * c);
+
+/* Forwarding state (plies, adjacency blocks, vectors) that control plane
+   has unlinked is freed only after every lookup thread has passed a
+   quiescent point; lookups never take locks.  Each thread records the
+   global epoch when it holds no references to forwarding state.  Objects
+   unlinked in epoch E are freed once all threads have recorded an epoch
+   after E.  Epoch is advanced by ip-lookup-reclaim process.  Every
+   thread passes its quiescent point in always polling ip-lookup-quiescent
+   input node, once per main loop. */
+typedef struct {
+  /* Called with opaque data to free object. */
+  void (* function) (uword opaque0, uword opaque1);
+  uword opaque[2];
+
+  /* Epoch when object was unlinked. */
+  u64 epoch;
+} ip_lookup_deferred_free_t;
+
+typedef struct {
+  /* Current epoch. */
+  u64 epoch;
+
+  /* Last epoch seen at quiescent point indexed by thread.  Sized for all
+   workers before they start; never resized by lookup threads. */
+  u64 * quiescent_epoch_by_thread;
+
+  /* FIFO of objects waiting to be freed; epochs are non-decreasing. */
+  ip_lookup_deferred_free_t * deferred_frees;
+
+  /* Number of objects freed so far. */
+  u64 n_freed;
+} ip_lookup_epoch_main_t;
+
+extern ip_lookup_epoch_main_t ip_lookup_epoch_main;
+
+/* Called by lookup threads when they hold no references to forwarding state. */
+always_inline void
+ip_lookup_thread_quiescent (u32 thread_index)
+{
+  ip_lookup_epoch_main_t * em = &ip_lookup_epoch_main;
+  ASSERT (thread_index < vec_len (em->quiescent_epoch_by_thread));
+  em->quiescent_epoch_by_thread[thread_index] = em->epoch;
+}
+
+/* Sizes quiescent state for given number of threads.  Must be called
+   before threads start. */
+void ip_lookup_epoch_validate_threads (u32 n_threads);
+
+void ip_lookup_defer_free (void (* function) (uword opaque0, uword opaque1),
+			   uword opaque0, uword opaque1);
+
+/* Vector free after grace period. */
+void ip_lookup_defer_vec_free (void * v);
+
+/* Pre-allocate adjacency heap so that it is not reallocated (and moved under
+   lookups) until given number of adjacencies are in use.  ip_lookup_init
+   reserves IP_LOOKUP_DEFAULT_ADJACENCY_HEAP_SIZE; ip4 config
+   adjacency-heap-size raises it.  Growing past the reservation still moves
+   the heap. */
+#define IP_LOOKUP_DEFAULT_ADJACENCY_HEAP_SIZE (16 << 10)
+
+void ip_adjacency_heap_reserve (ip_lookup_main_t * lm, u32 n_adj);
+
+/* Hold buffer until neighbor with given address is resolved; it then
+   resumes at given node.  Returns 1 if buffer is held; 0 if caller should
+   drop it.  Lock and allocation free: buffer is queued on calling worker's
+   ring. */
+uword ip_neighbor_pending_enqueue (vlib_main_t * vm, ip_lookup_main_t * lm,
+				   u32 sw_if_index, void * address, u32 bi,
+				   u32 resume_node_index);
+
+/* Send buffers held for neighbor to node they resume at.  Called whenever
+   neighbor is set, whether new or refreshed. */
+void ip_neighbor_pending_resolved (vlib_main_t * vm, ip_lookup_main_t * lm,
+				   u32 sw_if_index, void * address);
+
+/* Drop buffers held for neighbors on given interface (~0 means all). */
+void ip_neighbor_pending_flush (vlib_main_t * vm, ip_lookup_main_t * lm,
+				u32 sw_if_index);
+
+/* Sizes pending request rings for given number of workers.  Must be called
+   before workers start. */
+void ip_neighbor_pending_validate_workers (ip_lookup_main_t * lm, u32 n_workers);
+
 void ip_lookup_init (ip_lookup_main_t * lm, u32 ip_lookup_node_index);
 
 serialize_function_t serialize_ip_lookup_main, unserialize_ip_lookup_main;
@@ -458,6 +458,104 @@ tcp_round_trip_time_stats_compute (tcp_round_trip_time_stats_t * s, f64 * r)
   r[1] = rms;
 }
 
+/* RFC 6298 initial retransmit timeout and bounds in seconds. */
+#define TCP_RETRANSMIT_TIMEOUT_INITIAL 1.0
+#define TCP_RETRANSMIT_TIMEOUT_MIN 1.0
+#define TCP_RETRANSMIT_TIMEOUT_MAX 60.0
+
+/* Clock granularity of retransmit timer wheel. */
+#define TCP_RETRANSMIT_TICK_INTERVAL 10e-3
+
+/* Updates smoothed round trip time, its variation and retransmit timeout
+   given new measurement dt (RFC 6298 section 2). */
+always_inline void
+tcp_round_trip_time_update (tcp_main_t * tm, tcp_connection_t * c, f64 dt)
+{
+  tcp_round_trip_time_stats_t * s = &c->round_trip_time_stats;
+  f64 rto;
+
+  if (s->smoothed == 0)
+    {
+      s->smoothed = dt;
+      s->variation = dt / 2;
+    }
+  else
+    {
+      /* alpha = 1/8, beta = 1/4. */
+      s->variation = .75 * s->variation + .25 * fabs (s->smoothed - dt);
+      s->smoothed = .875 * s->smoothed + .125 * dt;
+    }
+
+  rto = s->smoothed + clib_max (TCP_RETRANSMIT_TICK_INTERVAL, 4 * s->variation);
+  rto = clib_max (rto, TCP_RETRANSMIT_TIMEOUT_MIN);
+  rto = clib_min (rto, TCP_RETRANSMIT_TIMEOUT_MAX);
+  c->retransmit_timeout = rto;
+}
+
+always_inline void
+tcp_retransmit_timer_start (tcp_main_t * tm, tcp_connection_t * c, u32 connection_handle)
+{
+  ASSERT (c->retransmit_timer_handle == ~0);
+  c->retransmit_timer_handle
+    = vnet_timer_wheel_start (&tm->retransmit_timer_wheel, connection_handle,
+			      c->retransmit_timeout);
+}
+
+always_inline void
+tcp_retransmit_timer_stop (tcp_main_t * tm, tcp_connection_t * c)
+{
+  if (c->retransmit_timer_handle != ~0)
+    vnet_timer_wheel_stop (&tm->retransmit_timer_wheel, c->retransmit_timer_handle);
+  c->retransmit_timer_handle = ~0;
+}
+
+/* Default delayed ACK timeout in seconds.  RFC 1122 4.2.3.2 allows
+   up to 500ms; we also ACK at least every second full segment. */
+#define TCP_DEFAULT_DELAYED_ACK_TIMEOUT 40e-3
+
+/* Queues connection for output node to send an ACK now or, unless
+   ack_now is set or 2 full segments are unacknowledged, starts delayed
+   ACK timer.  Connections are queued once so all segments for a
+   connection received before output node runs share one ACK. */
+always_inline void
+tcp_ack_schedule (tcp_main_t * tm, tcp_connection_t * c, u32 connection_handle, uword ack_now)
+{
+  ip46_tcp_main_t * tm46 = tcp_connection_is_ip6 (connection_handle) ? &tm->ip6 : &tm->ip4;
+
+  ack_now |= c->n_rx_unacked_bytes >= 2 * c->max_segment_size;
+  ack_now |= tm->delayed_ack_timeout == 0;
+
+  if (! ack_now)
+    {
+      if (c->delayed_ack_timer_handle == ~0)
+	c->delayed_ack_timer_handle
+	  = vnet_timer_wheel_start (&tm->delayed_ack_timer_wheel, connection_handle,
+				    tm->delayed_ack_timeout);
+    }
+  else if (! (c->flags & TCP_CONNECTION_FLAG_ack_pending))
+    {
+      c->flags |= TCP_CONNECTION_FLAG_ack_pending;
+      vec_add1 (tm46->connections_pending_acks, connection_handle / 2);
+    }
+}
+
+always_inline void
+tcp_delayed_ack_timer_stop (tcp_main_t * tm, tcp_connection_t * c)
+{
+  if (c->delayed_ack_timer_handle != ~0)
+    vnet_timer_wheel_stop (&tm->delayed_ack_timer_wheel, c->delayed_ack_timer_handle);
+  c->delayed_ack_timer_handle = ~0;
+}
+
+/* Called for each segment we send: all segments carry our ACK. */
+always_inline void
+tcp_ack_sent (tcp_main_t * tm, tcp_connection_t * c)
+{
+  c->flags &= ~TCP_CONNECTION_FLAG_ack_pending;
+  c->n_rx_unacked_bytes = 0;
+  tcp_delayed_ack_timer_stop (tm, c);
+}
+
 typedef struct {
   tcp_option_type_t type : 8;
   u8 length;
@@ -591,12 +689,20 @@ typedef enum {
   _ (UNEXPECTED_SEQ_NUMBER, "unexpected sequence number drops")		\
   _ (UNEXPECTED_ACK_NUMBER, "unexpected acknowledgment number drops")	\
   _ (CONNECTS_ESTABLISHED, "connects established")			\
+  _ (ESTABLISHED_HASH_FULL, "established connection table full")	\
+  _ (SYN_COOKIES_SENT, "syn cookies sent")				\
+  _ (SYN_COOKIE_INVALID, "invalid syn cookie drops")			\
   _ (NO_LISTENER_FOR_PORT, "no listener for port")			\
   _ (WRONG_LOCAL_ADDRESS_FOR_PORT, "wrong local address for port")	\
   _ (ACKS_SENT, "acks sent for established connections")		\
+  _ (DATA_SEGMENTS_SENT, "data segments sent")				\
+  _ (DATA_SEGMENTS_RETRANSMITTED, "data segments retransmitted")	\
   _ (NO_DATA, "acks with no data")					\
   _ (FINS_RECEIVED, "fins received")					\
   _ (SEGMENT_AFTER_FIN, "segments dropped after fin received")		\
+  _ (OUT_OF_ORDER_SEGMENTS, "out of order segments queued")		\
+  _ (DUPLICATE_SEGMENTS, "duplicate segment drops")			\
+  _ (ACKS_DELAYED, "data segments with delayed ack")			\
   _ (CONNECTIONS_CLOSED, "connections closed")
 
 typedef enum {
@@ -626,6 +732,454 @@ static_always_inline u32x4 u32x4_set_x2 (u32 x, u32 y)
 #else /* TCP_HAVE_VEC128 */
 #endif /* TCP_HAVE_VEC128 */
 
+always_inline ip4_tcp_udp_address_x4_and_connection_index_t *
+ip4_tcp_established_bucket (tcp_main_t * tm, u32 b)
+{
+  return (tm->ip4_established_connection_hash_pages[b >> TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE]
+	  + (b & pow2_mask (TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE)));
+}
+
+always_inline ip6_tcp_udp_address_x4_and_connection_index_t *
+ip6_tcp_established_bucket (tcp_main_t * tm, u32 b)
+{
+  return (tm->ip6_established_connection_hash_pages[b >> TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE]
+	  + (b & pow2_mask (TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE)));
+}
+
+/* Linear hashing: bucket for given hash value. */
+always_inline u32
+tcp_established_hash_bucket (tcp_established_hash_t * h, u32 hash)
+{
+  u32 b = hash & (h->n_base_buckets - 1);
+  return b < h->split_bucket_index ? hash & (2 * h->n_base_buckets - 1) : b;
+}
+
+always_inline u32
+tcp_established_hash_n_buckets (tcp_established_hash_t * h)
+{ return h->n_base_buckets + h->split_bucket_index; }
+
+/* Both established hashes of key: same as lanes 1 and 2 of hash computed
+   by ip46_tcp_lookup.  Key is ip4 src, dst, ports or ip6 src[4], dst[4],
+   ports as 32 bit words. */
+static_always_inline void
+tcp_established_key_hash (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 * key, u32 * hash)
+{
+  u32x4_union_t * seeds = tm->connection_hash_seeds[is_ip6];
+  u32 a1, b1, c1, a2, b2, c2;
+
+  a1 = seeds[0].as_u32[1] ^ key[0];
+  b1 = seeds[1].as_u32[1] ^ key[1];
+  c1 = seeds[2].as_u32[1] ^ key[2];
+  a2 = seeds[0].as_u32[2] ^ key[0];
+  b2 = seeds[1].as_u32[2] ^ key[1];
+  c2 = seeds[2].as_u32[2] ^ key[2];
+
+  if (is_ip6)
+    {
+      hash_v3_mix32 (a1, b1, c1);
+      hash_v3_mix32 (a2, b2, c2);
+
+      a1 ^= key[3]; b1 ^= key[4]; c1 ^= key[5];
+      a2 ^= key[3]; b2 ^= key[4]; c2 ^= key[5];
+
+      hash_v3_mix32 (a1, b1, c1);
+      hash_v3_mix32 (a2, b2, c2);
+
+      a1 ^= key[6]; b1 ^= key[7]; c1 ^= key[8];
+      a2 ^= key[6]; b2 ^= key[7]; c2 ^= key[8];
+    }
+
+  hash_v3_finalize32 (a1, b1, c1);
+  hash_v3_finalize32 (a2, b2, c2);
+
+  hash[0] = c1;
+  hash[1] = c2;
+}
+
+/* Key of connection from headers of received packet. */
+static_always_inline void
+tcp_connection_key_from_headers (tcp_ip_4_or_6_t is_ip6, void * ip, tcp_header_t * tcp,
+				 u32 * key)
+{
+  if (is_ip6)
+    {
+      ip6_header_t * ip6 = ip;
+      memcpy (key + 0, ip6->src_address.as_u32, sizeof (ip6->src_address));
+      memcpy (key + 4, ip6->dst_address.as_u32, sizeof (ip6->dst_address));
+      key[8] = tcp->ports.src_and_dst;
+    }
+  else
+    {
+      ip4_header_t * ip4 = ip;
+      key[0] = ip4->src_address.as_u32;
+      key[1] = ip4->dst_address.as_u32;
+      key[2] = tcp->ports.src_and_dst;
+    }
+}
+
+static_always_inline void
+tcp_established_key_get (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 hi, u32 * key)
+{
+  u32 i = hi % 4, j;
+
+  if (is_ip6)
+    {
+      ip6_tcp_udp_address_x4_t * a = &ip6_tcp_established_bucket (tm, hi / 4)->address_x4;
+      for (j = 0; j < 4; j++)
+	{
+	  key[0 + j] = a->src.as_u32[j][i];
+	  key[4 + j] = a->dst.as_u32[j][i];
+	}
+      key[8] = a->ports.as_ports[i].as_u32;
+    }
+  else
+    {
+      ip4_tcp_udp_address_x4_t * a = &ip4_tcp_established_bucket (tm, hi / 4)->address_x4;
+      key[0] = a->src.as_ip4_address[i].as_u32;
+      key[1] = a->dst.as_ip4_address[i].as_u32;
+      key[2] = a->ports.as_ports[i].as_u32;
+    }
+}
+
+static_always_inline void
+tcp_established_key_set (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 hi, u32 * key,
+			 u32 connection_index)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  u32 i = hi % 4, j;
+
+  if (is_ip6)
+    {
+      ip6_tcp_udp_address_x4_and_connection_index_t * b = ip6_tcp_established_bucket (tm, hi / 4);
+      for (j = 0; j < 4; j++)
+	{
+	  b->address_x4.src.as_u32[j][i] = key[0 + j];
+	  b->address_x4.dst.as_u32[j][i] = key[4 + j];
+	}
+      b->address_x4.ports.as_ports[i].as_u32 = key[8];
+      b->connection_index[i] = connection_index;
+    }
+  else
+    {
+      ip4_tcp_udp_address_x4_and_connection_index_t * b = ip4_tcp_established_bucket (tm, hi / 4);
+      b->address_x4.src.as_ip4_address[i].as_u32 = key[0];
+      b->address_x4.dst.as_ip4_address[i].as_u32 = key[1];
+      b->address_x4.ports.as_ports[i].as_u32 = key[2];
+      b->connection_index[i] = connection_index;
+    }
+
+  vec_elt_at_index (tm46->established_connections, connection_index)->address_hash_index = hi;
+}
+
+/* Slow path lookup of established connection by key.
+   Returns connection index or ~0. */
+static u32
+tcp_established_hash_lookup (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 * key)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  u32 hash[2], k[9], b, i, j, n_words = is_ip6 ? 9 : 3;
+
+  tcp_established_key_hash (tm, is_ip6, key, hash);
+  for (j = 0; j < 2; j++)
+    {
+      b = tcp_established_hash_bucket (&tm46->established_hash, hash[j]);
+      for (i = 0; i < 4; i++)
+	{
+	  tcp_established_key_get (tm, is_ip6, 4*b + i, k);
+	  if (! memcmp (k, key, n_words * sizeof (key[0])))
+	    return (is_ip6
+		    ? ip6_tcp_established_bucket (tm, b)->connection_index[i]
+		    : ip4_tcp_established_bucket (tm, b)->connection_index[i]);
+	}
+    }
+
+  return ~0;
+}
+
+/* Moves entry to empty entry of another bucket. */
+static_always_inline void
+tcp_established_hash_move (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 dst_hi, u32 src_hi)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  u32 ci;
+
+  if (is_ip6)
+    {
+      ip6_tcp_udp_address_x4_and_connection_index_t * d, * s;
+      d = ip6_tcp_established_bucket (tm, dst_hi / 4);
+      s = ip6_tcp_established_bucket (tm, src_hi / 4);
+      ip6_tcp_udp_address_x4_copy_and_invalidate (&d->address_x4, &s->address_x4,
+						  dst_hi % 4, src_hi % 4);
+      ci = d->connection_index[dst_hi % 4] = s->connection_index[src_hi % 4];
+    }
+  else
+    {
+      ip4_tcp_udp_address_x4_and_connection_index_t * d, * s;
+      d = ip4_tcp_established_bucket (tm, dst_hi / 4);
+      s = ip4_tcp_established_bucket (tm, src_hi / 4);
+      ip4_tcp_udp_address_x4_copy_and_invalidate (&d->address_x4, &s->address_x4,
+						  dst_hi % 4, src_hi % 4);
+      ci = d->connection_index[dst_hi % 4] = s->connection_index[src_hi % 4];
+    }
+
+  vec_elt_at_index (tm46->established_connections, ci)->address_hash_index = dst_hi;
+}
+
+always_inline uword
+tcp_established_bucket_first_empty (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 b)
+{
+  if (is_ip6)
+    return ip6_tcp_udp_address_x4_first_empty (&ip6_tcp_established_bucket (tm, b)->address_x4);
+  else
+    return ip4_tcp_udp_address_x4_first_empty (&ip4_tcp_established_bucket (tm, b)->address_x4);
+}
+
+/* Allocates page holding given bucket.  Pages are allocated in order. */
+static void
+tcp_established_hash_validate_bucket (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 b)
+{
+  uword p = b >> TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE;
+  uword n_bytes;
+
+  if (is_ip6)
+    {
+      if (p < vec_len (tm->ip6_established_connection_hash_pages))
+	return;
+      ASSERT (p == vec_len (tm->ip6_established_connection_hash_pages));
+      n_bytes = (sizeof (tm->ip6_established_connection_hash_pages[0][0])
+		 << TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE);
+      vec_add1 (tm->ip6_established_connection_hash_pages,
+		clib_mem_alloc_aligned (n_bytes, CLIB_CACHE_LINE_BYTES));
+      memset (tm->ip6_established_connection_hash_pages[p], 0, n_bytes);
+    }
+  else
+    {
+      if (p < vec_len (tm->ip4_established_connection_hash_pages))
+	return;
+      ASSERT (p == vec_len (tm->ip4_established_connection_hash_pages));
+      n_bytes = (sizeof (tm->ip4_established_connection_hash_pages[0][0])
+		 << TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE);
+      vec_add1 (tm->ip4_established_connection_hash_pages,
+		clib_mem_alloc_aligned (n_bytes, CLIB_CACHE_LINE_BYTES));
+      memset (tm->ip4_established_connection_hash_pages[p], 0, n_bytes);
+    }
+}
+
+/* Splits next bucket: entries whose hash now addresses new bucket move there. */
+static void
+tcp_established_hash_split (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  tcp_established_hash_t * h = &tm46->established_hash;
+  u32 key[9], hash[2], b, new_b, i, n_moved;
+
+  b = h->split_bucket_index;
+  new_b = b + h->n_base_buckets;
+  tcp_established_hash_validate_bucket (tm, is_ip6, new_b);
+
+  h->split_bucket_index++;
+
+  n_moved = 0;
+  for (i = 0; i < 4; i++)
+    {
+      if (is_ip6
+	  ? ! ip6_tcp_udp_address_x4_is_valid (&ip6_tcp_established_bucket (tm, b)->address_x4, i)
+	  : ! ip4_tcp_udp_address_x4_is_valid (&ip4_tcp_established_bucket (tm, b)->address_x4, i))
+	continue;
+
+      tcp_established_key_get (tm, is_ip6, 4*b + i, key);
+      tcp_established_key_hash (tm, is_ip6, key, hash);
+      if (tcp_established_hash_bucket (h, hash[0]) == b
+	  || tcp_established_hash_bucket (h, hash[1]) == b)
+	continue;
+
+      tcp_established_hash_move (tm, is_ip6, 4*new_b + n_moved, 4*b + i);
+      n_moved++;
+    }
+
+  if (h->split_bucket_index == h->n_base_buckets)
+    {
+      h->n_base_buckets *= 2;
+      h->split_bucket_index = 0;
+    }
+}
+
+/* Breadth first search for cuckoo path from key's buckets to an empty entry. */
+typedef struct {
+  u32 bucket;
+
+  /* Index in search queue of bucket holding entry which would move into
+     this bucket and its entry index there; ~0 for key's own buckets. */
+  u32 parent;
+  u32 parent_entry;
+} tcp_established_hash_search_t;
+
+#define TCP_ESTABLISHED_HASH_MAX_SEARCH 256
+
+/* Initial size of established hash; changed with tcp { established-connections N }. */
+#define TCP_DEFAULT_ESTABLISHED_CONNECTIONS 1024
+
+/* Returns 4 * bucket + entry where key was inserted or ~0 if no cuckoo
+   path to an empty entry was found. */
+static u32
+tcp_established_hash_insert (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 * key,
+			     u32 connection_index)
+{
+  static tcp_established_hash_search_t * q;
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  tcp_established_hash_t * h = &tm46->established_hash;
+  tcp_established_hash_search_t * s;
+  u32 hash[2], qi, i, e, b, alt, k[9];
+
+  vec_reset_length (q);
+
+  tcp_established_key_hash (tm, is_ip6, key, hash);
+  vec_add2 (q, s, 2);
+  s[0].bucket = tcp_established_hash_bucket (h, hash[0]);
+  s[1].bucket = tcp_established_hash_bucket (h, hash[1]);
+  s[0].parent = s[1].parent = ~0;
+
+  for (qi = 0; qi < vec_len (q); qi++)
+    {
+      b = q[qi].bucket;
+      e = tcp_established_bucket_first_empty (tm, is_ip6, b);
+      if (e < 4)
+	{
+	  /* Move entries along path into empty entry, last first. */
+	  while (q[qi].parent != ~0)
+	    {
+	      u32 p = q[qi].parent, pe = q[qi].parent_entry;
+	      tcp_established_hash_move (tm, is_ip6, 4*b + e, 4*q[p].bucket + pe);
+	      qi = p;
+	      b = q[qi].bucket;
+	      e = pe;
+	    }
+
+	  tcp_established_key_set (tm, is_ip6, 4*b + e, key, connection_index);
+	  h->n_elts++;
+	  return 4*b + e;
+	}
+
+      if (vec_len (q) + 4 > TCP_ESTABLISHED_HASH_MAX_SEARCH)
+	continue;
+
+      /* Bucket is full: each entry could move to its alternate bucket. */
+      for (i = 0; i < 4; i++)
+	{
+	  tcp_established_key_get (tm, is_ip6, 4*b + i, k);
+	  tcp_established_key_hash (tm, is_ip6, k, hash);
+	  alt = tcp_established_hash_bucket (h, hash[0]);
+	  alt = alt == b ? tcp_established_hash_bucket (h, hash[1]) : alt;
+	  if (alt == b)
+	    continue;
+
+	  /* Paths must not revisit a bucket. */
+	  vec_foreach (s, q)
+	    if (s->bucket == alt)
+	      break;
+	  if (s < vec_end (q))
+	    continue;
+
+	  vec_add2 (q, s, 1);
+	  s->bucket = alt;
+	  s->parent = qi;
+	  s->parent_entry = i;
+	}
+    }
+
+  return ~0;
+}
+
+/* Adds established connection to hash, growing table as it fills.
+   Returns ~0 if table is too full. */
+static u32
+tcp_established_hash_add (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 * key,
+			  u32 connection_index)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  tcp_established_hash_t * h = &tm46->established_hash;
+  u32 hi, n_splits;
+
+  /* Keep load below 7/8 by splitting a bucket per insert. */
+  if (8 * (h->n_elts + 1) > 7 * 4 * tcp_established_hash_n_buckets (h))
+    tcp_established_hash_split (tm, is_ip6);
+
+  /* No cuckoo path: split more buckets to make room. */
+  n_splits = 0;
+  while ((hi = tcp_established_hash_insert (tm, is_ip6, key, connection_index)) == ~0
+	 && n_splits++ < 64)
+    tcp_established_hash_split (tm, is_ip6);
+
+  return hi;
+}
+
+static void
+tcp_established_hash_del (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 hi)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+
+  if (is_ip6)
+    ip6_tcp_udp_address_x4_invalidate (&ip6_tcp_established_bucket (tm, hi / 4)->address_x4, hi % 4);
+  else
+    ip4_tcp_udp_address_x4_invalidate (&ip4_tcp_established_bucket (tm, hi / 4)->address_x4, hi % 4);
+
+  ASSERT (tm46->established_hash.n_elts > 0);
+  tm46->established_hash.n_elts--;
+}
+
+/* Sizes empty established hash for given number of connections. */
+static void
+tcp_established_hash_init (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 n_connections)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  tcp_established_hash_t * h = &tm46->established_hash;
+  u32 b;
+
+  ASSERT (h->n_elts == 0);
+
+  if (is_ip6)
+    {
+      for (b = 0; b < vec_len (tm->ip6_established_connection_hash_pages); b++)
+	clib_mem_free (tm->ip6_established_connection_hash_pages[b]);
+      vec_reset_length (tm->ip6_established_connection_hash_pages);
+    }
+  else
+    {
+      for (b = 0; b < vec_len (tm->ip4_established_connection_hash_pages); b++)
+	clib_mem_free (tm->ip4_established_connection_hash_pages[b]);
+      vec_reset_length (tm->ip4_established_connection_hash_pages);
+    }
+
+  /* Start half full. */
+  h->n_base_buckets = max_pow2 (clib_max (n_connections / 2, 1));
+  h->split_bucket_index = 0;
+
+  for (b = 0; b < h->n_base_buckets; b += 1 << TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE)
+    tcp_established_hash_validate_bucket (tm, is_ip6, b);
+}
+
+/* SYN cookies (RFC 4987).  While mini connection table churns, listeners
+   keep no state for SYNs: our initial sequence number encodes a keyed hash
+   of connection addresses, a coarse counter and negotiated MSS and window
+   scale.  Time stamps need no room in cookie since peer echoes ours in
+   ACK. */
+#define TCP_SYN_COOKIE_DATA_BITS 24
+#define TCP_SYN_COOKIE_LOG2_PERIOD 6
+#define TCP_SYN_COOKIE_MAX_AGE 2
+#define TCP_SYN_COOKIE_LIFETIME (TCP_SYN_COOKIE_MAX_AGE << TCP_SYN_COOKIE_LOG2_PERIOD)
+
+/* Cookies stay on this long after mini table stops churning. */
+#define TCP_SYN_COOKIE_HOLD_TIME 10.0
+
+/* Mini connections younger than this are still live when evicted. */
+#define TCP_MINI_CONNECTION_LIFETIME 1.0
+
+#define TCP_DEFAULT_SYN_COOKIE_EVICTION_THRESHOLD 32
+
+always_inline uword
+tcp_syn_cookies_enabled (tcp_main_t * tm, ip46_tcp_main_t * tm46, f64 now)
+{ return tm->syn_cookie_eviction_threshold == 0 || now < tm46->syn_cookies_until; }
+
 /* Dispatching on tcp/udp listeners (by dst port)
    and tcp/udp connections (by src/dst address/port). */
 static_always_inline uword
@@ -640,11 +1194,13 @@ ip46_tcp_lookup (vlib_main_t * vm,
   u32 * from, * to_next;
   u32 n_left_from, n_left_to_next, next, mini_now;
   vlib_node_runtime_t * error_node = node;
+  uword accept_syn_cookies;
 
   from = vlib_frame_vector_args (frame);
   n_left_from = n_packets;
   next = node->cached_next_index;
   mini_now = tcp_time_now (tm, TCP_TIMER_mini_connection);
+  accept_syn_cookies = tcp_syn_cookies_enabled (tm, tm46, vlib_time_now (vm) - TCP_SYN_COOKIE_LIFETIME);
   
   while (n_left_from > 0)
     {
@@ -656,11 +1212,11 @@ ip46_tcp_lookup (vlib_main_t * vm,
 	  ip6_header_t * ip60;
 	  ip4_header_t * ip40;
 	  tcp_header_t * tcp0;
-	  u32 bi0, imin0, iest0, li0;
+	  u32 bi0, imin0, iest0, li0, hash10, hash20;
 	  tcp_connection_state_t state0;
 	  u8 error0, next0;
-	  u8 min_match0, est_match0, is_min_match0, is_est_match0;
-	  u8 min_oldest0, est_first_empty0;
+	  u8 min_match0, est_match10, est_match20, is_min_match0, is_est_match0;
+	  u8 min_oldest0;
       
 	  bi0 = to_next[0] = from[0];
 
@@ -684,30 +1240,30 @@ ip46_tcp_lookup (vlib_main_t * vm,
 		ip60 = vlib_buffer_get_current (p0);
 		tcp0 = ip6_next_header (ip60);
 
-		a0 ^= u32x4_splat_x2 (ip60->src_address.as_u32[0]);
-		b0 ^= u32x4_splat_x2 (ip60->src_address.as_u32[1]);
-		c0 ^= u32x4_splat_x2 (ip60->src_address.as_u32[2]);
+		a0 ^= u32x4_splat (ip60->src_address.as_u32[0]);
+		b0 ^= u32x4_splat (ip60->src_address.as_u32[1]);
+		c0 ^= u32x4_splat (ip60->src_address.as_u32[2]);
 
 		hash_v3_mix_u32x (a0, b0, c0);
 
-		a0 ^= u32x4_splat_x2 (ip60->src_address.as_u32[3]);
-		b0 ^= u32x4_splat_x2 (ip60->dst_address.as_u32[0]);
-		c0 ^= u32x4_splat_x2 (ip60->dst_address.as_u32[1]);
+		a0 ^= u32x4_splat (ip60->src_address.as_u32[3]);
+		b0 ^= u32x4_splat (ip60->dst_address.as_u32[0]);
+		c0 ^= u32x4_splat (ip60->dst_address.as_u32[1]);
 
 		hash_v3_mix_u32x (a0, b0, c0);
 
-		a0 ^= u32x4_splat_x2 (ip60->dst_address.as_u32[2]);
-		b0 ^= u32x4_splat_x2 (ip60->dst_address.as_u32[3]);
-		c0 ^= u32x4_splat_x2 (tcp0->ports.src_and_dst);
+		a0 ^= u32x4_splat (ip60->dst_address.as_u32[2]);
+		b0 ^= u32x4_splat (ip60->dst_address.as_u32[3]);
+		c0 ^= u32x4_splat (tcp0->ports.src_and_dst);
 	      }
 	    else
 	      {
 		ip40 = vlib_buffer_get_current (p0);
 		tcp0 = ip4_next_header (ip40);
 
-		a0 ^= u32x4_splat_x2 (ip40->src_address.as_u32);
-		b0 ^= u32x4_splat_x2 (ip40->dst_address.as_u32);
-		c0 ^= u32x4_splat_x2 (tcp0->ports.src_and_dst);
+		a0 ^= u32x4_splat (ip40->src_address.as_u32);
+		b0 ^= u32x4_splat (ip40->dst_address.as_u32);
+		c0 ^= u32x4_splat (tcp0->ports.src_and_dst);
 	      }
 
 	    hash_v3_finalize_u32x (a0, b0, c0);
@@ -715,18 +1271,22 @@ ip46_tcp_lookup (vlib_main_t * vm,
 	    c0 &= tm->connection_hash_masks[is_ip6].as_u32x4;
 
 	    imin0 = u32x4_get0 (c0);
-	    iest0 = u32x4_get (c0, 1);
+	    hash10 = u32x4_get (c0, 1);
+	    hash20 = u32x4_get (c0, 2);
 	  }
 #else
 	  {
-	    u32 a00, a01, b00, b01, c00, c01;
+	    u32 a00, a01, a02, b00, b01, b02, c00, c01, c02;
 
 	    a00 = tm->connection_hash_seeds[is_ip6][0].as_u32[0];
 	    a01 = tm->connection_hash_seeds[is_ip6][0].as_u32[1];
+	    a02 = tm->connection_hash_seeds[is_ip6][0].as_u32[2];
 	    b00 = tm->connection_hash_seeds[is_ip6][1].as_u32[0];
 	    b01 = tm->connection_hash_seeds[is_ip6][1].as_u32[1];
+	    b02 = tm->connection_hash_seeds[is_ip6][1].as_u32[2];
 	    c00 = tm->connection_hash_seeds[is_ip6][2].as_u32[0];
 	    c01 = tm->connection_hash_seeds[is_ip6][2].as_u32[1];
+	    c02 = tm->connection_hash_seeds[is_ip6][2].as_u32[2];
 
 	    if (is_ip6)
 	      {
@@ -735,30 +1295,41 @@ ip46_tcp_lookup (vlib_main_t * vm,
 
 		a00 ^= ip60->src_address.as_u32[0];
 		a01 ^= ip60->src_address.as_u32[0];
+		a02 ^= ip60->src_address.as_u32[0];
 		b00 ^= ip60->src_address.as_u32[1];
 		b01 ^= ip60->src_address.as_u32[1];
+		b02 ^= ip60->src_address.as_u32[1];
 		c00 ^= ip60->src_address.as_u32[2];
 		c01 ^= ip60->src_address.as_u32[2];
+		c02 ^= ip60->src_address.as_u32[2];
 
 		hash_v3_mix32 (a00, b00, c00);
 		hash_v3_mix32 (a01, b01, c01);
+		hash_v3_mix32 (a02, b02, c02);
 
 		a00 ^= ip60->src_address.as_u32[3];
 		a01 ^= ip60->src_address.as_u32[3];
+		a02 ^= ip60->src_address.as_u32[3];
 		b00 ^= ip60->dst_address.as_u32[0];
 		b01 ^= ip60->dst_address.as_u32[0];
+		b02 ^= ip60->dst_address.as_u32[0];
 		c00 ^= ip60->dst_address.as_u32[1];
 		c01 ^= ip60->dst_address.as_u32[1];
+		c02 ^= ip60->dst_address.as_u32[1];
 
 		hash_v3_mix32 (a00, b00, c00);
 		hash_v3_mix32 (a01, b01, c01);
+		hash_v3_mix32 (a02, b02, c02);
 
 		a00 ^= ip60->dst_address.as_u32[2];
 		a01 ^= ip60->dst_address.as_u32[2];
+		a02 ^= ip60->dst_address.as_u32[2];
 		b00 ^= ip60->dst_address.as_u32[3];
 		b01 ^= ip60->dst_address.as_u32[3];
+		b02 ^= ip60->dst_address.as_u32[3];
 		c00 ^= tcp0->ports.src_and_dst;
 		c01 ^= tcp0->ports.src_and_dst;
+		c02 ^= tcp0->ports.src_and_dst;
 	      }
 	    else
 	      {
@@ -767,81 +1338,83 @@ ip46_tcp_lookup (vlib_main_t * vm,
 
 		a00 ^= ip40->src_address.as_u32;
 		a01 ^= ip40->src_address.as_u32;
+		a02 ^= ip40->src_address.as_u32;
 		b00 ^= ip40->dst_address.as_u32;
 		b01 ^= ip40->dst_address.as_u32;
+		b02 ^= ip40->dst_address.as_u32;
 		c00 ^= tcp0->ports.src_and_dst;
 		c01 ^= tcp0->ports.src_and_dst;
+		c02 ^= tcp0->ports.src_and_dst;
 	      }
 
 	    hash_v3_finalize32 (a00, b00, c00);
 	    hash_v3_finalize32 (a01, b01, c01);
+	    hash_v3_finalize32 (a02, b02, c02);
 
 	    c00 &= tm->connection_hash_masks[is_ip6].as_u32[0];
-	    c01 &= tm->connection_hash_masks[is_ip6].as_u32[1];
 
 	    imin0 = c00;
-	    iest0 = c01;
+	    hash10 = c01;
+	    hash20 = c02;
 	  }
 #endif
 
+	  {
+	    tcp_established_hash_t * h0 = &tm46->established_hash;
+	    hash10 = tcp_established_hash_bucket (h0, hash10);
+	    hash20 = tcp_established_hash_bucket (h0, hash20);
+	  }
+
 	  if (is_ip6)
 	    {
 	      ip6_tcp_udp_address_x4_and_timestamps_t * mina0;
-	      ip6_tcp_udp_address_x4_t * esta0;
+	      ip6_tcp_udp_address_x4_and_connection_index_t * esta10, * esta20;
 
 	      mina0 = vec_elt_at_index (tm->ip6_mini_connection_address_hash, imin0);
-	      esta0 = vec_elt_at_index (tm->ip6_established_connection_address_hash, iest0);
+	      esta10 = ip6_tcp_established_bucket (tm, hash10);
+	      esta20 = ip6_tcp_established_bucket (tm, hash20);
 
 	      min_match0 = ip6_tcp_udp_address_x4_match (&mina0->address_x4, ip60, tcp0);
-	      est_match0 = ip6_tcp_udp_address_x4_match (esta0, ip60, tcp0);
+	      est_match10 = ip6_tcp_udp_address_x4_match (&esta10->address_x4, ip60, tcp0);
+	      est_match20 = ip6_tcp_udp_address_x4_match (&esta20->address_x4, ip60, tcp0);
 
 	      min_oldest0 = find_oldest_timestamp_x4 (mina0->time_stamps, mini_now);
-	      est_first_empty0 = ip6_tcp_udp_address_x4_first_empty (esta0);
 
-	      if (PREDICT_FALSE (! est_match0 && est_first_empty0 >= 4 && ! min_match0))
-		{
-		  /* Lookup in overflow hash. */
-		  ASSERT (0);
-		}
+	      iest0 = est_match10 < 4 ? esta10->connection_index[est_match10] : ~0;
+	      iest0 = est_match20 < 4 ? esta20->connection_index[est_match20] : iest0;
 	    }
 	  else
 	    {
 	      ip4_tcp_udp_address_x4_and_timestamps_t * mina0;
-	      ip4_tcp_udp_address_x4_t * esta0;
+	      ip4_tcp_udp_address_x4_and_connection_index_t * esta10, * esta20;
 
 	      mina0 = vec_elt_at_index (tm->ip4_mini_connection_address_hash, imin0);
-	      esta0 = vec_elt_at_index (tm->ip4_established_connection_address_hash, iest0);
+	      esta10 = ip4_tcp_established_bucket (tm, hash10);
+	      esta20 = ip4_tcp_established_bucket (tm, hash20);
 
 	      min_match0 = ip4_tcp_udp_address_x4_match (&mina0->address_x4, ip40, tcp0);
-	      est_match0 = ip4_tcp_udp_address_x4_match (esta0, ip40, tcp0);
+	      est_match10 = ip4_tcp_udp_address_x4_match (&esta10->address_x4, ip40, tcp0);
+	      est_match20 = ip4_tcp_udp_address_x4_match (&esta20->address_x4, ip40, tcp0);
 
 	      min_oldest0 = find_oldest_timestamp_x4 (mina0->time_stamps, mini_now);
-	      est_first_empty0 = ip4_tcp_udp_address_x4_first_empty (esta0);
 
-	      if (PREDICT_FALSE (! est_match0 && est_first_empty0 >= 4 && ! min_match0))
-		{
-		  /* Lookup in overflow hash. */
-		  ASSERT (0);
-		}
+	      iest0 = est_match10 < 4 ? esta10->connection_index[est_match10] : ~0;
+	      iest0 = est_match20 < 4 ? esta20->connection_index[est_match20] : iest0;
 	    }
 
 	  is_min_match0 = min_match0 < 4;
-	  is_est_match0 = est_match0 < 4;
+	  is_est_match0 = iest0 != ~0;
 
 	  imin0 = 4 * imin0 + (is_min_match0 ? min_match0 : min_oldest0);
-	  iest0 = 4 * iest0 + (is_est_match0 ? est_match0 : est_first_empty0);
 
 	  /* Should simultaneously not match both in mini and established connection tables. */
 	  ASSERT (! (is_min_match0 && is_est_match0));
 
 	  {
 	    tcp_mini_connection_t * min0;
-	    tcp_connection_t * est0;
-	    tcp_sequence_pair_t * seq_pair0;
 	    u8 flags0;
 
 	    min0 = vec_elt_at_index (tm46->mini_connections, imin0);
-	    est0 = vec_elt_at_index (tm46->established_connections, iest0);
 
 	    if (min_match0 < 4)
 	      {
@@ -849,8 +1422,6 @@ ip46_tcp_lookup (vlib_main_t * vm,
 		ASSERT (min0->state != TCP_CONNECTION_STATE_established);
 	      }
 
-	    seq_pair0 = is_min_match0 ? &min0->sequence_numbers : &est0->sequence_numbers;
-
 	    state0 = is_min_match0 ? min0->state : TCP_CONNECTION_STATE_unused;
 	    state0 = is_est_match0 ? TCP_CONNECTION_STATE_established : state0;
 
@@ -863,6 +1434,16 @@ ip46_tcp_lookup (vlib_main_t * vm,
 	    next0 = tm->disposition_by_state_and_flags[state0][flags0].next;
 	    error0 = tm->disposition_by_state_and_flags[state0][flags0].error;
 
+	    /* ACK for no connection may answer a SYN cookie. */
+	    if (PREDICT_FALSE (accept_syn_cookies
+			       && state0 == TCP_CONNECTION_STATE_unused
+			       && flags0 == TCP_FLAG_ACK))
+	      {
+		next0 = TCP_LOOKUP_NEXT_LISTEN_ACK;
+		error0 = TCP_ERROR_NONE;
+		vnet_buffer (p0)->ip.tcp.mini_connection_index = ~0;
+	      }
+
 	    next0 = li0 != 0 ? next0 : TCP_LOOKUP_NEXT_PUNT;
 	    error0 = li0 != 0 ? error0 : TCP_ERROR_NO_LISTENER_FOR_PORT;
 	  }
@@ -912,11 +1493,6 @@ ip46_size_hash_tables (ip46_tcp_main_t * m)
   vec_validate_aligned (m->mini_connections,
 			m->mini_connection_hash_mask,
 			CLIB_CACHE_LINE_BYTES);
-
-  m->established_connection_hash_mask = pow2_mask (m->log2_n_established_connection_hash_elts);
-  vec_validate_aligned (m->established_connections,
-			m->established_connection_hash_mask,
-			CLIB_CACHE_LINE_BYTES);
 }
 
 static void
@@ -927,29 +1503,27 @@ ip46_tcp_lookup_init (vlib_main_t * vm, tcp_main_t * tm, int is_ip6)
   m->is_ip6 = is_ip6;
 
   m->log2_n_mini_connection_hash_elts = 8;
-  m->log2_n_established_connection_hash_elts = 8;
   ip46_size_hash_tables (m);
 
+  tcp_established_hash_init (tm, is_ip6, TCP_DEFAULT_ESTABLISHED_CONNECTIONS);
+
   if (is_ip6)
     {
       vec_validate_aligned (tm->ip6_mini_connection_address_hash,
 			    m->mini_connection_hash_mask / 4,
 			    CLIB_CACHE_LINE_BYTES);
-      vec_validate_aligned (tm->ip6_established_connection_address_hash,
-			    m->established_connection_hash_mask / 4,
-			    CLIB_CACHE_LINE_BYTES);
     }
   else
     {
       vec_validate_aligned (tm->ip4_mini_connection_address_hash,
 			    m->mini_connection_hash_mask / 4,
 			    CLIB_CACHE_LINE_BYTES);
-      vec_validate_aligned (tm->ip4_established_connection_address_hash,
-			    m->established_connection_hash_mask / 4,
-			    CLIB_CACHE_LINE_BYTES);
     }
   tm->connection_hash_masks[is_ip6].as_u32[0] = m->mini_connection_hash_mask / 4;
-  tm->connection_hash_masks[is_ip6].as_u32[1] = m->established_connection_hash_mask / 4;
+
+  /* Established hashes are masked by tcp_established_hash_bucket. */
+  tm->connection_hash_masks[is_ip6].as_u32[1] = ~0;
+  tm->connection_hash_masks[is_ip6].as_u32[2] = ~0;
 }
 
 static void
@@ -960,13 +1534,16 @@ tcp_lookup_init (vlib_main_t * vm, tcp_main_t * tm)
   /* Initialize hash seeds. */
   for (is_ip6 = 0; is_ip6 < 2; is_ip6++)
     {
-      u32 * r = clib_random_buffer_get_data (&vm->random_buffer, 3 * 2 * sizeof (r[0]));
+      u32 * r = clib_random_buffer_get_data (&vm->random_buffer, 3 * 3 * sizeof (r[0]));
       tm->connection_hash_seeds[is_ip6][0].as_u32[0] = r[0];
       tm->connection_hash_seeds[is_ip6][0].as_u32[1] = r[1];
-      tm->connection_hash_seeds[is_ip6][1].as_u32[0] = r[2];
-      tm->connection_hash_seeds[is_ip6][1].as_u32[1] = r[3];
-      tm->connection_hash_seeds[is_ip6][2].as_u32[0] = r[4];
-      tm->connection_hash_seeds[is_ip6][2].as_u32[1] = r[5];
+      tm->connection_hash_seeds[is_ip6][0].as_u32[2] = r[2];
+      tm->connection_hash_seeds[is_ip6][1].as_u32[0] = r[3];
+      tm->connection_hash_seeds[is_ip6][1].as_u32[1] = r[4];
+      tm->connection_hash_seeds[is_ip6][1].as_u32[2] = r[5];
+      tm->connection_hash_seeds[is_ip6][2].as_u32[0] = r[6];
+      tm->connection_hash_seeds[is_ip6][2].as_u32[1] = r[7];
+      tm->connection_hash_seeds[is_ip6][2].as_u32[2] = r[8];
 
       ip46_tcp_lookup_init (vm, tm, is_ip6);
     }
@@ -1228,7 +1805,7 @@ static VLIB_REGISTER_NODE (ip6_tcp_lookup_node) = {
     [TCP_LOOKUP_NEXT_DROP] = "error-drop",
     [TCP_LOOKUP_NEXT_PUNT] = "error-punt",
     [TCP_LOOKUP_NEXT_LISTEN_SYN] = "ip6-tcp-listen",
-    [TCP_LOOKUP_NEXT_LISTEN_ACK] = "ip4-tcp-establish",
+    [TCP_LOOKUP_NEXT_LISTEN_ACK] = "ip6-tcp-establish",
     [TCP_LOOKUP_NEXT_CONNECT_SYN_ACK] = "ip6-tcp-connect",
     [TCP_LOOKUP_NEXT_ESTABLISHED] = "ip6-tcp-established",
   },
@@ -1341,35 +1918,139 @@ tcp_options_decode_init (tcp_main_t * tm)
   m->time_stamps.his_net_byte_order = 0;
 }
 
-/* Initialize target buffer as "related" to given buffer. */
-always_inline void
-vlib_buffer_copy_shared_fields (vlib_main_t * vm, vlib_buffer_t * b, u32 bi_target)
-{
-  vlib_buffer_t * b_target = vlib_get_buffer (vm, bi_target);
-  vnet_buffer (b_target)->sw_if_index[VLIB_RX] = vnet_buffer (b)->sw_if_index[VLIB_RX];
-  b_target->trace_index = b->trace_index;
-  b_target->flags |= b->flags & VLIB_BUFFER_IS_TRACED;
-}
+/* Cookie data: 3 bits of MSS table index and 4 bits of window scale. */
+static u16 tcp_syn_cookie_mss_table[] = { 536, 1220, 1440, 1460, 4312, 8960, };
 
-typedef enum {
-  TCP_LISTEN_NEXT_DROP,
-  TCP_LISTEN_NEXT_REPLY,
-  TCP_LISTEN_N_NEXT,
-} tcp_listen_next_t;
+always_inline u32
+tcp_syn_cookie_count (f64 now)
+{ return (u32) now >> TCP_SYN_COOKIE_LOG2_PERIOD; }
 
-static_always_inline uword
-ip46_tcp_listen (vlib_main_t * vm,
-		 vlib_node_runtime_t * node,
-		 vlib_frame_t * frame,
-		 uword is_ip6)
+static_always_inline u32
+tcp_syn_cookie_hash (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 * key,
+		     u32 count, u32 which)
 {
-  tcp_main_t * tm = &tcp_main;
-  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
-  uword n_packets = frame->n_vectors;
+  u32 a, b, c;
+
+  a = tm->syn_cookie_secrets[which][0] ^ key[0];
+  b = tm->syn_cookie_secrets[which][1] ^ key[1];
+  c = tm->syn_cookie_secrets[which][2] ^ key[2];
+
+  if (is_ip6)
+    {
+      hash_v3_mix32 (a, b, c);
+      a ^= key[3]; b ^= key[4]; c ^= key[5];
+      hash_v3_mix32 (a, b, c);
+      a ^= key[6]; b ^= key[7]; c ^= key[8];
+    }
+
+  hash_v3_mix32 (a, b, c);
+  a ^= count;
+  hash_v3_finalize32 (a, b, c);
+
+  return c;
+}
+
+/* Returns cookie to use as our initial sequence number.  His sequence
+   number is from SYN. */
+static_always_inline u32
+tcp_syn_cookie_encode (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 * key,
+		       u32 his_seq, u32 count,
+		       u16 max_segment_size, u8 window_scale)
+{
+  u32 i, data;
+
+  for (i = ARRAY_LEN (tcp_syn_cookie_mss_table) - 1; i > 0; i--)
+    if (tcp_syn_cookie_mss_table[i] <= max_segment_size)
+      break;
+
+  data = i | (clib_min (window_scale, 14) << 3);
+
+  return (tcp_syn_cookie_hash (tm, is_ip6, key, 0, 0) + his_seq
+	  + (count << TCP_SYN_COOKIE_DATA_BITS)
+	  + ((tcp_syn_cookie_hash (tm, is_ip6, key, count, 1) + data)
+	     & pow2_mask (TCP_SYN_COOKIE_DATA_BITS)));
+}
+
+/* Rebuilds mini connection from ACK answering our cookie SYN-ACK.
+   Returns zero if cookie is forged or too old. */
+static_always_inline uword
+tcp_syn_cookie_decode (tcp_main_t * tm, tcp_ip_4_or_6_t is_ip6, u32 * key,
+		       tcp_header_t * tcp, u32 count,
+		       tcp_mini_connection_t * m)
+{
+  u32 his_seq, my_seq, cookie, age, data;
+
+  his_seq = clib_net_to_host_u32 (tcp->seq_number);
+  my_seq = clib_net_to_host_u32 (tcp->ack_number);
+  cookie = my_seq - 1 - tcp_syn_cookie_hash (tm, is_ip6, key, 0, 0) - (his_seq - 1);
+
+  age = (count - (cookie >> TCP_SYN_COOKIE_DATA_BITS)) & pow2_mask (32 - TCP_SYN_COOKIE_DATA_BITS);
+  if (age >= TCP_SYN_COOKIE_MAX_AGE)
+    return 0;
+
+  data = ((cookie - tcp_syn_cookie_hash (tm, is_ip6, key, count - age, 1))
+	  & pow2_mask (TCP_SYN_COOKIE_DATA_BITS));
+  if ((data >> 7) != 0
+      || (data & 7) >= ARRAY_LEN (tcp_syn_cookie_mss_table))
+    return 0;
+
+  m->sequence_numbers.his = his_seq;
+  m->sequence_numbers.ours = my_seq;
+  m->max_segment_size = tcp_syn_cookie_mss_table[data & 7];
+  m->window_scale = data >> 3;
+  m->time_stamps.ours_host_byte_order = tcp_options_decode_for_ack (tm, tcp, 0);
+  m->state = TCP_CONNECTION_STATE_listen_ack_wait;
+
+  return 1;
+}
+
+/* Switches listener to cookies when too many live mini connections are
+   being overwritten. */
+static void
+tcp_syn_cookie_mode_update (tcp_main_t * tm, ip46_tcp_main_t * tm46, f64 now)
+{
+  if (tm46->n_mini_connection_evictions > tm->syn_cookie_eviction_threshold)
+    tm46->syn_cookies_until = now + TCP_SYN_COOKIE_HOLD_TIME;
+
+  if (now - tm46->mini_connection_eviction_interval_start >= 1)
+    {
+      tm46->n_mini_connection_evictions = 0;
+      tm46->mini_connection_eviction_interval_start = now;
+    }
+}
+
+/* Initialize target buffer as "related" to given buffer. */
+always_inline void
+vlib_buffer_copy_shared_fields (vlib_main_t * vm, vlib_buffer_t * b, u32 bi_target)
+{
+  vlib_buffer_t * b_target = vlib_get_buffer (vm, bi_target);
+  vnet_buffer (b_target)->sw_if_index[VLIB_RX] = vnet_buffer (b)->sw_if_index[VLIB_RX];
+  b_target->trace_index = b->trace_index;
+  b_target->flags |= b->flags & VLIB_BUFFER_IS_TRACED;
+}
+
+typedef enum {
+  TCP_LISTEN_NEXT_DROP,
+  TCP_LISTEN_NEXT_REPLY,
+  TCP_LISTEN_N_NEXT,
+} tcp_listen_next_t;
+
+static_always_inline uword
+ip46_tcp_listen (vlib_main_t * vm,
+		 vlib_node_runtime_t * node,
+		 vlib_frame_t * frame,
+		 uword is_ip6)
+{
+  tcp_main_t * tm = &tcp_main;
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  uword n_packets = frame->n_vectors;
   u32 * from, * to_reply, * to_drop, * random_ack_numbers;
   u32 n_left_from, n_left_to_reply, n_left_to_drop, mini_now, timestamp_now;
+  u32 mini_lifetime, cookie_count;
   u16 * fid, * fragment_ids;
   vlib_node_runtime_t * error_node;
+  uword use_syn_cookies;
+  f64 now;
 
   error_node = vlib_node_get_runtime
     (vm, is_ip6 ? ip6_tcp_lookup_node.index : ip4_tcp_lookup_node.index);
@@ -1378,6 +2059,11 @@ ip46_tcp_listen (vlib_main_t * vm,
   n_left_from = n_packets;
   mini_now = tcp_time_now (tm, TCP_TIMER_mini_connection);
   timestamp_now = tcp_time_now (tm, TCP_TIMER_timestamp);
+  mini_lifetime = TCP_MINI_CONNECTION_LIFETIME / tm->secs_per_tick[TCP_TIMER_mini_connection];
+
+  now = vlib_time_now (vm);
+  use_syn_cookies = tcp_syn_cookies_enabled (tm, tm46, now);
+  cookie_count = tcp_syn_cookie_count (now);
   
   random_ack_numbers = clib_random_buffer_get_data (&vm->random_buffer,
 						    n_packets * sizeof (random_ack_numbers[0]));
@@ -1398,7 +2084,7 @@ ip46_tcp_listen (vlib_main_t * vm,
 	  ip6_header_t * ip60;
 	  ip4_header_t * ip40;
 	  tcp_header_t * tcp0;
-	  tcp_mini_connection_t * min0;
+	  tcp_mini_connection_t * min0, cookie_min0;
 	  tcp_syn_packet_t * tcp_reply0;
 	  ip_csum_t tcp_sum0;
 	  u32 bi0, bi_reply0, imin0, my_seq_net0, his_seq_host0, his_seq_net0;
@@ -1420,39 +2106,76 @@ ip46_tcp_listen (vlib_main_t * vm,
 
 	  if (is_ip6)
 	    {
-	      ip6_tcp_udp_address_x4_and_timestamps_t * mina0;
-
 	      ip60 = vlib_buffer_get_current (p0);
 	      tcp0 = ip6_next_header (ip60);
-
-	      mina0 = vec_elt_at_index (tm->ip6_mini_connection_address_hash, imin0 / 4);
-
-	      ip6_tcp_udp_address_x4_set_from_headers (&mina0->address_x4,
-						       ip60, tcp0, i0);
-	      mina0->time_stamps[i0] = mini_now;
 	    }
 	  else
 	    {
-	      ip4_tcp_udp_address_x4_and_timestamps_t * mina0;
-
 	      ip40 = vlib_buffer_get_current (p0);
 	      tcp0 = ip4_next_header (ip40);
+	    }
 
-	      mina0 = vec_elt_at_index (tm->ip4_mini_connection_address_hash, imin0 / 4);
+	  if (PREDICT_FALSE (use_syn_cookies))
+	    min0 = &cookie_min0;
+	  else
+	    {
+	      u32 * ts0;
 
-	      ip4_tcp_udp_address_x4_set_from_headers (&mina0->address_x4,
-						       ip40, tcp0, i0);
-	      mina0->time_stamps[i0] = mini_now;
-	    }
+	      min0 = vec_elt_at_index (tm46->mini_connections, imin0);
+
+	      if (is_ip6)
+		{
+		  ip6_tcp_udp_address_x4_and_timestamps_t * mina0;
+		  mina0 = vec_elt_at_index (tm->ip6_mini_connection_address_hash, imin0 / 4);
+		  ip6_tcp_udp_address_x4_set_from_headers (&mina0->address_x4,
+							   ip60, tcp0, i0);
+		  ts0 = &mina0->time_stamps[i0];
+		}
+	      else
+		{
+		  ip4_tcp_udp_address_x4_and_timestamps_t * mina0;
+		  mina0 = vec_elt_at_index (tm->ip4_mini_connection_address_hash, imin0 / 4);
+		  ip4_tcp_udp_address_x4_set_from_headers (&mina0->address_x4,
+							   ip40, tcp0, i0);
+		  ts0 = &mina0->time_stamps[i0];
+		}
 
-	  min0 = vec_elt_at_index (tm46->mini_connections, imin0);
+	      /* Count live half open connections we are throwing away. */
+	      tm46->n_mini_connection_evictions
+		+= (min0->state == TCP_CONNECTION_STATE_listen_ack_wait
+		    && mini_now - ts0[0] < mini_lifetime);
+	      ts0[0] = mini_now;
+	    }
 
 	  min0->state = TCP_CONNECTION_STATE_listen_ack_wait;
 	  min0->time_stamps.ours_host_byte_order = timestamp_now;
 	  tcp_options_decode_for_syn (tm, min0, tcp0);
 
-	  my_seq_net0 = *random_ack_numbers++;
+	  {
+	    ip_adjacency_t * adj0 = ip_get_adjacency (&ip4_main.lookup_main, vnet_buffer (p0)->ip.adj_index[VLIB_RX]);
+	    u16 my_mss =
+	      (adj0->rewrite_header.max_l3_packet_bytes
+	       - (is_ip6 ? sizeof (ip60[0]) : sizeof (ip40[0]))
+	       - sizeof (tcp0[0]));
+
+	    min0->max_segment_size = clib_min (my_mss, min0->max_segment_size);
+	  }
+
 	  his_seq_host0 = 1 + clib_net_to_host_u32 (tcp0->seq_number);
+	  my_seq_net0 = *random_ack_numbers++;
+
+	  if (PREDICT_FALSE (use_syn_cookies))
+	    {
+	      u32 key0[9];
+
+	      tcp_connection_key_from_headers (is_ip6, is_ip6 ? (void *) ip60 : (void *) ip40,
+					       tcp0, key0);
+	      my_seq_net0 = clib_host_to_net_u32
+		(tcp_syn_cookie_encode (tm, is_ip6, key0, his_seq_host0 - 1, cookie_count,
+					min0->max_segment_size, min0->window_scale));
+
+	      p0->error = error_node->errors[TCP_ERROR_SYN_COOKIES_SENT];
+	    }
 
 	  min0->sequence_numbers.ours = 1 + clib_net_to_host_u32 (my_seq_net0);
 	  min0->sequence_numbers.his = his_seq_host0;
@@ -1522,19 +2245,8 @@ ip46_tcp_listen (vlib_main_t * vm,
 	  tcp_reply0->header.ack_number = his_seq_net0;
 	  tcp_sum0 = ip_csum_add_even (tcp_sum0, his_seq_net0);
 
-	  {
-	    ip_adjacency_t * adj0 = ip_get_adjacency (&ip4_main.lookup_main, vnet_buffer (p0)->ip.adj_index[VLIB_RX]);
-	    u16 my_mss =
-	      (adj0->rewrite_header.max_l3_packet_bytes
-	       - (is_ip6 ? sizeof (ip60[0]) : sizeof (ip40[0]))
-	       - sizeof (tcp0[0]));
-
-	    my_mss = clib_min (my_mss, min0->max_segment_size);
-	    min0->max_segment_size = my_mss;
-
-	    tcp_reply0->options.mss.value = clib_host_to_net_u16 (my_mss);
-	    tcp_sum0 = ip_csum_add_even (tcp_sum0, tcp_reply0->options.mss.value);
-	  }
+	  tcp_reply0->options.mss.value = clib_host_to_net_u16 (min0->max_segment_size);
+	  tcp_sum0 = ip_csum_add_even (tcp_sum0, tcp_reply0->options.mss.value);
 
 	  tcp_reply0->options.time_stamp.my_time_stamp = clib_host_to_net_u32 (timestamp_now);
 	  tcp_sum0 = ip_csum_add_even (tcp_sum0, tcp_reply0->options.time_stamp.my_time_stamp);
@@ -1555,6 +2267,8 @@ ip46_tcp_listen (vlib_main_t * vm,
       vlib_put_next_frame (vm, node, TCP_LISTEN_NEXT_DROP, n_left_to_drop);
     }
 
+  tcp_syn_cookie_mode_update (tm, tm46, now);
+
   if (node->flags & VLIB_NODE_FLAG_TRACE)
     /* FIXME */ ;
 
@@ -1745,6 +2459,7 @@ ip46_tcp_establish (vlib_main_t * vm,
   uword n_packets = frame->n_vectors;
   u32 * from, * to_next;
   u32 n_left_from, n_left_to_next, next, mini_long_long_ago, timestamp_now;
+  u32 cookie_count;
   vlib_node_runtime_t * error_node;
 
   error_node = vlib_node_get_runtime
@@ -1757,6 +2472,7 @@ ip46_tcp_establish (vlib_main_t * vm,
     (tcp_time_now (tm, TCP_TIMER_mini_connection)
      + (1 << (BITS (mini_long_long_ago) - 1)));
   timestamp_now = tcp_time_now (tm, TCP_TIMER_timestamp);
+  cookie_count = tcp_syn_cookie_count (vlib_time_now (vm));
   
   while (n_left_from > 0)
     {
@@ -1768,11 +2484,11 @@ ip46_tcp_establish (vlib_main_t * vm,
 	  ip6_header_t * ip60;
 	  ip4_header_t * ip40;
 	  tcp_header_t * tcp0;
-	  tcp_mini_connection_t * min0;
+	  tcp_mini_connection_t * min0, cookie_min0;
 	  tcp_connection_t * est0;
 	  tcp_listener_t * l0;
-	  u32 bi0, imin0, iest0;
-	  u8 error0, next0, i0, e0;
+	  u32 bi0, imin0, iest0, key0[9];
+	  u8 error0, next0, i0;
       
 	  bi0 = to_next[0] = from[0];
 
@@ -1784,15 +2500,8 @@ ip46_tcp_establish (vlib_main_t * vm,
 	  p0 = vlib_get_buffer (vm, bi0);
 
 	  imin0 = vnet_buffer (p0)->ip.tcp.mini_connection_index;
-	  iest0 = vnet_buffer (p0)->ip.tcp.established_connection_index;
 
 	  i0 = imin0 % 4;
-	  e0 = iest0 % 4;
-
-	  min0 = vec_elt_at_index (tm46->mini_connections, imin0);
-	  if (PREDICT_FALSE (min0->state == TCP_CONNECTION_STATE_unused))
-	    goto already_established0;
-	  min0->state = TCP_CONNECTION_STATE_unused;
 
 	  if (is_ip6)
 	    {
@@ -1805,6 +2514,26 @@ ip46_tcp_establish (vlib_main_t * vm,
 	      tcp0 = ip4_next_header (ip40);
 	    }
 
+	  tcp_connection_key_from_headers (is_ip6, is_ip6 ? (void *) ip60 : (void *) ip40,
+					   tcp0, key0);
+
+	  if (PREDICT_FALSE (imin0 == ~0))
+	    {
+	      /* Earlier ACK in this frame may have established connection. */
+	      if (tcp_established_hash_lookup (tm, is_ip6, key0) != ~0)
+		goto already_established0;
+	      if (! tcp_syn_cookie_decode (tm, is_ip6, key0, tcp0, cookie_count, &cookie_min0))
+		goto invalid_syn_cookie0;
+	      min0 = &cookie_min0;
+	    }
+	  else
+	    {
+	      min0 = vec_elt_at_index (tm46->mini_connections, imin0);
+	      if (PREDICT_FALSE (min0->state == TCP_CONNECTION_STATE_unused))
+		goto already_established0;
+	    }
+	  min0->state = TCP_CONNECTION_STATE_unused;
+
 	  if (PREDICT_FALSE (clib_net_to_host_u32 (tcp0->seq_number)
 			     != min0->sequence_numbers.his))
 	    goto unexpected_seq_number0;
@@ -1812,33 +2541,36 @@ ip46_tcp_establish (vlib_main_t * vm,
 			     != min0->sequence_numbers.ours))
 	    goto unexpected_ack_number0;
 
-	  if (is_ip6)
+	  /* Free mini connection; cookie connections have none. */
+	  if (imin0 != ~0)
 	    {
-	      ip6_tcp_udp_address_x4_and_timestamps_t * mina0;
-	      ip6_tcp_udp_address_x4_t * esta0;
-
-	      mina0 = vec_elt_at_index (tm->ip6_mini_connection_address_hash, imin0 / 4);
-	      esta0 = vec_elt_at_index (tm->ip6_established_connection_address_hash, iest0 / 4);
+	      if (is_ip6)
+		{
+		  ip6_tcp_udp_address_x4_and_timestamps_t * mina0;
 
-	      ip6_tcp_udp_address_x4_copy_and_invalidate (esta0, &mina0->address_x4, e0, i0);
+		  mina0 = vec_elt_at_index (tm->ip6_mini_connection_address_hash, imin0 / 4);
+		  ip6_tcp_udp_address_x4_invalidate (&mina0->address_x4, i0);
+		  mina0->time_stamps[i0] = mini_long_long_ago;
+		}
+	      else
+		{
+		  ip4_tcp_udp_address_x4_and_timestamps_t * mina0;
 
-	      mina0->time_stamps[i0] = mini_long_long_ago;
+		  mina0 = vec_elt_at_index (tm->ip4_mini_connection_address_hash, imin0 / 4);
+		  ip4_tcp_udp_address_x4_invalidate (&mina0->address_x4, i0);
+		  mina0->time_stamps[i0] = mini_long_long_ago;
+		}
 	    }
-	  else
-	    {
-	      ip4_tcp_udp_address_x4_and_timestamps_t * mina0;
-	      ip4_tcp_udp_address_x4_t * esta0;
-
-	      mina0 = vec_elt_at_index (tm->ip4_mini_connection_address_hash, imin0 / 4);
-	      esta0 = vec_elt_at_index (tm->ip4_established_connection_address_hash, iest0 / 4);
 
-	      ip4_tcp_udp_address_x4_copy_and_invalidate (esta0, &mina0->address_x4, e0, i0);
+	  pool_get_aligned (tm46->established_connections, est0, CLIB_CACHE_LINE_BYTES);
+	  iest0 = est0 - tm46->established_connections;
 
-	      mina0->time_stamps[i0] = mini_long_long_ago;
+	  if (PREDICT_FALSE (tcp_established_hash_add (tm, is_ip6, key0, iest0) == ~0))
+	    {
+	      pool_put (tm46->established_connections, est0);
+	      goto established_hash_full0;
 	    }
 
-	  est0 = vec_elt_at_index (tm46->established_connections, iest0);
-
 	  est0->sequence_numbers = min0->sequence_numbers;
 	  est0->max_segment_size = (min0->max_segment_size
 				    - STRUCT_SIZE_OF (tcp_ack_packet_t, options));
@@ -1846,31 +2578,63 @@ ip46_tcp_establish (vlib_main_t * vm,
 	  est0->his_window = clib_net_to_host_u16 (tcp0->window);
 	  est0->time_stamps.ours_host_byte_order = min0->time_stamps.ours_host_byte_order;
 
-	  /* Compute first measurement of round trip time. */
+	  /* Compute first measurement of round trip time.  Echo of zero:
+	     peer does not send time stamps and there is no sample. */
+	  memset (&est0->round_trip_time_stats, 0, sizeof (est0->round_trip_time_stats));
+	  est0->retransmit_timeout = TCP_RETRANSMIT_TIMEOUT_INITIAL;
 	  {
 	    u32 t = tcp_options_decode_for_ack (tm, tcp0, &est0->time_stamps.his_net_byte_order);
 	    f64 dt = (timestamp_now - t) * tm->secs_per_tick[TCP_TIMER_timestamp];
-	    est0->round_trip_time_stats.sum = dt;
-	    est0->round_trip_time_stats.sum2 = dt*dt;
-	    est0->round_trip_time_stats.count = 1;
 
-	    {
-	      ELOG_TYPE_DECLARE (e) = {
-		.format = "establish ack rtt: %.4e",
-		.format_args = "f8",
-	      };
-	      struct { f64 dt; } * ed;
-	      ed = ELOG_DATA (&vm->elog_main, e);
-	      ed->dt = dt;
-	    }
+	    if (t != 0)
+	      {
+		est0->round_trip_time_stats.sum = dt;
+		est0->round_trip_time_stats.sum2 = dt*dt;
+		est0->round_trip_time_stats.count = 1;
+		tcp_round_trip_time_update (tm, est0, dt);
+
+		{
+		  ELOG_TYPE_DECLARE (e) = {
+		    .format = "establish ack rtt: %.4e",
+		    .format_args = "f8",
+		  };
+		  struct { f64 dt; } * ed;
+		  ed = ELOG_DATA (&vm->elog_main, e);
+		  ed->dt = dt;
+		}
+	      }
 	  }
 
 	  est0->my_window_scale = 7;
 	  est0->my_window = 256;
+	  est0->n_rx_out_of_order_bytes = 0;
+	  est0->n_rx_unacked_bytes = 0;
+	  ASSERT (vec_len (est0->rx_out_of_order_segments) == 0);
+
+	  est0->flags = 0;
+	  est0->n_tx_unacked_bytes = 0;
+	  est0->tx_max_sequence_number = est0->sequence_numbers.ours;
+	  est0->n_head_packet_bytes_acked = 0;
+	  est0->n_retransmits = 0;
+	  est0->retransmit_timer_handle = ~0;
+	  est0->delayed_ack_timer_handle = ~0;
+	  memset (&est0->head_packet, 0, sizeof (est0->head_packet));
+	  memset (&est0->tx_next_packet, 0, sizeof (est0->tx_next_packet));
+	  memset (&est0->tx_tail_packet, 0, sizeof (est0->tx_tail_packet));
+	  memset (&est0->write_tail_packet, 0, sizeof (est0->write_tail_packet));
+	  est0->write_tail_buffer_index = 0;
 
 	  l0 = pool_elt_at_index (tm->listener_pool, vnet_buffer (p0)->ip.tcp.listener_index);
 	  vec_add1 (l0->event_connections[is_ip6], tcp_connection_handle_set (iest0, is_ip6));
 
+	  /* Initial window (RFC 3390) and unlimited slow start threshold. */
+	  memset (&est0->congestion, 0, sizeof (est0->congestion));
+	  est0->congestion.type = l0->congestion_control;
+	  est0->congestion.window = clib_min (4 * est0->max_segment_size,
+					      clib_max (2 * est0->max_segment_size, 4380));
+	  est0->congestion.slow_start_threshold = ~0;
+	  est0->congestion.recover = est0->sequence_numbers.ours - 1;
+
 	  next0 = TCP_ESTABLISH_NEXT_DROP;
 	  error0 = TCP_ERROR_LISTENS_ESTABLISHED;
 
@@ -1892,8 +2656,16 @@ ip46_tcp_establish (vlib_main_t * vm,
 	  continue;
 
 	already_established0:
-	  next0 = TCP_ESTABLISH_NEXT_ESTABLISHED;
-	  error0 = TCP_ERROR_NONE;
+	  /* Lookup ran before connection was established. */
+	  iest0 = tcp_established_hash_lookup (tm, is_ip6, key0);
+	  vnet_buffer (p0)->ip.tcp.established_connection_index = iest0;
+	  next0 = iest0 != ~0 ? TCP_ESTABLISH_NEXT_ESTABLISHED : TCP_ESTABLISH_NEXT_DROP;
+	  error0 = iest0 != ~0 ? TCP_ERROR_NONE : TCP_ERROR_LOOKUP_DROPS;
+	  goto enqueue0;
+
+	invalid_syn_cookie0:
+	  next0 = TCP_ESTABLISH_NEXT_DROP;
+	  error0 = TCP_ERROR_SYN_COOKIE_INVALID;
 	  goto enqueue0;
 
 	unexpected_seq_number0:
@@ -1905,6 +2677,11 @@ ip46_tcp_establish (vlib_main_t * vm,
 	  next0 = TCP_ESTABLISH_NEXT_DROP;
 	  error0 = TCP_ERROR_UNEXPECTED_ACK_NUMBER;
 	  goto enqueue0;
+
+	established_hash_full0:
+	  next0 = TCP_ESTABLISH_NEXT_DROP;
+	  error0 = TCP_ERROR_ESTABLISHED_HASH_FULL;
+	  goto enqueue0;
 	}
   
       vlib_put_next_frame (vm, node, next, n_left_to_next);
@@ -1972,302 +2749,1314 @@ static VLIB_REGISTER_NODE (ip6_tcp_establish_node) = {
   },
 };
 
+/* Space reserved by tcp_write at start of each data packet for ip and tcp
+   headers.  Rounded up so that data starts ip_csum_t aligned for
+   ip_csum_and_memcpy. */
+always_inline u32
+tcp_tx_header_reserve_bytes (tcp_ip_4_or_6_t is_ip6)
+{
+  u32 n = is_ip6 ? sizeof (ip6_tcp_ack_packet_t) : sizeof (ip4_tcp_ack_packet_t);
+  return round_pow2 (n, sizeof (ip_csum_t));
+}
+
+/* Add packet to tail of connection's transmit queue. */
 static_always_inline void
-tcp_free_connection_x1 (vlib_main_t * vm, tcp_main_t * tm,
-			tcp_ip_4_or_6_t is_ip6,
-			u32 iest0)
+tcp_tx_packet_enqueue (vlib_main_t * vm, tcp_connection_t * c, tcp_tx_packet_t * p)
 {
-  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
-  tcp_connection_t * est0;
-  u32 iest_div0, iest_mod0;
-  
-  iest_div0 = iest0 / 4;
-  iest_mod0 = iest0 % 4;
+  vlib_buffer_t * b;
 
-  if (is_ip6)
-    {
-      ip6_tcp_udp_address_x4_t * esta0;
-      esta0 = vec_elt_at_index (tm->ip6_established_connection_address_hash, iest_div0);
-      ip6_tcp_udp_address_x4_invalidate (esta0, iest_mod0);
-    }
+  b = vlib_get_buffer (vm, p->first_buffer_index_this_packet);
+  vnet_buffer (b)->ip.tcp_tx.next_packet_n_data_bytes = 0;
+
+  if (c->head_packet.n_data_bytes == 0)
+    c->head_packet = p[0];
   else
     {
-      ip4_tcp_udp_address_x4_t * esta0;
-      esta0 = vec_elt_at_index (tm->ip4_established_connection_address_hash, iest_div0);
-      ip4_tcp_udp_address_x4_invalidate (esta0, iest_mod0);
+      b = vlib_get_buffer (vm, c->tx_tail_packet.first_buffer_index_this_packet);
+      vnet_buffer (b)->ip.tcp_tx.next_packet_first_buffer_index = p->first_buffer_index_this_packet;
+      vnet_buffer (b)->ip.tcp_tx.next_packet_data_ip_checksum = p->data_ip_checksum;
+      vnet_buffer (b)->ip.tcp_tx.next_packet_n_data_bytes = p->n_data_bytes;
     }
 
-  est0 = vec_elt_at_index (tm46->established_connections, iest0);
+  if (c->tx_next_packet.n_data_bytes == 0)
+    c->tx_next_packet = p[0];
+
+  c->tx_tail_packet = p[0];
 }
 
-static_always_inline void
-tcp_free_connection_x2 (vlib_main_t * vm, tcp_main_t * tm,
-			tcp_ip_4_or_6_t is_ip6,
-			u32 iest0, u32 iest1)
+/* Packet following given packet in transmit queue. */
+always_inline void
+tcp_tx_packet_get_next (vlib_main_t * vm, tcp_tx_packet_t * p, tcp_tx_packet_t * next)
 {
-  tcp_free_connection_x1 (vm, tm, is_ip6, iest0);
-  tcp_free_connection_x1 (vm, tm, is_ip6, iest1);
+  vlib_buffer_t * b = vlib_get_buffer (vm, p->first_buffer_index_this_packet);
+  next->first_buffer_index_this_packet = vnet_buffer (b)->ip.tcp_tx.next_packet_first_buffer_index;
+  next->data_ip_checksum = vnet_buffer (b)->ip.tcp_tx.next_packet_data_ip_checksum;
+  next->n_data_bytes = vnet_buffer (b)->ip.tcp_tx.next_packet_n_data_bytes;
 }
 
-static_always_inline uword
-ip46_tcp_output (vlib_main_t * vm,
-		 vlib_node_runtime_t * node,
-		 vlib_frame_t * frame,
-		 tcp_ip_4_or_6_t is_ip6)
+/* Non-zero if head of transmit queue has been sent and is awaiting ACK. */
+always_inline uword
+tcp_tx_head_packet_is_sent (tcp_connection_t * c)
 {
-  tcp_main_t * tm = &tcp_main;
-  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
-  u32 * cis, * to_next, n_left_to_next, n_connections_left;
-  u32 timestamp_now_host_byte_order, timestamp_now_net_byte_order;
-  vlib_node_runtime_t * error_node;
-  const u32 next = 0;
-  uword n_acks;
-
-  /* Inform listeners of new connections. */
-  {
-    tcp_listener_t * l;
-    pool_foreach (l, tm->listener_pool, ({
-      if (vec_len (l->eof_connections) > 0)
-	{
-	  if (l->event_function)
-	    l->event_function (l->eof_connections[is_ip6], TCP_EVENT_fin_received);
-	  else
-	    {
-	      uword i;
-	      for (i = 0; i < vec_len (l->eof_connections[is_ip6]); i++)
-		{
-		  tcp_connection_t * c = tcp_get_connection (l->eof_connections[is_ip6][i]);
-		  c->flags |= TCP_CONNECTION_FLAG_application_requested_close;
-		}
-	    }
-	  _vec_len (l->eof_connections[is_ip6]) = 0;
-	}
+  return (c->head_packet.n_data_bytes > 0
+	  && ! (c->tx_next_packet.n_data_bytes > 0
+		&& (c->tx_next_packet.first_buffer_index_this_packet
+		    == c->head_packet.first_buffer_index_this_packet)));
+}
 
-      if (vec_len (l->close_connections[is_ip6]) > 0)
-	{
-	  uword n_left;
-	  u32 * cis;
+/* Remove packet from head of connection's transmit queue. */
+static_always_inline void
+tcp_tx_packet_dequeue (vlib_main_t * vm, tcp_connection_t * c, tcp_tx_packet_t * p)
+{
+  ASSERT (c->head_packet.n_data_bytes > 0);
+  p[0] = c->head_packet;
 
-	  if (l->event_function)
-	    l->event_function (l->close_connections[is_ip6], TCP_EVENT_connection_closed);
+  if (! tcp_tx_head_packet_is_sent (c))
+    tcp_tx_packet_get_next (vm, p, &c->tx_next_packet);
 
-	  cis = l->close_connections[is_ip6];
-	  n_left = vec_len (cis);
-	  ASSERT (tm->n_established_connections[is_ip6] >= n_left);
-	  tm->n_established_connections[is_ip6] -= n_left;
-	  if (tm->n_established_connections[is_ip6] == 0)
-	    vlib_node_set_state (vm, tm46->output_node_index, VLIB_NODE_STATE_DISABLED);
-	  while (n_left >= 2)
-	    {
-	      tcp_free_connection_x2 (vm, tm, is_ip6, cis[0], cis[1]);
-	      n_left -= 2;
-	      cis += 2;
-	    }
+  tcp_tx_packet_get_next (vm, p, &c->head_packet);
 
-	  while (n_left > 0)
-	    {
-	      tcp_free_connection_x1 (vm, tm, is_ip6, cis[0]);
-	      n_left -= 1;
-	      cis += 1;
-	    }
+  if (c->head_packet.n_data_bytes == 0)
+    memset (&c->tx_tail_packet, 0, sizeof (c->tx_tail_packet));
+}
 
-	  _vec_len (l->close_connections[is_ip6]) = 0;
-	}
-    }));
-  }
+/* Copies data of queued packet into new buffer chain with same header
+   space reserved in front.  Queued buffers are kept until acknowledged
+   since interface output frees buffers it sends; vlib buffers have no
+   reference count so they cannot be shared with output.  Returns first
+   and last buffer of copy or 0 if out of buffers. */
+static uword
+tcp_tx_packet_copy (vlib_main_t * vm, tcp_main_t * tm, tcp_tx_packet_t * p,
+		    u32 * bi_result, u32 * last_bi_result)
+{
+  static u32 * copies;
+  vlib_buffer_t * b, * c;
+  u32 bi, n_buffers, n_alloc, i;
 
-  n_acks = 0;
-  cis = tm46->connections_pending_acks;
-  n_connections_left = vec_len (cis);
-  if (n_connections_left == 0)
-    return n_acks;
-  _vec_len (tm46->connections_pending_acks) = 0;
-  error_node = vlib_node_get_runtime
-    (vm, is_ip6 ? ip6_tcp_lookup_node.index : ip4_tcp_lookup_node.index);
+  n_buffers = 1;
+  b = vlib_get_buffer (vm, p->first_buffer_index_this_packet);
+  while (b->flags & VLIB_BUFFER_NEXT_PRESENT)
+    {
+      b = vlib_get_buffer (vm, b->next_buffer);
+      n_buffers++;
+    }
 
-  timestamp_now_host_byte_order = tcp_time_now (tm, TCP_TIMER_timestamp);
-  timestamp_now_net_byte_order = clib_host_to_net_u32 (timestamp_now_host_byte_order);
+  vec_validate (copies, n_buffers - 1);
+  n_alloc = vlib_buffer_alloc_from_free_list (vm, copies, n_buffers, tm->tx_buffer_free_list);
+  if (n_alloc != n_buffers)
+    {
+      vlib_buffer_free_no_next (vm, copies, n_alloc);
+      return 0;
+    }
 
-  while (n_connections_left > 0)
+  bi = p->first_buffer_index_this_packet;
+  for (i = 0; i < n_buffers; i++)
     {
-      vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+      b = vlib_get_buffer (vm, bi);
+      c = vlib_get_buffer (vm, copies[i]);
 
-      while (n_connections_left > 0 && n_left_to_next > 0)
-	{
-	  tcp_connection_t * est0;
-	  tcp_ack_packet_t * tcp0;
-	  tcp_udp_ports_t * ports0;
-	  ip_csum_t tcp_sum0;
-	  tcp_packet_template_type_t template_type0;
-	  u32 bi0, iest0, iest_div0, iest_mod0, my_seq_net0, his_seq_net0;
-	  u8 is_fin0;
+      c->current_data = b->current_data;
+      c->current_length = b->current_length;
+      c->flags = b->flags & VLIB_BUFFER_NEXT_PRESENT;
+      c->next_buffer = i + 1 < n_buffers ? copies[i + 1] : 0;
+      memcpy (vlib_buffer_get_current (c), vlib_buffer_get_current (b), b->current_length);
+
+      bi = b->next_buffer;
+    }
+
+  bi_result[0] = copies[0];
+  last_bi_result[0] = copies[n_buffers - 1];
+  return 1;
+}
+
+/* Finish checksum of packet being written and queue it for transmit. */
+static_always_inline void
+tcp_tx_packet_close_write_tail (vlib_main_t * vm, tcp_connection_t * c)
+{
+  tcp_tx_packet_t * p = &c->write_tail_packet;
+  vlib_buffer_t * b = vlib_get_buffer (vm, c->write_tail_buffer_index);
+
+  /* Sum in trailing partial word left by ip_csum_and_memcpy. */
+  p->data_ip_checksum =
+    ip_csum_and_memcpy_fold (p->data_ip_checksum,
+			     vlib_buffer_get_current (b) + b->current_length);
+
+  tcp_tx_packet_enqueue (vm, c, p);
+
+  memset (p, 0, sizeof (p[0]));
+  c->write_tail_buffer_index = 0;
+}
+
+static void
+tcp_tx_packets_free (vlib_main_t * vm, tcp_connection_t * c)
+{
+  tcp_tx_packet_t p;
+
+  while (c->head_packet.n_data_bytes > 0)
+    {
+      tcp_tx_packet_dequeue (vm, c, &p);
+      vlib_buffer_free (vm, &p.first_buffer_index_this_packet, 1);
+    }
+
+  if (c->write_tail_packet.n_data_bytes > 0)
+    vlib_buffer_free (vm, &c->write_tail_packet.first_buffer_index_this_packet, 1);
+
+  memset (&c->write_tail_packet, 0, sizeof (c->write_tail_packet));
+  c->write_tail_buffer_index = 0;
+  c->n_head_packet_bytes_acked = 0;
+}
+
+/* Window we offer: received data is handed to listener without copying
+   so only out of order data held here uses up window. */
+#define TCP_RX_WINDOW_BYTES (256 << 7)
+
+always_inline void
+tcp_rx_window_update (tcp_connection_t * c)
+{
+  u32 n = TCP_RX_WINDOW_BYTES - clib_min (c->n_rx_out_of_order_bytes, TCP_RX_WINDOW_BYTES);
+  c->my_window = n >> c->my_window_scale;
+}
+
+always_inline uword
+tcp_sequence_is_after (u32 a, u32 b)
+{ return (i32) (a - b) > 0; }
+
+/* Skips n_skip bytes at start of buffer chain and truncates it to n_bytes.
+   Returns index of last buffer in chain. */
+static u32
+tcp_rx_buffer_trim (vlib_main_t * vm, u32 bi, u32 n_skip, u32 n_bytes)
+{
+  vlib_buffer_t * b;
+  u32 n;
+
+  while (1)
+    {
+      b = vlib_get_buffer (vm, bi);
+      n = clib_min (n_skip, b->current_length);
+      vlib_buffer_advance (b, n);
+      n_skip -= n;
+
+      if (b->current_length >= n_bytes || ! (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+	break;
+
+      n_bytes -= b->current_length;
+      bi = b->next_buffer;
+    }
+
+  /* Drop link layer padding and anything else past end of segment. */
+  b->current_length = clib_min (b->current_length, n_bytes);
+  if (b->flags & VLIB_BUFFER_NEXT_PRESENT)
+    {
+      vlib_buffer_free (vm, &b->next_buffer, 1);
+      b->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+    }
+
+  return bi;
+}
+
+always_inline void
+tcp_rx_buffer_chain (vlib_main_t * vm, u32 last_bi, u32 next_bi)
+{
+  vlib_buffer_t * b = vlib_get_buffer (vm, last_bi);
+  b->next_buffer = next_bi;
+  b->flags |= VLIB_BUFFER_NEXT_PRESENT;
+}
+
+/* Holds segment received ahead of next expected sequence number.
+   Buffer must point to segment data. */
+static void
+tcp_rx_out_of_order_insert (vlib_main_t * vm, tcp_connection_t * c,
+			    u32 bi, u32 seq, u32 n_bytes)
+{
+  tcp_rx_segment_t * s, * t;
+  u32 i, n_skip, end, last_bi;
+
+  /* Index of first interval starting after segment. */
+  for (i = 0; i < vec_len (c->rx_out_of_order_segments); i++)
+    if (tcp_sequence_is_after (c->rx_out_of_order_segments[i].sequence_number, seq))
+      break;
+
+  /* Trim data already held by neighbors. */
+  n_skip = 0;
+  if (i > 0)
+    {
+      s = vec_elt_at_index (c->rx_out_of_order_segments, i - 1);
+      end = s->sequence_number + s->n_bytes;
+      if (tcp_sequence_is_after (end, seq))
+	{
+	  n_skip = end - seq;
+	  if (n_skip >= n_bytes)
+	    {
+	      vlib_buffer_free (vm, &bi, 1);
+	      return;
+	    }
+	  seq += n_skip;
+	  n_bytes -= n_skip;
+	}
+    }
+  if (i < vec_len (c->rx_out_of_order_segments))
+    {
+      s = vec_elt_at_index (c->rx_out_of_order_segments, i);
+      if (tcp_sequence_is_after (seq + n_bytes, s->sequence_number))
+	n_bytes = s->sequence_number - seq;
+    }
+
+  last_bi = tcp_rx_buffer_trim (vm, bi, n_skip, n_bytes);
+  c->n_rx_out_of_order_bytes += n_bytes;
+
+  /* Append to previous interval or start new one. */
+  s = i > 0 ? vec_elt_at_index (c->rx_out_of_order_segments, i - 1) : 0;
+  if (s && s->sequence_number + s->n_bytes == seq)
+    {
+      tcp_rx_buffer_chain (vm, s->last_buffer_index, bi);
+      s->last_buffer_index = last_bi;
+      s->n_bytes += n_bytes;
+      i = i - 1;
+    }
+  else
+    {
+      vec_insert (c->rx_out_of_order_segments, 1, i);
+      s = vec_elt_at_index (c->rx_out_of_order_segments, i);
+      s->sequence_number = seq;
+      s->n_bytes = n_bytes;
+      s->first_buffer_index = bi;
+      s->last_buffer_index = last_bi;
+    }
+
+  /* Merge with following interval when gap is now closed. */
+  if (i + 1 < vec_len (c->rx_out_of_order_segments))
+    {
+      t = s + 1;
+      if (s->sequence_number + s->n_bytes == t->sequence_number)
+	{
+	  tcp_rx_buffer_chain (vm, s->last_buffer_index, t->first_buffer_index);
+	  s->last_buffer_index = t->last_buffer_index;
+	  s->n_bytes += t->n_bytes;
+	  vec_delete (c->rx_out_of_order_segments, 1, i + 1);
+	}
+    }
+}
+
+/* Removes first out of order interval if in order data has reached it.
+   Returns buffer chain to deliver or ~0. */
+static u32
+tcp_rx_out_of_order_next (vlib_main_t * vm, tcp_connection_t * c)
+{
+  tcp_rx_segment_t * s;
+  u32 n_skip, n_bytes, bi;
+
+  while (vec_len (c->rx_out_of_order_segments) > 0)
+    {
+      s = c->rx_out_of_order_segments;
+      if (tcp_sequence_is_after (s->sequence_number, c->sequence_numbers.his))
+	break;
+
+      n_skip = c->sequence_numbers.his - s->sequence_number;
+      n_bytes = s->n_bytes;
+      bi = s->first_buffer_index;
+      vec_delete (c->rx_out_of_order_segments, 1, 0);
+
+      c->n_rx_out_of_order_bytes -= n_bytes;
+
+      /* Retransmission may have covered all of interval. */
+      if (n_skip >= n_bytes)
+	{
+	  vlib_buffer_free (vm, &bi, 1);
+	  continue;
+	}
+
+      if (n_skip > 0)
+	tcp_rx_buffer_trim (vm, bi, n_skip, n_bytes - n_skip);
+      c->sequence_numbers.his += n_bytes - n_skip;
+      return bi;
+    }
+
+  return ~0;
+}
+
+static void
+tcp_rx_out_of_order_free (vlib_main_t * vm, tcp_connection_t * c)
+{
+  tcp_rx_segment_t * s;
+
+  vec_foreach (s, c->rx_out_of_order_segments)
+    vlib_buffer_free (vm, &s->first_buffer_index, 1);
+  vec_free (c->rx_out_of_order_segments);
+  c->n_rx_out_of_order_bytes = 0;
+}
+
+/* Established node may send more or fewer buffers than it receives. */
+static_always_inline void
+tcp_established_enqueue (vlib_main_t * vm, vlib_node_runtime_t * node,
+			 u32 * next, u32 ** to_next, u32 * n_left_to_next,
+			 u32 bi, u32 next_bi)
+{
+  if (PREDICT_FALSE (next_bi != *next || *n_left_to_next == 0))
+    {
+      vlib_put_next_frame (vm, node, *next, *n_left_to_next);
+      *next = next_bi;
+      vlib_get_next_frame (vm, node, *next, *to_next, *n_left_to_next);
+    }
+
+  (*to_next)[0] = bi;
+  *to_next += 1;
+  *n_left_to_next -= 1;
+}
+
+static_always_inline void
+tcp_free_connection_x1 (vlib_main_t * vm, tcp_main_t * tm,
+			tcp_ip_4_or_6_t is_ip6,
+			u32 iest0)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  tcp_connection_t * est0;
+
+  est0 = pool_elt_at_index (tm46->established_connections, iest0);
+
+  tcp_established_hash_del (tm, is_ip6, est0->address_hash_index);
+
+  tcp_retransmit_timer_stop (tm, est0);
+  tcp_delayed_ack_timer_stop (tm, est0);
+  tcp_tx_packets_free (vm, est0);
+  tcp_rx_out_of_order_free (vm, est0);
+
+  pool_put (tm46->established_connections, est0);
+}
+
+static_always_inline void
+tcp_free_connection_x2 (vlib_main_t * vm, tcp_main_t * tm,
+			tcp_ip_4_or_6_t is_ip6,
+			u32 iest0, u32 iest1)
+{
+  tcp_free_connection_x1 (vm, tm, is_ip6, iest0);
+  tcp_free_connection_x1 (vm, tm, is_ip6, iest1);
+}
+
+/* Fills in variable fields of ip and tcp headers in copy of ack packet
+   template for given established connection.  Data packets have
+   n_data_bytes following headers whose checksum is data_ip_checksum.
+   Retransmissions use sequence number of first byte resent. */
+static_always_inline void
+ip46_tcp_ack_packet_set_headers (tcp_main_t * tm,
+				 tcp_ip_4_or_6_t is_ip6,
+				 tcp_packet_template_type_t template_type0,
+				 u32 iest0,
+				 void * r,
+				 u32 timestamp_now_host_byte_order,
+				 u32 timestamp_now_net_byte_order,
+				 u32 my_seq_host0,
+				 u32 n_data_bytes0,
+				 u16 data_ip_checksum0)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  tcp_connection_t * est0;
+  tcp_ack_packet_t * tcp0;
+  tcp_udp_ports_t * ports0;
+  ip_csum_t tcp_sum0;
+  u32 iest_div0, iest_mod0, my_seq_net0, his_seq_net0;
+
+  est0 = vec_elt_at_index (tm46->established_connections, iest0);
+  iest_div0 = est0->address_hash_index / 4;
+  iest_mod0 = est0->address_hash_index % 4;
+
+  tcp_sum0 = tm46->packet_templates[template_type0].tcp_checksum_net_byte_order;
+
+  if (is_ip6)
+    {
+      ip6_tcp_ack_packet_t * r0 = r;
+      ip6_tcp_udp_address_x4_t * esta0;
+      uword tmp0, i;
+
+      esta0 = &ip6_tcp_established_bucket (tm, iest_div0)->address_x4;
+      tcp0 = &r0->tcp;
+
+      for (i = 0; i < ARRAY_LEN (r0->ip6.src_address.as_u32); i++)
+	{
+	  tmp0 = r0->ip6.src_address.as_u32[i] = esta0->dst.as_u32[i][iest_mod0];
+	  tcp_sum0 = ip_csum_add_even (tcp_sum0, tmp0);
+
+	  tmp0 = r0->ip6.dst_address.as_u32[i] = esta0->src.as_u32[i][iest_mod0];
+	  tcp_sum0 = ip_csum_add_even (tcp_sum0, tmp0);
+	}
+
+      if (n_data_bytes0 > 0)
+	r0->ip6.payload_length = clib_host_to_net_u16 (sizeof (r0->tcp) + n_data_bytes0);
+
+      ports0 = &esta0->ports.as_ports[iest_mod0];
+    }
+  else
+    {
+      ip4_tcp_ack_packet_t * r0 = r;
+      ip4_tcp_udp_address_x4_t * esta0;
+      ip_csum_t ip_sum0;
+      u32 src0, dst0;
+
+      esta0 = &ip4_tcp_established_bucket (tm, iest_div0)->address_x4;
+      tcp0 = &r0->tcp;
+
+      ip_sum0 = tm46->packet_templates[template_type0].ip4_checksum_net_byte_order;
+
+      src0 = r0->ip4.src_address.as_u32 = esta0->dst.as_ip4_address[iest_mod0].as_u32;
+      dst0 = r0->ip4.dst_address.as_u32 = esta0->src.as_ip4_address[iest_mod0].as_u32;
+
+      ip_sum0 = ip_csum_add_even (ip_sum0, src0);
+      tcp_sum0 = ip_csum_add_even (tcp_sum0, src0);
+
+      ip_sum0 = ip_csum_add_even (ip_sum0, dst0);
+      tcp_sum0 = ip_csum_add_even (tcp_sum0, dst0);
+
+      if (n_data_bytes0 > 0)
+	{
+	  u16 old_length0, new_length0;
+
+	  old_length0 = r0->ip4.length;
+	  new_length0 = clib_host_to_net_u16 (sizeof (r0[0]) + n_data_bytes0);
+	  r0->ip4.length = new_length0;
+	  ip_sum0 = ip_csum_update (ip_sum0, old_length0, new_length0,
+				    ip4_header_t, length);
+	}
+
+      r0->ip4.checksum = ip_csum_fold (ip_sum0);
+
+      ASSERT (r0->ip4.checksum == ip4_header_checksum (&r0->ip4));
+      ports0 = &esta0->ports.as_ports[iest_mod0];
+    }
+
+  tcp_sum0 = ip_csum_add_even (tcp_sum0, ports0->as_u32);
+  tcp0->header.ports.src = ports0->dst;
+  tcp0->header.ports.dst = ports0->src;
+
+  /* Advertise window left after out of order data. */
+  {
+    u16 old_window0 = tcp0->header.window;
+    u16 new_window0 = clib_host_to_net_u16 (est0->my_window);
+    tcp0->header.window = new_window0;
+    tcp_sum0 = ip_csum_update (tcp_sum0, old_window0, new_window0,
+			       tcp_header_t, window);
+  }
+
+  my_seq_net0 = clib_host_to_net_u32 (my_seq_host0);
+  his_seq_net0 = clib_host_to_net_u32 (est0->sequence_numbers.his);
+
+  tcp0->header.seq_number = my_seq_net0;
+  tcp_sum0 = ip_csum_add_even (tcp_sum0, my_seq_net0);
+
+  tcp0->header.ack_number = his_seq_net0;
+  tcp_sum0 = ip_csum_add_even (tcp_sum0, his_seq_net0);
+
+  est0->time_stamps.ours_host_byte_order = timestamp_now_host_byte_order;
+  tcp0->options.time_stamp.my_time_stamp = timestamp_now_net_byte_order;
+  tcp_sum0 = ip_csum_add_even (tcp_sum0, timestamp_now_net_byte_order);
+
+  tcp0->options.time_stamp.his_time_stamp = est0->time_stamps.his_net_byte_order;
+  tcp_sum0 = ip_csum_add_even (tcp_sum0, est0->time_stamps.his_net_byte_order);
+
+  /* Data length in pseudo header plus data itself. */
+  tcp_sum0 = ip_csum_add_even (tcp_sum0, clib_host_to_net_u16 (n_data_bytes0));
+  tcp_sum0 = ip_csum_add_even (tcp_sum0, data_ip_checksum0);
+
+  tcp0->header.checksum = ip_csum_fold (tcp_sum0);
+}
+
+/* Prepends ack template headers to copy of queued data packet. */
+static_always_inline void
+ip46_tcp_data_packet_set_headers (vlib_main_t * vm,
+				  tcp_main_t * tm,
+				  tcp_ip_4_or_6_t is_ip6,
+				  u32 iest0,
+				  u32 bi0,
+				  u32 timestamp_now_host_byte_order,
+				  u32 timestamp_now_net_byte_order,
+				  u32 my_seq_host0,
+				  tcp_tx_packet_t * p0)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  tcp_packet_template_t * t = &tm46->packet_templates[TCP_PACKET_TEMPLATE_ACK];
+  tcp_connection_t * est0 = vec_elt_at_index (tm46->established_connections, iest0);
+  vlib_buffer_t * b0 = vlib_get_buffer (vm, bi0);
+  u32 n_header_bytes = vec_len (t->vlib.packet_data);
+
+  /* Headers go in front of data in space reserved by tcp_write. */
+  vlib_buffer_advance (b0, -(i32) n_header_bytes);
+  memcpy (vlib_buffer_get_current (b0), t->vlib.packet_data, n_header_bytes);
+
+  /* Look up destination in default fib. */
+  vnet_buffer (b0)->sw_if_index[VLIB_RX] = 0;
+  vnet_buffer (b0)->sw_if_index[VLIB_TX] = ~0;
+
+  ip46_tcp_ack_packet_set_headers (tm, is_ip6, TCP_PACKET_TEMPLATE_ACK, iest0,
+				   vlib_buffer_get_current (b0),
+				   timestamp_now_host_byte_order,
+				   timestamp_now_net_byte_order,
+				   my_seq_host0,
+				   p0->n_data_bytes,
+				   p0->data_ip_checksum);
+
+  /* Segment carries our ACK. */
+  tcp_ack_sent (tm, est0);
+}
+
+/* Resends oldest unacknowledged segment of connections whose
+   retransmit timer expired (RFC 6298 5.4) or which are in fast recovery.
+   After a timeout data output resends the segments following it. */
+static_always_inline uword
+ip46_tcp_output_retransmit (vlib_main_t * vm,
+			    vlib_node_runtime_t * node,
+			    tcp_main_t * tm,
+			    tcp_ip_4_or_6_t is_ip6,
+			    u32 timestamp_now_host_byte_order,
+			    u32 timestamp_now_net_byte_order)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  u32 * cis, * to_next, n_left_to_next, n_connections_left;
+  const u32 next = 0;
+  uword n_segments;
+
+  cis = tm46->connections_pending_retransmit;
+  n_connections_left = vec_len (cis);
+  if (n_connections_left == 0)
+    return 0;
+
+  n_segments = 0;
+
+  vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+
+  while (n_connections_left > 0)
+    {
+      tcp_connection_t * est0;
+      u32 iest0, bi0, last_bi0, my_seq0;
+
+      iest0 = cis[0];
+      est0 = vec_elt_at_index (tm46->established_connections, iest0);
+
+      if (n_left_to_next == 0)
+	{
+	  vlib_put_next_frame (vm, node, next, n_left_to_next);
+	  vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+	}
+
+      /* Sequence number of head packet's first byte. */
+      my_seq0 = est0->sequence_numbers.ours - est0->n_head_packet_bytes_acked;
+
+      if (tcp_tx_head_packet_is_sent (est0))
+	{
+	  if (! tcp_tx_packet_copy (vm, tm, &est0->head_packet, &bi0, &last_bi0))
+	    break;
+	  ip46_tcp_data_packet_set_headers (vm, tm, is_ip6, iest0, bi0,
+					    timestamp_now_host_byte_order,
+					    timestamp_now_net_byte_order,
+					    my_seq0,
+					    &est0->head_packet);
+	}
+
+      /* Only our FIN is unacknowledged. */
+      else if ((est0->flags & TCP_CONNECTION_FLAG_fin_sent)
+	       && est0->n_tx_unacked_bytes == 1)
+	{
+	  void * r0 = vlib_packet_template_get_packet
+	    (vm, &tm46->packet_templates[TCP_PACKET_TEMPLATE_FIN_ACK].vlib, &bi0);
+	  ip46_tcp_ack_packet_set_headers (tm, is_ip6, TCP_PACKET_TEMPLATE_FIN_ACK, iest0, r0,
+					   timestamp_now_host_byte_order,
+					   timestamp_now_net_byte_order,
+					   my_seq0,
+					   /* n_data_bytes */ 0,
+					   /* data_ip_checksum */ 0);
+	  tcp_ack_sent (tm, est0);
+	}
+
+      /* Acknowledged since timer expired. */
+      else
+	bi0 = ~0;
+
+      /* Segment being timed may be among those resent (Karn). */
+      est0->flags &= ~(TCP_CONNECTION_FLAG_retransmit_pending
+		       | TCP_CONNECTION_FLAG_rtt_timing);
+      cis += 1;
+      n_connections_left -= 1;
+
+      if (bi0 != ~0)
+	{
+	  to_next[0] = bi0;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+	  n_segments += 1;
+	}
+    }
+
+  vlib_put_next_frame (vm, node, next, n_left_to_next);
+
+  /* Connections left when out of buffers are retried next time. */
+  vec_delete (tm46->connections_pending_retransmit,
+	      cis - tm46->connections_pending_retransmit, 0);
+
+  return n_segments;
+}
+
+/* Default size of super segments: 40 1460 byte segments. */
+#define TCP_DEFAULT_GSO_MAX_DATA_BYTES (40 * 1460)
+
+/* Appends copies of full sized segments following super segment s in
+   transmit queue while window allows.  Interface output splits super
+   segments with more than one segment (see vnet/gso.h) so forwarding
+   sees one packet for many segments.  Returns number of segments added. */
+static uword
+tcp_tx_super_segment_extend (vlib_main_t * vm, tcp_main_t * tm, tcp_connection_t * c,
+			     u32 window, tcp_tx_packet_t * s, u32 last_bi)
+{
+  tcp_tx_packet_t * p = &c->tx_next_packet;
+  vlib_buffer_t * b;
+  ip_csum_t sum;
+  u32 bi, n_last_bytes;
+  uword n_segments;
+
+  /* Checksum of each segment's data saves interface output summing it. */
+  b = vlib_get_buffer (vm, s->first_buffer_index_this_packet);
+  vnet_buffer (b)->ip.gso.data_ip_checksum = s->data_ip_checksum;
+  vnet_buffer (b)->ip.gso.n_data_bytes = s->n_data_bytes;
+
+  sum = s->data_ip_checksum;
+  n_last_bytes = s->n_data_bytes;
+  n_segments = 0;
+
+  /* All but last segment must be full sized. */
+  while (n_last_bytes == c->max_segment_size
+	 && p->n_data_bytes > 0
+	 && s->n_data_bytes + p->n_data_bytes <= tm->gso_max_data_bytes
+	 && c->n_tx_unacked_bytes + s->n_data_bytes + p->n_data_bytes <= window)
+    {
+      vlib_buffer_t * last;
+
+      last = vlib_get_buffer (vm, last_bi);
+      if (! tcp_tx_packet_copy (vm, tm, p, &bi, &last_bi))
+	break;
+
+      last->flags |= VLIB_BUFFER_NEXT_PRESENT;
+      last->next_buffer = bi;
+
+      b = vlib_get_buffer (vm, bi);
+      b->flags |= VNET_BUFFER_GSO_SEGMENT_START;
+      vnet_buffer (b)->ip.gso.data_ip_checksum = p->data_ip_checksum;
+      vnet_buffer (b)->ip.gso.n_data_bytes = p->n_data_bytes;
+
+      sum = ip_csum_add_block (sum, p->data_ip_checksum, s->n_data_bytes);
+      s->n_data_bytes += p->n_data_bytes;
+      n_last_bytes = p->n_data_bytes;
+      n_segments += 1;
+
+      tcp_tx_packet_get_next (vm, p, p);
+    }
+
+  s->data_ip_checksum = ip_csum_fold (sum);
+
+  if (n_segments > 0)
+    {
+      b = vlib_get_buffer (vm, s->first_buffer_index_this_packet);
+      b->flags |= VNET_BUFFER_GSO;
+      vnet_buffer (b)->ip.gso.segment_size = c->max_segment_size;
+    }
+
+  return n_segments;
+}
+
+/* Sends segments queued by tcp_write as far as peer's window allows. */
+static_always_inline uword
+ip46_tcp_output_data (vlib_main_t * vm,
+		      vlib_node_runtime_t * node,
+		      tcp_main_t * tm,
+		      tcp_ip_4_or_6_t is_ip6,
+		      u32 timestamp_now_host_byte_order,
+		      u32 timestamp_now_net_byte_order)
+{
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  u32 * cis, * to_next, n_left_to_next, n_connections_left;
+  const u32 next = 0;
+  uword n_segments;
+
+  cis = tm46->connections_pending_data;
+  n_connections_left = vec_len (cis);
+  if (n_connections_left == 0)
+    return 0;
+
+  /* Connections blocked by window are added back while we walk vector.
+     Writes never overtake reads so this is safe. */
+  _vec_len (tm46->connections_pending_data) = 0;
+
+  n_segments = 0;
+
+  vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+
+  while (n_connections_left > 0)
+    {
+      tcp_connection_t * est0;
+      u32 iest0, his_window0;
+
+      iest0 = cis[0];
+      cis += 1;
+      n_connections_left -= 1;
+      est0 = vec_elt_at_index (tm46->established_connections, iest0);
+
+      /* Send partial segment rather than wait for application to fill it. */
+      if (est0->write_tail_packet.n_data_bytes > 0)
+	tcp_tx_packet_close_write_tail (vm, est0);
+
+      /* Send no more than peer's window and our congestion window allow. */
+      his_window0 = est0->his_window << est0->his_window_scale;
+      his_window0 = clib_min (his_window0, est0->congestion.window);
+
+      while (est0->tx_next_packet.n_data_bytes > 0
+	     && ((est0->n_tx_unacked_bytes + est0->tx_next_packet.n_data_bytes
+		  <= his_window0)
+		 || (est0->flags & TCP_CONNECTION_FLAG_window_probe)))
+	{
+	  tcp_tx_packet_t * p0 = &est0->tx_next_packet;
+	  tcp_tx_packet_t s0;
+	  u32 bi0, last_bi0;
+
+	  if (n_left_to_next == 0)
+	    {
+	      vlib_put_next_frame (vm, node, next, n_left_to_next);
+	      vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+	    }
+
+	  if (! tcp_tx_packet_copy (vm, tm, p0, &bi0, &last_bi0))
+	    break;
+
+	  s0 = p0[0];
+	  s0.first_buffer_index_this_packet = bi0;
+
+	  /* Keep packet queued until acknowledged. */
+	  tcp_tx_packet_get_next (vm, p0, p0);
+
+	  n_segments += 1 + tcp_tx_super_segment_extend (vm, tm, est0, his_window0,
+							 &s0, last_bi0);
+
+	  ip46_tcp_data_packet_set_headers (vm, tm, is_ip6, iest0, bi0,
+					    timestamp_now_host_byte_order,
+					    timestamp_now_net_byte_order,
+					    est0->sequence_numbers.ours + est0->n_tx_unacked_bytes,
+					    &s0);
+
+	  /* Interface output finds headers to copy for each segment here. */
+	  {
+	    vlib_buffer_t * b0 = vlib_get_buffer (vm, bi0);
+	    vnet_buffer (b0)->ip.gso.l3_header_offset = b0->current_data;
+	  }
+
+	  /* Time one segment per round trip for peers without time stamps
+	     (RFC 6298 3).  Data is timed when first sent only: data resent
+	     after a retransmit timeout lies below tx_max and output node
+	     clears timing whenever it retransmits (Karn). */
+	  {
+	    u32 seq0 = est0->sequence_numbers.ours + est0->n_tx_unacked_bytes;
+
+	    if (! (est0->flags & TCP_CONNECTION_FLAG_rtt_timing)
+		&& (i32) (seq0 - est0->tx_max_sequence_number) >= 0)
+	      {
+		est0->flags |= TCP_CONNECTION_FLAG_rtt_timing;
+		est0->rtt_sequence_number = seq0 + s0.n_data_bytes;
+		est0->rtt_time_sent = timestamp_now_host_byte_order;
+	      }
+
+	    if ((i32) (seq0 + s0.n_data_bytes - est0->tx_max_sequence_number) > 0)
+	      est0->tx_max_sequence_number = seq0 + s0.n_data_bytes;
+	  }
+
+	  est0->n_tx_unacked_bytes += s0.n_data_bytes;
+	  est0->flags &= ~TCP_CONNECTION_FLAG_window_probe;
+
+	  /* Time oldest unacknowledged segment (RFC 6298 5.1). */
+	  if (est0->retransmit_timer_handle == ~0)
+	    tcp_retransmit_timer_start (tm, est0, tcp_connection_handle_set (iest0, is_ip6));
+
+	  to_next[0] = bi0;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+	}
+
+      if (est0->tx_next_packet.n_data_bytes > 0)
+	{
+	  vec_add1 (tm46->connections_pending_data, iest0);
+
+	  /* Window too small for next segment and nothing in flight: no
+	     ACK will come to open it, so persist timer probes it
+	     (RFC 1122 4.2.2.17). */
+	  if (est0->n_tx_unacked_bytes == 0 && est0->retransmit_timer_handle == ~0)
+	    tcp_retransmit_timer_start (tm, est0, tcp_connection_handle_set (iest0, is_ip6));
+	}
+      else
+	{
+	  est0->flags &= ~TCP_CONNECTION_FLAG_data_pending;
+
+	  /* Queue drained: send FIN application asked for when it closed
+	     with data still queued. */
+	  if ((est0->flags & (TCP_CONNECTION_FLAG_application_requested_close
+			      | TCP_CONNECTION_FLAG_fin_sent))
+	      == TCP_CONNECTION_FLAG_application_requested_close)
+	    tcp_ack_schedule (tm, est0, tcp_connection_handle_set (iest0, is_ip6),
+			      /* ack_now */ 1);
+	}
+    }
+
+  vlib_put_next_frame (vm, node, next, n_left_to_next);
+
+  return n_segments;
+}
+
+static_always_inline uword
+ip46_tcp_output (vlib_main_t * vm,
+		 vlib_node_runtime_t * node,
+		 vlib_frame_t * frame,
+		 tcp_ip_4_or_6_t is_ip6)
+{
+  tcp_main_t * tm = &tcp_main;
+  ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
+  u32 * cis, * to_next, n_left_to_next, n_connections_left;
+  u32 timestamp_now_host_byte_order, timestamp_now_net_byte_order;
+  vlib_node_runtime_t * error_node;
+  const u32 next = 0;
+  uword n_acks, n_data_segments, n_segments;
+
+  /* Inform listeners of new connections. */
+  {
+    tcp_listener_t * l;
+    pool_foreach (l, tm->listener_pool, ({
+      if (vec_len (l->eof_connections[is_ip6]) > 0)
+	{
+	  if (l->event_function)
+	    l->event_function (l->eof_connections[is_ip6], TCP_EVENT_fin_received);
+	  else
+	    {
+	      uword i;
+	      for (i = 0; i < vec_len (l->eof_connections[is_ip6]); i++)
+		{
+		  tcp_connection_t * c = tcp_get_connection (l->eof_connections[is_ip6][i]);
+		  c->flags |= TCP_CONNECTION_FLAG_application_requested_close;
+		}
+	    }
+	  _vec_len (l->eof_connections[is_ip6]) = 0;
+	}
+
+      if (vec_len (l->close_connections[is_ip6]) > 0)
+	{
+	  uword n_left;
+	  u32 * cis;
+
+	  if (l->event_function)
+	    l->event_function (l->close_connections[is_ip6], TCP_EVENT_connection_closed);
+
+	  cis = l->close_connections[is_ip6];
+	  n_left = vec_len (cis);
+	  ASSERT (tm->n_established_connections[is_ip6] >= n_left);
+	  tm->n_established_connections[is_ip6] -= n_left;
+	  if (tm->n_established_connections[is_ip6] == 0)
+	    vlib_node_set_state (vm, tm46->output_node_index, VLIB_NODE_STATE_DISABLED);
+	  while (n_left >= 2)
+	    {
+	      tcp_free_connection_x2 (vm, tm, is_ip6, cis[0], cis[1]);
+	      n_left -= 2;
+	      cis += 2;
+	    }
+
+	  while (n_left > 0)
+	    {
+	      tcp_free_connection_x1 (vm, tm, is_ip6, cis[0]);
+	      n_left -= 1;
+	      cis += 1;
+	    }
+
+	  _vec_len (l->close_connections[is_ip6]) = 0;
+	}
+    }));
+  }
+
+  timestamp_now_host_byte_order = tcp_time_now (tm, TCP_TIMER_timestamp);
+  timestamp_now_net_byte_order = clib_host_to_net_u32 (timestamp_now_host_byte_order);
+
+  error_node = vlib_node_get_runtime
+    (vm, is_ip6 ? ip6_tcp_lookup_node.index : ip4_tcp_lookup_node.index);
+
+  n_segments = ip46_tcp_output_retransmit (vm, node, tm, is_ip6,
+					   timestamp_now_host_byte_order,
+					   timestamp_now_net_byte_order);
+  vlib_error_count (vm, error_node->node_index, TCP_ERROR_DATA_SEGMENTS_RETRANSMITTED, n_segments);
+
+  n_data_segments = ip46_tcp_output_data (vm, node, tm, is_ip6,
+					  timestamp_now_host_byte_order,
+					  timestamp_now_net_byte_order);
+  vlib_error_count (vm, error_node->node_index, TCP_ERROR_DATA_SEGMENTS_SENT, n_data_segments);
+  n_segments += n_data_segments;
+
+  n_acks = 0;
+  cis = tm46->connections_pending_acks;
+  n_connections_left = vec_len (cis);
+  if (n_connections_left == 0)
+    return n_segments;
+  _vec_len (tm46->connections_pending_acks) = 0;
+
+  while (n_connections_left > 0)
+    {
+      vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+
+      while (n_connections_left > 0 && n_left_to_next > 0)
+	{
+	  tcp_connection_t * est0;
+	  tcp_packet_template_type_t template_type0;
+	  void * r0;
+	  u32 bi0, iest0;
+	  u8 is_fin0;
 
 	  iest0 = cis[0];
 	  cis += 1;
-	  iest_div0 = iest0 / 4;
-	  iest_mod0 = iest0 % 4;
+	  n_connections_left -= 1;
 	  est0 = vec_elt_at_index (tm46->established_connections, iest0);
 
-	  /* Send a FIN along with our ACK if application closed connection. */
+	  /* Data segment sent above already carried ACK. */
+	  if (! (est0->flags & TCP_CONNECTION_FLAG_ack_pending))
+	    continue;
+
+	  /* Send a FIN along with our ACK if application closed connection
+	     and all its data has been sent. */
 	  {
-	    u8 is_closed0, fin_sent0;
+	    u8 is_closed0, fin_sent0, data_queued0;
 
 	    is_closed0 = (est0->flags & TCP_CONNECTION_FLAG_application_requested_close) != 0;
 	    fin_sent0 = (est0->flags & TCP_CONNECTION_FLAG_fin_sent) != 0;
+	    data_queued0 = (est0->tx_next_packet.n_data_bytes
+			    + est0->write_tail_packet.n_data_bytes) != 0;
 
-	    is_fin0 = is_closed0 && ! fin_sent0;
+	    is_fin0 = is_closed0 && ! fin_sent0 && ! data_queued0;
 	    template_type0 = 
 	      (is_fin0
 	       ? TCP_PACKET_TEMPLATE_FIN_ACK
 	       : TCP_PACKET_TEMPLATE_ACK);
-	    est0->flags |= is_closed0 << LOG2_TCP_CONNECTION_FLAG_fin_sent;
+	    est0->flags |= is_fin0 << LOG2_TCP_CONNECTION_FLAG_fin_sent;
 	  }
 
-	  if (is_ip6)
-	    {
-	      ip6_tcp_ack_packet_t * r0;
-	      ip6_tcp_udp_address_x4_t * esta0;
-	      uword tmp0, i;
+	  r0 = vlib_packet_template_get_packet
+	    (vm, &tm46->packet_templates[template_type0].vlib, &bi0);
 
-	      esta0 = vec_elt_at_index (tm->ip6_established_connection_address_hash, iest_div0);
-	      r0 = vlib_packet_template_get_packet
-		(vm, &tm->ip6.packet_templates[template_type0].vlib, &bi0);
-	      tcp0 = &r0->tcp;
+	  ip46_tcp_ack_packet_set_headers (tm, is_ip6, template_type0, iest0, r0,
+					   timestamp_now_host_byte_order,
+					   timestamp_now_net_byte_order,
+					   est0->sequence_numbers.ours + est0->n_tx_unacked_bytes,
+					   /* n_data_bytes */ 0,
+					   /* data_ip_checksum */ 0);
 
-	      tcp_sum0 = (tm->ip6.packet_templates[template_type0]
-			  .tcp_checksum_net_byte_order);
+	  /* FIN accounts for 1 sequence number. */
+	  est0->n_tx_unacked_bytes += is_fin0;
+	  if (is_fin0
+	      && (i32) (est0->sequence_numbers.ours + est0->n_tx_unacked_bytes
+			- est0->tx_max_sequence_number) > 0)
+	    est0->tx_max_sequence_number = est0->sequence_numbers.ours + est0->n_tx_unacked_bytes;
+	  if (is_fin0 && est0->retransmit_timer_handle == ~0)
+	    tcp_retransmit_timer_start (tm, est0, tcp_connection_handle_set (iest0, is_ip6));
 
-	      for (i = 0; i < ARRAY_LEN (r0->ip6.src_address.as_u32); i++)
-		{
-		  tmp0 = r0->ip6.src_address.as_u32[i] = esta0->dst.as_u32[i][iest_mod0];
-		  tcp_sum0 = ip_csum_add_even (tcp_sum0, tmp0);
+	  tcp_ack_sent (tm, est0);
 
-		  tmp0 = r0->ip6.dst_address.as_u32[i] = esta0->src.as_u32[i][iest_mod0];
-		  tcp_sum0 = ip_csum_add_even (tcp_sum0, tmp0);
-		}
+	  to_next[0] = bi0;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+	  n_acks += 1;
+	}
 
-	      ports0 = &esta0->ports.as_ports[iest_mod0];
-	    }
-	  else
-	    {
-	      ip4_tcp_ack_packet_t * r0;
-	      ip4_tcp_udp_address_x4_t * esta0;
-	      ip_csum_t ip_sum0;
-	      u32 src0, dst0;
+      vlib_put_next_frame (vm, node, next, n_left_to_next);
+    }
 
-	      esta0 = vec_elt_at_index (tm->ip4_established_connection_address_hash, iest_div0);
-	      r0 = vlib_packet_template_get_packet
-		(vm, &tm->ip4.packet_templates[template_type0].vlib, &bi0);
-	      tcp0 = &r0->tcp;
+  vlib_error_count (vm, error_node->node_index, TCP_ERROR_ACKS_SENT, n_acks);
 
-	      ip_sum0 = (tm->ip4.packet_templates[template_type0]
-			  .ip4_checksum_net_byte_order);
-	      tcp_sum0 = (tm->ip4.packet_templates[template_type0]
-			  .tcp_checksum_net_byte_order);
+  return n_segments + n_acks;
+}
+
+static uword
+ip4_tcp_output (vlib_main_t * vm,
+		vlib_node_runtime_t * node,
+		vlib_frame_t * frame)
+{ return ip46_tcp_output (vm, node, frame, /* is_ip6 */ 0); }
+
+static uword
+ip6_tcp_output (vlib_main_t * vm,
+		vlib_node_runtime_t * node,
+		vlib_frame_t * frame)
+{ return ip46_tcp_output (vm, node, frame, /* is_ip6 */ 1); }
+
+static VLIB_REGISTER_NODE (ip4_tcp_output_node) = {
+  .function = ip4_tcp_output,
+  .name = "ip4-tcp-output",
+  .state = VLIB_NODE_STATE_DISABLED,
+  .type = VLIB_NODE_TYPE_INPUT,
+
+  .vector_size = sizeof (u32),
+
+  .n_next_nodes = 1,
+  .next_nodes = {
+    [0] = CLIB_DEBUG > 0 ? "ip4-input" : "ip4-lookup",
+  },
+};
+
+static VLIB_REGISTER_NODE (ip6_tcp_output_node) = {
+  .function = ip6_tcp_output,
+  .name = "ip6-tcp-output",
+  .state = VLIB_NODE_STATE_DISABLED,
+  .type = VLIB_NODE_TYPE_INPUT,
+
+  .vector_size = sizeof (u32),
+
+  .n_next_nodes = 1,
+  .next_nodes = {
+    [0] = CLIB_DEBUG > 0 ? "ip6-input" : "ip6-lookup",
+  },
+};
+
+/* Marks connection for output node to resend oldest unacknowledged segment. */
+always_inline void
+tcp_retransmit_schedule (tcp_main_t * tm, tcp_connection_t * c, u32 connection_handle)
+{
+  ip46_tcp_main_t * tm46 = tcp_connection_is_ip6 (connection_handle) ? &tm->ip6 : &tm->ip4;
+
+  if (! (c->flags & TCP_CONNECTION_FLAG_retransmit_pending))
+    {
+      c->flags |= TCP_CONNECTION_FLAG_retransmit_pending;
+      vec_add1 (tm46->connections_pending_retransmit, connection_handle / 2);
+    }
+}
+
+/* Loss detected: congestion control algorithm lowers slow start threshold. */
+always_inline void
+tcp_congestion_loss (tcp_connection_t * c)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+
+  tcp_congestion_controls[s->type].loss (c);
+  s->n_bytes_acked = 0;
+  s->n_dup_acks = 0;
+}
+
+/* Duplicate ACK (RFC 5681 3.2 and RFC 6582 3.2): third one starts fast
+   retransmit and recovery, later ones inflate window by a segment. */
+static_always_inline void
+tcp_dup_ack (tcp_main_t * tm, tcp_connection_t * c, u32 connection_handle)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+
+  if (s->in_fast_recovery)
+    {
+      s->window += c->max_segment_size;
+      return;
+    }
+
+  if (++s->n_dup_acks < 3)
+    return;
+
+  /* Don't start recovery again for losses of data sent before last one. */
+  if ((i32) (c->sequence_numbers.ours - s->recover) <= 0)
+    return;
+
+  tcp_congestion_loss (c);
+  s->window = s->slow_start_threshold + 3 * c->max_segment_size;
+  s->recover = c->sequence_numbers.ours + c->n_tx_unacked_bytes;
+  s->in_fast_recovery = 1;
+
+  tcp_retransmit_schedule (tm, c, connection_handle);
+}
+
+/* Retransmit timeout: head packet is resent by retransmit path and
+   output node resends rest of queue after it as window allows (go back
+   N).  FIN already sent is sent again once queue drains. */
+static void
+tcp_tx_rewind (vlib_main_t * vm, tcp_main_t * tm, tcp_connection_t * c,
+	       u32 connection_handle)
+{
+  ip46_tcp_main_t * tm46 = tcp_connection_is_ip6 (connection_handle) ? &tm->ip6 : &tm->ip4;
+
+  tcp_tx_packet_get_next (vm, &c->head_packet, &c->tx_next_packet);
+  c->n_tx_unacked_bytes = c->head_packet.n_data_bytes - c->n_head_packet_bytes_acked;
+  c->flags &= ~(TCP_CONNECTION_FLAG_fin_sent | TCP_CONNECTION_FLAG_rtt_timing);
+
+  if (! (c->flags & TCP_CONNECTION_FLAG_data_pending))
+    {
+      c->flags |= TCP_CONNECTION_FLAG_data_pending;
+      vec_add1 (tm46->connections_pending_data, connection_handle / 2);
+    }
+}
 
-	      src0 = r0->ip4.src_address.as_u32 = esta0->dst.as_ip4_address[iest_mod0].as_u32;
-	      dst0 = r0->ip4.dst_address.as_u32 = esta0->src.as_ip4_address[iest_mod0].as_u32;
+/* ACK beyond send point after tcp_tx_rewind: data (and FIN) sent before
+   timeout arrived after all.  Skipped packets count as sent; packet
+   acknowledged in part is left in flight whole. */
+static void
+tcp_tx_advance (vlib_main_t * vm, tcp_connection_t * c, u32 n_bytes)
+{
+  tcp_tx_packet_t * p = &c->tx_next_packet;
+
+  while (n_bytes > 0 && p->n_data_bytes > 0)
+    {
+      n_bytes -= clib_min (n_bytes, p->n_data_bytes);
+      c->n_tx_unacked_bytes += p->n_data_bytes;
+      tcp_tx_packet_get_next (vm, p, p);
+    }
+
+  if (n_bytes > 0)
+    {
+      ASSERT (n_bytes == 1);
+      c->n_tx_unacked_bytes += n_bytes;
+      c->flags |= TCP_CONNECTION_FLAG_fin_sent;
+    }
+}
 
-	      ip_sum0 = ip_csum_add_even (ip_sum0, src0);
-	      tcp_sum0 = ip_csum_add_even (tcp_sum0, src0);
+/* Frees fully acknowledged packets, restarts retransmit timer
+   (RFC 6298 5.2 and 5.3) and updates congestion window. */
+static_always_inline void
+tcp_ack (vlib_main_t * vm, tcp_main_t * tm, tcp_connection_t * c,
+	 u32 connection_handle, u32 n_bytes_acked, f64 now)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+  tcp_tx_packet_t p;
+  u32 n_bytes;
 
-	      ip_sum0 = ip_csum_add_even (ip_sum0, dst0);
-	      tcp_sum0 = ip_csum_add_even (tcp_sum0, dst0);
+  ASSERT (n_bytes_acked <= c->tx_max_sequence_number - c->sequence_numbers.ours);
+  if (n_bytes_acked == 0)
+    return;
 
-	      r0->ip4.checksum = ip_csum_fold (ip_sum0);
+  if (PREDICT_FALSE (n_bytes_acked > c->n_tx_unacked_bytes))
+    tcp_tx_advance (vm, c, n_bytes_acked - c->n_tx_unacked_bytes);
 
-	      ASSERT (r0->ip4.checksum == ip4_header_checksum (&r0->ip4));
-	      ports0 = &esta0->ports.as_ports[iest_mod0];
-	    }
+  c->n_tx_unacked_bytes -= n_bytes_acked;
 
-	  tcp_sum0 = ip_csum_add_even (tcp_sum0, ports0->as_u32);
-	  tcp0->header.ports.src = ports0->dst;
-	  tcp0->header.ports.dst = ports0->src;
+  n_bytes = n_bytes_acked + c->n_head_packet_bytes_acked;
+  while (tcp_tx_head_packet_is_sent (c)
+	 && n_bytes >= c->head_packet.n_data_bytes)
+    {
+      n_bytes -= c->head_packet.n_data_bytes;
+      tcp_tx_packet_dequeue (vm, c, &p);
+      vlib_buffer_free (vm, &p.first_buffer_index_this_packet, 1);
+    }
 
-	  my_seq_net0 = clib_host_to_net_u32 (est0->sequence_numbers.ours);
-	  his_seq_net0 = clib_host_to_net_u32 (est0->sequence_numbers.his);
+  /* Remainder is either part of head packet or our FIN. */
+  c->n_head_packet_bytes_acked = tcp_tx_head_packet_is_sent (c) ? n_bytes : 0;
 
-	  /* FIN accounts for 1 sequence number. */
-	  est0->sequence_numbers.ours += is_fin0;
+  c->n_retransmits = 0;
+  tcp_retransmit_timer_stop (tm, c);
+  if (c->n_tx_unacked_bytes > 0)
+    tcp_retransmit_timer_start (tm, c, connection_handle);
 
-	  tcp0->header.seq_number = my_seq_net0;
-	  tcp_sum0 = ip_csum_add_even (tcp_sum0, my_seq_net0);
+  s->n_dup_acks = 0;
+  if (! s->in_fast_recovery)
+    tcp_congestion_controls[s->type].ack (c, n_bytes_acked, now);
 
-	  tcp0->header.ack_number = his_seq_net0;
-	  tcp_sum0 = ip_csum_add_even (tcp_sum0, his_seq_net0);
+  /* Full ACK ends recovery with window deflated to threshold. */
+  else if ((i32) (c->sequence_numbers.ours + n_bytes_acked - s->recover) >= 0)
+    {
+      s->in_fast_recovery = 0;
+      s->window = clib_min (s->slow_start_threshold,
+			    (clib_max (c->n_tx_unacked_bytes, c->max_segment_size)
+			     + c->max_segment_size));
+    }
 
-	  est0->time_stamps.ours_host_byte_order = timestamp_now_host_byte_order;
-	  tcp0->options.time_stamp.my_time_stamp = timestamp_now_net_byte_order;
-	  tcp_sum0 = ip_csum_add_even (tcp_sum0, timestamp_now_net_byte_order);
+  /* Partial ACK: resend next unacknowledged segment and deflate window
+     by amount acknowledged. */
+  else
+    {
+      s->window -= clib_min (s->window, n_bytes_acked);
+      if (n_bytes_acked >= c->max_segment_size)
+	s->window += c->max_segment_size;
+      tcp_retransmit_schedule (tm, c, connection_handle);
+    }
+}
 
-	  tcp0->options.time_stamp.his_time_stamp = est0->time_stamps.his_net_byte_order;
-	  tcp_sum0 = ip_csum_add_even (tcp_sum0, est0->time_stamps.his_net_byte_order);
+/* Backs off and restarts expired retransmit timers (RFC 6298 5.5 and 5.6)
+   and marks connections for output node to resend. */
+static void
+tcp_retransmit_timers_expired (vlib_main_t * vm, tcp_main_t * tm)
+{
+  static u32 * expired;
+  uword i;
 
-	  tcp0->header.checksum = ip_csum_fold (tcp_sum0);
+  vec_reset_length (expired);
+  expired = vnet_timer_wheel_advance (&tm->retransmit_timer_wheel, vlib_time_now (vm), expired);
 
-	  est0->flags &= ~TCP_CONNECTION_FLAG_ack_pending;
+  for (i = 0; i < vec_len (expired); i++)
+    {
+      u32 h = expired[i];
+      tcp_connection_t * c = tcp_get_connection (h);
 
-	  to_next[0] = bi0;
-	  to_next += 1;
-	  n_left_to_next -= 1;
-	  n_connections_left -= 1;
-	  n_acks += 1;
+      c->retransmit_timer_handle = ~0;
+      if (c->n_tx_unacked_bytes == 0)
+	{
+	  /* Persist timer: output node sends next segment as window probe;
+	     its retransmit timer backs off further probes. */
+	  if (c->tx_next_packet.n_data_bytes > 0)
+	    {
+	      c->flags |= TCP_CONNECTION_FLAG_window_probe;
+	      c->retransmit_timeout = clib_min (2 * c->retransmit_timeout, TCP_RETRANSMIT_TIMEOUT_MAX);
+	    }
+	  continue;
 	}
 
-      vlib_put_next_frame (vm, node, next, n_left_to_next);
-    }
+      /* Window collapses to one segment (RFC 5681 3.1).  Threshold is
+	 only lowered on first timeout of a segment. */
+      if (c->n_retransmits == 0)
+	tcp_congestion_loss (c);
+      c->congestion.window = c->max_segment_size;
+      c->congestion.in_fast_recovery = 0;
+      c->congestion.recover = c->tx_max_sequence_number;
 
-  vlib_error_count (vm, error_node->node_index, TCP_ERROR_ACKS_SENT, n_acks);
+      /* Resend everything from oldest unacknowledged byte. */
+      if (tcp_tx_head_packet_is_sent (c))
+	tcp_tx_rewind (vm, tm, c, h);
+
+      c->retransmit_timeout = clib_min (2 * c->retransmit_timeout, TCP_RETRANSMIT_TIMEOUT_MAX);
+      c->n_retransmits += c->n_retransmits < 255;
+      tcp_retransmit_timer_start (tm, c, h);
 
-  return n_acks;
+      tcp_retransmit_schedule (tm, c, h);
+    }
 }
 
-static uword
-ip4_tcp_output (vlib_main_t * vm,
-		vlib_node_runtime_t * node,
-		vlib_frame_t * frame)
-{ return ip46_tcp_output (vm, node, frame, /* is_ip6 */ 0); }
+/* Queues connections whose delayed ACK timer expired so that output
+   nodes send all of their ACKs in one vector. */
+static void
+tcp_delayed_ack_timers_expired (vlib_main_t * vm, tcp_main_t * tm)
+{
+  static u32 * expired;
+  uword i;
 
-static uword
-ip6_tcp_output (vlib_main_t * vm,
-		vlib_node_runtime_t * node,
-		vlib_frame_t * frame)
-{ return ip46_tcp_output (vm, node, frame, /* is_ip6 */ 1); }
+  vec_reset_length (expired);
+  expired = vnet_timer_wheel_advance (&tm->delayed_ack_timer_wheel, vlib_time_now (vm), expired);
 
-static VLIB_REGISTER_NODE (ip4_tcp_output_node) = {
-  .function = ip4_tcp_output,
-  .name = "ip4-tcp-output",
-  .state = VLIB_NODE_STATE_DISABLED,
-  .type = VLIB_NODE_TYPE_INPUT,
+  for (i = 0; i < vec_len (expired); i++)
+    {
+      u32 h = expired[i];
+      tcp_connection_t * c = tcp_get_connection (h);
 
-  .vector_size = sizeof (u32),
+      c->delayed_ack_timer_handle = ~0;
+      tcp_ack_schedule (tm, c, h, /* ack_now */ 1);
+    }
+}
 
-  .n_next_nodes = 1,
-  .next_nodes = {
-    [0] = CLIB_DEBUG > 0 ? "ip4-input" : "ip4-lookup",
-  },
-};
+static uword
+tcp_retransmit_process (vlib_main_t * vm,
+			vlib_node_runtime_t * rt,
+			vlib_frame_t * f)
+{
+  tcp_main_t * tm = &tcp_main;
 
-static VLIB_REGISTER_NODE (ip6_tcp_output_node) = {
-  .function = ip6_tcp_output,
-  .name = "ip6-tcp-output",
-  .state = VLIB_NODE_STATE_DISABLED,
-  .type = VLIB_NODE_TYPE_INPUT,
+  while (1)
+    {
+      vlib_process_suspend (vm, TCP_RETRANSMIT_TICK_INTERVAL);
+      if (vnet_timer_wheel_n_running (&tm->retransmit_timer_wheel) > 0)
+	tcp_retransmit_timers_expired (vm, tm);
+      if (vnet_timer_wheel_n_running (&tm->delayed_ack_timer_wheel) > 0)
+	tcp_delayed_ack_timers_expired (vm, tm);
+    }
 
-  .vector_size = sizeof (u32),
+  return 0;
+}
 
-  .n_next_nodes = 1,
-  .next_nodes = {
-    [0] = CLIB_DEBUG > 0 ? "ip6-input" : "ip6-lookup",
-  },
+static VLIB_REGISTER_NODE (tcp_retransmit_node) = {
+  .function = tcp_retransmit_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "tcp-retransmit",
 };
 
-static_always_inline void
-tcp_ack (tcp_main_t * tm, tcp_connection_t * c, u32 n_bytes)
-{
-  ASSERT (n_bytes == 0);
-}
-
 typedef enum {
   TCP_ESTABLISHED_NEXT_DROP,
   TCP_ESTABLISHED_N_NEXT,
@@ -2283,8 +4072,9 @@ ip46_tcp_established (vlib_main_t * vm,
   ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
   uword n_packets = frame->n_vectors;
   u32 * from, * to_next;
-  u32 n_left_from, n_left_to_next, next, timestamp_now;
+  u32 n_left_from, n_left_to_next, next, timestamp_now, n_out_of_order, n_acks_delayed;
   vlib_node_runtime_t * error_node;
+  f64 time_now;
 
   error_node = vlib_node_get_runtime
     (vm, is_ip6 ? ip6_tcp_lookup_node.index : ip4_tcp_lookup_node.index);
@@ -2293,160 +4083,231 @@ ip46_tcp_established (vlib_main_t * vm,
   n_left_from = n_packets;
   next = node->cached_next_index;
   timestamp_now = tcp_time_now (tm, TCP_TIMER_timestamp);
+  time_now = vlib_time_now (vm);
+  n_out_of_order = 0;
+  n_acks_delayed = 0;
   
+  vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
+
   while (n_left_from > 0)
     {
-      vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
-
-      while (n_left_from > 0 && n_left_to_next > 0)
-	{
-	  vlib_buffer_t * p0;
-	  ip6_header_t * ip60;
-	  ip4_header_t * ip40;
-	  tcp_header_t * tcp0;
-	  tcp_connection_t * est0;
-	  tcp_listener_t * l0;
-	  u32 bi0, iest0, n_data_bytes0, his_ack_host0, n_ack0;
-	  u8 error0, next0, n_advance_bytes0, is_fin0, send_ack0;
+      vlib_buffer_t * p0;
+      ip6_header_t * ip60;
+      ip4_header_t * ip40;
+      tcp_header_t * tcp0;
+      tcp_connection_t * est0;
+      tcp_listener_t * l0;
+      u32 bi0, iest0, ch0, n_data_bytes0, his_ack_host0, n_ack0, seq0, n_skip0;
+      i32 seq_offset0;
+      u8 error0, next0, n_advance_bytes0, is_fin0, is_dup_ack0;
       
-	  bi0 = to_next[0] = from[0];
+      bi0 = from[0];
 
-	  from += 1;
-	  n_left_from -= 1;
-	  to_next += 1;
-	  n_left_to_next -= 1;
+      from += 1;
+      n_left_from -= 1;
       
-	  p0 = vlib_get_buffer (vm, bi0);
+      p0 = vlib_get_buffer (vm, bi0);
 
-	  if (is_ip6)
-	    {
-	      ip60 = vlib_buffer_get_current (p0);
-	      tcp0 = ip6_next_header (ip60);
-	      ASSERT (ip60->protocol == IP_PROTOCOL_TCP);
-	      n_advance_bytes0 = tcp_header_bytes (tcp0);
-	      n_data_bytes0 = clib_net_to_host_u16 (ip60->payload_length) - n_advance_bytes0;
-	      n_advance_bytes0 += sizeof (ip60[0]);
-	    }
-	  else
-	    {
-	      ip40 = vlib_buffer_get_current (p0);
-	      tcp0 = ip4_next_header (ip40);
-	      n_advance_bytes0 = (ip4_header_bytes (ip40)
-				  + tcp_header_bytes (tcp0));
-	      n_data_bytes0 = clib_net_to_host_u16 (ip40->length) - n_advance_bytes0;
-	    }
+      if (is_ip6)
+	{
+	  ip60 = vlib_buffer_get_current (p0);
+	  tcp0 = ip6_next_header (ip60);
+	  ASSERT (ip60->protocol == IP_PROTOCOL_TCP);
+	  n_advance_bytes0 = tcp_header_bytes (tcp0);
+	  n_data_bytes0 = clib_net_to_host_u16 (ip60->payload_length) - n_advance_bytes0;
+	  n_advance_bytes0 += sizeof (ip60[0]);
+	}
+      else
+	{
+	  ip40 = vlib_buffer_get_current (p0);
+	  tcp0 = ip4_next_header (ip40);
+	  n_advance_bytes0 = (ip4_header_bytes (ip40)
+			      + tcp_header_bytes (tcp0));
+	  n_data_bytes0 = clib_net_to_host_u16 (ip40->length) - n_advance_bytes0;
+	}
 
-	  iest0 = vnet_buffer (p0)->ip.tcp.established_connection_index;
-	  est0 = vec_elt_at_index (tm46->established_connections, iest0);
+      iest0 = vnet_buffer (p0)->ip.tcp.established_connection_index;
+      est0 = vec_elt_at_index (tm46->established_connections, iest0);
+      ch0 = tcp_connection_handle_set (iest0, is_ip6);
 
-	  error0 = TCP_ERROR_NO_DATA;
-	  next0 = TCP_ESTABLISHED_NEXT_DROP;
+      error0 = TCP_ERROR_NO_DATA;
+      next0 = TCP_ESTABLISHED_NEXT_DROP;
 
-	  if (PREDICT_FALSE (clib_net_to_host_u32 (tcp0->seq_number)
-			     != est0->sequence_numbers.his))
-	    goto unexpected_seq_number0;
-	  if (PREDICT_FALSE (clib_net_to_host_u32 (tcp0->ack_number) - est0->sequence_numbers.ours
-			     > est0->n_tx_unacked_bytes))
-	    goto unexpected_ack_number0;
+      /* Positive when segment starts beyond next expected byte;
+	 negative when it starts with data we already have. */
+      seq0 = clib_net_to_host_u32 (tcp0->seq_number);
+      seq_offset0 = seq0 - est0->sequence_numbers.his;
 
-	  is_fin0 = (tcp0->flags & TCP_FLAG_FIN) != 0;
+      if (PREDICT_FALSE (seq_offset0 > 0
+			 && (n_data_bytes0 == 0
+			     || seq_offset0 + n_data_bytes0 > TCP_RX_WINDOW_BYTES)))
+	goto unexpected_seq_number0;
+      if (PREDICT_FALSE (seq_offset0 < 0 && -seq_offset0 > TCP_RX_WINDOW_BYTES))
+	goto unexpected_seq_number0;
+      if (PREDICT_FALSE (clib_net_to_host_u32 (tcp0->ack_number) - est0->sequence_numbers.ours
+			 > est0->tx_max_sequence_number - est0->sequence_numbers.ours))
+	goto unexpected_ack_number0;
 
-	  if (PREDICT_FALSE ((est0->flags & TCP_CONNECTION_FLAG_fin_received)
-			     && (is_fin0 || n_data_bytes0 > 0)))
-	    goto already_received_fin0;
+      /* FIN is only processed in order; retransmitted FINs are just ACKed. */
+      is_fin0 = ((tcp0->flags & TCP_FLAG_FIN) != 0
+		 && seq_offset0 <= 0
+		 && (i32) (seq_offset0 + n_data_bytes0) >= 0);
 
-	  /* Update window. */
-	  est0->his_window = clib_net_to_host_u16 (tcp0->window);
+      n_skip0 = seq_offset0 < 0 ? clib_min (-seq_offset0, n_data_bytes0) : 0;
 
-	  /* Update his sequence number to account for data he's just sent. */
-	  est0->sequence_numbers.his += n_data_bytes0 + is_fin0;
+      if (PREDICT_FALSE ((est0->flags & TCP_CONNECTION_FLAG_fin_received)
+			 && (is_fin0 || n_data_bytes0 > n_skip0)))
+	goto already_received_fin0;
 
-	  his_ack_host0 = clib_net_to_host_u32 (tcp0->ack_number);
-	  n_ack0 = his_ack_host0 - est0->sequence_numbers.ours;
-	  tcp_ack (tm, est0, n_ack0);
-	  est0->sequence_numbers.ours = his_ack_host0;
+      his_ack_host0 = clib_net_to_host_u32 (tcp0->ack_number);
+      n_ack0 = his_ack_host0 - est0->sequence_numbers.ours;
+
+      /* Same ACK and window again without data while we have data outstanding. */
+      is_dup_ack0 = (n_ack0 == 0 && n_data_bytes0 == 0 && ! is_fin0
+		     && est0->n_tx_unacked_bytes > 0
+		     && clib_net_to_host_u16 (tcp0->window) == est0->his_window);
+
+      /* Update window. */
+      est0->his_window = clib_net_to_host_u16 (tcp0->window);
+
+      {
+	u32 t = tcp_options_decode_for_ack (tm, tcp0, &est0->time_stamps.his_net_byte_order);
 
+	/* Echo of zero: peer does not send time stamps.  Sample is taken
+	   from segment timed by output node once it is acknowledged. */
+	if (t == 0)
 	  {
-	    u32 t = tcp_options_decode_for_ack (tm, tcp0, &est0->time_stamps.his_net_byte_order);
-	    if (t != est0->time_stamps.ours_host_byte_order)
+	    if ((est0->flags & TCP_CONNECTION_FLAG_rtt_timing)
+		&& (i32) (his_ack_host0 - est0->rtt_sequence_number) >= 0)
 	      {
-		f64 dt = (timestamp_now - t) * tm->secs_per_tick[TCP_TIMER_timestamp];
+		f64 dt = (timestamp_now - est0->rtt_time_sent) * tm->secs_per_tick[TCP_TIMER_timestamp];
 		est0->round_trip_time_stats.sum += dt;
 		est0->round_trip_time_stats.sum2 += dt*dt;
 		est0->round_trip_time_stats.count += 1;
-		est0->time_stamps.ours_host_byte_order = t;
-
-		{
-		  ELOG_TYPE_DECLARE (e) = {
-		    .format = "ack rtt: %.4e",
-		    .format_args = "f8",
-		  };
-		  struct { f64 dt; } * ed;
-		  ed = ELOG_DATA (&vm->elog_main, e);
-		  ed->dt = dt;
-		}
+		est0->flags &= ~TCP_CONNECTION_FLAG_rtt_timing;
+		tcp_round_trip_time_update (tm, est0, dt);
 	      }
 	  }
-	  
-	  send_ack0 = ((est0->flags & TCP_CONNECTION_FLAG_ack_pending) == 0
-		       && (n_data_bytes0 > 0 || is_fin0));
-	  vec_add1 (tm46->connections_pending_acks, vnet_buffer (p0)->ip.tcp.established_connection_index);
-	  _vec_len (tm46->connections_pending_acks) -= ! send_ack0;
-	  est0->flags |= send_ack0 << LOG2_TCP_CONNECTION_FLAG_ack_pending;
-
-	  est0->flags |= is_fin0 << LOG2_TCP_CONNECTION_FLAG_fin_received;
-
-	  l0 = pool_elt_at_index (tm->listener_pool, vnet_buffer (p0)->ip.tcp.listener_index);
-
+	else if (t != est0->time_stamps.ours_host_byte_order)
 	  {
-	    u32 ch0 = tcp_connection_handle_set (iest0, is_ip6);
+	    f64 dt = (timestamp_now - t) * tm->secs_per_tick[TCP_TIMER_timestamp];
+	    est0->round_trip_time_stats.sum += dt;
+	    est0->round_trip_time_stats.sum2 += dt*dt;
+	    est0->round_trip_time_stats.count += 1;
+	    est0->time_stamps.ours_host_byte_order = t;
 
-	    vec_add1 (l0->eof_connections[is_ip6], ch0);
-	    _vec_len (l0->eof_connections[is_ip6]) -= ! is_fin0;
+	    /* Only ACKs of new data give valid samples (RFC 7323 4.1). */
+	    if (n_ack0 > 0)
+	      tcp_round_trip_time_update (tm, est0, dt);
 
-	    vec_add1 (l0->close_connections[is_ip6], ch0);
-	    _vec_len (l0->close_connections[is_ip6]) -= !(est0->flags & TCP_CONNECTION_FLAG_fin_sent);
+	    {
+	      ELOG_TYPE_DECLARE (e) = {
+		.format = "ack rtt: %.4e",
+		.format_args = "f8",
+	      };
+	      struct { f64 dt; } * ed;
+	      ed = ELOG_DATA (&vm->elog_main, e);
+	      ed->dt = dt;
+	    }
 	  }
+      }
 
-	  next0 = n_data_bytes0 > 0 ? l0->next_index : next0;
+      tcp_ack (vm, tm, est0, ch0, n_ack0, time_now);
+      if (is_dup_ack0)
+	tcp_dup_ack (tm, est0, ch0);
+      est0->sequence_numbers.ours = his_ack_host0;
 
-	  vlib_buffer_advance (p0, n_advance_bytes0);
+      l0 = pool_elt_at_index (tm->listener_pool, vnet_buffer (p0)->ip.tcp.listener_index);
 
-	enqueue0:
-	  p0->error = error_node->errors[error0];
-	  if (PREDICT_FALSE (next0 != next))
-	    {
-	      to_next -= 1;
-	      n_left_to_next += 1;
+      vlib_buffer_advance (p0, n_advance_bytes0);
+      vnet_buffer (p0)->ip.tcp.connection_handle = ch0;
 
-	      vlib_put_next_frame (vm, node, next, n_left_to_next);
+      if (PREDICT_FALSE (seq_offset0 > 0))
+	{
+	  /* Hold until gap before it is filled. */
+	  tcp_rx_out_of_order_insert (vm, est0, bi0, seq0, n_data_bytes0);
+	  tcp_rx_window_update (est0);
+	  n_out_of_order += 1;
 
-	      next = next0;
-	      vlib_get_next_frame (vm, node, next, to_next, n_left_to_next);
-	      to_next[0] = bi0;
-	      to_next += 1;
-	      n_left_to_next -= 1;
-	    }
+	  /* Duplicate ACK tells sender about gap (RFC 5681 4.2). */
+	  tcp_ack_schedule (tm, est0, ch0, /* ack_now */ 1);
 	  continue;
+	}
 
-	unexpected_seq_number0:
-	  next0 = TCP_ESTABLISHED_NEXT_DROP;
-	  error0 = TCP_ERROR_UNEXPECTED_SEQ_NUMBER;
-	  goto enqueue0;
+      if (n_data_bytes0 > n_skip0)
+	{
+	  u32 bi, seq_his0;
+	  uword fills_gap0;
 
-	unexpected_ack_number0:
-	  next0 = TCP_ESTABLISHED_NEXT_DROP;
-	  error0 = TCP_ERROR_UNEXPECTED_ACK_NUMBER;
-	  goto enqueue0;
+	  tcp_rx_buffer_trim (vm, bi0, n_skip0, n_data_bytes0 - n_skip0);
+	  est0->sequence_numbers.his += n_data_bytes0 - n_skip0;
+	  seq_his0 = est0->sequence_numbers.his;
+	  fills_gap0 = est0->n_rx_out_of_order_bytes > 0;
 
-	already_received_fin0:
-	  next0 = TCP_ESTABLISHED_NEXT_DROP;
-	  error0 = TCP_ERROR_SEGMENT_AFTER_FIN;
-	  goto enqueue0;
+	  tcp_established_enqueue (vm, node, &next, &to_next, &n_left_to_next,
+				   bi0, l0->next_index);
+
+	  /* Deliver held data this segment made contiguous. */
+	  while ((bi = tcp_rx_out_of_order_next (vm, est0)) != ~0)
+	    {
+	      vnet_buffer (vlib_get_buffer (vm, bi))->ip.tcp.connection_handle = ch0;
+	      tcp_established_enqueue (vm, node, &next, &to_next, &n_left_to_next,
+				       bi, l0->next_index);
+	    }
+	  tcp_rx_window_update (est0);
+
+	  /* Segments filling a gap and FINs are ACKed immediately;
+	     others may wait for delayed ACK timer. */
+	  est0->n_rx_unacked_bytes += (n_data_bytes0 - n_skip0
+				       + est0->sequence_numbers.his - seq_his0);
+	  tcp_ack_schedule (tm, est0, ch0, fills_gap0 || is_fin0);
+	  n_acks_delayed += (est0->flags & TCP_CONNECTION_FLAG_ack_pending) == 0;
 	}
-  
-      vlib_put_next_frame (vm, node, next, n_left_to_next);
+      else
+	{
+	  error0 = n_data_bytes0 > 0 ? TCP_ERROR_DUPLICATE_SEGMENTS : error0;
+	  p0->error = error_node->errors[error0];
+	  tcp_established_enqueue (vm, node, &next, &to_next, &n_left_to_next,
+				   bi0, next0);
+
+	  /* Duplicate data and (retransmitted) FINs get an immediate ACK. */
+	  if (n_data_bytes0 > 0 || (tcp0->flags & TCP_FLAG_FIN))
+	    tcp_ack_schedule (tm, est0, ch0, /* ack_now */ 1);
+	}
+
+      est0->sequence_numbers.his += is_fin0;
+      est0->flags |= is_fin0 << LOG2_TCP_CONNECTION_FLAG_fin_received;
+
+      vec_add1 (l0->eof_connections[is_ip6], ch0);
+      _vec_len (l0->eof_connections[is_ip6]) -= ! is_fin0;
+
+      vec_add1 (l0->close_connections[is_ip6], ch0);
+      _vec_len (l0->close_connections[is_ip6]) -= !(est0->flags & TCP_CONNECTION_FLAG_fin_sent);
+      continue;
+
+    drop0:
+      p0->error = error_node->errors[error0];
+      tcp_established_enqueue (vm, node, &next, &to_next, &n_left_to_next,
+			       bi0, TCP_ESTABLISHED_NEXT_DROP);
+      continue;
+
+    unexpected_seq_number0:
+      error0 = TCP_ERROR_UNEXPECTED_SEQ_NUMBER;
+      goto drop0;
+
+    unexpected_ack_number0:
+      error0 = TCP_ERROR_UNEXPECTED_ACK_NUMBER;
+      goto drop0;
+
+    already_received_fin0:
+      error0 = TCP_ERROR_SEGMENT_AFTER_FIN;
+      goto drop0;
     }
+  
+  vlib_put_next_frame (vm, node, next, n_left_to_next);
+
+  vlib_error_count (vm, error_node->node_index, TCP_ERROR_OUT_OF_ORDER_SEGMENTS, n_out_of_order);
+  vlib_error_count (vm, error_node->node_index, TCP_ERROR_ACKS_DELAYED, n_acks_delayed);
 
   if (node->flags & VLIB_NODE_FLAG_TRACE)
     /* FIXME */ ;
@@ -2535,9 +4396,17 @@ tcp_register_listener (vlib_main_t * vm,
 
   l->dst_port = r->port;
   l->next_index = vlib_node_add_next (vm, ip4_tcp_established_node.index, r->data_node_index);
+
+  /* ip4 and ip6 established nodes share listener's next index. */
+  if (vlib_node_add_next (vm, ip6_tcp_established_node.index, r->data_node_index)
+      != l->next_index)
+    clib_error ("ip4/ip6 tcp established next index mismatch");
   l->valid_local_adjacency_bitmap = 0;
   l->flags = r->flags & (TCP_LISTENER_IP4 | TCP_LISTENER_IP6);
 
+  ASSERT (r->congestion_control < TCP_N_CONGESTION_CONTROL);
+  l->congestion_control = r->congestion_control;
+
   tm->listener_index_by_dst_port[clib_host_to_net_u16 (l->dst_port)] = l - tm->listener_pool;
 
   return l - tm->listener_pool;
@@ -2614,14 +4483,71 @@ tcp_udp_lookup_init (vlib_main_t * vm)
   tcp_lookup_init (vm, tm);
   tcp_options_decode_init (tm);
 
+  {
+    u32 * r = clib_random_buffer_get_data (&vm->random_buffer, sizeof (tm->syn_cookie_secrets));
+    memcpy (tm->syn_cookie_secrets, r, sizeof (tm->syn_cookie_secrets));
+    tm->syn_cookie_eviction_threshold = TCP_DEFAULT_SYN_COOKIE_EVICTION_THRESHOLD;
+  }
+
   tm->tx_buffer_free_list = VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX;
   tm->tx_buffer_free_list_n_buffer_bytes = VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES;
 
+  vnet_timer_wheel_init (&tm->retransmit_timer_wheel, TCP_RETRANSMIT_TICK_INTERVAL,
+			 vlib_time_now (vm));
+  vnet_timer_wheel_init (&tm->delayed_ack_timer_wheel, TCP_RETRANSMIT_TICK_INTERVAL,
+			 vlib_time_now (vm));
+  tm->delayed_ack_timeout = TCP_DEFAULT_DELAYED_ACK_TIMEOUT;
+  tm->gso_max_data_bytes = TCP_DEFAULT_GSO_MAX_DATA_BYTES;
+
   return 0;
 }
 
 VLIB_INIT_FUNCTION (tcp_udp_lookup_init);
 
+static clib_error_t *
+tcp_config (vlib_main_t * vm, unformat_input_t * input)
+{
+  tcp_main_t * tm = &tcp_main;
+  u32 n_established = TCP_DEFAULT_ESTABLISHED_CONNECTIONS;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "established-connections %d", &n_established))
+	;
+      else if (unformat (input, "syn-cookie-threshold %d", &tm->syn_cookie_eviction_threshold))
+	;
+      else if (unformat (input, "syn-cookies-always"))
+	tm->syn_cookie_eviction_threshold = 0;
+      else if (unformat (input, "delayed-ack-timeout %f", &tm->delayed_ack_timeout))
+	;
+      else if (unformat (input, "no-delayed-ack"))
+	tm->delayed_ack_timeout = 0;
+      else if (unformat (input, "gso-max-bytes %d", &tm->gso_max_data_bytes))
+	;
+      else if (unformat (input, "no-gso"))
+	tm->gso_max_data_bytes = 0;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (tm->delayed_ack_timeout < 0 || tm->delayed_ack_timeout > .5)
+    return clib_error_return (0, "delayed ack timeout must be 0 to .5 seconds");
+
+  /* Super segment must fit in 16 bit ip length. */
+  if (tm->gso_max_data_bytes > 0xffff - tcp_tx_header_reserve_bytes (TCP_IP6))
+    return clib_error_return (0, "gso max bytes must be at most %d",
+			      0xffff - tcp_tx_header_reserve_bytes (TCP_IP6));
+
+  /* Config runs before any connection can be established. */
+  tcp_established_hash_init (tm, TCP_IP4, n_established);
+  tcp_established_hash_init (tm, TCP_IP6, n_established);
+
+  return 0;
+}
+
+VLIB_CONFIG_FUNCTION (tcp_config, "tcp");
+
 static u8 * format_tcp_time_stamp (u8 * s, va_list * va)
 {
   tcp_timer_type_t type = va_arg (*va, tcp_timer_type_t);
@@ -2740,6 +4666,17 @@ static u8 * format_tcp_established_connection (u8 * s, va_list * va)
 		  r[0], r[1]);
     }
 
+  s = format (s, ", rto %.3f", c->retransmit_timeout);
+
+  s = format (s, ", %s cwnd %d", tcp_congestion_controls[c->congestion.type].name,
+	      c->congestion.window);
+  if (c->congestion.slow_start_threshold != ~0)
+    s = format (s, " ssthresh %d", c->congestion.slow_start_threshold);
+  if (c->congestion.in_fast_recovery)
+    s = format (s, " recovering");
+  if (c->n_retransmits > 0)
+    s = format (s, ", %d retransmits", c->n_retransmits);
+
   return s;
 }
 
@@ -2751,11 +4688,11 @@ static u8 * format_ip4_tcp_established_connection (u8 * s, va_list * va)
   tcp_connection_t * est;
   ip4_tcp_udp_address_x4_t * esta;
   
-  iest_div = iest / 4;
-  iest_mod = iest % 4;
+  est = pool_elt_at_index (tm->ip4.established_connections, iest);
+  iest_div = est->address_hash_index / 4;
+  iest_mod = est->address_hash_index % 4;
 
-  esta = vec_elt_at_index (tm->ip4_established_connection_address_hash, iest_div);
-  est = vec_elt_at_index (tm->ip4.established_connections, iest);
+  esta = &ip4_tcp_established_bucket (tm, iest_div)->address_x4;
 
   s = format (s, "%U%U",
 	      format_ip4_tcp_udp_address_x4, esta, iest_mod,
@@ -2772,11 +4709,11 @@ static u8 * format_ip6_tcp_established_connection (u8 * s, va_list * va)
   tcp_connection_t * est;
   ip6_tcp_udp_address_x4_t * esta;
   
-  iest_div = iest / 4;
-  iest_mod = iest % 4;
+  est = pool_elt_at_index (tm->ip6.established_connections, iest);
+  iest_div = est->address_hash_index / 4;
+  iest_mod = est->address_hash_index % 4;
 
-  esta = vec_elt_at_index (tm->ip6_established_connection_address_hash, iest_div);
-  est = vec_elt_at_index (tm->ip6.established_connections, iest);
+  esta = &ip6_tcp_established_bucket (tm, iest_div)->address_x4;
 
   s = format (s, "%U%U",
 	      format_ip6_tcp_udp_address_x4, esta, iest_mod,
@@ -2838,6 +4775,9 @@ show_mini_connections (vlib_main_t * vm, unformat_input_t * input, vlib_cli_comm
   if (n_valid == 0)
     vlib_cli_output (vm, "no %U mini tcp connections", format_tcp_ip_4_or_6, is_ip6);
 
+  if (tcp_syn_cookies_enabled (tm, tm46, vlib_time_now (vm)))
+    vlib_cli_output (vm, "syn cookies enabled");
+
   return error;
 }
 
@@ -2854,10 +4794,9 @@ show_established_connections (vlib_main_t * vm, unformat_input_t * input, vlib_c
   ip46_tcp_main_t * tm46;
   tcp_ip_4_or_6_t is_ip6 = TCP_IP4;
   tcp_connection_t * est;
-  ip6_tcp_udp_address_x4_t * esta6;
-  ip4_tcp_udp_address_x4_t * esta4;
+  tcp_established_hash_t * h;
   clib_error_t * error = 0;
-  uword i, i0, i1, n_valid;
+  uword n_valid;
 
   if (unformat (input, "4"))
     is_ip6 = TCP_IP4;
@@ -2866,31 +4805,17 @@ show_established_connections (vlib_main_t * vm, unformat_input_t * input, vlib_c
 
   n_valid = 0;
   tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
-  for (i = 0; i < vec_len (tm46->established_connections); i++)
-    {
-      i0 = i / 4;
-      i1 = i % 4;
-
-      est = vec_elt_at_index (tm46->established_connections, i);
-      if (is_ip6)
-	{
-	  esta6 = vec_elt_at_index (tm->ip6_established_connection_address_hash, i0);
-	  if (ip6_tcp_udp_address_x4_is_valid (esta6, i1))
-	    {
-	      vlib_cli_output (vm, "%U", format_ip6_tcp_established_connection, i);
-	      n_valid += 1;
-	    }
-	}
-      else
-	{
-	  esta4 = vec_elt_at_index (tm->ip4_established_connection_address_hash, i0);
-	  if (ip4_tcp_udp_address_x4_is_valid (esta4, i1))
-	    {
-	      vlib_cli_output (vm, "%U", format_ip4_tcp_established_connection, i);
-	      n_valid += 1;
-	    }
-	}
-    }
+  pool_foreach (est, tm46->established_connections, ({
+    vlib_cli_output (vm, "%U",
+		     is_ip6 ? format_ip6_tcp_established_connection : format_ip4_tcp_established_connection,
+		     est - tm46->established_connections);
+    n_valid += 1;
+  }));
+
+  h = &tm46->established_hash;
+  vlib_cli_output (vm, "%d connections in %d buckets (%d split), %.1f%% full",
+		   h->n_elts, tcp_established_hash_n_buckets (h), h->split_bucket_index,
+		   100. * h->n_elts / (4 * tcp_established_hash_n_buckets (h)));
 
   if (n_valid == 0)
     vlib_cli_output (vm, "no %U established tcp connections", format_tcp_ip_4_or_6, is_ip6);
@@ -2904,91 +4829,100 @@ static VLIB_CLI_COMMAND (vlib_cli_show_tcp_established_connections_command) = {
   .function = show_established_connections,
 };
 
-#if 0
 uword
 tcp_write (vlib_main_t * vm, u32 connection_handle, void * data, uword n_data_bytes)
 {
   tcp_main_t * tm = &tcp_main;
   tcp_ip_4_or_6_t is_ip6 = tcp_connection_is_ip6 (connection_handle);
   ip46_tcp_main_t * tm46 = is_ip6 ? &tm->ip6 : &tm->ip4;
-  tcp_connection_t * c = vec_elt_at_index (tm46->established_connections, connection_handle / 2);
+  u32 iest = connection_handle / 2;
+  tcp_connection_t * c = vec_elt_at_index (tm46->established_connections, iest);
+  tcp_tx_packet_t * p = &c->write_tail_packet;
   vlib_buffer_t * b;
-  u32 bi, bi_next, bi_start_of_packet;
+  u32 bi, n_bytes_left_buffer, n_data_left, n_reserve_bytes;
   ip_csum_t sum;
+  u8 * d = data;
+
+  /* No more data after application close. */
+  if (c->flags & (TCP_CONNECTION_FLAG_application_requested_close
+		  | TCP_CONNECTION_FLAG_fin_sent))
+    return 0;
+
+  n_reserve_bytes = tcp_tx_header_reserve_bytes (is_ip6);
 
   b = 0;
-  bi = c->write_tail_buffer_index;
-  n_bytes_left_tail = 0;
-  if (bi != 0)
+  n_bytes_left_buffer = 0;
+  if (p->n_data_bytes > 0)
     {
-      b = vlib_get_buffer (vm, bi);
-      n_bytes_left_tail = tm->tx_buffer_free_list_n_buffer_bytes - b->current_length;
+      b = vlib_get_buffer (vm, c->write_tail_buffer_index);
+      n_bytes_left_buffer = (tm->tx_buffer_free_list_n_buffer_bytes
+			     - (b->current_data + b->current_length));
     }
 
-  n_bytes_this_packet = c->write_tail_packet.n_data_bytes;
-  n_bytes_left_packet = c->max_segment_size - n_bytes_this_packet;
-
+  sum = p->data_ip_checksum;
   n_data_left = n_data_bytes;
-  sum = c->write_tail_packet.data_ip_checksum;
 
   while (n_data_left > 0)
     {
       u32 n_copy;
 
-      if (n_bytes_left_tail == 0)
+      if (p->n_data_bytes == 0)
 	{
-	  if (! vlib_buffer_alloc_from_free_list (vm, &bi_next, 1,
-						  tm->tx_buffer_free_list))
-	    return n_data_bytes - n_data_left;
-
-	  bi_start_of_packet = bi_next;
-	  if (b)
-	    {
-	      b->flags |= VLIB_BUFFER_NEXT_PRESENT;
-	      b->next_buffer = bi_next;
-	      bi_start_of_packet = b->opaque[0];
-	    }
-	  bi = bi_next;
+	  /* Start new packet leaving room for headers. */
+	  if (! vlib_buffer_alloc_from_free_list (vm, &bi, 1, tm->tx_buffer_free_list))
+	    break;
 	  b = vlib_get_buffer (vm, bi);
+	  b->current_data = n_reserve_bytes;
+	  b->current_length = 0;
+	  b->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+
+	  p->first_buffer_index_this_packet = bi;
+	  c->write_tail_buffer_index = bi;
+	  n_bytes_left_buffer = tm->tx_buffer_free_list_n_buffer_bytes - n_reserve_bytes;
+	  sum = 0;
+	}
+      else if (n_bytes_left_buffer == 0)
+	{
+	  /* Chain another buffer onto packet. */
+	  if (! vlib_buffer_alloc_from_free_list (vm, &bi, 1, tm->tx_buffer_free_list))
+	    break;
+	  b->flags |= VLIB_BUFFER_NEXT_PRESENT;
+	  b->next_buffer = bi;
 
-	  /* Save away start of packet buffer in opaque. */
-	  b->opaque[0] = bi_start_of_packet;
+	  b = vlib_get_buffer (vm, bi);
+	  b->current_data = 0;
+	  b->current_length = 0;
+	  b->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
 
-	  c->tail_buffer.buffer_index = bi;
-	  n_bytes_left_tail = tm->tx_buffer_free_list_n_buffer_bytes;
+	  c->write_tail_buffer_index = bi;
+	  n_bytes_left_buffer = tm->tx_buffer_free_list_n_buffer_bytes;
 	}
 
       n_copy = n_data_left;
-      n_copy = clib_min (n_copy, n_bytes_left_tail);
-      n_copy = clib_min (n_copy, n_bytes_left_packet);
+      n_copy = clib_min (n_copy, n_bytes_left_buffer);
+      n_copy = clib_min (n_copy, c->max_segment_size - p->n_data_bytes);
 
-      sum = ip_csum_and_memcpy (sum, b->data + b->current_length,
-				data, n_copy);
+      sum = ip_csum_and_memcpy (sum, vlib_buffer_get_current (b) + b->current_length,
+				d, n_copy);
 
       b->current_length += n_copy;
-      n_bytes_left_tail -= n_copy;
-      n_bytes_left_packet -= n_copy;
-      n_data_left -=- n_copy;
-      n_bytes_this_packet += n_copy;
-
-      if (n_bytes_left_packet == 0)
-	{
-	  bi_start_of_packet = b->opaque[0];
-
-	  if (c->tail_packet.buffer_index != 0)
-	    {
-	      vlib_buffer_t * p = vlib_get_buffer (vm, c->tail_packet.buffer_index);
-	      tcp_buffer_t * next = vlib_get_buffer_opaque (p);
-	      next[0] = c->;
-	    }
-	  c->tail_packet.buffer_index = bi_start_of_packet;
-	}
+      n_bytes_left_buffer -= n_copy;
+      n_data_left -= n_copy;
+      d += n_copy;
+      p->n_data_bytes += n_copy;
+      p->data_ip_checksum = ip_csum_fold (sum);
+
+      /* Full sized segment: queue it for transmit. */
+      if (p->n_data_bytes >= c->max_segment_size)
+	tcp_tx_packet_close_write_tail (vm, c);
     }
 
-  c->tail_buffer.buffer_index = bi;
-  c->tail_buffer.n_data_bytes = n_bytes_this_packet;
-  c->tail_buffer.data_ip_checksum = ip_csum_fold (sum);
+  if (n_data_left < n_data_bytes
+      && ! (c->flags & TCP_CONNECTION_FLAG_data_pending))
+    {
+      c->flags |= TCP_CONNECTION_FLAG_data_pending;
+      vec_add1 (tm46->connections_pending_data, iest);
+    }
 
-  return 0;
+  return n_data_bytes - n_data_left;
 }
-#endif
@@ -27,6 +27,7 @@
 #define included_tcp_protocol_h
 
 #include <clib/vector.h>
+#include <vnet/timer_wheel.h>
 
 /* No support for e.g. Altivec. */
 #if defined (__SSE2__)
@@ -86,6 +87,34 @@ typedef struct {
   u32 time_stamps[4];
 } ip6_tcp_udp_address_x4_and_timestamps_t;
 
+/* Bucket of established connection hash. */
+typedef struct {
+  ip4_tcp_udp_address_x4_t address_x4;
+  u32 connection_index[4];
+} ip4_tcp_udp_address_x4_and_connection_index_t;
+
+typedef struct {
+  ip6_tcp_udp_address_x4_t address_x4;
+  u32 connection_index[4];
+} ip6_tcp_udp_address_x4_and_connection_index_t;
+
+/* Established connections are found by bucketized cuckoo hash: each
+   connection may live in either of 2 buckets of 4 entries given by 2
+   independent hashes.  Table grows online one bucket at a time (linear
+   hashing) so there is never a full rehash.  Buckets are allocated in pages
+   which never move. */
+#define TCP_ESTABLISHED_HASH_LOG2_BUCKETS_PER_PAGE 10
+
+typedef struct {
+  /* Power of 2 number of buckets at current level.  Buckets below split
+     index have been split: they are addressed with twice the mask. */
+  u32 n_base_buckets;
+  u32 split_bucket_index;
+
+  /* Number of connections in table. */
+  u32 n_elts;
+} tcp_established_hash_t;
+
 #define foreach_tcp_connection_state					\
   /* unused */								\
   _ (unused)								\
@@ -125,30 +154,126 @@ typedef struct {
 
   /* Number of measurements. */
   f64 count;
+
+  /* RFC 6298 smoothed round trip time and its variation in seconds. */
+  f32 smoothed, variation;
 } tcp_round_trip_time_stats_t;
 
+/* Segment of data queued for transmit: chain of buffers starting with
+   first_buffer_index_this_packet.  No packet when n_data_bytes is zero. */
 typedef struct {
   u32 first_buffer_index_this_packet;
 
+  /* Checksum of data bytes (not complemented). */
   u16 data_ip_checksum;
 
   u16 n_data_bytes;
 } tcp_tx_packet_t;
 
+#define foreach_tcp_congestion_control	\
+  _ (newreno)					\
+  _ (cubic)
+
+typedef enum {
+#define _(f) TCP_CONGESTION_CONTROL_##f,
+  foreach_tcp_congestion_control
+#undef _
+  TCP_N_CONGESTION_CONTROL,
+} tcp_congestion_control_type_t;
+
+/* Per connection congestion control state (RFC 5681 and RFC 6582). */
+typedef struct {
+  /* Congestion window and slow start threshold in bytes. */
+  u32 window, slow_start_threshold;
+
+  /* Our next sequence number when fast recovery started. */
+  u32 recover;
+
+  /* Bytes acknowledged towards next window increase in
+     congestion avoidance (RFC 3465). */
+  u32 n_bytes_acked;
+
+  /* CUBIC: window in segments before last reduction, time in seconds
+     to grow back to it and start of current epoch (0 when none). */
+  f32 cubic_window_max, cubic_k;
+  f64 cubic_epoch_start;
+
+  /* Consecutive duplicate ACKs received. */
+  u8 n_dup_acks;
+
+  u8 in_fast_recovery;
+
+  /* tcp_congestion_control_type_t. */
+  u8 type;
+} tcp_congestion_control_state_t;
+
+/* Received data beyond next expected sequence number.  Adjacent
+   segments are chained into a single interval without copying. */
+typedef struct {
+  /* Sequence number of first byte and number of bytes. */
+  u32 sequence_number;
+  u32 n_bytes;
+
+  /* First and last buffer of chain holding data. */
+  u32 first_buffer_index, last_buffer_index;
+} tcp_rx_segment_t;
+
 typedef struct {
   tcp_sequence_pair_t sequence_numbers;
 
   tcp_time_stamp_pair_t time_stamps;
 
-  tcp_tx_packet_t head_packet, tx_tail_packet, write_tail_packet;
+  /* Queue of full segments: head is oldest not yet acknowledged,
+     tx_next is next to send and tx_tail is last.
+     Each packet's first buffer opaque links to next packet. */
+  tcp_tx_packet_t head_packet, tx_next_packet, tx_tail_packet;
+
+  /* Segment being filled by tcp_write and its last buffer. */
+  tcp_tx_packet_t write_tail_packet;
 
   u32 write_tail_buffer_index;
 
+  /* Handle of retransmit timer in tcp main's timer wheel or ~0.
+     With no data in flight but data blocked by peer's window it is
+     the persist timer. */
+  u32 retransmit_timer_handle;
+
+  /* Handle of delayed ACK timer in tcp main's timer wheel or ~0. */
+  u32 delayed_ack_timer_handle;
+
+  /* 4 * bucket + entry of connection's addresses in established hash.
+     Updated when cuckoo insert or table growth moves entry. */
+  u32 address_hash_index;
+
   tcp_round_trip_time_stats_t round_trip_time_stats;
 
+  tcp_congestion_control_state_t congestion;
+
+  /* Vector of out of order received intervals sorted by sequence number. */
+  tcp_rx_segment_t * rx_out_of_order_segments;
+
+  /* Number of bytes held in out of order intervals. */
+  u32 n_rx_out_of_order_bytes;
+
+  /* In order bytes received since we last sent an ACK. */
+  u32 n_rx_unacked_bytes;
+
+  /* Current retransmit timeout in seconds including backoff. */
+  f32 retransmit_timeout;
+
   /* Number of un-acknowledged bytes we've sent. */
   u32 n_tx_unacked_bytes;
 
+  /* Sequence number following highest one sent (SND.MAX).  Ahead of
+     ours + n_tx_unacked_bytes while data is resent after a retransmit
+     timeout rewound transmit queue. */
+  u32 tx_max_sequence_number;
+
+  /* Segment timed for round trip measurement when peer does not echo
+     time stamps: sequence number following it and time stamp clock when
+     it was sent.  Valid with rtt_timing flag. */
+  u32 rtt_sequence_number, rtt_time_sent;
+
   /* segment size and window scale (saved from options
      or set to defaults). */
   u16 max_segment_size;
@@ -158,6 +283,21 @@ typedef struct {
 
   u16 my_window;
 
+  /* Bytes of head packet acknowledged by partial ACK. */
+  u16 n_head_packet_bytes_acked;
+
+  u16 flags;
+#define foreach_tcp_connection_flag		\
+  _ (ack_pending)				\
+  _ (fin_received)				\
+  _ (fin_sent)					\
+  _ (application_requested_close)		\
+  _ (data_pending)				\
+  _ (retransmit_pending)			\
+  /* Send next segment past peer's window. */	\
+  _ (window_probe)				\
+  _ (rtt_timing)
+
   u8 his_window_scale;
 
   u8 my_window_scale;
@@ -165,23 +305,42 @@ typedef struct {
   /* ip4/ip6 tos/ttl to use for packets we send. */
   u8 tos, ttl;
 
-  u16 flags;
-#define foreach_tcp_connection_flag		\
-  _ (ack_pending)				\
-  _ (fin_received)				\
-  _ (fin_sent)					\
-  _ (application_requested_close)
+  /* Retransmit timeouts since data was last acknowledged. */
+  u8 n_retransmits;
 
-  u8 listener_opaque[128
+  /* Fills connection to 3 cache lines.  Fields above are ordered so
+     there is no padding before it. */
+  u8 listener_opaque[192
 		     - 1 * sizeof (tcp_sequence_pair_t)
 		     - 1 * sizeof (tcp_time_stamp_pair_t)
-		     - 3 * sizeof (tcp_tx_packet_t)
+		     - 4 * sizeof (tcp_tx_packet_t)
 		     - 1 * sizeof (tcp_round_trip_time_stats_t)
-		     - 2 * sizeof (u32)
-		     - 4 * sizeof (u16)
-		     - 4 * sizeof (u8)];
+		     - 1 * sizeof (tcp_congestion_control_state_t)
+		     - 1 * sizeof (tcp_rx_segment_t *)
+		     - 1 * sizeof (f32)
+		     - 10 * sizeof (u32)
+		     - 5 * sizeof (u16)
+		     - 5 * sizeof (u8)];
 } tcp_connection_t;
 
+/* Fails to compile if listener_opaque size above does not match fields. */
+typedef char tcp_connection_size_check_t[sizeof (tcp_connection_t) == 192 ? 1 : -1];
+
+/* Congestion control algorithm.  Generic code handles duplicate ACKs,
+   fast retransmit/recovery and retransmit timeouts. */
+typedef struct {
+  char * name;
+
+  /* New data acknowledged outside of fast recovery: grow window. */
+  void (* ack) (tcp_connection_t * c, u32 n_bytes_acked, f64 now);
+
+  /* Loss detected by duplicate ACKs or retransmit timeout:
+     set slow start threshold. */
+  void (* loss) (tcp_connection_t * c);
+} tcp_congestion_control_t;
+
+extern tcp_congestion_control_t tcp_congestion_controls[TCP_N_CONGESTION_CONTROL];
+
 typedef enum {
   TCP_IP4,
   TCP_IP6,
@@ -220,21 +379,26 @@ typedef struct {
 
 typedef struct {
   u8 log2_n_mini_connection_hash_elts;
-  u8 log2_n_established_connection_hash_elts;
   u8 is_ip6;
 
   u32 mini_connection_hash_mask;
-  u32 established_connection_hash_mask;
 
-  uword * established_connection_overflow_hash;
+  tcp_established_hash_t established_hash;
 
   tcp_mini_connection_t * mini_connections;
 
+  /* Pool of established connections. */
   tcp_connection_t * established_connections;
 
   /* Vector of established connection indices which need ACKs sent. */
   u32 * connections_pending_acks;
 
+  /* Vector of established connection indices with data queued by tcp_write. */
+  u32 * connections_pending_data;
+
+  /* Vector of established connection indices whose retransmit timer expired. */
+  u32 * connections_pending_retransmit;
+
   /* Default valid_local_adjacency_bitmap for listeners who want to listen
      for a given port in on all interfaces. */
   uword * default_valid_local_adjacency_bitmap;
@@ -242,6 +406,14 @@ typedef struct {
   u32 output_node_index;
 
   tcp_packet_template_t packet_templates[TCP_N_PACKET_TEMPLATE];
+
+  /* Live mini connections overwritten by new SYNs in current interval. */
+  u32 n_mini_connection_evictions;
+  f64 mini_connection_eviction_interval_start;
+
+  /* SYN cookies replace mini connections until this time.  Cookie ACKs
+     are accepted for one cookie lifetime longer. */
+  f64 syn_cookies_until;
 } ip46_tcp_main_t;
 
 #define foreach_tcp_event					\
@@ -275,6 +447,9 @@ typedef struct {
 
   u16 next_index;
 
+  /* tcp_congestion_control_type_t for connections to this listener. */
+  u8 congestion_control;
+
   u32 flags;
 
   /* Connection indices for which event in event_function applies to. */
@@ -309,11 +484,12 @@ typedef struct {
   ip4_tcp_udp_address_x4_and_timestamps_t * ip4_mini_connection_address_hash;
   ip6_tcp_udp_address_x4_and_timestamps_t * ip6_mini_connection_address_hash;
 
-  /* Vector of size log2_n_established_connection_hash_elts plus overflow. */
-  ip4_tcp_udp_address_x4_t * ip4_established_connection_address_hash;
-  ip6_tcp_udp_address_x4_t * ip6_established_connection_address_hash;
+  /* Vector of pages of established connection hash buckets. */
+  ip4_tcp_udp_address_x4_and_connection_index_t ** ip4_established_connection_hash_pages;
+  ip6_tcp_udp_address_x4_and_connection_index_t ** ip6_established_connection_hash_pages;
 
-  /* Jenkins hash seeds for established and mini hash tables. */
+  /* Jenkins hash seeds for mini hash table (lane 0) and
+     2 established hashes (lanes 1 and 2). */
   u32x4_union_t connection_hash_seeds[2][3];
   u32x4_union_t connection_hash_masks[2];
 
@@ -338,6 +514,28 @@ typedef struct {
 
   u32 tx_buffer_free_list;
   u32 tx_buffer_free_list_n_buffer_bytes;
+
+  /* Evictions of live mini connections per second above which
+     listeners switch to SYN cookies; 0 means always use cookies. */
+  u32 syn_cookie_eviction_threshold;
+
+  /* Secrets for SYN cookie hashes. */
+  u32 syn_cookie_secrets[2][3];
+
+  /* Retransmit timers of established connections.
+     Timer user data is connection handle. */
+  vnet_timer_wheel_t retransmit_timer_wheel;
+
+  /* Delayed ACK timers; user data is connection handle. */
+  vnet_timer_wheel_t delayed_ack_timer_wheel;
+
+  /* Longest time in seconds received data waits for an ACK;
+     0 acknowledges every segment immediately. */
+  f64 delayed_ack_timeout;
+
+  /* Most data bytes sent as one super segment to be split into
+     segments at interface output; 0 sends each segment separately. */
+  u32 gso_max_data_bytes;
 } tcp_main_t;
 
 /* Global TCP main structure. */
@@ -351,16 +549,25 @@ typedef struct {
 #define TCP_LISTENER_IP6 (1 << 1)
   u16 flags;
 
-  /* Next node index for data packets. */
+  /* Next node index for data packets.  Data node receives in order
+     payload (headers removed) with connection handle in buffer opaque. */
   u32 data_node_index;
 
   /* Event function: called on new connections, etc. */
   tcp_event_function_t * event_function;
+
+  /* Congestion control for connections; default (zero) is NewReno. */
+  tcp_congestion_control_type_t congestion_control;
 } tcp_listener_registration_t;
 
 uword
 tcp_register_listener (vlib_main_t * vm, tcp_listener_registration_t * r);
 
+/* Queue data for transmit on established connection.  Returns number of
+   bytes queued which is less than n_data_bytes when out of buffers. */
+uword
+tcp_write (vlib_main_t * vm, u32 connection_handle, void * data, uword n_data_bytes);
+
 always_inline tcp_ip_4_or_6_t
 tcp_connection_is_ip6 (u32 h)
 { return h & 1; }
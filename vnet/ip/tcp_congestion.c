@@ -0,0 +1,149 @@
+/*
+ * ip/tcp_congestion.c: tcp congestion control algorithms
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/ip/ip.h>
+#include <vnet/ip/tcp.h>
+#include <math.h>
+
+/* Slow start: one segment per segment acknowledged (RFC 5681 3.1).
+   Returns non-zero if connection is in slow start. */
+always_inline uword
+tcp_slow_start (tcp_connection_t * c, u32 n_bytes_acked)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+
+  if (s->window >= s->slow_start_threshold)
+    return 0;
+
+  s->window += clib_min (n_bytes_acked, c->max_segment_size);
+  return 1;
+}
+
+static void
+newreno_ack (tcp_connection_t * c, u32 n_bytes_acked, f64 now)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+
+  if (tcp_slow_start (c, n_bytes_acked))
+    return;
+
+  /* Congestion avoidance: one segment per window of data acknowledged. */
+  s->n_bytes_acked += n_bytes_acked;
+  if (s->n_bytes_acked >= s->window)
+    {
+      s->n_bytes_acked -= s->window;
+      s->window += c->max_segment_size;
+    }
+}
+
+static void
+newreno_loss (tcp_connection_t * c)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+  s->slow_start_threshold = clib_max (c->n_tx_unacked_bytes / 2, 2 * c->max_segment_size);
+}
+
+/* RFC 8312 constants. */
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+static void
+cubic_ack (tcp_connection_t * c, u32 n_bytes_acked, f64 now)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+  f64 w, t, rtt, w_cubic, w_est, target;
+  u32 n_increase;
+
+  if (tcp_slow_start (c, n_bytes_acked))
+    return;
+
+  /* Window in segments. */
+  w = (f64) s->window / c->max_segment_size;
+
+  if (s->cubic_epoch_start == 0)
+    {
+      s->cubic_epoch_start = now;
+      if (w < s->cubic_window_max)
+	s->cubic_k = cbrt ((s->cubic_window_max - w) / CUBIC_C);
+      else
+	{
+	  s->cubic_k = 0;
+	  s->cubic_window_max = w;
+	}
+    }
+
+  rtt = c->round_trip_time_stats.smoothed;
+  t = now - s->cubic_epoch_start;
+
+  /* Cubic window one round trip from now (RFC 8312 4.1). */
+  w_cubic = CUBIC_C * pow (t + rtt - s->cubic_k, 3) + s->cubic_window_max;
+
+  /* Window standard TCP would have reached (TCP friendly region 4.2). */
+  w_est = (s->cubic_window_max * CUBIC_BETA
+	   + (3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA)) * (rtt > 0 ? t / rtt : 0));
+
+  target = clib_max (w_cubic, w_est);
+  target = clib_min (target, 1.5 * w);
+  if (target <= w)
+    return;
+
+  /* Grow by (target - w) / w segments per segment acknowledged.
+     Accumulate acknowledged bytes until increase is at least a byte. */
+  s->n_bytes_acked += n_bytes_acked;
+  n_increase = (target - w) / w * s->n_bytes_acked;
+  if (n_increase > 0)
+    {
+      s->window += n_increase;
+      s->n_bytes_acked = 0;
+    }
+}
+
+static void
+cubic_loss (tcp_connection_t * c)
+{
+  tcp_congestion_control_state_t * s = &c->congestion;
+  f64 w = (f64) s->window / c->max_segment_size;
+
+  s->cubic_epoch_start = 0;
+
+  /* Fast convergence (RFC 8312 4.6): release bandwidth to new flows. */
+  s->cubic_window_max = w < s->cubic_window_max ? w * (1 + CUBIC_BETA) / 2 : w;
+
+  s->slow_start_threshold = clib_max (s->window * CUBIC_BETA, 2 * c->max_segment_size);
+}
+
+tcp_congestion_control_t tcp_congestion_controls[TCP_N_CONGESTION_CONTROL] = {
+  [TCP_CONGESTION_CONTROL_newreno] = {
+    .name = "newreno",
+    .ack = newreno_ack,
+    .loss = newreno_loss,
+  },
+
+  [TCP_CONGESTION_CONTROL_cubic] = {
+    .name = "cubic",
+    .ack = cubic_ack,
+    .loss = cubic_loss,
+  },
+};
@@ -542,6 +542,8 @@ mpls_rewrite_inline (vlib_main_t * vm,
 		     int rewrite_for_locally_received_packets)
 {
   ip_lookup_main_t * lm = &mpls_main.lookup_main;
+  vlib_combined_counter_main_t * cm
+    = vnet_combined_counter_shard (&lm->adjacency_counters, os_get_cpu_number ());
   u32 * from = vlib_frame_vector_args (frame);
   u32 n_left_from, n_left_to_next, * to_next, next_index;
   vlib_node_runtime_t * error_node = vlib_node_get_runtime (vm, mpls_input_node.index);
@@ -624,11 +626,11 @@ mpls_rewrite_inline (vlib_main_t * vm,
 	  rw_len0 = adj0[0].rewrite_header.data_bytes;
 	  rw_len1 = adj1[0].rewrite_header.data_bytes;
 
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index0,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len0);
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index1,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len1);
@@ -707,7 +709,7 @@ mpls_rewrite_inline (vlib_main_t * vm,
 	  /* Update packet buffer attributes/set output interface. */
 	  rw_len0 = adj0[0].rewrite_header.data_bytes;
 
-	  vlib_increment_combined_counter (&lm->adjacency_counters,
+	  vlib_increment_combined_counter (cm,
 					   adj_index0,
 					   /* packet increment */ 0,
 					   /* byte increment */ rw_len0);
@@ -923,8 +923,9 @@ pg_generate_set_lengths (pg_main_t * pg,
     vnet_interface_main_t * im = &vm->interface_main;
     vnet_sw_interface_t * si = vnet_get_sw_interface (vm, s->sw_if_index[VLIB_RX]);
 
-    vlib_increment_combined_counter (im->combined_sw_if_counters
+    vnet_increment_combined_counter (im->combined_sw_if_counters
 				     + VNET_INTERFACE_COUNTER_RX,
+				     os_get_cpu_number (),
 				     si->sw_if_index,
 				     n_buffers,
 				     length_sum);
@@ -1290,8 +1291,9 @@ pg_stream_fill_helper (pg_main_t * pg,
 	  u32 i;
 	  for (i = 0; i < n_alloc; i++)
 	    l += vlib_buffer_index_length_in_chain (vm, buffers[i]);
-	  vlib_increment_combined_counter (im->combined_sw_if_counters
+	  vnet_increment_combined_counter (im->combined_sw_if_counters
 					   + VNET_INTERFACE_COUNTER_RX,
+					   os_get_cpu_number (),
 					   si->sw_if_index,
 					   n_alloc,
 					   l);
@@ -0,0 +1,1253 @@
+/*
+ * sched.c: interface output scheduler
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/vnet.h>
+#include <vnet/sched.h>
+#include <vnet/ethernet/ethernet.h>
+#include <vnet/ip/ip.h>
+#include <math.h>
+
+vnet_sched_main_t vnet_sched_main;
+
+/* Wire bytes per unit of class weight. */
+#define VNET_SCHED_WEIGHT_BYTES 1514
+
+#define VNET_SCHED_DEFAULT_QUEUE_SIZE 1024
+
+/* Bound on packets dequeued per call so one interface cannot hold its
+   lock for long. */
+#define VNET_SCHED_MAX_DEQUEUE (2 * VLIB_FRAME_SIZE)
+
+/* How often poll process drains backlogged schedulers. */
+#define VNET_SCHED_POLL_INTERVAL 100e-6
+
+/* RFC 8289 and RFC 8033 defaults. */
+#define VNET_SCHED_CODEL_TARGET 5e-3
+#define VNET_SCHED_CODEL_INTERVAL 100e-3
+#define VNET_SCHED_PIE_TARGET 15e-3
+#define VNET_SCHED_PIE_UPDATE_INTERVAL 15e-3
+#define VNET_SCHED_PIE_ALPHA 0.125
+#define VNET_SCHED_PIE_BETA 1.25
+#define VNET_SCHED_PIE_MAX_BURST 150e-3
+
+/* Packets are timestamped on one worker and dequeued on another, so all
+   use cpu clock scaled by main thread's calibration rather than per
+   thread vlib time. */
+always_inline f64
+sched_time_now (vnet_sched_main_t * sm)
+{ return clib_cpu_time_now () * sm->seconds_per_clock; }
+
+always_inline void
+sched_lock (vnet_sched_t * s)
+{
+  while (__sync_lock_test_and_set (&s->lock, 1))
+    ;
+}
+
+always_inline void
+sched_unlock (vnet_sched_t * s)
+{ __sync_lock_release (&s->lock); }
+
+/* ip4/ip6 header behind ethernet header and up to 2 VLAN tags; null for
+   other packets. */
+static u8 *
+sched_ethernet_ip_header (vlib_buffer_t * b, u32 * is_ip6)
+{
+  ethernet_header_t * e = vlib_buffer_get_current (b);
+  u8 * p = (u8 *) (e + 1);
+  u8 * end = (u8 *) vlib_buffer_get_current (b) + b->current_length;
+  u16 type = e->type;
+  uword i;
+
+  for (i = 0; i < 2 && type == clib_host_to_net_u16 (ETHERNET_TYPE_VLAN); i++)
+    {
+      ethernet_vlan_header_t * v = (void *) p;
+      if (p + sizeof (v[0]) > end)
+	return 0;
+      type = v->type;
+      p += sizeof (v[0]);
+    }
+
+  if (type == clib_host_to_net_u16 (ETHERNET_TYPE_IP4)
+      && p + sizeof (ip4_header_t) <= end)
+    {
+      *is_ip6 = 0;
+      return p;
+    }
+
+  if (type == clib_host_to_net_u16 (ETHERNET_TYPE_IP6)
+      && p + sizeof (ip6_header_t) <= end)
+    {
+      *is_ip6 = 1;
+      return p;
+    }
+
+  return 0;
+}
+
+/* DSCP of ip4/ip6 packet in ethernet frame; ~0 for other packets. */
+static u32
+sched_ethernet_dscp (vlib_buffer_t * b)
+{
+  u32 is_ip6;
+  u8 * h = sched_ethernet_ip_header (b, &is_ip6);
+  ip6_header_t * ip6;
+
+  if (! h)
+    return ~0;
+
+  if (! is_ip6)
+    return ((ip4_header_t *) h)->tos >> 2;
+
+  ip6 = (void *) h;
+  return (clib_net_to_host_u32 (ip6->ip_version_traffic_class_and_flow_label) >> 22) & 0x3f;
+}
+
+/* Marks ECN capable ip4/ip6 packet congestion experienced.  Returns zero
+   for packets which are not ECN capable. */
+static uword
+sched_ethernet_ecn_mark (vlib_buffer_t * b)
+{
+  u32 is_ip6, w;
+  u8 * h = sched_ethernet_ip_header (b, &is_ip6);
+
+  if (! h)
+    return 0;
+
+  if (! is_ip6)
+    {
+      ip4_header_t * ip4 = (void *) h;
+      ip_csum_t sum;
+      u8 tos = ip4->tos;
+
+      if ((tos & 3) == 0)
+	return 0;
+
+      sum = ip4->checksum;
+      sum = ip_csum_update (sum, tos, tos | 3, ip4_header_t, tos);
+      ip4->checksum = ip_csum_fold (sum);
+      ip4->tos = tos | 3;
+    }
+  else
+    {
+      ip6_header_t * ip6 = (void *) h;
+
+      /* ECN is low 2 bits of traffic class. */
+      w = clib_net_to_host_u32 (ip6->ip_version_traffic_class_and_flow_label);
+      if ((w & (3 << 20)) == 0)
+	return 0;
+      ip6->ip_version_traffic_class_and_flow_label = clib_host_to_net_u32 (w | (3 << 20));
+    }
+
+  return 1;
+}
+
+always_inline u32
+sched_classify (vnet_sched_t * s, vlib_buffer_t * b)
+{
+  uword * p;
+  u32 dscp;
+
+  if (s->class_by_sw_if_index
+      && (p = hash_get (s->class_by_sw_if_index, vnet_buffer (b)->sw_if_index[VLIB_TX])))
+    return p[0];
+
+  if (s->n_dscp_mapped > 0 && s->is_ethernet)
+    {
+      dscp = sched_ethernet_dscp (b);
+      if (dscp < ARRAY_LEN (s->class_by_dscp) && s->class_by_dscp[dscp] != ~0)
+	return s->class_by_dscp[dscp];
+    }
+
+  return 0;
+}
+
+static void
+sched_enqueue (vlib_main_t * vm,
+	       vnet_sched_t * s,
+	       vnet_hw_interface_t * hi,
+	       u32 * buffers, uword n_buffers,
+	       f64 now,
+	       u32 ** drops)
+{
+  vnet_sched_class_t * c;
+  vnet_sched_packet_t * p;
+  vlib_buffer_t * b;
+  u32 i, ci, depth, n_bytes;
+
+  for (i = 0; i < n_buffers; i++)
+    {
+      b = vlib_get_buffer (vm, buffers[i]);
+      ci = sched_classify (s, b);
+      c = vec_elt_at_index (s->classes, ci);
+
+      depth = vnet_sched_class_depth (c);
+      if (depth >= vec_len (c->queue))
+	{
+	  c->n_drops += 1;
+	  vec_add1 (drops[0], buffers[i]);
+	  continue;
+	}
+
+      n_bytes = vlib_buffer_length_in_chain (vm, b) + hi->per_packet_overhead_bytes;
+
+      p = c->queue + (c->tail & (vec_len (c->queue) - 1));
+      p->buffer_index = buffers[i];
+      p->n_wire_bytes = clib_max (n_bytes, hi->min_packet_bytes);
+      p->time_enqueued = now;
+      c->tail += 1;
+      c->max_depth = clib_max (c->max_depth, depth + 1);
+      s->n_queued += 1;
+
+      if (! c->is_active)
+	{
+	  c->is_active = 1;
+	  s->active_classes[s->active_tail & (vec_len (s->active_classes) - 1)] = ci;
+	  s->active_tail += 1;
+	}
+    }
+}
+
+always_inline f64
+sched_codel_control_law (vnet_sched_aqm_t * a, f64 t)
+{ return t + a->interval / sqrt (a->codel.count); }
+
+/* Non-zero if packet leaving queue after given sojourn time should be
+   dropped (RFC 8289 dequeue). */
+static uword
+sched_codel (vnet_sched_aqm_t * a, f64 sojourn, f64 now, u32 n_left)
+{
+  vnet_sched_codel_t * cd = &a->codel;
+  uword ok_to_drop = 0;
+  u32 delta;
+
+  /* Delay must stay above target for an interval; never drop last packet. */
+  if (sojourn < a->target || n_left == 0)
+    cd->first_above_time = 0;
+  else if (cd->first_above_time == 0)
+    cd->first_above_time = now + a->interval;
+  else
+    ok_to_drop = now >= cd->first_above_time;
+
+  if (cd->is_dropping)
+    {
+      if (! ok_to_drop)
+	{
+	  cd->is_dropping = 0;
+	  return 0;
+	}
+      if (now < cd->drop_next)
+	return 0;
+
+      /* Drop rate increases with square root of drops. */
+      cd->count += 1;
+      cd->drop_next = sched_codel_control_law (a, cd->drop_next);
+      return 1;
+    }
+
+  if (! ok_to_drop)
+    return 0;
+
+  /* Enter dropping state.  If we were dropping recently, resume near
+     drop rate we left off with. */
+  cd->is_dropping = 1;
+  delta = cd->count - cd->last_count;
+  cd->count = (delta > 1 && now - cd->drop_next < 16 * a->interval) ? delta : 1;
+  cd->drop_next = sched_codel_control_law (a, now);
+  cd->last_count = cd->count;
+  return 1;
+}
+
+/* Runs every update interval with delay of packet at head of queue
+   (zero when queue is empty). */
+static void
+sched_pie_update (vnet_sched_aqm_t * a, f64 delay, uword is_empty)
+{
+  vnet_sched_pie_t * pie = &a->pie;
+  f64 p;
+
+  p = (VNET_SCHED_PIE_ALPHA * (delay - a->target)
+       + VNET_SCHED_PIE_BETA * (delay - pie->delay_old));
+
+  /* Small probabilities move in small steps. */
+  if (pie->drop_probability < 1e-6)
+    p /= 2048;
+  else if (pie->drop_probability < 1e-5)
+    p /= 512;
+  else if (pie->drop_probability < 1e-4)
+    p /= 128;
+  else if (pie->drop_probability < 1e-3)
+    p /= 32;
+  else if (pie->drop_probability < 1e-2)
+    p /= 8;
+  else if (pie->drop_probability < 1e-1)
+    p /= 2;
+  else if (p > 0.02)
+    p = 0.02;
+
+  /* Respond quickly to very long queues. */
+  if (delay > 250e-3)
+    p += 0.02;
+
+  pie->drop_probability += p;
+
+  /* Decay while queue stays drained. */
+  if (is_empty)
+    pie->drop_probability *= 0.98;
+
+  pie->drop_probability = clib_max (pie->drop_probability, 0);
+  pie->drop_probability = clib_min (pie->drop_probability, 1);
+
+  pie->burst_allowance = clib_max (pie->burst_allowance - a->interval, 0);
+  if (pie->drop_probability == 0
+      && delay < a->target / 2
+      && pie->delay_old < a->target / 2)
+    pie->burst_allowance = VNET_SCHED_PIE_MAX_BURST;
+
+  pie->delay_old = delay;
+}
+
+/* Non-zero if packet leaving queue should be dropped (RFC 8033 applied
+   at dequeue).  Drop probability is updated by poll process. */
+static uword
+sched_pie (vlib_main_t * vm, vnet_sched_aqm_t * a, u32 n_left)
+{
+  vnet_sched_pie_t * pie = &a->pie;
+  u32 r;
+
+  if (pie->burst_allowance > 0)
+    return 0;
+
+  if (pie->delay_old < a->target / 2 && pie->drop_probability < 0.2)
+    return 0;
+
+  if (n_left < 2)
+    return 0;
+
+  r = *(u32 *) clib_random_buffer_get_data (&vm->random_buffer, sizeof (r));
+  return r < pie->drop_probability * (f64) ~0U;
+}
+
+/* Non-zero if packet at head of class queue is to be dropped; congested
+   ECN capable packets are marked instead when class allows. */
+static uword
+sched_aqm_drop (vlib_main_t * vm, vnet_sched_t * s, vnet_sched_class_t * c,
+		u32 bi, f64 sojourn, f64 now)
+{
+  vnet_sched_aqm_t * a = &c->aqm;
+  u32 n_left = vnet_sched_class_depth (c);
+  uword is_congested;
+
+  if (a->type == VNET_SCHED_AQM_CODEL)
+    is_congested = sched_codel (a, sojourn, now, n_left);
+  else
+    is_congested = sched_pie (vm, a, n_left);
+
+  if (! is_congested)
+    return 0;
+
+  /* PIE drops even ECN capable packets once marking is not keeping up. */
+  if (a->ecn
+      && s->is_ethernet
+      && ! (a->type == VNET_SCHED_AQM_PIE && a->pie.drop_probability > 0.1)
+      && sched_ethernet_ecn_mark (vlib_get_buffer (vm, bi)))
+    {
+      a->n_marks += 1;
+      return 0;
+    }
+
+  a->n_drops += 1;
+  return 1;
+}
+
+always_inline void
+sched_delay_histogram_add (vnet_sched_class_t * c, f64 sojourn)
+{
+  uword usec = sojourn * 1e6;
+  uword i = usec > 1 ? min_log2 (usec) : 0;
+  c->delay_histogram[clib_min (i, VNET_SCHED_N_DELAY_BUCKETS - 1)] += 1;
+}
+
+/* Deficit round robin over backlogged classes.  A visit to a class ends
+   when its next packet exceeds its deficit or its shaper runs dry.  When
+   the interface shaper runs dry (or enough has been sent) the class keeps
+   its place and remaining deficit for the next call.  Packets dropped by
+   active queue management cost neither deficit nor tokens. */
+static uword
+sched_dequeue (vlib_main_t * vm, vnet_sched_t * s, f64 now,
+	       u32 ** result, u32 ** aqm_drops, uword n_max)
+{
+  vnet_sched_class_t * c;
+  vnet_sched_packet_t * p;
+  f64 sojourn;
+  u32 active_mask = vec_len (s->active_classes) - 1;
+  uword n = 0, n_shaped_visits = 0, is_shaped;
+
+  vnet_sched_token_bucket_refill (&s->shaper, now);
+
+  while (s->active_head != s->active_tail)
+    {
+      c = vec_elt_at_index (s->classes, s->active_classes[s->active_head & active_mask]);
+
+      if (! s->head_has_quantum)
+	{
+	  c->deficit += c->quantum;
+	  s->head_has_quantum = 1;
+	}
+
+      vnet_sched_token_bucket_refill (&c->shaper, now);
+
+      is_shaped = 0;
+      while (c->head != c->tail)
+	{
+	  p = c->queue + (c->head & (vec_len (c->queue) - 1));
+
+	  if ((i32) p->n_wire_bytes > c->deficit)
+	    break;
+
+	  if (! vnet_sched_token_bucket_conforms (&c->shaper))
+	    {
+	      is_shaped = 1;
+	      break;
+	    }
+
+	  if (n >= n_max || ! vnet_sched_token_bucket_conforms (&s->shaper))
+	    return n;
+
+	  c->head += 1;
+	  s->n_queued -= 1;
+
+	  sojourn = clib_max (now - p->time_enqueued, 0);
+	  sched_delay_histogram_add (c, sojourn);
+
+	  if (c->aqm.type != VNET_SCHED_AQM_NONE
+	      && sched_aqm_drop (vm, s, c, p->buffer_index, sojourn, now))
+	    {
+	      vec_add1 (aqm_drops[0], p->buffer_index);
+	      continue;
+	    }
+
+	  vec_add1 (result[0], p->buffer_index);
+	  n += 1;
+
+	  c->deficit -= p->n_wire_bytes;
+	  c->n_packets += 1;
+	  c->n_bytes += p->n_wire_bytes;
+
+	  vnet_sched_token_bucket_take (&c->shaper, p->n_wire_bytes);
+	  vnet_sched_token_bucket_take (&s->shaper, p->n_wire_bytes);
+	}
+
+      /* Visit over: move class to end of round or retire it. */
+      s->head_has_quantum = 0;
+      s->active_head += 1;
+
+      if (c->head == c->tail)
+	{
+	  c->deficit = 0;
+	  c->is_active = 0;
+	}
+      else
+	{
+	  /* Class held back by its own shaper does not bank quanta. */
+	  if (is_shaped)
+	    c->deficit = clib_min (c->deficit, (i32) c->quantum);
+	  s->active_classes[s->active_tail & active_mask] = c - s->classes;
+	  s->active_tail += 1;
+	}
+
+      /* Every backlogged class is waiting for tokens. */
+      n_shaped_visits = is_shaped ? n_shaped_visits + 1 : 0;
+      if (n_shaped_visits >= s->active_tail - s->active_head)
+	break;
+    }
+
+  return n;
+}
+
+u32 * vnet_sched_output (vlib_main_t * vm,
+			 vnet_hw_interface_t * hi,
+			 u32 scheduler_index,
+			 u32 * buffers, uword n_buffers,
+			 u32 ** drops)
+{
+  vnet_sched_main_t * sm = &vnet_sched_main;
+  vnet_sched_worker_t * w = sm->workers + os_get_cpu_number ();
+  vnet_sched_t * s = sm->schedulers[scheduler_index];
+  f64 now;
+
+  vec_reset_length (w->buffers);
+  vec_reset_length (w->drops);
+  vec_reset_length (w->aqm_drops);
+
+  /* Scheduler disabled since caller looked at interface. */
+  if (PREDICT_FALSE (! s))
+    {
+      vec_add (w->buffers, buffers, n_buffers);
+      *drops = w->drops;
+      return w->buffers;
+    }
+
+  sched_lock (s);
+
+  if (PREDICT_FALSE (s->is_deleted))
+    vec_add (w->buffers, buffers, n_buffers);
+  else
+    {
+      now = sched_time_now (sm);
+      sched_enqueue (vm, s, hi, buffers, n_buffers, now, &w->drops);
+      sched_dequeue (vm, s, now, &w->buffers, &w->aqm_drops, VNET_SCHED_MAX_DEQUEUE);
+    }
+
+  sched_unlock (s);
+
+  if (vec_len (w->aqm_drops) > 0)
+    vlib_buffer_free (vm, w->aqm_drops, vec_len (w->aqm_drops));
+
+  *drops = w->drops;
+  return w->buffers;
+}
+
+void
+vnet_sched_count_tx (vlib_main_t * vm, u32 * buffers, uword n_buffers)
+{
+  vnet_interface_main_t * im = &vnet_main.interface_main;
+  vnet_combined_counter_main_t * cm = im->combined_sw_if_counters + VNET_INTERFACE_COUNTER_TX;
+  uword cpu = os_get_cpu_number ();
+  vlib_buffer_t * b;
+  u32 i, n_bytes, n_packets, sw_if_index, last_sw_if_index;
+
+  n_bytes = n_packets = 0;
+  last_sw_if_index = ~0;
+
+  for (i = 0; i < n_buffers; i++)
+    {
+      b = vlib_get_buffer (vm, buffers[i]);
+      sw_if_index = vnet_buffer (b)->sw_if_index[VLIB_TX];
+      if (sw_if_index != last_sw_if_index)
+	{
+	  if (n_packets > 0)
+	    vnet_increment_combined_counter (cm, cpu, last_sw_if_index, n_packets, n_bytes);
+	  last_sw_if_index = sw_if_index;
+	  n_packets = n_bytes = 0;
+	}
+      n_packets += 1;
+      n_bytes += vlib_buffer_length_in_chain (vm, b);
+    }
+
+  if (n_packets > 0)
+    vnet_increment_combined_counter (cm, cpu, last_sw_if_index, n_packets, n_bytes);
+}
+
+/* Sends packets from poll process straight to interface's tx node.  Like
+   interface output, every buffer of a chain goes into the tx frame. */
+static void
+sched_tx (vlib_main_t * vm, vnet_hw_interface_t * hi, u32 * buffers)
+{
+  vlib_frame_t * f = 0;
+  vlib_buffer_t * b;
+  u32 * to_tx = 0, bi, i, n_chain;
+
+  for (i = 0; i < vec_len (buffers); i++)
+    {
+      b = vlib_get_buffer (vm, buffers[i]);
+
+      n_chain = 1;
+      while (b->flags & VLIB_BUFFER_NEXT_PRESENT)
+	{
+	  b = vlib_get_buffer (vm, b->next_buffer);
+	  n_chain += 1;
+	}
+
+      if (f && f->n_vectors + n_chain > VLIB_FRAME_SIZE)
+	{
+	  vlib_put_frame_to_node (vm, hi->tx_node_index, f);
+	  f = 0;
+	}
+
+      if (! f)
+	{
+	  f = vlib_get_frame_to_node (vm, hi->tx_node_index);
+	  to_tx = vlib_frame_vector_args (f);
+	  f->n_vectors = 0;
+	}
+
+      bi = buffers[i];
+      while (1)
+	{
+	  b = vlib_get_buffer (vm, bi);
+	  to_tx[f->n_vectors++] = bi;
+	  if (! (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+	    break;
+	  bi = b->next_buffer;
+	}
+    }
+
+  if (f)
+    vlib_put_frame_to_node (vm, hi->tx_node_index, f);
+
+  vnet_sched_count_tx (vm, buffers, vec_len (buffers));
+}
+
+/* Updates PIE classes whose interval has passed, including idle ones so
+   drop probability decays after queue drains. */
+static void
+sched_pie_poll (vnet_sched_t * s, f64 now)
+{
+  vnet_sched_class_t * c;
+  vnet_sched_packet_t * p;
+  vnet_sched_aqm_t * a;
+  uword is_empty;
+  f64 delay;
+
+  vec_foreach (c, s->classes)
+    {
+      a = &c->aqm;
+      if (a->type != VNET_SCHED_AQM_PIE
+	  || now - a->pie.time_last_update < a->interval)
+	continue;
+
+      is_empty = c->head == c->tail;
+      delay = 0;
+      if (! is_empty)
+	{
+	  p = c->queue + (c->head & (vec_len (c->queue) - 1));
+	  delay = clib_max (now - p->time_enqueued, 0);
+	}
+
+      sched_pie_update (a, delay, is_empty);
+      a->pie.time_last_update = now;
+    }
+}
+
+/* Packets wait in queues for tokens after their sender has moved on;
+   periodically send whatever has become eligible. */
+static uword
+sched_poll_process (vlib_main_t * vm,
+		    vlib_node_runtime_t * rt,
+		    vlib_frame_t * f)
+{
+  vnet_sched_main_t * sm = &vnet_sched_main;
+  vnet_sched_t * s;
+  uword i;
+  f64 now;
+
+  while (1)
+    {
+      vlib_process_suspend (vm, sm->n_schedulers > 0 ? VNET_SCHED_POLL_INTERVAL : 10e-3);
+
+      for (i = 0; i < vec_len (sm->schedulers); i++)
+	{
+	  s = sm->schedulers[i];
+	  if (! s)
+	    continue;
+
+	  vec_reset_length (sm->poll_buffers);
+	  vec_reset_length (sm->poll_aqm_drops);
+
+	  sched_lock (s);
+	  now = sched_time_now (sm);
+	  sched_pie_poll (s, now);
+	  if (s->n_queued > 0)
+	    sched_dequeue (vm, s, now,
+			   &sm->poll_buffers, &sm->poll_aqm_drops,
+			   VNET_SCHED_MAX_DEQUEUE);
+	  sched_unlock (s);
+
+	  if (vec_len (sm->poll_aqm_drops) > 0)
+	    vlib_buffer_free (vm, sm->poll_aqm_drops, vec_len (sm->poll_aqm_drops));
+
+	  if (vec_len (sm->poll_buffers) > 0)
+	    sched_tx (vm, vnet_get_hw_interface (&vnet_main, s->hw_if_index),
+		      sm->poll_buffers);
+	}
+    }
+
+  return 0;
+}
+
+static VLIB_REGISTER_NODE (sched_poll_process_node) = {
+  .function = sched_poll_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "vnet-sched-poll",
+};
+
+static void
+sched_token_bucket_init (vnet_sched_token_bucket_t * t,
+			 f64 bits_per_sec, f64 burst_bytes)
+{
+  t->bytes_per_sec = bits_per_sec / 8;
+
+  /* Default burst: 1 msec at rate but at least a few jumbo frames. */
+  if (burst_bytes == 0)
+    burst_bytes = clib_max (t->bytes_per_sec * 1e-3, 4 * 9216);
+
+  t->burst_bytes = burst_bytes;
+  t->tokens = burst_bytes;
+  t->time_last_refill = 0;
+}
+
+/* Queue size change keeps queued packets in order. */
+static void
+sched_class_set_queue_size (vnet_sched_class_t * c, u32 n)
+{
+  vnet_sched_packet_t * q = 0;
+  u32 i, depth = vnet_sched_class_depth (c);
+
+  ASSERT (is_pow2 (n) && n >= depth);
+  vec_validate (q, n - 1);
+  for (i = 0; i < depth; i++)
+    q[i] = c->queue[(c->head + i) & (vec_len (c->queue) - 1)];
+
+  vec_free (c->queue);
+  c->queue = q;
+  c->head = 0;
+  c->tail = depth;
+}
+
+static void
+sched_aqm_init (vnet_sched_aqm_t * a, vnet_sched_aqm_type_t type)
+{
+  u32 ecn = a->ecn;
+
+  memset (a, 0, sizeof (a[0]));
+  a->type = type;
+  a->ecn = ecn;
+
+  switch (type)
+    {
+    case VNET_SCHED_AQM_CODEL:
+      a->target = VNET_SCHED_CODEL_TARGET;
+      a->interval = VNET_SCHED_CODEL_INTERVAL;
+      break;
+
+    case VNET_SCHED_AQM_PIE:
+      a->target = VNET_SCHED_PIE_TARGET;
+      a->interval = VNET_SCHED_PIE_UPDATE_INTERVAL;
+      a->pie.burst_allowance = VNET_SCHED_PIE_MAX_BURST;
+      break;
+
+    default:
+      break;
+    }
+}
+
+static u32
+sched_class_add (vnet_sched_t * s)
+{
+  vnet_sched_class_t * c;
+  u32 * a = 0, i, n_active;
+
+  vec_add2 (s->classes, c, 1);
+  c->quantum = VNET_SCHED_WEIGHT_BYTES;
+  sched_class_set_queue_size (c, VNET_SCHED_DEFAULT_QUEUE_SIZE);
+
+  /* Active ring must hold every class. */
+  if (vec_len (s->classes) > vec_len (s->active_classes))
+    {
+      n_active = s->active_tail - s->active_head;
+      vec_validate (a, max_pow2 (vec_len (s->classes)) - 1);
+      for (i = 0; i < n_active; i++)
+	a[i] = s->active_classes[(s->active_head + i) & (vec_len (s->active_classes) - 1)];
+      vec_free (s->active_classes);
+      s->active_classes = a;
+      s->active_head = 0;
+      s->active_tail = n_active;
+    }
+
+  return c - s->classes;
+}
+
+static void
+sched_free_deferred (uword opaque0, uword opaque1)
+{
+  vnet_sched_t * s = uword_to_pointer (opaque0, vnet_sched_t *);
+  vnet_sched_class_t * c;
+
+  vec_foreach (c, s->classes)
+    vec_free (c->queue);
+  vec_free (s->classes);
+  vec_free (s->active_classes);
+  hash_free (s->class_by_sw_if_index);
+  clib_mem_free (s);
+}
+
+static vnet_sched_t *
+sched_for_hw_interface (vnet_hw_interface_t * hi)
+{
+  vnet_sched_main_t * sm = &vnet_sched_main;
+  return (hi->output_scheduler_index != ~0
+	  ? sm->schedulers[hi->output_scheduler_index]
+	  : 0);
+}
+
+static vnet_sched_t *
+sched_enable (vlib_main_t * vm, vnet_hw_interface_t * hi)
+{
+  vnet_sched_main_t * sm = &vnet_sched_main;
+  vnet_sched_t * s, ** old, ** v;
+  u32 i;
+
+  if ((s = sched_for_hw_interface (hi)))
+    return s;
+
+  if (sm->seconds_per_clock == 0)
+    sm->seconds_per_clock = vm->clib_time.seconds_per_clock;
+
+  s = clib_mem_alloc_aligned (sizeof (s[0]), CLIB_CACHE_LINE_BYTES);
+  memset (s, 0, sizeof (s[0]));
+  s->hw_if_index = hi->hw_if_index;
+  s->is_ethernet = hi->hw_class_index == ethernet_hw_interface_class.index;
+  memset (s->class_by_dscp, ~0, sizeof (s->class_by_dscp));
+  sched_token_bucket_init (&s->shaper, hi->max_rate_bits_per_sec, 0);
+
+  /* Default class. */
+  sched_class_add (s);
+
+  for (i = 0; i < vec_len (sm->schedulers); i++)
+    if (! sm->schedulers[i])
+      break;
+
+  if (i < vec_len (sm->schedulers))
+    sm->schedulers[i] = s;
+  else
+    {
+      old = sm->schedulers;
+      v = vec_dup (old);
+      vec_add1 (v, s);
+      CLIB_MEMORY_BARRIER ();
+      sm->schedulers = v;
+      if (old)
+	ip_lookup_defer_vec_free (old);
+    }
+
+  CLIB_MEMORY_BARRIER ();
+  hi->output_scheduler_index = i;
+  sm->n_schedulers += 1;
+
+  return s;
+}
+
+/* Called with scheduler locked.  Frees queued packets sent to given
+   sw interface or all packets for ~0.  Emptied classes leave active list
+   on their next visit. */
+static void
+sched_flush (vlib_main_t * vm, vnet_sched_t * s, u32 sw_if_index)
+{
+  vnet_sched_class_t * c;
+  vnet_sched_packet_t * p;
+  u32 i, mask, tail;
+
+  vec_foreach (c, s->classes)
+    {
+      mask = vec_len (c->queue) - 1;
+      tail = c->head;
+      for (i = c->head; i != c->tail; i++)
+	{
+	  p = c->queue + (i & mask);
+	  if (sw_if_index == ~0
+	      || (vnet_buffer (vlib_get_buffer (vm, p->buffer_index))->sw_if_index[VLIB_TX]
+		  == sw_if_index))
+	    {
+	      vlib_buffer_free (vm, &p->buffer_index, 1);
+	      s->n_queued -= 1;
+	    }
+	  else
+	    c->queue[tail++ & mask] = p[0];
+	}
+      c->tail = tail;
+    }
+}
+
+static void
+sched_disable (vlib_main_t * vm, vnet_hw_interface_t * hi)
+{
+  vnet_sched_main_t * sm = &vnet_sched_main;
+  vnet_sched_t * s = sched_for_hw_interface (hi);
+
+  if (! s)
+    return;
+
+  sm->schedulers[hi->output_scheduler_index] = 0;
+  hi->output_scheduler_index = ~0;
+  sm->n_schedulers -= 1;
+
+  /* Senders which still see scheduler transmit directly from now on. */
+  sched_lock (s);
+  s->is_deleted = 1;
+  sched_flush (vm, s, ~0);
+  sched_unlock (s);
+
+  ip_lookup_defer_free (sched_free_deferred, pointer_to_uword (s), 0);
+}
+
+static clib_error_t *
+sched_hw_interface_add_del (vnet_main_t * vnm,
+			    u32 hw_if_index,
+			    u32 is_create)
+{
+  vnet_hw_interface_t * hi = vnet_get_hw_interface (vnm, hw_if_index);
+
+  if (! is_create)
+    sched_disable (vnm->vlib_main, hi);
+
+  return 0;
+}
+
+static VNET_HW_INTERFACE_ADD_DEL_FUNCTION (sched_hw_interface_add_del);
+
+/* Packets queued for an interface which goes down would otherwise be
+   sent whenever it comes back up. */
+static clib_error_t *
+sched_hw_interface_link_up_down (vnet_main_t * vnm,
+				 u32 hw_if_index,
+				 u32 flags)
+{
+  vnet_sched_t * s = sched_for_hw_interface (vnet_get_hw_interface (vnm, hw_if_index));
+
+  if (s && ! (flags & VNET_HW_INTERFACE_FLAG_LINK_UP))
+    {
+      sched_lock (s);
+      sched_flush (vnm->vlib_main, s, ~0);
+      sched_unlock (s);
+    }
+
+  return 0;
+}
+
+static VNET_HW_INTERFACE_LINK_UP_DOWN_FUNCTION (sched_hw_interface_link_up_down);
+
+static clib_error_t *
+sched_sw_interface_admin_up_down (vnet_main_t * vnm,
+				  u32 sw_if_index,
+				  u32 flags)
+{
+  vnet_sw_interface_t * si = vnet_get_sw_interface (vnm, sw_if_index);
+  vnet_sched_t * s = sched_for_hw_interface (vnet_get_sup_hw_interface (vnm, sw_if_index));
+
+  if (s && ! (flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP))
+    {
+      sched_lock (s);
+      sched_flush (vnm->vlib_main, s,
+		   si->type == VNET_SW_INTERFACE_TYPE_HARDWARE ? ~0 : sw_if_index);
+      sched_unlock (s);
+    }
+
+  return 0;
+}
+
+static VNET_SW_INTERFACE_ADMIN_UP_DOWN_FUNCTION (sched_sw_interface_admin_up_down);
+
+static u8 *
+format_sched_aqm (u8 * s, va_list * args)
+{
+  vnet_sched_aqm_t * a = va_arg (*args, vnet_sched_aqm_t *);
+
+  s = format (s, "%s target %.1f msec %s %.1f msec%s, %Ld drops %Ld marks",
+	      a->type == VNET_SCHED_AQM_CODEL ? "codel" : "pie",
+	      a->target * 1e3,
+	      a->type == VNET_SCHED_AQM_CODEL ? "interval" : "update",
+	      a->interval * 1e3,
+	      a->ecn ? " ecn" : "",
+	      a->n_drops, a->n_marks);
+
+  if (a->type == VNET_SCHED_AQM_CODEL)
+    s = format (s, ", %s count %d",
+		a->codel.is_dropping ? "dropping" : "not dropping", a->codel.count);
+  else
+    s = format (s, ", drop probability %.4f", a->pie.drop_probability);
+
+  return s;
+}
+
+static u8 *
+format_sched_delay_histogram (u8 * s, va_list * args)
+{
+  vnet_sched_class_t * c = va_arg (*args, vnet_sched_class_t *);
+  uword i;
+
+  for (i = 0; i < VNET_SCHED_N_DELAY_BUCKETS; i++)
+    {
+      if (c->delay_histogram[i] == 0)
+	continue;
+      if (i == VNET_SCHED_N_DELAY_BUCKETS - 1)
+	s = format (s, " >=%dus %Ld", 1 << i, c->delay_histogram[i]);
+      else
+	s = format (s, " %d-%dus %Ld", i == 0 ? 0 : 1 << i, 2 << i,
+		    c->delay_histogram[i]);
+    }
+
+  return s;
+}
+
+u8 * format_vnet_sched (u8 * s, va_list * args)
+{
+  vnet_sched_main_t * sm = &vnet_sched_main;
+  u32 scheduler_index = va_arg (*args, u32);
+  vnet_sched_t * sc = sm->schedulers[scheduler_index];
+  vnet_sched_class_t * c;
+  uword indent = format_get_indent (s);
+
+  s = format (s, "output scheduler: rate %.0f bits/sec burst %.0f bytes, %d packets queued",
+	      sc->shaper.bytes_per_sec * 8, sc->shaper.burst_bytes, sc->n_queued);
+
+  s = format (s, "\n%U%=8s%=10s%=16s%=16s%=16s%=10s%=10s%=12s",
+	      format_white_space, indent,
+	      "Class", "Quantum", "Rate", "Packets", "Bytes", "Drops", "Depth", "Max depth");
+
+  vec_foreach (c, sc->classes)
+    s = format (s, "\n%U%=8d%=10d%=16Ld%=16Ld%=16Ld%=10Ld%=10d%=12d",
+		format_white_space, indent,
+		c - sc->classes, c->quantum, (u64) (c->shaper.bytes_per_sec * 8),
+		c->n_packets, c->n_bytes, c->n_drops,
+		vnet_sched_class_depth (c), c->max_depth);
+
+  vec_foreach (c, sc->classes)
+    {
+      if (c->aqm.type != VNET_SCHED_AQM_NONE)
+	s = format (s, "\n%Uclass %d %U",
+		    format_white_space, indent,
+		    c - sc->classes, format_sched_aqm, &c->aqm);
+
+      if (c->n_packets + c->aqm.n_drops > 0)
+	s = format (s, "\n%Uclass %d delay:%U",
+		    format_white_space, indent,
+		    c - sc->classes, format_sched_delay_histogram, c);
+    }
+
+  return s;
+}
+
+static clib_error_t *
+set_interface_scheduler (vlib_main_t * vm,
+			 unformat_input_t * input,
+			 vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = &vnet_main;
+  vnet_hw_interface_t * hi;
+  vnet_sched_t * s;
+  u32 hw_if_index, is_disable = 0;
+  f64 rate = -1, burst = 0;
+
+  if (! unformat_user (input, unformat_vnet_hw_interface, vnm, &hw_if_index))
+    return clib_error_return (0, "unknown interface `%U'",
+			      format_unformat_error, input);
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "rate %f", &rate))
+	;
+      else if (unformat (input, "burst %f", &burst))
+	;
+      else if (unformat (input, "disable"))
+	is_disable = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  hi = vnet_get_hw_interface (vnm, hw_if_index);
+
+  if (is_disable)
+    {
+      sched_disable (vm, hi);
+      return 0;
+    }
+
+  s = sched_enable (vm, hi);
+
+  if (rate >= 0 || burst > 0)
+    {
+      sched_lock (s);
+      sched_token_bucket_init (&s->shaper,
+			       rate >= 0 ? rate : s->shaper.bytes_per_sec * 8,
+			       burst);
+      sched_unlock (s);
+    }
+
+  return 0;
+}
+
+static VLIB_CLI_COMMAND (set_interface_scheduler_command) = {
+  .path = "set interface scheduler",
+  .short_help = "set interface scheduler <hw-interface> [rate <bits/sec>] [burst <bytes>] [disable]",
+  .function = set_interface_scheduler,
+};
+
+static clib_error_t *
+set_interface_scheduler_class (vlib_main_t * vm,
+			       unformat_input_t * input,
+			       vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = &vnet_main;
+  vnet_hw_interface_t * hi;
+  vnet_sched_t * s;
+  vnet_sched_class_t * c;
+  u32 hw_if_index, class_index, sw_if_index, dscp, weight = 0, queue_size = 0;
+  u32 * sw_if_indices = 0, * dscps = 0, i, aqm_type = ~0, ecn = ~0;
+  f64 rate = -1, burst = 0, target_msec = 0, interval_msec = 0;
+  clib_error_t * error = 0;
+
+  if (! unformat_user (input, unformat_vnet_hw_interface, vnm, &hw_if_index))
+    return clib_error_return (0, "unknown interface `%U'",
+			      format_unformat_error, input);
+
+  if (! unformat (input, "%d", &class_index))
+    return clib_error_return (0, "expected class index `%U'",
+			      format_unformat_error, input);
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "weight %d", &weight))
+	;
+      else if (unformat (input, "rate %f", &rate))
+	;
+      else if (unformat (input, "burst %f", &burst))
+	;
+      else if (unformat (input, "queue-size %d", &queue_size))
+	;
+      else if (unformat (input, "dscp %d", &dscp))
+	vec_add1 (dscps, dscp);
+      else if (unformat (input, "sw-interface %U",
+			 unformat_vnet_sw_interface, vnm, &sw_if_index))
+	vec_add1 (sw_if_indices, sw_if_index);
+      else if (unformat (input, "aqm codel"))
+	aqm_type = VNET_SCHED_AQM_CODEL;
+      else if (unformat (input, "aqm pie"))
+	aqm_type = VNET_SCHED_AQM_PIE;
+      else if (unformat (input, "aqm none"))
+	aqm_type = VNET_SCHED_AQM_NONE;
+      else if (unformat (input, "target %f", &target_msec))
+	;
+      else if (unformat (input, "interval %f", &interval_msec))
+	;
+      else if (unformat (input, "no-ecn"))
+	ecn = 0;
+      else if (unformat (input, "ecn"))
+	ecn = 1;
+      else
+	{
+	  error = clib_error_return (0, "unknown input `%U'",
+				     format_unformat_error, input);
+	  goto done;
+	}
+    }
+
+  hi = vnet_get_hw_interface (vnm, hw_if_index);
+  s = sched_for_hw_interface (hi);
+  if (! s)
+    {
+      error = clib_error_return (0, "scheduler not enabled on %v", hi->name);
+      goto done;
+    }
+
+  if (class_index > vec_len (s->classes))
+    {
+      error = clib_error_return (0, "class %d: next new class is %d",
+				 class_index, vec_len (s->classes));
+      goto done;
+    }
+
+  if (weight == 0 && class_index == vec_len (s->classes))
+    weight = 1;
+
+  if (queue_size != 0 && ! is_pow2 (queue_size))
+    {
+      error = clib_error_return (0, "queue size must be a power of 2");
+      goto done;
+    }
+
+  for (i = 0; i < vec_len (dscps); i++)
+    if (dscps[i] >= ARRAY_LEN (s->class_by_dscp))
+      {
+	error = clib_error_return (0, "DSCP %d out of range", dscps[i]);
+	goto done;
+      }
+
+  for (i = 0; i < vec_len (sw_if_indices); i++)
+    if (vnet_get_sup_hw_interface (vnm, sw_if_indices[i]) != hi)
+      {
+	error = clib_error_return (0, "%U is not an interface of %v",
+				   format_vnet_sw_if_index_name, vnm, sw_if_indices[i],
+				   hi->name);
+	goto done;
+      }
+
+  sched_lock (s);
+
+  if (class_index == vec_len (s->classes))
+    sched_class_add (s);
+
+  c = vec_elt_at_index (s->classes, class_index);
+
+  if (weight != 0)
+    c->quantum = weight * VNET_SCHED_WEIGHT_BYTES;
+
+  if (queue_size != 0)
+    {
+      if (queue_size >= vnet_sched_class_depth (c))
+	sched_class_set_queue_size (c, queue_size);
+      else
+	error = clib_error_return (0, "class %d has %d packets queued; queue size unchanged",
+				   class_index, vnet_sched_class_depth (c));
+    }
+
+  if (rate >= 0 || burst > 0)
+    sched_token_bucket_init (&c->shaper,
+			     rate >= 0 ? rate : c->shaper.bytes_per_sec * 8,
+			     burst);
+
+  for (i = 0; i < vec_len (dscps); i++)
+    {
+      if (s->class_by_dscp[dscps[i]] == ~0)
+	s->n_dscp_mapped += 1;
+      s->class_by_dscp[dscps[i]] = class_index;
+    }
+
+  for (i = 0; i < vec_len (sw_if_indices); i++)
+    hash_set (s->class_by_sw_if_index, sw_if_indices[i], class_index);
+
+  if (aqm_type != ~0 && aqm_type != c->aqm.type)
+    sched_aqm_init (&c->aqm, aqm_type);
+  if (target_msec > 0)
+    c->aqm.target = target_msec * 1e-3;
+  if (interval_msec > 0)
+    c->aqm.interval = interval_msec * 1e-3;
+  if (ecn != ~0)
+    c->aqm.ecn = ecn;
+
+  sched_unlock (s);
+
+ done:
+  vec_free (dscps);
+  vec_free (sw_if_indices);
+  return error;
+}
+
+static VLIB_CLI_COMMAND (set_interface_scheduler_class_command) = {
+  .path = "set interface scheduler-class",
+  .short_help = "set interface scheduler-class <hw-interface> <class> [weight <n>] [rate <bits/sec>] [burst <bytes>] [queue-size <packets>] [dscp <n>]... [sw-interface <intfc>]... [aqm codel|pie|none] [target <msec>] [interval <msec>] [ecn|no-ecn]",
+  .function = set_interface_scheduler_class,
+};
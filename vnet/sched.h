@@ -0,0 +1,268 @@
+/*
+ * sched.h: interface output scheduler
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef included_vnet_sched_h
+#define included_vnet_sched_h
+
+#include <vnet/vnet.h>
+#include <vnet/handoff.h>
+
+/* Optional output scheduler of a hardware interface.  When enabled,
+   interface output queues packets by class instead of handing them
+   straight to tx.  Backlogged classes are served deficit round robin and
+   each class as well as the interface as a whole may be rate limited by a
+   token bucket.  Quanta and rates count packet length on the wire:
+   max (length + per_packet_overhead_bytes, min_packet_bytes).
+
+   Class queues may run active queue management (CoDel or PIE) on the
+   time packets spent queued; otherwise full queues tail drop. */
+
+typedef struct {
+  u32 buffer_index;
+
+  /* Packet length on wire. */
+  u32 n_wire_bytes;
+
+  f64 time_enqueued;
+} vnet_sched_packet_t;
+
+/* Token bucket in wire bytes.  Zero rate means unlimited. */
+typedef struct {
+  f64 bytes_per_sec;
+
+  /* Bucket depth: largest burst sent back to back. */
+  f64 burst_bytes;
+
+  /* May go negative by at most one packet; debt is paid back before
+     next packet is sent so long term rate stays exact. */
+  f64 tokens;
+
+  f64 time_last_refill;
+} vnet_sched_token_bucket_t;
+
+always_inline void
+vnet_sched_token_bucket_refill (vnet_sched_token_bucket_t * t, f64 now)
+{
+  /* Workers' clocks may be slightly apart. */
+  if (now > t->time_last_refill)
+    {
+      t->tokens += (now - t->time_last_refill) * t->bytes_per_sec;
+      t->tokens = clib_min (t->tokens, t->burst_bytes);
+      t->time_last_refill = now;
+    }
+}
+
+always_inline uword
+vnet_sched_token_bucket_conforms (vnet_sched_token_bucket_t * t)
+{ return t->bytes_per_sec == 0 || t->tokens > 0; }
+
+always_inline void
+vnet_sched_token_bucket_take (vnet_sched_token_bucket_t * t, u32 n_bytes)
+{
+  if (t->bytes_per_sec != 0)
+    t->tokens -= n_bytes;
+}
+
+typedef enum {
+  VNET_SCHED_AQM_NONE,
+  VNET_SCHED_AQM_CODEL,
+  VNET_SCHED_AQM_PIE,
+} vnet_sched_aqm_type_t;
+
+/* CoDel (RFC 8289) control state. */
+typedef struct {
+  /* Time sojourn times will have stayed above target for an interval. */
+  f64 first_above_time;
+
+  /* Time of next drop while dropping. */
+  f64 drop_next;
+
+  /* Drops since entering dropping state and count when last entered. */
+  u32 count, last_count;
+
+  u32 is_dropping;
+} vnet_sched_codel_t;
+
+/* PIE (RFC 8033) control state.  Delay is age of packet at head of
+   queue, sampled by poll process every update interval, rather than
+   estimated from departure rate. */
+typedef struct {
+  f64 drop_probability;
+
+  /* Delay at previous update. */
+  f64 delay_old;
+
+  /* Time left during which bursts pass without drops. */
+  f64 burst_allowance;
+
+  f64 time_last_update;
+} vnet_sched_pie_t;
+
+typedef struct {
+  vnet_sched_aqm_type_t type;
+
+  /* Mark ECN capable ip4/ip6 packets congestion experienced instead of
+     dropping them. */
+  u32 ecn;
+
+  /* Target sojourn time.  Interval is CoDel's interval or PIE's update
+     interval. */
+  f64 target, interval;
+
+  union {
+    vnet_sched_codel_t codel;
+    vnet_sched_pie_t pie;
+  };
+
+  u64 n_drops, n_marks;
+} vnet_sched_aqm_t;
+
+/* Sojourn time histogram: bucket i counts times in [2^i, 2^(i+1)) usec;
+   first bucket also counts shorter and last bucket longer times. */
+#define VNET_SCHED_N_DELAY_BUCKETS 20
+
+typedef struct {
+  /* Power of 2 sized ring of queued packets. */
+  vnet_sched_packet_t * queue;
+  u32 head, tail;
+
+  /* Bytes added to deficit each round. */
+  u32 quantum;
+
+  /* Bytes class may still send in current round. */
+  i32 deficit;
+
+  /* Set while class is on scheduler's active list. */
+  u32 is_active;
+
+  vnet_sched_token_bucket_t shaper;
+
+  vnet_sched_aqm_t aqm;
+
+  /* Packets and wire bytes sent. */
+  u64 n_packets, n_bytes;
+
+  /* Packets dropped because queue was full. */
+  u64 n_drops;
+
+  /* Deepest queue seen. */
+  u32 max_depth;
+
+  u64 delay_histogram[VNET_SCHED_N_DELAY_BUCKETS];
+} vnet_sched_class_t;
+
+always_inline u32
+vnet_sched_class_depth (vnet_sched_class_t * c)
+{ return c->tail - c->head; }
+
+typedef struct {
+  /* Serializes workers sending on interface and poll process. */
+  volatile u32 lock;
+
+  /* Set when scheduler is disabled; senders which still see it transmit
+     directly. */
+  u32 is_deleted;
+
+  u32 hw_if_index;
+
+  /* Interface frames are ethernet: DSCP and ECN can be found. */
+  u32 is_ethernet;
+
+  /* Class 0 is default class. */
+  vnet_sched_class_t * classes;
+
+  /* Class by output sw_if_index (e.g. sub-interface). */
+  uword * class_by_sw_if_index;
+
+  /* Class by DSCP of ip4/ip6 packets in ethernet frames; ~0 when not mapped. */
+  u32 class_by_dscp[64];
+
+  /* Number of DSCP values mapped; zero skips parsing packets. */
+  u32 n_dscp_mapped;
+
+  /* Ring of backlogged class indices in round robin order.  Power of 2
+     sized and at least as large as number of classes. */
+  u32 * active_classes;
+  u32 active_head, active_tail;
+
+  /* Class at head of active ring has been given its quantum for this round. */
+  u32 head_has_quantum;
+
+  /* Interface rate limit; defaults to max_rate_bits_per_sec. */
+  vnet_sched_token_bucket_t shaper;
+
+  /* Packets queued over all classes. */
+  u32 n_queued;
+} vnet_sched_t;
+
+typedef struct {
+  /* Packets to transmit now. */
+  u32 * buffers;
+
+  /* Packets dropped with full queues. */
+  u32 * drops;
+
+  /* Packets dropped by active queue management. */
+  u32 * aqm_drops;
+} vnet_sched_worker_t;
+
+typedef struct {
+  /* Indexed by hw interface output_scheduler_index; null when free.
+     Replaced (not resized) when it grows so senders never see it move. */
+  vnet_sched_t ** schedulers;
+
+  /* Number of enabled schedulers. */
+  u32 n_schedulers;
+
+  /* Scales cpu clock to seconds for packet timestamps; set once from
+     main thread. */
+  f64 seconds_per_clock;
+
+  /* Dequeued and dropped by poll process. */
+  u32 * poll_buffers, * poll_aqm_drops;
+
+  /* Indexed by cpu number. */
+  vnet_sched_worker_t workers[VNET_MAX_WORKERS];
+} vnet_sched_main_t;
+
+extern vnet_sched_main_t vnet_sched_main;
+
+/* Queues given packets on scheduler and returns vector of packets which
+   may be transmitted now.  Packets dropped because their class queue was
+   full are returned in drops.  Vectors belong to calling worker and are
+   valid until its next call. */
+u32 * vnet_sched_output (vlib_main_t * vm,
+			 vnet_hw_interface_t * hi,
+			 u32 scheduler_index,
+			 u32 * buffers, uword n_buffers,
+			 u32 ** drops);
+
+/* Counts transmitted packets on their own (sub-)interface; queues mix
+   packets of all sub-interfaces of a hardware interface. */
+void vnet_sched_count_tx (vlib_main_t * vm, u32 * buffers, uword n_buffers);
+
+format_function_t format_vnet_sched;
+
+#endif /* included_vnet_sched_h */
@@ -0,0 +1,153 @@
+/*
+ * timer_wheel.c: hierarchical timer wheel
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <vnet/timer_wheel.h>
+
+void vnet_timer_wheel_init (vnet_timer_wheel_t * w, f64 tick_interval, f64 now)
+{
+  memset (w, 0, sizeof (w[0]));
+  w->tick_interval = tick_interval;
+  w->time_zero = now;
+}
+
+always_inline uword
+slot_for_tick (u64 tick, uword level)
+{ return (tick >> (level * VNET_TIMER_WHEEL_LOG2_N_SLOTS)) & (VNET_TIMER_WHEEL_N_SLOTS - 1); }
+
+static void
+timer_insert (vnet_timer_wheel_t * w, u32 ti)
+{
+  vnet_timer_wheel_timer_t * t = pool_elt_at_index (w->timers, ti);
+  u64 delta = t->expire_tick - w->current_tick;
+  uword level;
+  u32 ** s;
+
+  /* Lowest level whose revolution covers delta. */
+  for (level = 0; level + 1 < VNET_TIMER_WHEEL_N_LEVELS; level++)
+    if (delta < ((u64) 1 << ((level + 1) * VNET_TIMER_WHEEL_LOG2_N_SLOTS)))
+      break;
+
+  t->level = level;
+  t->slot = slot_for_tick (t->expire_tick, level);
+  s = &w->slots[t->level][t->slot];
+  t->index_in_slot = vec_len (s[0]);
+  vec_add1 (s[0], ti);
+}
+
+static void
+timer_remove (vnet_timer_wheel_t * w, u32 ti)
+{
+  vnet_timer_wheel_timer_t * t = pool_elt_at_index (w->timers, ti);
+  u32 * s = w->slots[t->level][t->slot];
+  u32 last = vec_len (s) - 1;
+
+  /* Move last timer into removed timer's place. */
+  if (t->index_in_slot != last)
+    {
+      s[t->index_in_slot] = s[last];
+      w->timers[s[last]].index_in_slot = t->index_in_slot;
+    }
+  _vec_len (s) = last;
+}
+
+u32 vnet_timer_wheel_start (vnet_timer_wheel_t * w, u32 user_data, f64 interval)
+{
+  vnet_timer_wheel_timer_t * t;
+  u64 n_ticks;
+  u64 max_ticks = ((u64) 1 << (VNET_TIMER_WHEEL_N_LEVELS * VNET_TIMER_WHEEL_LOG2_N_SLOTS)) - 1;
+
+  n_ticks = interval > 0 ? (u64) (interval / w->tick_interval + .999) : 0;
+  n_ticks = clib_max (n_ticks, 1);
+  n_ticks = clib_min (n_ticks, max_ticks);
+
+  pool_get (w->timers, t);
+  t->expire_tick = w->current_tick + n_ticks;
+  t->user_data = user_data;
+  timer_insert (w, t - w->timers);
+
+  return t - w->timers;
+}
+
+void vnet_timer_wheel_stop (vnet_timer_wheel_t * w, u32 handle)
+{
+  timer_remove (w, handle);
+  pool_put (w->timers, pool_elt_at_index (w->timers, handle));
+}
+
+/* Re-insert timers of given higher level slot into lower levels. */
+static void
+cascade (vnet_timer_wheel_t * w, uword level, uword slot)
+{
+  u32 * s = w->slots[level][slot];
+  uword i;
+
+  w->slots[level][slot] = 0;
+  for (i = 0; i < vec_len (s); i++)
+    timer_insert (w, s[i]);
+  vec_free (s);
+}
+
+u32 * vnet_timer_wheel_advance (vnet_timer_wheel_t * w, f64 now, u32 * expired)
+{
+  u64 target_tick;
+  uword level, slot, i;
+  u32 * s;
+
+  if (now < w->time_zero)
+    return expired;
+
+  target_tick = (now - w->time_zero) / w->tick_interval;
+
+  while (w->current_tick < target_tick)
+    {
+      w->current_tick++;
+
+      /* Cascade from highest level down when lower levels wrap. */
+      for (level = VNET_TIMER_WHEEL_N_LEVELS - 1; level > 0; level--)
+	{
+	  u64 mask = ((u64) 1 << (level * VNET_TIMER_WHEEL_LOG2_N_SLOTS)) - 1;
+	  if ((w->current_tick & mask) == 0)
+	    cascade (w, level, slot_for_tick (w->current_tick, level));
+	}
+
+      slot = slot_for_tick (w->current_tick, 0);
+      s = w->slots[0][slot];
+      for (i = 0; i < vec_len (s); i++)
+	{
+	  vnet_timer_wheel_timer_t * t = pool_elt_at_index (w->timers, s[i]);
+	  ASSERT (t->expire_tick == w->current_tick);
+	  vec_add1 (expired, t->user_data);
+	  pool_put (w->timers, t);
+	}
+      if (s)
+	_vec_len (s) = 0;
+
+      /* Nothing to do until next timer if wheel is empty. */
+      if (pool_elts (w->timers) == 0)
+	w->current_tick = target_tick;
+    }
+
+  return expired;
+}
@@ -0,0 +1,85 @@
+/*
+ * timer_wheel.h: hierarchical timer wheel
+ *
+ * Copyright (c) 2012 Eliot Dresselhaus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ *  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ *  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ *  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ *  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef included_vnet_timer_wheel_h
+#define included_vnet_timer_wheel_h
+
+#include <clib/pool.h>
+
+/* Hierarchical timer wheel for large numbers of coarse timers (neighbor
+   aging, transport retransmits).  Level 0 has one slot per tick; each slot
+   of level L covers all slots of level L - 1.  Starting and stopping a
+   timer is O(1); timers in a higher level slot are cascaded to lower
+   levels when wheel reaches that slot. */
+#define VNET_TIMER_WHEEL_N_LEVELS 3
+#define VNET_TIMER_WHEEL_LOG2_N_SLOTS 8
+#define VNET_TIMER_WHEEL_N_SLOTS (1 << VNET_TIMER_WHEEL_LOG2_N_SLOTS)
+
+typedef struct {
+  /* Absolute tick when timer expires. */
+  u64 expire_tick;
+
+  /* Returned to user when timer expires. */
+  u32 user_data;
+
+  /* Slot timer is on and its index in slot's vector. */
+  u8 level;
+  u8 slot;
+  u32 index_in_slot;
+} vnet_timer_wheel_timer_t;
+
+typedef struct {
+  /* Pool of running timers. */
+  vnet_timer_wheel_timer_t * timers;
+
+  /* Vectors of timer indices for each slot. */
+  u32 * slots[VNET_TIMER_WHEEL_N_LEVELS][VNET_TIMER_WHEEL_N_SLOTS];
+
+  /* Ticks wheel has advanced. */
+  u64 current_tick;
+
+  /* Seconds per tick and time of tick 0. */
+  f64 tick_interval;
+  f64 time_zero;
+} vnet_timer_wheel_t;
+
+void vnet_timer_wheel_init (vnet_timer_wheel_t * w, f64 tick_interval, f64 now);
+
+/* Returns handle for stopping timer.  Intervals are rounded up to
+   whole ticks; timer never expires before at least one tick. */
+u32 vnet_timer_wheel_start (vnet_timer_wheel_t * w, u32 user_data, f64 interval);
+
+/* Handle must be of a timer which has not expired. */
+void vnet_timer_wheel_stop (vnet_timer_wheel_t * w, u32 handle);
+
+/* Advance wheel to given time.  User data of expired timers is added to
+   given vector which is returned. */
+u32 * vnet_timer_wheel_advance (vnet_timer_wheel_t * w, f64 now, u32 * expired);
+
+always_inline uword
+vnet_timer_wheel_n_running (vnet_timer_wheel_t * w)
+{ return pool_elts (w->timers); }
+
+#endif /* included_vnet_timer_wheel_h */
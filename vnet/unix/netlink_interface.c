@@ -377,11 +377,13 @@ static void netlink_rx_add_del_neighbor (struct nlmsghdr * h, uword is_del)
   void * dst_address_l3 = 0;
   void * dst_address_l2 = 0;
   u8 zero[16] = {0};
+  u32 is_static;
 
   if (n->ndm_type != RTN_UNICAST)
     return;
 
   is_del |= n->ndm_state == NUD_FAILED;
+  is_static = (n->ndm_state & NUD_PERMANENT) != 0;
 
   switch (n->ndm_state)
     {
@@ -419,13 +421,16 @@ static void netlink_rx_add_del_neighbor (struct nlmsghdr * h, uword is_del)
 	ethernet_arp_ip4_over_ethernet_address_t a;
 	memcpy (&a.ip4.as_u8, dst_address_l3, sizeof (a.ip4.as_u8));
 	memcpy (&a.ethernet, dst_address_l2, sizeof (a.ethernet));
-	ip4_add_del_ethernet_neighbor (&a, ni->vnet_sw_if_index, is_del);
+	ip4_add_del_ethernet_neighbor (&a, ni->vnet_sw_if_index, is_static, is_del);
 	break;
       }
 
     case AF_INET6:
       {
-	ASSERT (0);
+	ip6_address_t a;
+	memcpy (&a.as_u8, dst_address_l3, sizeof (a.as_u8));
+	ip6_add_del_ethernet_neighbor (&a, dst_address_l2, ni->vnet_sw_if_index,
+				       is_static, is_del);
 	break;
       }
 
@@ -225,8 +225,9 @@ tuntap_rx (vlib_main_t * vm,
       }
 
     /* Interface counters for tuntap interface. */
-    vlib_increment_combined_counter (vnet_main.interface_main.combined_sw_if_counters
+    vnet_increment_combined_counter (vnet_main.interface_main.combined_sw_if_counters
 				     + VNET_INTERFACE_COUNTER_RX,
+				     os_get_cpu_number (),
 				     tm->sw_if_index,
 				     1, n_bytes_in_packet);
 
@@ -36,6 +36,7 @@ typedef enum {
 
 #include <vnet/buffer.h>
 #include <vnet/config.h>
+#include <vnet/counter.h>
 #include <vnet/interface.h>
 #include <vnet/rewrite.h>
 